@@ -0,0 +1,143 @@
+#!/bin/bash
+
+# Runs the router on one Linux box, without VNS or Mininet, on local
+# interfaces (sr -i).  Needs root.
+#
+#   h1 10.0.1.100 ---- eth1 10.0.1.1  sr  10.0.2.1 eth2 ---- 10.0.2.100 h2
+#
+# h1, h2 and the router are network namespaces.  With the packet driver
+# the links are veth pairs.  With the tap driver the router's ends are
+# TAP devices, moved into h1 and h2 once the router has them open.
+#
+#   ./netns.sh up [packet|tap]     make the namespaces, ifaces.netns, rtable.netns
+#   ./netns.sh run [packet|tap] [sr options]
+#                                  up, start sr, ping h2 from h1, down
+#   ./netns.sh taps                tap driver: after starting sr by hand
+#   ./netns.sh down                remove everything
+
+NS_SR=sr
+NS_H1=h1
+NS_H2=h2
+
+usage()
+{
+  echo "Usage: `basename $0` up|run [packet|tap] [sr options] | down"
+  exit 1
+}
+
+# no offloads: the router sees and forwards frames as they are on the wire
+no_offload()
+{
+  if which ethtool > /dev/null 2>&1; then
+    ip netns exec $1 ethtool -K $2 tx off tso off gso off gro off > /dev/null 2>&1
+  fi
+}
+
+down()
+{
+  ip netns del $NS_SR 2> /dev/null
+  ip netns del $NS_H1 2> /dev/null
+  ip netns del $NS_H2 2> /dev/null
+  rm -f ifaces.netns rtable.netns
+}
+
+host()
+{
+  ip -n $1 link set $2 up
+  ip -n $1 addr add $3/24 dev $2
+  ip -n $1 route add default via $4
+  no_offload $1 $2
+}
+
+up()
+{
+  down
+  ip netns add $NS_SR
+  ip netns add $NS_H1
+  ip netns add $NS_H2
+  ip -n $NS_SR link set lo up
+
+  if [ "$1" = "tap" ]; then
+    ip -n $NS_SR tuntap add dev tap1 mode tap
+    ip -n $NS_SR tuntap add dev tap2 mode tap
+    DEV1=tap1
+    DEV2=tap2
+  else
+    ip link add sr-eth1 netns $NS_SR type veth peer name h1-eth0 netns $NS_H1
+    ip link add sr-eth2 netns $NS_SR type veth peer name h2-eth0 netns $NS_H2
+    # -- the router's ends carry no addresses, the router has them --
+    for d in sr-eth1 sr-eth2; do
+      ip netns exec $NS_SR sysctl -q -w net.ipv6.conf.$d.disable_ipv6=1
+      ip -n $NS_SR link set $d up
+      no_offload $NS_SR $d
+    done
+    host $NS_H1 h1-eth0 10.0.1.100 10.0.1.1
+    host $NS_H2 h2-eth0 10.0.2.100 10.0.2.1
+    DEV1=sr-eth1
+    DEV2=sr-eth2
+  fi
+
+  cat > ifaces.netns <<EOF
+# name  device  ip
+eth1    $DEV1   10.0.1.1
+eth2    $DEV2   10.0.2.1
+EOF
+  cat > rtable.netns <<EOF
+10.0.1.0   0.0.0.0   255.255.255.0   eth1
+10.0.2.0   0.0.0.0   255.255.255.0   eth2
+EOF
+}
+
+# the router has its TAP devices open: hand the other ends to the hosts
+tap_hosts()
+{
+  ip -n $NS_SR link set tap1 netns $NS_H1
+  ip -n $NS_SR link set tap2 netns $NS_H2
+  host $NS_H1 tap1 10.0.1.100 10.0.1.1
+  host $NS_H2 tap2 10.0.2.100 10.0.2.1
+}
+
+run()
+{
+  DRIVER=$1
+  shift
+  up $DRIVER
+  ip netns exec $NS_SR ./sr -i ifaces.netns -r rtable.netns -d $DRIVER "$@" &
+  SR_PID=$!
+  sleep 1
+  if [ "$DRIVER" = "tap" ]; then
+    tap_hosts
+  fi
+
+  ip netns exec $NS_H1 ping -c 5 10.0.2.100
+  STATUS=$?
+
+  kill $SR_PID
+  wait $SR_PID
+  down
+  exit $STATUS
+}
+
+case "$1" in
+  up)
+    up ${2:-packet}
+    if [ "${2:-packet}" = "tap" ]; then
+      echo "Start sr in namespace $NS_SR, then: $0 taps"
+    fi
+    ;;
+  taps)
+    tap_hosts
+    ;;
+  run)
+    shift
+    DRIVER=${1:-packet}
+    [ $# -gt 0 ] && shift
+    run $DRIVER "$@"
+    ;;
+  down)
+    down
+    ;;
+  *)
+    usage
+    ;;
+esac
@@ -0,0 +1,129 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_adj.c
+ *
+ * Description:
+ *
+ * Next hop adjacency table.  See sr_adj.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_adj.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+
+static __inline__ unsigned int sr_adj_slot(uint32_t ip, uint16_t ifindex)
+{
+    return (((ip ^ ((uint32_t)ifindex << 24)) * 2654435761U) >> 16) &
+        (SR_ADJ_HASH_SZ - 1);
+} /* -- sr_adj_slot -- */
+
+struct sr_adj_table* sr_adj_create(void)
+{
+    struct sr_adj_table* t = 0;
+    void* mem = 0;
+
+    if(posix_memalign(&mem, 64, sizeof(struct sr_adj_table)) != 0)
+    { return 0; }
+    memset(mem, 0, sizeof(struct sr_adj_table));
+
+    t = (struct sr_adj_table*)mem;
+    t->nadj = 1;
+    pthread_mutex_init(&(t->lock), 0);
+
+    return t;
+} /* -- sr_adj_create -- */
+
+void sr_adj_destroy(struct sr_adj_table* t)
+{
+    if(!t)
+    { return; }
+
+    pthread_mutex_destroy(&(t->lock));
+    free(t);
+} /* -- sr_adj_destroy -- */
+
+void sr_adj_init(struct sr_adj* a, uint32_t ip, const struct sr_if* iface)
+{
+    struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)a->eth;
+
+    /* -- REQUIRES -- */
+    assert(a);
+    assert(iface);
+
+    a->ip       = ip;
+    a->arp_gen  = 0;
+    a->arp_slot = 0;
+    a->ifindex  = iface->index;
+
+    memset(e_hdr->ether_dhost, 0, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ethertype_ip);
+} /* -- sr_adj_init -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_adj_get(..)
+ * Scope:  Global
+ *
+ * A new entry is complete before its id is handed out; callers publish
+ * the id with a release store, so a reader that sees the id sees the
+ * entry.
+ *
+ *---------------------------------------------------------------------*/
+
+uint16_t sr_adj_get(struct sr_adj_table* t, uint32_t ip,
+                    const struct sr_if* iface)
+{
+    unsigned int i = 0;
+    uint16_t id = 0;
+
+    /* -- REQUIRES -- */
+    assert(t);
+    assert(iface);
+
+    pthread_mutex_lock(&(t->lock));
+
+    i = sr_adj_slot(ip, iface->index);
+    while((id = t->hash[i]) != 0)
+    {
+        if(t->adj[id].ip == ip && t->adj[id].ifindex == iface->index)
+        { break; }
+        i = (i + 1) & (SR_ADJ_HASH_SZ - 1);
+    }
+
+    if(id == 0 && t->nadj < SR_ADJ_MAX)
+    {
+        id = (uint16_t)t->nadj++;
+        sr_adj_init(&(t->adj[id]), ip, iface);
+        t->hash[i] = id;
+        if(t->nadj == SR_ADJ_MAX)
+        {
+            fprintf(stderr, "Adjacency table full, further next hops "
+                    "are resolved by name\n");
+        }
+    }
+
+    pthread_mutex_unlock(&(t->lock));
+
+    return id;
+} /* -- sr_adj_get -- */
+
+void sr_adj_resolve(struct sr_adj* a, const unsigned char* mac,
+                    uint32_t arp_gen, uint32_t arp_slot)
+{
+    struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)a->eth;
+
+    /* -- REQUIRES -- */
+    assert(mac);
+
+    memcpy(e_hdr->ether_dhost, mac, ETHER_ADDR_LEN);
+    a->arp_slot = arp_slot;
+    a->arp_gen = arp_gen;
+} /* -- sr_adj_resolve -- */
@@ -0,0 +1,93 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_adj.h
+ *
+ * Description:
+ *
+ * Next hop adjacency table.  An adjacency is one (neighbour IP, egress
+ * interface) pair; routes refer to it by a small integer id instead of by
+ * gateway and interface name.  The entry carries the interface index and
+ * a prebuilt Ethernet header with our source MAC and, once ARP has
+ * resolved the neighbour, its destination MAC, so the forwarding path
+ * never has to look an interface up by name or copy a name around.
+ *
+ * Adjacencies are created by the routing table writers as they bind
+ * routes, never on the forwarding path, and live as long as the router;
+ * ids are never reused, so a route or a DIR-24-8 next hop copy that holds
+ * an id can never see it point somewhere else.  Next hops beyond
+ * SR_ADJ_MAX get no id and are resolved by name, packet by packet.  The
+ * destination MAC is stamped with the ARP cache generation it was read
+ * under and is ignored once the cache has moved on.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ADJ_H
+#define SR_ADJ_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_protocol.h"
+
+#define SR_ADJ_MAX     4096     /* adjacency 0 means none */
+#define SR_ADJ_HASH_SZ (2 * SR_ADJ_MAX)
+
+struct sr_if;
+
+struct sr_adj
+{
+    uint32_t ip;               /* neighbour, network byte order */
+    uint32_t arp_gen;          /* eth has the neighbour's MAC while the ARP
+                                  cache is at this generation, 0 = never */
+    uint32_t arp_slot;         /* ARP cache slot it came from, valid at
+                                  arp_gen, see sr_arpcache_touch */
+    uint16_t ifindex;          /* egress interface, see sr_if_by_index */
+    uint8_t  eth[sizeof(struct sr_ethernet_hdr)]; /* prebuilt header */
+} __attribute__ ((aligned (32)));
+
+struct sr_adj_table
+{
+    struct sr_adj adj[SR_ADJ_MAX];
+    unsigned int nadj;         /* entries in use, including slot 0 */
+    uint16_t hash[SR_ADJ_HASH_SZ]; /* (ip, ifindex) -> id, 0 = empty */
+    pthread_mutex_t lock;      /* serializes sr_adj_get */
+};
+
+struct sr_adj_table* sr_adj_create(void);
+void sr_adj_destroy(struct sr_adj_table* t);
+
+/* Id of the adjacency for neighbour ip (network byte order) on iface,
+   created if need be.  Returns 0 if the table is full; the caller then
+   fills an entry of its own with sr_adj_init for each packet.  Safe to
+   call from any thread. */
+uint16_t sr_adj_get(struct sr_adj_table* t, uint32_t ip,
+                    const struct sr_if* iface);
+
+/* Set a up for neighbour ip on iface, not resolved yet. */
+void sr_adj_init(struct sr_adj* a, uint32_t ip, const struct sr_if* iface);
+
+/* Record the neighbour's MAC as read from the ARP cache at arp_gen, out of
+   slot arp_slot.  Only the forwarding thread resolves adjacencies. */
+void sr_adj_resolve(struct sr_adj* a, const unsigned char* mac,
+                    uint32_t arp_gen, uint32_t arp_slot);
+
+static __inline__ struct sr_adj* sr_adj_at(struct sr_adj_table* t,
+                                           uint16_t id)
+{
+    return &(t->adj[id]);
+}
+
+/* Whether eth can be put on a packet as is. */
+static __inline__ int sr_adj_resolved(const struct sr_adj* a,
+                                      uint32_t arp_gen)
+{
+    return a->arp_gen == arp_gen;
+}
+
+#endif /* -- SR_ADJ_H -- */
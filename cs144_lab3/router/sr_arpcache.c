@@ -1,4 +1,5 @@
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <time.h>
@@ -10,57 +11,391 @@
 #include "sr_router.h"
 #include "sr_if.h"
 #include "sr_protocol.h"
+#include "sr_rcu.h"
+#include "sr_icmp.h"
 
-/* 
-  This function gets called every second. For each request sent out, we keep
-  checking whether we should resend an request or destroy the arp request.
-  See the comments in the header file for an idea of what it should look like.
-*/
-void sr_arpcache_sweepreqs(struct sr_instance *sr) { 
-    /* Fill this in */
-    struct sr_arpreq *arpreq = sr->cache.requests;
-    struct sr_arpreq *next = arpreq->next
-    while (req) {
-        sr_handle_arpreq(sr, arpreq);
-        req = next;
-        next = req->next;
+/* Home slot of (ip, ifindex). */
+static unsigned int sr_arpcache_home(const struct sr_arpcache *cache,
+                                     uint32_t ip, uint16_t ifindex) {
+    return ((ip ^ ((uint32_t)ifindex << 24)) * 2654435761U) & (cache->nslots - 1);
+}
+
+/* Slot holding (ip, ifindex), or -1. Caller holds the lock, or is a
+   reader that checks the sequence count afterwards; the probe is bounded
+   because a reader racing a writer can see a run with no end. */
+static int sr_arpcache_find(const struct sr_arpcache *cache, uint32_t ip,
+                            uint16_t ifindex) {
+    unsigned int i = sr_arpcache_home(cache, ip, ifindex);
+    unsigned int n;
+    
+    for (n = 0; n < cache->nslots && cache->entries[i].valid; n++) {
+        if (cache->entries[i].ip == ip && cache->entries[i].ifindex == ifindex)
+            return (int)i;
+        i = (i + 1) & (cache->nslots - 1);
     }
+    return -1;
 }
 
-/* You should not need to touch the rest of this code. */
+/* Bracket every change to entries; caller holds the lock. */
+static void sr_arpcache_write_begin(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order.
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip) {
-    pthread_mutex_lock(&(cache->lock));
+static void sr_arpcache_write_end(struct sr_arpcache *cache) {
+    __atomic_store_n(&(cache->seq), cache->seq + 1, __ATOMIC_RELEASE);
+}
+
+/* Empties slot i, shifting later entries of the same probe run back so
+   that lookups never have to step over holes. Caller holds the lock. */
+static void sr_arpcache_remove(struct sr_arpcache *cache, unsigned int i) {
+    unsigned int mask = cache->nslots - 1;
+    unsigned int j = i, k;
     
-    struct sr_arpentry *entry = NULL, *copy = NULL;
+    sr_arpcache_write_begin(cache);
+    while (1) {
+        j = (j + 1) & mask;
+        if (!cache->entries[j].valid)
+            break;
+        k = sr_arpcache_home(cache, cache->entries[j].ip, cache->entries[j].ifindex);
+        /* an entry whose home lies cyclically in (i, j] stays put */
+        if ((i <= j) ? (i < k && k <= j) : (i < k || k <= j))
+            continue;
+        cache->entries[i] = cache->entries[j];
+        __atomic_store_n(&(cache->ref[i]), __atomic_load_n(&(cache->ref[j]), __ATOMIC_RELAXED), __ATOMIC_RELAXED);
+        /* the slot's timer goes with the entry: a static one has none */
+        if (sr_timer_pending(&(cache->timer[j])))
+            sr_timer_add(&(cache->wheel), &(cache->timer[i]), cache->timer[j].expires);
+        else
+            sr_timer_del(&(cache->wheel), &(cache->timer[i]));
+        i = j;
+    }
+    sr_timer_del(&(cache->wheel), &(cache->timer[i]));
+    cache->entries[i].valid = 0;
+    __atomic_store_n(&(cache->ref[i]), 0, __ATOMIC_RELAXED);
+    cache->count--;
+    sr_arpcache_write_end(cache);
+    __atomic_add_fetch(&(cache->gen), 1, __ATOMIC_RELEASE);
+}
+
+/* Drops the first dynamic entry the CLOCK hand finds with its reference
+   bit clear, clearing bits as it goes. Caller holds the lock and the
+   cache holds more than its static entries. */
+static void sr_arpcache_evict(struct sr_arpcache *cache) {
+    unsigned int h;
     
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if ((cache->entries[i].valid) && (cache->entries[i].ip == ip)) {
-            entry = &(cache->entries[i]);
+    while (1) {
+        h = cache->hand;
+        cache->hand = (h + 1) & (cache->nslots - 1);
+        if (!cache->entries[h].valid || cache->entries[h].permanent)
+            continue;
+        if (__atomic_load_n(&(cache->ref[h]), __ATOMIC_RELAXED) & SR_ARPENTRY_REF) {
+            __atomic_fetch_and(&(cache->ref[h]), ~SR_ARPENTRY_REF, __ATOMIC_RELAXED);
+            continue;
         }
+        sr_arpcache_remove(cache, h);
+        return;
+    }
+}
+
+/* Arms t, waking the cache thread if it is asleep past expires. Caller
+   holds the lock. */
+static void sr_arpcache_arm(struct sr_arpcache *cache, struct sr_timer *t,
+                            uint64_t expires) {
+    sr_timer_add(&(cache->wheel), t, expires);
+    if (expires < cache->wake_at) {
+        cache->wake_at = expires;
+        pthread_cond_signal(&(cache->wake));
     }
+}
+
+/* Notes down an ARP request for ip out of interface ifindex, to mac if
+   given, for the end of the timer run. Caller holds the lock. */
+static void sr_arpcache_post(struct sr_arpcache *cache, uint16_t ifindex, uint32_t ip,
+                             const unsigned char *mac) {
+    struct sr_arptx *tx;
+    unsigned int cap;
     
-    /* Must return a copy b/c another thread could jump in and modify
-       table after we return. */
-    if (entry) {
+    if (cache->ntx == cache->cap_tx) {
+        cap = cache->cap_tx ? 2 * cache->cap_tx : SR_ARPTX_BURST;
+        tx = (struct sr_arptx *) realloc(cache->tx, cap * sizeof(struct sr_arptx));
+        if (!tx)
+            return;
+        cache->tx = tx;
+        cache->cap_tx = cap;
+    }
+    
+    tx = &(cache->tx[cache->ntx++]);
+    tx->ip = ip;
+    tx->ifindex = ifindex;
+    tx->unicast = (mac != NULL);
+    if (mac)
+        memcpy(tx->mac, mac, ETHER_ADDR_LEN);
+}
+
+/* Asks for ip out of interface ifindex, to mac if we have one for the
+   neighbour (to confirm it) and broadcast if not, if the interface's rate
+   allows. Caller holds the lock; the request goes out after the run. */
+static void sr_arpcache_ask(struct sr_instance *sr, uint16_t ifindex, uint32_t ip,
+                            const unsigned char *mac) {
+    struct sr_if *iface = sr_if_by_index(sr, ifindex);
+    
+    if (iface && sr_arpcache_tx_allow(&(sr->cache), iface))
+        sr_arpcache_post(&(sr->cache), ifindex, ip, mac);
+}
+
+/* Sends an ARP request the timers left, from the interface's template.
+   Called without the lock. */
+static void sr_arpcache_probe(struct sr_instance *sr, const struct sr_arptx *tx) {
+    uint8_t frame[SR_ARP_FRAME_LEN];
+    struct sr_ethernet_hdr *e_hdr = (struct sr_ethernet_hdr *) frame;
+    struct sr_arp_hdr *a_hdr = (struct sr_arp_hdr *) (frame + sizeof(struct sr_ethernet_hdr));
+    struct sr_if *iface = sr_if_by_index(sr, tx->ifindex);
+    
+    if (!iface)
+        return;
+    
+    memcpy(frame, iface->arp_request, SR_ARP_FRAME_LEN);
+    if (tx->unicast) {
+        memcpy(e_hdr->ether_dhost, tx->mac, ETHER_ADDR_LEN);
+        memcpy(a_hdr->ar_tha, tx->mac, ETHER_ADDR_LEN);
+    }
+    a_hdr->ar_tip = tx->ip;
+    
+    sr_send_packet_if(sr, frame, sizeof(frame), iface);
+}
+
+/* Timer of the entry in one slot. It first fires refresh_ms before the
+   deadline; an entry in use is then probed every retry interval until a
+   reply refreshes it, anything else is dropped at the deadline. */
+static void sr_arpcache_expire(void *ctx, struct sr_timer *t) {
+    struct sr_instance *sr = (struct sr_instance *) ctx;
+    struct sr_arpcache *cache = (struct sr_arpcache *) t->arg;
+    unsigned int i = (unsigned int)(t - cache->timer);
+    struct sr_arpentry *entry = &(cache->entries[i]);
+    uint64_t now = sr_timer_now_ms();
+    uint64_t next = entry->expires;
+    
+    if (now >= entry->expires) {
+        cache->qstats.expired++;
+        sr_arpcache_remove(cache, i);
+        return;
+    }
+    
+    if (__atomic_load_n(&(cache->ref[i]), __ATOMIC_RELAXED) & SR_ARPENTRY_USED) {
+        sr_arpcache_ask(sr, entry->ifindex, entry->ip, entry->mac);
+        cache->qstats.probes++;
+        if (now + cache->retry_ms < next)
+            next = now + cache->retry_ms;
+    }
+    sr_arpcache_arm(cache, t, next);
+}
+
+/* Chain of failed neighbours ip hashes to. */
+static struct sr_arpneg **sr_arpneg_chain(struct sr_arpcache *cache, uint32_t ip) {
+    return &(cache->neg_hash[((ip * 2654435761U) >> 24) & (SR_ARPNEG_HASH_SZ - 1)]);
+}
+
+/* Failed neighbour ip, or NULL. Caller holds the lock. */
+static struct sr_arpneg *sr_arpneg_find(struct sr_arpcache *cache, uint32_t ip) {
+    struct sr_arpneg *neg;
+    
+    for (neg = *sr_arpneg_chain(cache, ip); neg; neg = neg->hnext) {
+        if (neg->ip == ip)
+            break;
+    }
+    return neg;
+}
+
+/* Forgets a failed neighbour. Caller holds the lock. */
+static void sr_arpneg_remove(struct sr_arpcache *cache, struct sr_arpneg *neg) {
+    struct sr_arpneg **pp = sr_arpneg_chain(cache, neg->ip);
+    
+    while (*pp != neg)
+        pp = &((*pp)->hnext);
+    *pp = neg->hnext;
+    sr_timer_del(&(cache->wheel), &(neg->timer));
+    cache->nneg--;
+    free(neg);
+}
+
+/* Interval between background requests to a failed neighbour. */
+static uint64_t sr_arpneg_interval(const struct sr_arpcache *cache) {
+    uint64_t ms = cache->hold_ms / SR_ARPNEG_PROBES;
+    
+    return ms > cache->retry_ms ? ms : cache->retry_ms;
+}
+
+/* Timer of a failed neighbour: asks for it again in the background until
+   the hold-down is over, then forgets it, so that the next packet for it
+   starts a fresh request. */
+static void sr_arpneg_due(void *ctx, struct sr_timer *t) {
+    struct sr_instance *sr = (struct sr_instance *) ctx;
+    struct sr_arpcache *cache = &(sr->cache);
+    struct sr_arpneg *neg = (struct sr_arpneg *) t->arg;
+    uint64_t now = sr_timer_now_ms();
+    uint64_t next = now + sr_arpneg_interval(cache);
+    
+    if (now >= neg->until) {
+        sr_arpneg_remove(cache, neg);
+        return;
+    }
+    
+    sr_arpcache_ask(sr, neg->ifindex, neg->ip, NULL);
+    cache->qstats.neg_probes++;
+    sr_arpcache_arm(cache, t, next < neg->until ? next : neg->until);
+}
+
+/* Holds ip down as failed, on interface ifindex. Caller holds the lock. */
+static void sr_arpneg_add(struct sr_arpcache *cache, uint32_t ip, uint16_t ifindex) {
+    struct sr_arpneg *neg = sr_arpneg_find(cache, ip);
+    uint64_t now = sr_timer_now_ms();
+    
+    if (!neg) {
+        if (cache->nneg >= SR_ARPNEG_MAX)
+            return;
+        neg = (struct sr_arpneg *) calloc(1, sizeof(struct sr_arpneg));
+        if (!neg)
+            return;
+        neg->ip = ip;
+        sr_timer_init(&(neg->timer), sr_arpneg_due, neg);
+        neg->hnext = *sr_arpneg_chain(cache, ip);
+        *sr_arpneg_chain(cache, ip) = neg;
+        cache->nneg++;
+        cache->qstats.failed++;
+    }
+    neg->ifindex = ifindex;
+    neg->until = now + cache->hold_ms;
+    neg->icmp_next = 0;
+    sr_arpcache_arm(cache, &(neg->timer), now + sr_arpneg_interval(cache));
+}
+
+/* What sr_arpreq_step says a request needs now. */
+#define SR_ARPREQ_WAIT   0      /* not due, or held back by the rate */
+#define SR_ARPREQ_SEND   1      /* ask again */
+#define SR_ARPREQ_GIVEUP 2      /* off the queue, tell the senders */
+
+static int sr_arpreq_step(struct sr_instance *sr, struct sr_arpreq *req,
+                          struct sr_if **iface);
+
+/* Timer of a request: a retry is due. */
+static void sr_arpreq_due(void *ctx, struct sr_timer *t) {
+    struct sr_instance *sr = (struct sr_instance *) ctx;
+    struct sr_arpcache *cache = &(sr->cache);
+    struct sr_arpreq *req = (struct sr_arpreq *) t->arg;
+    struct sr_if *iface = NULL;
+    uint64_t now = sr_timer_now_ms();
+    int step;
+    
+    /* a packet for it pushed it along since the timer was armed */
+    if (req->sent && now < req->sent + cache->retry_ms) {
+        sr_arpcache_arm(cache, t, req->sent + cache->retry_ms);
+        return;
+    }
+    
+    step = sr_arpreq_step(sr, req, &iface);
+    if (step == SR_ARPREQ_GIVEUP) {
+        /* already disarmed; the end of the run tells its senders */
+        req->next = cache->gaveup;
+        cache->gaveup = req;
+        return;
+    }
+    if (step == SR_ARPREQ_SEND)
+        sr_arpcache_post(cache, iface->index, req->ip, NULL);
+    sr_arpcache_arm(cache, t, now + cache->retry_ms);
+}
+
+/* Checks if an IP->MAC mapping for a neighbour on interface ifindex is in
+   the cache and copies it to *entry. IP is in network byte order. Lock
+   free: the copy is retried if a writer was at work while it was made. */
+int sr_arpcache_lookup_into(struct sr_arpcache *cache, uint32_t ip,
+                            uint16_t ifindex, struct sr_arpentry *entry) {
+    uint32_t seq;
+    int i = -1;
+    
+    do {
+        seq = __atomic_load_n(&(cache->seq), __ATOMIC_ACQUIRE);
+        if (seq & 1)
+            continue;
+        i = sr_arpcache_find(cache, ip, ifindex);
+        if (i >= 0)
+            memcpy(entry, &(cache->entries[i]), sizeof(struct sr_arpentry));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&(cache->seq), __ATOMIC_RELAXED));
+    
+    if (i < 0)
+        return 0;
+    
+    sr_arpcache_touch(cache, (uint32_t)i);
+    return i + 1;
+}
+
+/* As sr_arpcache_lookup_into, but returns a copy you must free if it is
+   not NULL. */
+struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                                       uint16_t ifindex) {
+    struct sr_arpentry entry;
+    struct sr_arpentry *copy = NULL;
+    
+    if (sr_arpcache_lookup_into(cache, ip, ifindex, &entry)) {
         copy = (struct sr_arpentry *) malloc(sizeof(struct sr_arpentry));
-        memcpy(copy, entry, sizeof(struct sr_arpentry));
+        memcpy(copy, &entry, sizeof(struct sr_arpentry));
     }
-        
-    pthread_mutex_unlock(&(cache->lock));
     
     return copy;
 }
 
+/* Chain of pending requests ip hashes to. */
+static struct sr_arpreq **sr_arpreq_chain(struct sr_arpcache *cache, uint32_t ip) {
+    return &(cache->req_hash[((ip * 2654435761U) >> 22) & (SR_ARPREQ_HASH_SZ - 1)]);
+}
+
+/* Takes req off the queue and its hash chain if it is on them. Caller
+   holds the lock. */
+static void sr_arpreq_unlink(struct sr_arpcache *cache, struct sr_arpreq *req) {
+    struct sr_arpreq **pp = sr_arpreq_chain(cache, req->ip);
+    
+    while (*pp && *pp != req)
+        pp = &((*pp)->hnext);
+    if (!*pp)
+        return;
+    *pp = req->hnext;
+    
+    if (req->prev)
+        req->prev->next = req->next;
+    else
+        cache->requests = req->next;
+    if (req->next)
+        req->next->prev = req->prev;
+    req->next = req->prev = req->hnext = NULL;
+    
+    /* answered or given up, no more retries */
+    sr_timer_del(&(cache->wheel), &(req->timer));
+    cache->qstats.requests--;
+}
+
+/* Frees the oldest packet waiting on req. Caller holds the lock. */
+static void sr_arpreq_drop_oldest(struct sr_arpcache *cache, struct sr_arpreq *req) {
+    struct sr_packet *pkt = req->packets;
+    
+    req->packets = pkt->next;
+    if (!req->packets)
+        req->last = NULL;
+    req->npackets--;
+    req->bytes -= pkt->len;
+    cache->qstats.bytes -= pkt->len;
+    free(pkt);
+}
+
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
-   that corresponds to this ARP request. You should free the passed *packet.
+   that corresponds to this ARP request, within the queue limits. The packet
+   is copied; the caller keeps *packet.
    
    A pointer to the ARP request is returned; it should not be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
+   can remove the ARP request from the queue by calling sr_arpreq_destroy.
+   NULL is returned, and no request made, if there is none for ip yet and
+   the packet does not fit: a request always has packets waiting. */
 struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                                        uint32_t ip,
                                        uint8_t *packet,           /* borrowed */
@@ -69,32 +404,94 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
 {
     pthread_mutex_lock(&(cache->lock));
     
+    struct sr_arpreq **chain = sr_arpreq_chain(cache, ip);
     struct sr_arpreq *req;
-    for (req = cache->requests; req != NULL; req = req->next) {
+    struct sr_packet *new_pkt = NULL;
+    for (req = *chain; req != NULL; req = req->hnext) {
         if (req->ip == ip) {
             break;
         }
     }
     
+    /* Too many neighbours being resolved at once: drop early */
+    if (!req && cache->qstats.requests >= cache->req_max) {
+        cache->qstats.drop_cap++;
+        pthread_mutex_unlock(&(cache->lock));
+        return NULL;
+    }
+    
+    /* Decide whether the packet is kept before touching anything. Under
+       oldest-drop only the request's own packets can make room for it, so
+       a new request has none to give. */
+    if (packet && packet_len && iface) {
+        int oldest = (cache->req_policy == SR_ARPREQ_DROP_OLDEST);
+        uint64_t others = cache->qstats.bytes - ((req && oldest) ? req->bytes : 0);
+        
+        if (others + packet_len > cache->req_max_bytes)
+            cache->qstats.drop_bytes++;
+        else if (req && !oldest && req->npackets >= cache->req_max_pkts)
+            cache->qstats.drop_req++;
+        else
+            new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet) + packet_len);
+    }
+    
+    /* A request exists only with a packet waiting on it; handle_arpreq
+       takes the interface to ask on from its packets */
+    if (!req && !new_pkt) {
+        pthread_mutex_unlock(&(cache->lock));
+        return NULL;
+    }
+    
     /* If the IP wasn't found, add it */
     if (!req) {
         req = (struct sr_arpreq *) calloc(1, sizeof(struct sr_arpreq));
+        if (!req) {
+            free(new_pkt);
+            pthread_mutex_unlock(&(cache->lock));
+            return NULL;
+        }
         req->ip = ip;
         req->next = cache->requests;
+        if (req->next)
+            req->next->prev = req;
         cache->requests = req;
+        req->hnext = *chain;
+        *chain = req;
+        cache->qstats.requests++;
+        sr_timer_init(&(req->timer), sr_arpreq_due, req);
+        sr_arpcache_arm(cache, &(req->timer), sr_timer_now_ms() + cache->retry_ms);
     }
     
-    /* Add the packet to the list of packets for this request */
-    if (packet && packet_len && iface) {
-        struct sr_packet *new_pkt = (struct sr_packet *)malloc(sizeof(struct sr_packet));
+    /* Add the packet to the list of packets for this request, making room
+       from the request's oldest ones; the check above leaves enough */
+    if (new_pkt) {
+        if (req->npackets >= cache->req_max_pkts) {
+            cache->qstats.drop_req++;
+            sr_arpreq_drop_oldest(cache, req);
+        }
+        while (cache->qstats.bytes + packet_len > cache->req_max_bytes) {
+            cache->qstats.drop_bytes++;
+            sr_arpreq_drop_oldest(cache, req);
+        }
         
-        new_pkt->buf = (uint8_t *)malloc(packet_len);
+        /* one allocation holds the record and the frame */
+        new_pkt->buf = (uint8_t *)(new_pkt + 1);
         memcpy(new_pkt->buf, packet, packet_len);
         new_pkt->len = packet_len;
-		new_pkt->iface = (char *)malloc(sr_IFACE_NAMELEN);
         strncpy(new_pkt->iface, iface, sr_IFACE_NAMELEN);
-        new_pkt->next = req->packets;
-        req->packets = new_pkt;
+        new_pkt->iface[sr_IFACE_NAMELEN - 1] = '\0';
+        new_pkt->next = NULL;
+        if (req->last)
+            req->last->next = new_pkt;
+        else
+            req->packets = new_pkt;
+        req->last = new_pkt;
+        req->npackets++;
+        req->bytes += packet_len;
+        cache->qstats.queued++;
+        cache->qstats.bytes += packet_len;
+        if (cache->qstats.bytes > cache->qstats.bytes_peak)
+            cache->qstats.bytes_peak = cache->qstats.bytes;
     }
     
     pthread_mutex_unlock(&(cache->lock));
@@ -102,82 +499,220 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
     return req;
 }
 
+/* Puts a new entry for (ip, ifindex) in a free slot, evicting another if
+   the cache is full, and returns the slot. Its timer is left to the
+   caller. Caller holds the lock and (ip, ifindex) is not in the cache. */
+static unsigned int sr_arpcache_place(struct sr_arpcache *cache,
+                                      const unsigned char *mac, uint32_t ip,
+                                      uint16_t ifindex, uint64_t expires,
+                                      unsigned char ref) {
+    struct sr_arpentry *entry;
+    unsigned int i;
+    
+    if (cache->count >= cache->capacity)
+        sr_arpcache_evict(cache);
+    
+    i = sr_arpcache_home(cache, ip, ifindex);
+    while (cache->entries[i].valid)
+        i = (i + 1) & (cache->nslots - 1);
+    
+    entry = &(cache->entries[i]);
+    sr_arpcache_write_begin(cache);
+    memcpy(entry->mac, mac, 6);
+    entry->ifindex = ifindex;
+    entry->ip = ip;
+    entry->added = time(NULL);
+    entry->expires = expires;
+    entry->permanent = 0;
+    entry->valid = 1;
+    __atomic_store_n(&(cache->ref[i]), ref, __ATOMIC_RELAXED);
+    cache->count++;
+    sr_arpcache_write_end(cache);
+    __atomic_add_fetch(&(cache->gen), 1, __ATOMIC_RELEASE);
+    
+    return i;
+}
+
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
-   2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
+   2) Inserts this IP to MAC mapping for interface ifindex in the cache, and
+      marks it valid, evicting another entry if the cache is full. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
-                                     uint32_t ip)
+                                     uint32_t ip,
+                                     uint16_t ifindex)
+{
+    return sr_arpcache_merge(cache, mac, ip, ifindex, 1, NULL);
+}
+
+/* As sr_arpcache_insert, but a new entry is only made if add is set or a
+   request for ip is pending; otherwise only a mapping we already have is
+   updated (RFC 826 merge). *taken, if given, says whether the mapping
+   was stored. */
+struct sr_arpreq *sr_arpcache_merge(struct sr_arpcache *cache,
+                                    unsigned char *mac,
+                                    uint32_t ip,
+                                    uint16_t ifindex,
+                                    int add,
+                                    int *taken)
 {
     pthread_mutex_lock(&(cache->lock));
     
-    struct sr_arpreq *req, *prev = NULL, *next = NULL; 
-    for (req = cache->requests; req != NULL; req = req->next) {
-        if (req->ip == ip) {            
-            if (prev) {
-                next = req->next;
-                prev->next = next;
-            } 
-            else {
-                next = req->next;
-                cache->requests = next;
-            }
-            
+    struct sr_arpreq *req;
+    for (req = *sr_arpreq_chain(cache, ip); req != NULL; req = req->hnext) {
+        if (req->ip == ip) {
+            sr_arpreq_unlink(cache, req);
             break;
         }
-        prev = req;
     }
     
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-        if (!(cache->entries[i].valid))
-            break;
+    int i = sr_arpcache_find(cache, ip, ifindex);
+    struct sr_arpentry *entry;
+    
+    uint64_t now = sr_timer_now_ms();
+    
+    /* a neighbour held down as failed is back */
+    struct sr_arpneg *neg = sr_arpneg_find(cache, ip);
+    if (neg)
+        sr_arpneg_remove(cache, neg);
+    
+    if (taken)
+        *taken = (i >= 0 || add || req || neg);
+    if (i < 0 && !add && !req && !neg) {
+        pthread_mutex_unlock(&(cache->lock));
+        return NULL;
     }
     
-    if (i != SR_ARPCACHE_SZ) {
-        memcpy(cache->entries[i].mac, mac, 6);
-        cache->entries[i].ip = ip;
-        cache->entries[i].added = time(NULL);
-        cache->entries[i].valid = 1;
+    if (i >= 0 && cache->entries[i].permanent) {
+        /* static entries are only changed by configuration */
+        if (taken)
+            *taken = 0;
+        pthread_mutex_unlock(&(cache->lock));
+        return req;
+    }
+    if (i >= 0) {
+        /* known neighbour: refresh, and only invalidate users if it moved */
+        entry = &(cache->entries[i]);
+        sr_arpcache_write_begin(cache);
+        entry->added = time(NULL);
+        entry->expires = now + cache->timeout_ms;
+        if (memcmp(entry->mac, mac, 6) != 0) {
+            memcpy(entry->mac, mac, 6);
+            __atomic_add_fetch(&(cache->gen), 1, __ATOMIC_RELEASE);
+        }
+        sr_arpcache_write_end(cache);
+        __atomic_fetch_and(&(cache->ref[i]), ~SR_ARPENTRY_USED, __ATOMIC_RELAXED);
     }
+    else {
+        i = (int)sr_arpcache_place(cache, mac, ip, ifindex, now + cache->timeout_ms, 0);
+        entry = &(cache->entries[i]);
+    }
+    sr_arpcache_arm(cache, &(cache->timer[i]), entry->expires - cache->refresh_ms);
     
     pthread_mutex_unlock(&(cache->lock));
     
     return req;
 }
 
+/* Adds a static entry, which never expires and is never evicted, or
+   makes the dynamic entry for (ip, ifindex) static. At most half the
+   capacity may be static. Returns 0 on success. */
+int sr_arpcache_add_static(struct sr_arpcache *cache, const unsigned char *mac,
+                           uint32_t ip, uint16_t ifindex) {
+    struct sr_arpentry *entry;
+    int i;
+    
+    pthread_mutex_lock(&(cache->lock));
+    
+    i = sr_arpcache_find(cache, ip, ifindex);
+    if (i < 0 && cache->nstatic >= cache->capacity / 2) {
+        pthread_mutex_unlock(&(cache->lock));
+        return -1;
+    }
+    
+    if (i < 0)
+        i = (int)sr_arpcache_place(cache, mac, ip, ifindex, SR_TIMER_NEVER, 0);
+    entry = &(cache->entries[i]);
+    sr_timer_del(&(cache->wheel), &(cache->timer[i]));
+    if (!entry->permanent)
+        cache->nstatic++;
+    sr_arpcache_write_begin(cache);
+    entry->permanent = 1;
+    entry->expires = SR_TIMER_NEVER;
+    if (memcmp(entry->mac, mac, 6) != 0) {
+        memcpy(entry->mac, mac, 6);
+        __atomic_add_fetch(&(cache->gen), 1, __ATOMIC_RELEASE);
+    }
+    sr_arpcache_write_end(cache);
+    
+    pthread_mutex_unlock(&(cache->lock));
+    
+    return 0;
+}
+
+/* Adds a mapping saved by an earlier run as stale: usable, but already
+   due for refresh and marked used, so it is revalidated with unicast
+   requests straight away and dropped at the end of the refresh window if
+   nobody answers. A mapping we already have is left alone. */
+void sr_arpcache_add_stale(struct sr_arpcache *cache, const unsigned char *mac,
+                           uint32_t ip, uint16_t ifindex) {
+    uint64_t now = sr_timer_now_ms();
+    unsigned int i;
+    
+    pthread_mutex_lock(&(cache->lock));
+    
+    if (sr_arpcache_find(cache, ip, ifindex) < 0 &&
+        cache->count - cache->nstatic < cache->capacity) {
+        i = sr_arpcache_place(cache, mac, ip, ifindex, now + cache->refresh_ms,
+                              SR_ARPENTRY_USED);
+        sr_arpcache_arm(cache, &(cache->timer[i]), now);
+    }
+    
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+/* Whether ip failed to answer ARP within the hold-down. For a failed
+   neighbour, says if an ICMP host unreachable may go out now, at most one
+   every SR_ARPNEG_ICMP_MS per neighbour. */
+int sr_arpcache_failed(struct sr_arpcache *cache, uint32_t ip) {
+    struct sr_arpneg *neg;
+    uint64_t now;
+    int ret = SR_ARPNEG_NONE;
+    
+    pthread_mutex_lock(&(cache->lock));
+    
+    neg = sr_arpneg_find(cache, ip);
+    if (neg) {
+        now = sr_timer_now_ms();
+        cache->qstats.neg_fast++;
+        if (now >= neg->icmp_next) {
+            neg->icmp_next = now + SR_ARPNEG_ICMP_MS;
+            ret = SR_ARPNEG_ICMP;
+        }
+        else {
+            ret = SR_ARPNEG_DROP;
+        }
+    }
+    
+    pthread_mutex_unlock(&(cache->lock));
+    
+    return ret;
+}
+
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
 void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
     pthread_mutex_lock(&(cache->lock));
     
     if (entry) {
-        struct sr_arpreq *req, *prev = NULL, *next = NULL; 
-        for (req = cache->requests; req != NULL; req = req->next) {
-            if (req == entry) {                
-                if (prev) {
-                    next = req->next;
-                    prev->next = next;
-                } 
-                else {
-                    next = req->next;
-                    cache->requests = next;
-                }
-                
-                break;
-            }
-            prev = req;
-        }
+        sr_arpreq_unlink(cache, entry);
         
         struct sr_packet *pkt, *nxt;
         
         for (pkt = entry->packets; pkt; pkt = nxt) {
             nxt = pkt->next;
-            if (pkt->buf)
-                free(pkt->buf);
-            if (pkt->iface)
-                free(pkt->iface);
+            cache->qstats.bytes -= pkt->len;
             free(pkt);
         }
         
@@ -189,27 +724,187 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry) {
 
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache) {
-    fprintf(stderr, "\nMAC            IP         ADDED                      VALID\n");
-    fprintf(stderr, "-----------------------------------------------------------\n");
+    pthread_mutex_lock(&(cache->lock));
     
-    int i;
-    for (i = 0; i < SR_ARPCACHE_SZ; i++) {
+    fprintf(stderr, "\nMAC            IP         IF   ADDED                      VALID\n");
+    fprintf(stderr, "----------------------------------------------------------------\n");
+    
+    unsigned int i;
+    for (i = 0; i < cache->nslots; i++) {
         struct sr_arpentry *cur = &(cache->entries[i]);
         unsigned char *mac = cur->mac;
-        fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %.24s   %d\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), ctime(&(cur->added)), cur->valid);
+        if (!cur->valid)
+            continue;
+        fprintf(stderr, "%.1x%.1x%.1x%.1x%.1x%.1x   %.8x   %-4u %.24s   %s\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], ntohl(cur->ip), cur->ifindex, ctime(&(cur->added)), cur->permanent ? "static" : "1");
     }
     
-    fprintf(stderr, "\n");
+    fprintf(stderr, "%u of %u entries, %u static\n\n", cache->count, cache->capacity, cache->nstatic);
+    
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+/* Sets the pending packet limits, 0 keeping the default, and the drop
+   policy. */
+void sr_arpcache_set_queue_limits(struct sr_arpcache *cache,
+                                  unsigned int max_pkts,
+                                  uint64_t max_bytes, int policy) {
+    pthread_mutex_lock(&(cache->lock));
+    if (max_pkts)
+        cache->req_max_pkts = max_pkts;
+    if (max_bytes)
+        cache->req_max_bytes = max_bytes;
+    cache->req_policy = policy;
+    pthread_mutex_unlock(&(cache->lock));
 }
 
-/* Initialize table + table lock. Returns 0 on success. */
-int sr_arpcache_init(struct sr_arpcache *cache) {  
-    /* Seed RNG to kick out a random entry if all entries full. */
-    srand(time(NULL));
+/* Sets the most requests outstanding and the per interface ARP request
+   rate, 0 keeping the defaults. */
+void sr_arpcache_set_req_limits(struct sr_arpcache *cache,
+                                unsigned int max_reqs, uint32_t tx_rate) {
+    pthread_mutex_lock(&(cache->lock));
+    if (max_reqs)
+        cache->req_max = max_reqs;
+    if (tx_rate)
+        cache->tx_rate = tx_rate;
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+/* Token bucket of the ARP requests sent out iface, kept in thousandths of
+   a request so it refills a little every millisecond. */
+int sr_arpcache_tx_allow(struct sr_arpcache *cache, struct sr_if *iface) {
+    uint64_t now = sr_timer_now_ms();
+    uint64_t full = (uint64_t)SR_ARPTX_BURST * 1000;
+    int ok = 0;
+    
+    pthread_mutex_lock(&(cache->lock));
+    
+    if (now - iface->arp_tx_at >= full / cache->tx_rate)
+        iface->arp_tokens = full;
+    else
+        iface->arp_tokens += (now - iface->arp_tx_at) * cache->tx_rate;
+    if (iface->arp_tokens > full)
+        iface->arp_tokens = full;
+    iface->arp_tx_at = now;
+    
+    if (iface->arp_tokens >= 1000) {
+        iface->arp_tokens -= 1000;
+        ok = 1;
+    }
+    else {
+        cache->qstats.tx_limited++;
+    }
+    
+    pthread_mutex_unlock(&(cache->lock));
+    
+    return ok;
+}
+
+/* Sets how long a neighbour that did not answer is held down as failed,
+   0 keeping the default. */
+void sr_arpcache_set_holddown(struct sr_arpcache *cache, uint32_t hold_ms) {
+    pthread_mutex_lock(&(cache->lock));
+    if (hold_ms)
+        cache->hold_ms = hold_ms;
+    pthread_mutex_unlock(&(cache->lock));
+}
+
+/* Prints out the pending request queue counters. */
+void sr_arpcache_print_stats(struct sr_arpcache *cache) {
+    struct sr_arpq_stats st;
+    
+    pthread_mutex_lock(&(cache->lock));
+    st = cache->qstats;
+    pthread_mutex_unlock(&(cache->lock));
+    
+    fprintf(stderr, "ARP queue: %llu packets queued, %llu dropped at the "
+            "per request limit of %u, %llu at the limit of %llu bytes (%s)\n",
+            (unsigned long long)st.queued, (unsigned long long)st.drop_req,
+            cache->req_max_pkts, (unsigned long long)st.drop_bytes,
+            (unsigned long long)cache->req_max_bytes,
+            cache->req_policy == SR_ARPREQ_DROP_OLDEST ? "oldest-drop" : "tail-drop");
+    fprintf(stderr, "ARP queue: %llu requests and %llu bytes pending, "
+            "peak %llu bytes\n", (unsigned long long)st.requests,
+            (unsigned long long)st.bytes, (unsigned long long)st.bytes_peak);
+    fprintf(stderr, "ARP cache: %llu entries expired, %llu refresh requests "
+            "sent, %llu packets queued after a mapping went away\n",
+            (unsigned long long)st.expired, (unsigned long long)st.probes,
+            (unsigned long long)st.requeued);
+    fprintf(stderr, "ARP cache: %llu mappings learned from requests\n",
+            (unsigned long long)st.learned);
+    fprintf(stderr, "ARP cache: %llu neighbours held down for %u ms, %llu "
+            "packets failed fast, %llu background requests\n",
+            (unsigned long long)st.failed, cache->hold_ms,
+            (unsigned long long)st.neg_fast, (unsigned long long)st.neg_probes);
+    fprintf(stderr, "ARP cache: %llu packets dropped at %u requests outstanding, "
+            "%llu requests held back at %u/s per interface\n",
+            (unsigned long long)st.drop_cap, cache->req_max,
+            (unsigned long long)st.tx_limited, cache->tx_rate);
+}
+
+/* Initialize table + table lock. Keeps at most capacity entries,
+   SR_ARPCACHE_SZ if 0; retry_ms and timeout_ms of 0 pick the defaults.
+   Returns 0 on success. */
+int sr_arpcache_init(struct sr_arpcache *cache, unsigned int capacity,
+                     uint32_t retry_ms, uint32_t timeout_ms) {  
+    if (capacity == 0)
+        capacity = SR_ARPCACHE_SZ;
+    cache->retry_ms = retry_ms ? retry_ms : SR_ARPREQ_RETRY_MS;
+    cache->timeout_ms = timeout_ms ? timeout_ms : SR_ARPCACHE_TO_MS;
+    cache->refresh_ms = cache->timeout_ms / SR_ARPCACHE_REFRESH_DIV;
+    
+    /* At least twice as many slots as entries keeps probe runs short */
+    cache->nslots = 1;
+    while (cache->nslots < 2 * capacity)
+        cache->nslots <<= 1;
+    cache->capacity = capacity;
+    cache->count = 0;
+    cache->nstatic = 0;
+    cache->hand = 0;
+    cache->seq = 0;
     
     /* Invalidate all entries */
-    memset(cache->entries, 0, sizeof(cache->entries));
+    cache->entries = (struct sr_arpentry *) calloc(cache->nslots, sizeof(struct sr_arpentry));
+    cache->ref = (unsigned char *) calloc(cache->nslots, 1);
+    cache->timer = (struct sr_timer *) calloc(cache->nslots, sizeof(struct sr_timer));
+    if (!cache->entries || !cache->ref || !cache->timer) {
+        free(cache->entries);
+        free(cache->ref);
+        free(cache->timer);
+        cache->entries = NULL;
+        cache->ref = NULL;
+        cache->timer = NULL;
+        return -1;
+    }
     cache->requests = NULL;
+    memset(cache->req_hash, 0, sizeof(cache->req_hash));
+    cache->req_max = SR_ARPREQ_MAX;
+    cache->tx_rate = SR_ARPTX_RATE;
+    cache->req_max_pkts = SR_ARPREQ_MAX_PKTS;
+    cache->req_max_bytes = SR_ARPREQ_MAX_BYTES;
+    cache->req_policy = SR_ARPREQ_DROP_TAIL;
+    memset(cache->neg_hash, 0, sizeof(cache->neg_hash));
+    cache->nneg = 0;
+    cache->hold_ms = SR_ARPNEG_HOLD_MS;
+    cache->tx = NULL;
+    cache->ntx = 0;
+    cache->cap_tx = 0;
+    cache->gaveup = NULL;
+    memset(&(cache->qstats), 0, sizeof(cache->qstats));
+    cache->gen = 1;
+    
+    /* Every slot's timer expires whatever entry is in the slot */
+    sr_timer_wheel_init(&(cache->wheel), sr_timer_now_ms());
+    unsigned int i;
+    for (i = 0; i < cache->nslots; i++)
+        sr_timer_init(&(cache->timer[i]), sr_arpcache_expire, cache);
+    cache->wake_at = 0;
+    
+    /* The cache thread sleeps on the same clock as the timers */
+    pthread_condattr_t cattr;
+    pthread_condattr_init(&cattr);
+    pthread_condattr_setclock(&cattr, CLOCK_MONOTONIC);
+    pthread_cond_init(&(cache->wake), &cattr);
+    pthread_condattr_destroy(&cattr);
     
     /* Acquire mutex lock */
     pthread_mutexattr_init(&(cache->attr));
@@ -221,166 +916,369 @@ int sr_arpcache_init(struct sr_arpcache *cache) {
 
 /* Destroys table + table lock. Returns 0 on success. */
 int sr_arpcache_destroy(struct sr_arpcache *cache) {
+    unsigned int i;
+    for (i = 0; i < SR_ARPNEG_HASH_SZ; i++) {
+        while (cache->neg_hash[i])
+            sr_arpneg_remove(cache, cache->neg_hash[i]);
+    }
+    free(cache->entries);
+    free(cache->ref);
+    free(cache->timer);
+    free(cache->tx);
+    cache->entries = NULL;
+    cache->ref = NULL;
+    cache->timer = NULL;
+    cache->tx = NULL;
+    pthread_cond_destroy(&(cache->wake));
     return pthread_mutex_destroy(&(cache->lock)) && pthread_mutexattr_destroy(&(cache->attr));
 }
 
-/* Thread which sweeps through the cache and invalidates entries that were added
-   more than SR_ARPCACHE_TO seconds ago. */
+/* Thread which runs the cache's timers: entries are invalidated once they
+   are older than the timeout, and requests are retried. It sleeps until the
+   next timer is due, or until one is armed that is due sooner. */
+static void sr_arpreq_fail(struct sr_instance *sr, struct sr_arpreq *req);
+
+/* Runs the timers that are due and notes when the next one is. Caller
+   holds the lock, once: the timers only note down what is to be sent,
+   and it goes out with the lock dropped, so neither the forwarding path
+   nor the RCU read section waits behind it. Only the one thread running
+   the timers adds to cache->tx, so it is left alone meanwhile. */
+static uint64_t sr_arpcache_tick(struct sr_instance *sr) {
+    struct sr_arpcache *cache = &(sr->cache);
+    struct sr_arpreq *gaveup, *req;
+    unsigned int i, n;
+    
+    sr_timer_run(&(cache->wheel), sr_timer_now_ms(), sr);
+    n = cache->ntx;
+    gaveup = cache->gaveup;
+    cache->gaveup = NULL;
+    
+    if (n || gaveup) {
+        pthread_mutex_unlock(&(cache->lock));
+        sr_rcu_read_lock();
+        sr_tx_cork(sr);
+        for (i = 0; i < n; i++)
+            sr_arpcache_probe(sr, &(cache->tx[i]));
+        while ((req = gaveup) != NULL) {
+            gaveup = req->next;
+            sr_arpreq_fail(sr, req);
+        }
+        sr_tx_uncork(sr);
+        sr_rcu_read_unlock();
+        pthread_mutex_lock(&(cache->lock));
+        cache->ntx = 0;
+    }
+    
+    cache->wake_at = sr_timer_next(&(cache->wheel));
+    return cache->wake_at;
+}
+
+/* For the event loop, which has no cache thread: runs the timers that are
+   due and returns when they next are, SR_TIMER_NEVER if none is armed.
+   Arming a sooner timer later lowers cache->wake_at. */
+uint64_t sr_arpcache_run_timers(struct sr_instance *sr) {
+    uint64_t next;
+    
+    pthread_mutex_lock(&(sr->cache.lock));
+    next = sr_arpcache_tick(sr);
+    pthread_mutex_unlock(&(sr->cache.lock));
+    
+    return next;
+}
+
 void *sr_arpcache_timeout(void *sr_ptr) {
     struct sr_instance *sr = sr_ptr;
     struct sr_arpcache *cache = &(sr->cache);
+    struct timespec ts;
+    uint64_t next;
+    
+    pthread_mutex_lock(&(cache->lock));
     
     while (1) {
-        sleep(1.0);
-        
-        pthread_mutex_lock(&(cache->lock));
+        next = sr_arpcache_tick(sr);
+        if (next == SR_TIMER_NEVER) {
+            pthread_cond_wait(&(cache->wake), &(cache->lock));
+        }
+        else {
+            ts.tv_sec = next / 1000;
+            ts.tv_nsec = (long)(next % 1000) * 1000000;
+            pthread_cond_timedwait(&(cache->wake), &(cache->lock), &ts);
+        }
+    }
     
-        time_t curtime = time(NULL);
+    pthread_mutex_unlock(&(cache->lock));
+    
+    return NULL;
+}
+
+/* Learns the sender's mapping from an ARP request that came in on iface,
+   before it is answered or dropped. A request for one of our addresses
+   adds or refreshes the sender's entry, since the sender is about to talk
+   to us and we will have to answer it; any other request, gratuitous ARP
+   included, only updates an entry we already have or one we are asking
+   for. Packets waiting on the sender are sent right away. Returns 1 if a
+   mapping was taken. */
+int sr_arpcache_learn(struct sr_instance *sr, struct sr_arp_hdr *arp_hdr, struct sr_if *iface) {
+    struct sr_arpreq *req = 0;
+    struct sr_packet *pkt = 0;
+    struct sr_ethernet_hdr *e_hdr = 0;
+    unsigned int i;
+    int taken = 0;
+    
+    if (!iface ||
+        arp_hdr->ar_hrd != htons(arp_hrd_ethernet) ||
+        arp_hdr->ar_pro != htons(ethertype_ip) ||
+        arp_hdr->ar_hln != ETHER_ADDR_LEN || arp_hdr->ar_pln != 4)
+        return 0;
+    
+    /* address probes (RFC 5227) say nothing yet, and a group or broadcast
+       sender address is never a neighbour's */
+    if (arp_hdr->ar_sip == 0 || (arp_hdr->ar_sha[0] & 1))
+        return 0;
+    
+    /* someone else claiming one of our addresses is not learned */
+    for (i = 0; i < sr->nifs; i++) {
+        if (sr->if_index[i] && sr->if_index[i]->ip == arp_hdr->ar_sip)
+            return 0;
+    }
+    
+    req = sr_arpcache_merge(&(sr->cache), arp_hdr->ar_sha, arp_hdr->ar_sip,
+                            iface->index, arp_hdr->ar_tip == iface->ip, &taken);
+    if (taken)
+        __atomic_add_fetch(&(sr->cache.qstats.learned), 1, __ATOMIC_RELAXED);
+    if (!req)
+        return taken;
+    
+    /* the queue goes out in one write when batching */
+    sr_tx_cork(sr);
+    for (pkt = req->packets; pkt; pkt = pkt->next) {
+        e_hdr = (struct sr_ethernet_hdr *) (pkt->buf);
+        memcpy(e_hdr->ether_dhost, arp_hdr->ar_sha, ETHER_ADDR_LEN);
+        sr_send_packet(sr, pkt->buf, pkt->len, pkt->iface);
+    }
+    sr_tx_uncork(sr);
+    sr_arpreq_destroy(&(sr->cache), req);
+    
+    return 1;
+}
+
+/* Reads neighbours from path, one "ip mac interface" per line, '#'
+   starting a comment, into the cache as static entries, or as stale ones
+   if stale is set. Returns the number added, or -1 if path cannot be
+   read. */
+int sr_arpcache_load(struct sr_instance *sr, const char *path, int stale) {
+    FILE *fp = fopen(path, "r");
+    char line[256];
+    char ip_str[32], mac_str[32], if_str[sr_IFACE_NAMELEN];
+    unsigned int m[6];
+    unsigned char mac[6];
+    struct in_addr ip;
+    struct sr_if *iface = 0;
+    int lineno = 0, added = 0, k;
+    
+    if (!fp)
+        return -1;
+    
+    while (fgets(line, sizeof(line), fp)) {
+        lineno++;
+        if (strchr(line, '#'))
+            *strchr(line, '#') = '\0';
+        if (sscanf(line, "%31s", ip_str) != 1)
+            continue;
         
-        int i;    
-        for (i = 0; i < SR_ARPCACHE_SZ; i++) {
-            if ((cache->entries[i].valid) && (difftime(curtime,cache->entries[i].added) > SR_ARPCACHE_TO)) {
-                cache->entries[i].valid = 0;
-            }
+        if (sscanf(line, "%31s %31s %31s", ip_str, mac_str, if_str) != 3 ||
+            inet_aton(ip_str, &ip) == 0 ||
+            sscanf(mac_str, "%x:%x:%x:%x:%x:%x", &m[0], &m[1], &m[2], &m[3], &m[4], &m[5]) != 6) {
+            fprintf(stderr, "%s:%d: expected \"ip mac interface\"\n", path, lineno);
+            continue;
         }
+        iface = sr_get_interface(sr, if_str);
+        if (!iface) {
+            fprintf(stderr, "%s:%d: no interface %s\n", path, lineno, if_str);
+            continue;
+        }
+        for (k = 0; k < 6; k++)
+            mac[k] = (unsigned char) m[k];
         
-        sr_arpcache_sweepreqs(sr);
+        if (stale) {
+            sr_arpcache_add_stale(&(sr->cache), mac, ip.s_addr, iface->index);
+        }
+        else if (sr_arpcache_add_static(&(sr->cache), mac, ip.s_addr, iface->index) != 0) {
+            fprintf(stderr, "%s:%d: too many static entries\n", path, lineno);
+            continue;
+        }
+        added++;
+    }
+    
+    fclose(fp);
+    return added;
+}
 
-        pthread_mutex_unlock(&(cache->lock));
+/* Writes the dynamic entries to path in the format sr_arpcache_load
+   reads, through a temporary file so a crash midway leaves the old
+   snapshot. Returns the number written, or -1 on error. */
+int sr_arpcache_save(struct sr_instance *sr, const char *path) {
+    struct sr_arpcache *cache = &(sr->cache);
+    char tmp[512];
+    FILE *fp;
+    struct in_addr ip;
+    struct sr_if *iface;
+    unsigned char *mac;
+    unsigned int i;
+    int saved = 0;
+    
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    fp = fopen(tmp, "w");
+    if (!fp)
+        return -1;
+    
+    fprintf(fp, "# ARP cache snapshot: ip mac interface\n");
+    
+    pthread_mutex_lock(&(cache->lock));
+    for (i = 0; i < cache->nslots; i++) {
+        struct sr_arpentry *cur = &(cache->entries[i]);
+        if (!cur->valid || cur->permanent)
+            continue;
+        iface = sr_if_by_index(sr, cur->ifindex);
+        if (!iface)
+            continue;
+        ip.s_addr = cur->ip;
+        mac = cur->mac;
+        fprintf(fp, "%s %02x:%02x:%02x:%02x:%02x:%02x %s\n", inet_ntoa(ip),
+                mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], iface->name);
+        saved++;
     }
+    pthread_mutex_unlock(&(cache->lock));
     
-    return NULL;
+    if (fclose(fp) != 0 || rename(tmp, path) != 0) {
+        remove(tmp);
+        return -1;
+    }
+    return saved;
 }
 
+/* Answers an ARP request for the address of interface: the interface's
+   reply with the asker put in. Returns 1 if the interface is not ours. */
 int sr_response_arp_req(struct sr_instance *sr, struct sr_arp_hdr *arp_hdr, char *interface) {
-    /* response ARP request */
     struct sr_if *sr_if = sr_get_interface(sr, interface);
+    uint8_t frame[SR_ARP_FRAME_LEN];
+    struct sr_ethernet_hdr *resp_hdr = (struct sr_ethernet_hdr *) frame;
+    struct sr_arp_hdr *resp_arp_hdr = (struct sr_arp_hdr *) (frame + sizeof(struct sr_ethernet_hdr));
+    
     if (!sr_if)
         return 1;
-
-    struct sr_ethernet_hdr *resp_hdr = 0;
-    struct sr_arp_hdr *resp_arp_hdr = 0;
-
-    /* init ethernet header */
-    unsigned int len = sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr);
-    resp_hdr = (struct sr_ethernet_hdr*)malloc(len);
+    
+    memcpy(frame, sr_if->arp_reply, SR_ARP_FRAME_LEN);
     memcpy(resp_hdr->ether_dhost, arp_hdr->ar_sha, ETHER_ADDR_LEN);
-    memcpy(resp_hdr->ether_shost, sr_if->addr, ETHER_ADDR_LEN);
-    resp_hdr->ether_type = htons(ethertype_arp);
-
-    /* init arp header */
-    resp_arp_hdr = (struct sr_arp_hdr*)((uint8_t*)resp_hdr + sizeof(struct sr_ethernet_hdr));
-    resp_arp_hdr->ar_hrd = arp_hdr->ar_hrd;
-    resp_arp_hdr->ar_pro = arp_hdr->ar_pro;
-    resp_arp_hdr->ar_hln = arp_hdr->ar_hln;
-    resp_arp_hdr->ar_pln = arp_hdr->ar_pln;
-    resp_arp_hdr->ar_op = htons(arp_op_reply);
     memcpy(resp_arp_hdr->ar_tha, arp_hdr->ar_sha, ETHER_ADDR_LEN);
-    memcpy(resp_arp_hdr->ar_sha, sr_if->addr, ETHER_ADDR_LEN);
     resp_arp_hdr->ar_tip = arp_hdr->ar_sip;
-    resp_arp_hdr->ar_sip = sr_if->ip;
-
-    /* send response packet and return response result */
-    int response_result = sr_send_packet(sr, (uint8_t*)resp_hdr, len, interface);
-    free(resp_hdr);
-    return response_result;
+    
+    return sr_send_packet_if(sr, frame, SR_ARP_FRAME_LEN, sr_if);
 }
 
-
-int sr_handle_arp_reply(struct sr_instance *sr, struct sr_arp_hdr *arp_hdr) {
-
-    struct sr_arpcache *arp_cache = &(sr->cache);
-    struct sr_ethernet_hdr *e_hdr = 0;
-    unsigned char *next_hop_mac = arp_hdr->ar_sha;
-    uint32_t ip = arp_hdr->ar_sip;
+/* Takes the mapping from an ARP reply that came in on interface and sends
+   the packets that were waiting on it. Returns 1 if the interface is not
+   ours. */
+int sr_handle_arp_reply(struct sr_instance *sr, struct sr_arp_hdr *arp_hdr, char *interface) {
+    struct sr_if *sr_if = sr_get_interface(sr, interface);
     struct sr_arpreq *req = 0;
-
-    /* add mutex lock */
-    pthread_mutex_lock(&(sr->cache.lock));
-
-    req = arpcache_insert(cache, next_hop_mac, ip);
-    struct sr_packet *packet = req -> packets;
-
-    if (req && packet) {
-        while(packet){
-            /* copy packets and send */
-            e_hdr = (sr_ethernet_hdr_t*)(pkt->buf);
-            memcpy(e_hdr->ether_dhost, next_hop_mac, ETHER_ADDR_LEN);
-            sr_send_packet(sr, pkt->buf, pkt->len, pkt->iface);
-            packet = packet->next;
-        }
-        /* destroy when send all packets*/
-        arpreq_destroy(cache, req);
+    struct sr_packet *pkt = 0;
+    struct sr_ethernet_hdr *e_hdr = 0;
+    
+    if (!sr_if)
+        return 1;
+    
+    /* the request is off the queue once insert hands it back, ours alone */
+    req = sr_arpcache_insert(&(sr->cache), arp_hdr->ar_sha, arp_hdr->ar_sip,
+                             sr_if->index);
+    if (!req)
+        return 0;
+    
+    sr_tx_cork(sr);
+    for (pkt = req->packets; pkt; pkt = pkt->next) {
+        e_hdr = (struct sr_ethernet_hdr *) (pkt->buf);
+        memcpy(e_hdr->ether_dhost, arp_hdr->ar_sha, ETHER_ADDR_LEN);
+        sr_send_packet(sr, pkt->buf, pkt->len, pkt->iface);
     }
-    pthread_mutex_unlock(&(sr->cache.lock));
+    sr_tx_uncork(sr);
+    sr_arpreq_destroy(&(sr->cache), req);
+    
     return 0;
 }
 
+int sr_send_arp_req(struct sr_instance *sr, char *sha, uint32_t sip, uint32_t tip, char *iface) {
+    /* the interface's broadcast request, only the target to fill in; it
+       has the interface's own sha and sip */
+    struct sr_if *sr_if = sr_get_interface(sr, iface);
+    uint8_t packet[SR_ARP_FRAME_LEN];
+    struct sr_arp_hdr *a_hdr = (sr_arp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
 
+    if (!sr_if)
+        return -1;
 
-
-int sr_send_arp_req(struct sr_instance *sr, char *sha, uint32_t sip, uint32_t tip, char *iface) {
-    uint8_t *packet = 0;
-    struct sr_ethernet_hdr *e_hdr= 0;
-    struct sr_arp_hdr *a_hdr = 0;
-    char *broadcast = "\xff\xff\xff\xff\xff\xff";
-    int result = 0;
-    int len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_arp_hdr_t);
-    packet = malloc(len);
-    e_hdr = (struct sr_ethernet_hdr*)packet;
-    memcpy(e_hdr->ether_shost, sha, ETHER_ADDR_LEN);
-    memcpy(e_hdr->ether_dhost, broadcast, ETHER_ADDR_LEN);
-    e_hdr->ether_type = htons(ethertype_arp);
-
-    a_hdr = (sr_arp_hdr_t*)(packet + sizeof(sr_ethernet_hdr_t));
-    a_hdr->ar_hrd = htons(arp_hrd_ethernet);
-    a_hdr->ar_pro = htons(0x0800);
-    a_hdr->ar_hln = ETHER_ADDR_LEN;
-    a_hdr->ar_pln = 4;
-    a_hdr->ar_op = htons(arp_op_request);
-    memcpy(a_hdr->ar_tha, broadcast, ETHER_ADDR_LEN);
-    memcpy(a_hdr->ar_sha, sha, ETHER_ADDR_LEN);
+    memcpy(packet, sr_if->arp_request, SR_ARP_FRAME_LEN);
     a_hdr->ar_tip = tip;
-    a_hdr->ar_sip = sip;
 
-    result = sr_send_packet(sr, packet, len, iface);
-    free(packet);
-    return result;
+    return sr_send_packet_if(sr, packet, SR_ARP_FRAME_LEN, sr_if);
 }
 
-void sr_handle_arpreq(struct sr_instance *sr, struct sr_arpreq *req) {
-    pthread_mutex_lock(&(sr->cache.lock));
-    time_t curtime = time(NULL);
-    struct sr_if *sr_if = sr_get_interface(sr, req->packets->iface);
-    struct sr_packet *pkt = 0;
-    struct sr_ip_hdr *ip_hdr = 0;
-    uint8_t *packet_to_send = 0;
-    uint32_t ip_dst = 0;
-    uint32_t next_hop_ip = 0;
-    unsigned int len = 0;
-    char iface_out[sr_IFACE_NAMELEN];
-
-    if (difftime(curtime, req->sent) >= 1) {
-        if (req->times_sent < 5) {
-            sr_send_arp_req(sr, (char*)(sr_if->addr), sr_if->ip, req->ip, sr_if->name);
-            req->sent = time(NULL);
-            req->times_sent++;
-        }
-        else {
-            for (pkt=req->packets; pkt; pkt=pkt->next) {
-                ip_hdr = (sr_ip_hdr_t*)(pkt->buf + sizeof(sr_ethernet_hdr_t));
-                ip_dst = ip_hdr->ip_src;
-                len = sizeof(sr_ethernet_hdr_t) + sizeof(sr_ip_hdr_t) + sizeof(sr_icmp_t3_hdr_t);
-                packet_to_send = malloc(len);
-                sr_find_next_hop_ip_and_iface(sr->routing_table, ip_dst, &next_hop_ip, iface_out);
-                sr_fill_in_icmp_hostunreachable(sr, packet_to_send, pkt->buf, iface_out);
-                sr_arpcache_queuereq(&(sr->cache), next_hop_ip, packet_to_send, len, iface_out);
-                free(packet_to_send);
-            }
-            arpreq_destroy(&(sr->cache), req);
-        }
+/* What req needs now: SR_ARPREQ_WAIT if it is not due or the
+   interface's rate holds it back, SR_ARPREQ_SEND with *iface to ask on,
+   or, after SR_ARPREQ_TRIES, SR_ARPREQ_GIVEUP, with the request taken
+   off the queue and the neighbour held down so the packets that follow
+   fail fast instead of asking all over again. The one place the retry
+   cap and the rate are applied, for the request's timer and for the
+   packet that started it alike. Caller holds the lock and does the
+   sending once it is dropped. */
+static int sr_arpreq_step(struct sr_instance *sr, struct sr_arpreq *req,
+                          struct sr_if **iface) {
+    struct sr_arpcache *cache = &(sr->cache);
+    uint64_t now = sr_timer_now_ms();
+    
+    if (req->sent && now - req->sent < cache->retry_ms)
+        return SR_ARPREQ_WAIT;
+    *iface = sr_get_interface(sr, req->packets->iface);
+    
+    if (*iface && req->times_sent < SR_ARPREQ_TRIES) {
+        /* over the interface's ARP rate: left to the next retry */
+        if (!sr_arpcache_tx_allow(cache, *iface))
+            return SR_ARPREQ_WAIT;
+        req->sent = now;
+        req->times_sent++;
+        return SR_ARPREQ_SEND;
     }
-    pthread_mutex_unlock(&(sr->cache.lock));
+    
+    if (*iface)
+        sr_arpneg_add(cache, req->ip, (*iface)->index);
+    sr_arpreq_unlink(cache, req);
+    return SR_ARPREQ_GIVEUP;
 }
 
+/* Tells every sender waiting on req, which is off the queue, that the
+   neighbour did not answer, then frees it. Called without the lock. */
+static void sr_arpreq_fail(struct sr_instance *sr, struct sr_arpreq *req) {
+    struct sr_packet *pkt;
+    
+    for (pkt = req->packets; pkt; pkt = pkt->next)
+        sr_icmp_send_error(sr, pkt->buf, pkt->len, icmp_type_unreach,
+                           icmp_code_host_unreach);
+    sr_arpreq_destroy(&(sr->cache), req);
+}
 
+/* Pushes req along from the packet that started it: sends the next ARP
+   request if one is due, or gives up. */
+void sr_handle_arpreq(struct sr_instance *sr, struct sr_arpreq *req) {
+    struct sr_if *sr_if = NULL;
+    uint32_t ip;
+    int step;
+    
+    pthread_mutex_lock(&(sr->cache.lock));
+    ip = req->ip;
+    step = sr_arpreq_step(sr, req, &sr_if);
+    pthread_mutex_unlock(&(sr->cache.lock));
+    
+    if (step == SR_ARPREQ_SEND)
+        sr_send_arp_req(sr, (char *)(sr_if->addr), sr_if->ip, ip, sr_if->name);
+    else if (step == SR_ARPREQ_GIVEUP)
+        sr_arpreq_fail(sr, req);
+}
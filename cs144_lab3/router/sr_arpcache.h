@@ -2,18 +2,79 @@
    request queue, and ARP cache entries. The ARP request queue holds data about
    an outgoing ARP cache request and the packets that are waiting on a reply
    to that ARP cache request. The ARP cache entries hold IP->MAC mappings and
-   are timed out every SR_ARPCACHE_TO seconds.
+   are timed out SR_ARPCACHE_TO_MS milliseconds after they were learned (or
+   whatever sr_arpcache_init was given).
+
+   The entries live in an open addressing hash table keyed by (interface
+   index, IP) with linear probing, sized to twice the configured capacity.
+   Once capacity entries are in use, inserting another evicts one chosen
+   by CLOCK: every lookup hit sets the entry's reference bit, and the hand
+   clears bits until it finds an entry that has not been used since it
+   last came round.
+
+   Lookups do not take the cache lock. Writers, which are serialized by
+   the lock, make the table's sequence count odd while they change it and
+   even again when done; a reader copies the entry out and retries if the
+   count was odd or moved in the meantime. Writers never wait for readers.
+
+   Busy neighbours are refreshed ahead of time. Lookups, and the
+   adjacencies and route cache entries built from them, mark the entry's
+   slot used (sr_arpcache_touch); while the cache generation they were
+   stamped with is current the slot cannot have moved. From refresh_ms
+   before an entry's deadline, an entry that was used since it was learned
+   or last refreshed is revalidated with a unicast ARP request to the MAC
+   we have, once per retry interval. Forwarding carries on with the old
+   mapping meanwhile: a reply with the same MAC only pushes the deadline
+   out and does not move the cache generation. Only if no reply comes by
+   the deadline is the entry dropped. Idle entries are simply dropped at
+   their deadline.
+
+   Neighbours are also learned from the ARP requests they send
+   (sr_arpcache_learn). A request for one of our addresses adds or
+   refreshes the sender's entry, since it is about to send us traffic we
+   will answer; any other request, gratuitous ARP included, only updates
+   an entry we already have or are asking for. Either way, packets waiting
+   on the sender go out at once instead of after our own request.
+
+   Entries can also be static, loaded from a neighbour file at startup:
+   they never expire, are never evicted and ARP traffic does not change
+   them. The dynamic entries can be saved on shutdown and loaded on the
+   next start as stale entries (sr_arpcache_add_stale), which forward
+   traffic at once but are revalidated like busy entries near their
+   deadline and are gone within refresh_ms if nobody answers.
+
+   A scan of a connected subnet asks for many neighbours at once. At most
+   req_max requests are outstanding; a packet that would start another is
+   dropped. And every ARP request sent out an interface takes a token from
+   that interface's bucket (sr_arpcache_tx_allow); a request without one
+   waits for its next retry, so broadcasts stay at tx_rate a second while
+   neighbours we already know are not affected.
+
+   Pending requests are also chained in a hash table by IP, so finding the
+   request for a destination does not walk the queue. The packets waiting
+   on a request are kept in arrival order and bounded twice: at most
+   req_max_pkts per request, and at most req_max_bytes of frames over all
+   requests together. What happens to a packet that does not fit is the
+   drop policy: SR_ARPREQ_DROP_TAIL throws the new packet away,
+   SR_ARPREQ_DROP_OLDEST makes room by dropping the oldest packets of the
+   same request, so one dead neighbour cannot push out traffic waiting on
+   others. Under either policy the new packet is dropped if even all of
+   its request's own packets would not make room, and a packet that would
+   start a request but does not fit starts none. Drops are counted in
+   cache->qstats.
 
    Pseudocode for use of these structures follows.
 
    --
 
-   # When sending packet to next_hop_ip
-   entry = arpcache_lookup(next_hop_ip)
+   # When sending packet to next_hop_ip out of interface if
+   entry = arpcache_lookup(next_hop_ip, if->index)
 
    if entry:
        use next_hop_ip->mac mapping in entry to send the packet
        free entry
+   else if arpcache_failed(next_hop_ip):
+       send icmp host unreachable if it says so, and drop the packet
    else:
        req = arpcache_queuereq(next_hop_ip, packet, len)
        handle_arpreq(req)
@@ -24,7 +85,7 @@
    handle sending ARP requests if necessary:
 
    function handle_arpreq(req):
-       if difftime(now, req->sent) > 1.0
+       if now - req->sent >= retry interval (ms)
            if req->times_sent >= 5:
                send icmp host unreachable to source addr of all pkts waiting
                  on this request
@@ -40,7 +101,7 @@
    queue to the ARP cache:
 
    # When servicing an arp reply that gives us an IP->MAC mapping
-   req = arpcache_insert(ip, mac)
+   req = arpcache_insert(ip, mac, index of the interface it arrived on)
 
    if req:
        send all packets on the req->packets linked list
@@ -48,19 +109,22 @@
 
    --
 
-   To meet the guidelines in the assignment (ARP requests are sent every second
-   until we send 5 ARP requests, then we send ICMP host unreachable back to
-   all packets waiting on this ARP request), you must fill out the following
-   function that is called every second and is defined in sr_arpcache.c:
+   Every cache entry and every request owns a timer on the cache's timer
+   wheel (sr_timer.h), run by the cache thread on a monotonic millisecond
+   clock. An entry's timer removes it when it times out; a request's timer
+   calls handle_arpreq one retry interval after it was queued or last sent,
+   so requests are retried exactly when due instead of by a once a second
+   sweep, and the cost is per timer firing rather than per cache slot.
 
-   void sr_arpcache_sweepreqs(struct sr_instance *sr) {
-       for each request on sr->cache.requests:
-           handle_arpreq(request)
-   }
+   ARP requests are sent every retry interval until we send 5 ARP requests,
+   then we send ICMP host unreachable back to all packets waiting on this
+   ARP request.
 
-   Since handle_arpreq as defined in the comments above could destroy your
-   current request, make sure to save the next pointer before calling
-   handle_arpreq when traversing through the ARP requests linked list.
+   The neighbour is then held down as failed for hold_ms
+   (sr_arpcache_failed): packets for it get a host unreachable straight
+   away, no more than one every SR_ARPNEG_ICMP_MS, and are not queued,
+   while a few broadcast requests in the background notice it coming
+   back.  Any ARP from the neighbour ends the hold-down.
  */
 
 #ifndef SR_ARPCACHE_H
@@ -70,45 +134,163 @@
 #include <time.h>
 #include <pthread.h>
 #include "sr_if.h"
+#include "sr_timer.h"
+
+#define SR_ARPCACHE_SZ     1024   /* default capacity, see sr_arpcache_init */
+#define SR_ARPCACHE_TO_MS  15000  /* default entry lifetime */
+#define SR_ARPREQ_RETRY_MS 1000   /* default interval between ARP requests */
+#define SR_ARPCACHE_REFRESH_DIV 5 /* refresh the last 1/5 of an entry's life */
+#define SR_ARPREQ_HASH_SZ  1024   /* pending request chains, power of two */
+#define SR_ARPREQ_MAX_PKTS 64     /* default packets queued per request */
+#define SR_ARPREQ_MAX_BYTES (4 * 1024 * 1024) /* default bytes over all */
 
-#define SR_ARPCACHE_SZ    100  
-#define SR_ARPCACHE_TO    15.0
+#define SR_ARPREQ_TRIES    5      /* requests sent before giving up */
+#define SR_ARPREQ_MAX      256    /* default outstanding requests */
+#define SR_ARPTX_RATE      100    /* default ARP requests/s per interface */
+#define SR_ARPTX_BURST     16     /* and how many may go back to back */
+#define SR_ARPNEG_HOLD_MS  20000  /* default hold-down of a failed neighbour */
+#define SR_ARPNEG_PROBES   4      /* background requests per hold-down */
+#define SR_ARPNEG_ICMP_MS  100    /* least interval between its unreachables */
+#define SR_ARPNEG_HASH_SZ  256    /* failed neighbour chains, power of two */
+#define SR_ARPNEG_MAX      1024   /* most neighbours held down at once */
+
+/* sr_arpcache_failed */
+#define SR_ARPNEG_NONE 0          /* not held down */
+#define SR_ARPNEG_ICMP 1          /* held down, send host unreachable */
+#define SR_ARPNEG_DROP 2          /* held down, just drop */
+
+#define SR_ARPREQ_DROP_TAIL   0   /* drop the packet that does not fit */
+#define SR_ARPREQ_DROP_OLDEST 1   /* drop the request's oldest packets */
 
 struct sr_packet {
-    uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC empty */
+    uint8_t *buf;               /* A raw Ethernet frame, presumably with the dest MAC
+                                   empty; lives in the same allocation */
     unsigned int len;           /* Length of raw Ethernet frame */
-    char *iface;                /* The outgoing interface */
-    struct sr_packet *next;
+    char iface[sr_IFACE_NAMELEN]; /* The outgoing interface */
+    struct sr_packet *next;     /* Next packet to arrive after this one */
 };
 
 struct sr_arpentry {
     unsigned char mac[6]; 
+    uint16_t ifindex;           /* interface the neighbour is on */
     uint32_t ip;                /* IP addr in network byte order */
     time_t added;         
+    uint64_t expires;           /* hard deadline, ms on sr_timer_now_ms */
+    int permanent;              /* static: never expires or is evicted */
     int valid;
 };
 
+/* Bits of cache->ref */
+#define SR_ARPENTRY_REF  1      /* CLOCK reference bit */
+#define SR_ARPENTRY_USED 2      /* used since learned or last refreshed */
+
 struct sr_arpreq {
     uint32_t ip;
-    time_t sent;                /* Last time this ARP request was sent. You 
-                                   should update this. If the ARP request was 
-                                   never sent, will be 0. */
+    uint64_t sent;              /* Last time this ARP request was sent, in ms
+                                   on the sr_timer_now_ms clock. You should
+                                   update this. If the ARP request was never
+                                   sent, will be 0. */
     uint32_t times_sent;        /* Number of times this request was sent. You 
                                    should update this. */
-    struct sr_packet *packets;  /* List of pkts waiting on this req to finish */
+    struct sr_packet *packets;  /* List of pkts waiting on this req to finish,
+                                   oldest first */
+    struct sr_packet *last;     /* Newest packet */
+    unsigned int npackets;
+    unsigned int bytes;         /* frame bytes of the packets */
+    struct sr_timer timer;      /* calls handle_arpreq when a retry is due */
     struct sr_arpreq *next;
+    struct sr_arpreq *prev;
+    struct sr_arpreq *hnext;    /* hash chain */
+};
+
+/* A neighbour that did not answer ARP, held down as failed. */
+struct sr_arpneg {
+    uint32_t ip;
+    uint16_t ifindex;           /* where we asked for it */
+    uint64_t until;             /* end of the hold-down, ms */
+    uint64_t icmp_next;         /* no host unreachable before this */
+    struct sr_timer timer;      /* background requests, then removal */
+    struct sr_arpneg *hnext;
+};
+
+/* An ARP request a timer wants sent. Timers run under the cache lock, so
+   they only note it down; it goes out once the run is over and the lock
+   dropped. */
+struct sr_arptx {
+    uint32_t ip;                /* target */
+    uint16_t ifindex;           /* interface to ask on */
+    unsigned char unicast;      /* to mac rather than broadcast */
+    unsigned char mac[6];
+};
+
+/* Pending request queue counters, packets unless noted. */
+struct sr_arpq_stats {
+    uint64_t queued;            /* accepted onto a request */
+    uint64_t drop_req;          /* dropped at the per request limit */
+    uint64_t drop_bytes;        /* dropped at the total byte limit */
+    uint64_t bytes;             /* bytes queued right now */
+    uint64_t bytes_peak;        /* most bytes ever queued at once */
+    uint64_t requests;          /* requests pending right now */
+    uint64_t requeued;          /* queued because the neighbour's mapping
+                                   had expired or was evicted */
+    uint64_t probes;            /* unicast refresh requests sent */
+    uint64_t expired;           /* entries that reached their deadline */
+    uint64_t learned;           /* mappings taken from ARP requests */
+    uint64_t failed;            /* neighbours held down */
+    uint64_t neg_fast;          /* packets to them failed fast */
+    uint64_t neg_probes;        /* background requests to them */
+    uint64_t drop_cap;          /* dropped, too many requests outstanding */
+    uint64_t tx_limited;        /* ARP requests held back by the rate */
 };
 
 struct sr_arpcache {
-    struct sr_arpentry entries[SR_ARPCACHE_SZ];
+    struct sr_arpentry *entries; /* hash table, nslots entries */
+    unsigned char *ref;         /* SR_ARPENTRY_ bits of each slot */
+    unsigned int nslots;        /* power of two */
+    unsigned int capacity;      /* most valid entries kept */
+    unsigned int count;         /* valid entries */
+    unsigned int nstatic;       /* of which static */
+    unsigned int hand;          /* CLOCK hand, a slot number */
+    uint32_t seq;               /* odd while a writer changes entries */
+    struct sr_timer *timer;     /* expiry of the entry in each slot */
+    struct sr_timer_wheel wheel; /* entry and request timers */
+    uint32_t timeout_ms;        /* entry lifetime */
+    uint32_t refresh_ms;        /* refresh used entries this long before */
+    uint32_t retry_ms;          /* interval between ARP requests */
+    uint64_t wake_at;           /* when the timers next need running */
+    pthread_cond_t wake;        /* wakes it early for a sooner timer */
     struct sr_arpreq *requests;
+    struct sr_arpreq *req_hash[SR_ARPREQ_HASH_SZ]; /* requests by IP */
+    unsigned int req_max;       /* most requests outstanding */
+    unsigned int req_max_pkts;  /* packets kept per request */
+    uint64_t req_max_bytes;     /* frame bytes kept over all requests */
+    int req_policy;             /* SR_ARPREQ_DROP_TAIL or _OLDEST */
+    struct sr_arpneg *neg_hash[SR_ARPNEG_HASH_SZ]; /* failed neighbours */
+    unsigned int nneg;
+    uint32_t hold_ms;           /* how long they stay failed */
+    uint32_t tx_rate;           /* ARP requests per second per interface */
+    struct sr_arptx *tx;        /* requests the running timers left */
+    unsigned int ntx;
+    unsigned int cap_tx;
+    struct sr_arpreq *gaveup;   /* given up by them, off the queue */
+    struct sr_arpq_stats qstats;
+    uint32_t gen;               /* bumped whenever a mapping changes */
     pthread_mutex_t lock;
     pthread_mutexattr_t attr;
 };
 
-/* Checks if an IP->MAC mapping is in the cache. IP is in network byte order. 
-   You must free the returned structure if it is not NULL. */
-struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
+/* Checks if an IP->MAC mapping for a neighbour on interface ifindex is in
+   the cache and copies it to *entry. IP is in network byte order. Returns
+   0 if not found, otherwise one more than the entry's slot, for
+   sr_arpcache_touch. Never blocks and never allocates; this is the one to
+   use on the forwarding path. */
+int sr_arpcache_lookup_into(struct sr_arpcache *cache, uint32_t ip,
+                            uint16_t ifindex, struct sr_arpentry *entry);
+
+/* As sr_arpcache_lookup_into, but returns a copy you must free if it is
+   not NULL. */
+struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip,
+                                       uint16_t ifindex);
 
 /* Adds an ARP request to the ARP request queue. If the request is already on
    the queue, adds the packet to the linked list of packets for this sr_arpreq
@@ -116,7 +298,11 @@ struct sr_arpentry *sr_arpcache_lookup(struct sr_arpcache *cache, uint32_t ip);
    freed by the caller.
 
    A pointer to the ARP request is returned; it should be freed. The caller
-   can remove the ARP request from the queue by calling sr_arpreq_destroy. */
+   can remove the ARP request from the queue by calling sr_arpreq_destroy.
+   The packet may be dropped, or older ones dropped to make room for it,
+   under the queue limits. If there is no request for ip yet and req_max
+   are outstanding already, or the packet does not fit, it is dropped and
+   NULL returned: a request never exists without packets waiting on it. */
 struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
                          uint32_t ip,
                          uint8_t *packet,               /* borrowed */
@@ -126,10 +312,23 @@ struct sr_arpreq *sr_arpcache_queuereq(struct sr_arpcache *cache,
 /* This method performs two functions:
    1) Looks up this IP in the request queue. If it is found, returns a pointer
       to the sr_arpreq with this IP. Otherwise, returns NULL.
-   2) Inserts this IP to MAC mapping in the cache, and marks it valid. */
+   2) Inserts this IP to MAC mapping for interface ifindex in the cache, and
+      marks it valid, evicting another entry if the cache is full. */
 struct sr_arpreq *sr_arpcache_insert(struct sr_arpcache *cache,
                                      unsigned char *mac,
-                                     uint32_t ip);
+                                     uint32_t ip,
+                                     uint16_t ifindex);
+
+/* As sr_arpcache_insert, but a new entry is only made if add is set or a
+   request for ip is pending; otherwise only a mapping we already have is
+   updated, as RFC 826 merges what an ARP packet's sender says about
+   itself. *taken, if not NULL, is set to whether the mapping was stored. */
+struct sr_arpreq *sr_arpcache_merge(struct sr_arpcache *cache,
+                                    unsigned char *mac,
+                                    uint32_t ip,
+                                    uint16_t ifindex,
+                                    int add,
+                                    int *taken);
 
 /* Frees all memory associated with this arp request entry. If this arp request
    entry is on the arp request queue, it is removed from the queue. */
@@ -138,12 +337,74 @@ void sr_arpreq_destroy(struct sr_arpcache *cache, struct sr_arpreq *entry);
 /* Prints out the ARP table. */
 void sr_arpcache_dump(struct sr_arpcache *cache);
 
+/* Sets the pending packet limits, 0 keeping the default, and the drop
+   policy. */
+void sr_arpcache_set_queue_limits(struct sr_arpcache *cache,
+                                  unsigned int max_pkts,
+                                  uint64_t max_bytes, int policy);
+
+/* Adds a static entry for (ip, ifindex), or makes the one we have
+   static. Static entries never expire, are never evicted and are not
+   changed by ARP traffic; at most half the capacity may be static.
+   Returns 0 on success. */
+int sr_arpcache_add_static(struct sr_arpcache *cache, const unsigned char *mac,
+                           uint32_t ip, uint16_t ifindex);
+
+/* Adds a mapping remembered from an earlier run. It is used straight
+   away but revalidated in the background, and dropped within refresh_ms
+   unless the neighbour answers. Mappings we already have win. */
+void sr_arpcache_add_stale(struct sr_arpcache *cache, const unsigned char *mac,
+                           uint32_t ip, uint16_t ifindex);
+
+/* Whether ip failed to resolve lately: SR_ARPNEG_NONE if not, otherwise
+   SR_ARPNEG_ICMP if a host unreachable may be sent for the packet (at
+   most one every SR_ARPNEG_ICMP_MS per neighbour) or SR_ARPNEG_DROP if it
+   should just be dropped. Either way the packet is not queued. */
+int sr_arpcache_failed(struct sr_arpcache *cache, uint32_t ip);
+
+/* Sets the most requests outstanding and the ARP requests per second
+   each interface may send, 0 keeping the defaults. */
+void sr_arpcache_set_req_limits(struct sr_arpcache *cache,
+                                unsigned int max_reqs, uint32_t tx_rate);
+
+/* Takes a token from iface's ARP request bucket, which refills at tx_rate
+   per second up to SR_ARPTX_BURST. Every ARP request we send, first,
+   retry or probe, needs one; returns 0 if there is none, and the request
+   should then wait for its next retry. */
+int sr_arpcache_tx_allow(struct sr_arpcache *cache, struct sr_if *iface);
+
+/* Sets the hold-down of failed neighbours, 0 keeping the default. */
+void sr_arpcache_set_holddown(struct sr_arpcache *cache, uint32_t hold_ms);
+
+/* Prints out the pending request queue counters. */
+void sr_arpcache_print_stats(struct sr_arpcache *cache);
+
+/* Mark the entry in slot used, slot as returned (less one) by
+   sr_arpcache_lookup_into under the current generation. Only stores when
+   a bit is missing, so a busy entry's line stays shared. */
+static __inline__ void sr_arpcache_touch(struct sr_arpcache *cache,
+                                         uint32_t slot) {
+    if ((__atomic_load_n(&(cache->ref[slot]), __ATOMIC_RELAXED) &
+         (SR_ARPENTRY_REF | SR_ARPENTRY_USED)) !=
+        (SR_ARPENTRY_REF | SR_ARPENTRY_USED))
+        __atomic_fetch_or(&(cache->ref[slot]),
+                          SR_ARPENTRY_REF | SR_ARPENTRY_USED, __ATOMIC_RELAXED);
+}
+
+/* Current generation of the cache.  Anything derived from a lookup (the
+   route cache) is stale once this has moved on. */
+static __inline__ uint32_t sr_arpcache_gen(struct sr_arpcache *cache) {
+    return __atomic_load_n(&(cache->gen), __ATOMIC_ACQUIRE);
+}
+
 /* You shouldn't have to call these methods--they're already called in the
    starter code for you. The init call is a constructor, the destroy call is
-   a destructor, and a cleanup thread times out cache entries every 15
-   seconds. */
+   a destructor, and a cleanup thread runs the timers that time out cache
+   entries and retry requests. init keeps at most capacity entries,
+   SR_ARPCACHE_SZ if 0; retry_ms and timeout_ms of 0 pick the defaults. */
 
-int   sr_arpcache_init(struct sr_arpcache *cache);
+int   sr_arpcache_init(struct sr_arpcache *cache, unsigned int capacity,
+                       uint32_t retry_ms, uint32_t timeout_ms);
 int   sr_arpcache_destroy(struct sr_arpcache *cache);
 void *sr_arpcache_timeout(void *cache_ptr);
 
@@ -0,0 +1,871 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_dir24.c
+ *
+ * Description:
+ *
+ * Compiles the trie FIB into a DIR-24-8 table.  See sr_dir24.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <sys/mman.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_dir24.h"
+#include "sr_fib.h"
+#include "sr_rt.h"
+#include "sr_rcu.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define DIR24_HAVE_AVX2 1
+#include <immintrin.h>
+#endif
+
+
+/* ----------------------------------------------------------------------------
+ * Next hops are deduplicated on (gateway, interface), so the 15 bit index
+ * only has to cover distinct next hops rather than prefixes.  The table keeps
+ * its own copy of each next hop; routes can then be withdrawn without
+ * leaving the table pointing at freed memory.  A multipath route's path set
+ * is not copied but shared, and is part of the key: it belongs to one route,
+ * and once it is freed no range maps to the copy pointing at it any more.
+ *
+ * The table may be updated while other threads look things up in it (see
+ * sr_dir24_update).  Entries are written with single 16 bit stores, a new
+ * second level block is filled in before the first level entry pointing at
+ * it is published, and the nh and tbllong arrays are grown by copying and
+ * freeing the old array after an RCU grace period.
+ *
+ * Every next hop index counts the entries of either level holding it.  One
+ * whose count is still 0 at the end of an update is taken out of the hash
+ * and retired, as is a block whose /24 is covered whole again.  A lookup
+ * that read an entry before it changed may still use either, so retired
+ * indices and blocks wait in limbo.  Once DIR24_RECLAIM of them have piled
+ * up, or there is nothing else left, the writer moves them into grace and
+ * queues a callback with sr_rcu_defer; it never waits for readers itself.
+ * When the callback has run, the next writer that is short of indices or
+ * blocks makes them free for reuse.  Route churn then keeps the table the
+ * size of the routes it holds, not of all the routes it ever held.
+ * -------------------------------------------------------------------------- */
+
+#define DIR24_HASH_SZ  (2 * (SR_DIR24_MAX_NH + 1))
+#define DIR24_RECLAIM  64
+#define DIR24_CHECKED  0x80000000U  /* in nh_ref: index is on nh_check */
+
+#define DIR24_GRACE_WAIT   0        /* d->grace: callback not run yet */
+#define DIR24_GRACE_DONE   1        /*   it ran, the batch can be reused */
+#define DIR24_GRACE_ORPHAN 2        /*   the table is gone, callback frees */
+
+#define DIR24_SET(p, v)     __atomic_store_n(&(p), (v), __ATOMIC_RELAXED)
+#define DIR24_PUBLISH(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+
+struct dir24_builder
+{
+    struct sr_dir24* d;
+    int failed;
+};
+
+/* whether p was allocated by us rather than being part of an image */
+static int dir24_owned(const struct sr_dir24* d, const void* p)
+{
+    const char* c = (const char*)p;
+
+    return !d->map || c < (const char*)d->map ||
+        c >= (const char*)d->map + d->map_len;
+} /* -- dir24_owned -- */
+
+static unsigned int dir24_nh_hash(const struct sr_rt* rt)
+{
+    const unsigned char* p = (const unsigned char*)rt->interface;
+    unsigned int h = 2166136261U;
+    int i = 0;
+
+    /* -- FNV-1a over the gateway bytes too, so they reach the low bits -- */
+    for(i = 0; i < 4; i++)
+    { h = (h ^ ((const unsigned char*)&(rt->gw.s_addr))[i]) * 16777619U; }
+    while(*p)
+    { h = (h ^ *p++) * 16777619U; }
+    return (h ^ (unsigned int)((size_t)rt->mp >> 4)) & (DIR24_HASH_SZ - 1);
+} /* -- dir24_nh_hash -- */
+
+static int dir24_nh_equal(const struct sr_rt* a, const struct sr_rt* b)
+{
+    return a->gw.s_addr == b->gw.s_addr && a->mp == b->mp &&
+        strncmp(a->interface, b->interface, sr_IFACE_NAMELEN) == 0;
+} /* -- dir24_nh_equal -- */
+
+/* look at k once the update is done, it may have no entries left */
+static void dir24_check(struct sr_dir24* d, uint16_t k)
+{
+    if(!(d->nh_ref[k] & DIR24_CHECKED))
+    {
+        d->nh_ref[k] |= DIR24_CHECKED;
+        d->nh_check[d->nh_ncheck++] = k;
+    }
+} /* -- dir24_check -- */
+
+static void dir24_ref(struct sr_dir24* d, uint16_t k, uint32_t n)
+{
+    if(k)
+    { d->nh_ref[k] += n; }
+} /* -- dir24_ref -- */
+
+static void dir24_unref(struct sr_dir24* d, uint16_t k, uint32_t n)
+{
+    if(k && ((d->nh_ref[k] -= n) & ~DIR24_CHECKED) == 0)
+    { dir24_check(d, k); }
+} /* -- dir24_unref -- */
+
+/* sr_rcu_defer callback: no lookup can hold the batch in grace any more */
+static void dir24_grace_done(void* arg)
+{
+    int* state = (int*)arg;
+
+    if(__atomic_exchange_n(state, DIR24_GRACE_DONE, __ATOMIC_ACQ_REL) ==
+       DIR24_GRACE_ORPHAN)
+    { free(state); }
+} /* -- dir24_grace_done -- */
+
+/* exchange the first a and the next b entries of spare, in any order */
+static void dir24_swap_spare(uint16_t* spare, unsigned int a, unsigned int b)
+{
+    unsigned int i = 0;
+    uint16_t k = 0;
+
+    for(i = 0; i < a && i < b; i++)
+    {
+        k = spare[i];
+        spare[i] = spare[a + b - 1 - i];
+        spare[a + b - 1 - i] = k;
+    }
+} /* -- dir24_swap_spare -- */
+
+/*---------------------------------------------------------------------
+ * Method: dir24_reclaim(..)
+ * Scope:  Local
+ *
+ * Make the indices and blocks in grace free for reuse if their grace
+ * period is over; the index's copy of its route goes now too.  Then,
+ * unless a grace period is still running, put limbo in grace if enough
+ * has piled up or the caller has nothing else left (need).  Only one
+ * batch is in grace at a time, at the front of the spare arrays.
+ *
+ *---------------------------------------------------------------------*/
+
+static void dir24_reclaim(struct sr_dir24* d, int need)
+{
+    unsigned int i = 0;
+    uint16_t k = 0;
+
+    if(d->grace &&
+       __atomic_load_n(d->grace, __ATOMIC_ACQUIRE) == DIR24_GRACE_DONE)
+    {
+        for(i = 0; i < d->nh_grace; i++)
+        {
+            k = d->nh_spare[i];
+            free(d->nh[k]);
+            DIR24_SET(d->nh[k], (struct sr_rt*)0);
+        }
+        d->nh_free += d->nh_grace;
+        d->nh_grace = 0;
+        d->blk_free += d->blk_grace;
+        d->blk_grace = 0;
+        free(d->grace);
+        d->grace = 0;
+    }
+
+    if(d->grace || (d->nh_limbo == 0 && d->blk_limbo == 0))
+    { return; }
+    if(!need && d->nh_limbo < DIR24_RECLAIM && d->blk_limbo < DIR24_RECLAIM)
+    { return; }
+
+    /* -- no memory: limbo stays where it is, try again later -- */
+    d->grace = (int*)malloc(sizeof(int));
+    if(!d->grace)
+    { return; }
+    *(d->grace) = DIR24_GRACE_WAIT;
+
+    dir24_swap_spare(d->nh_spare, d->nh_free, d->nh_limbo);
+    d->nh_grace = d->nh_limbo;
+    d->nh_limbo = 0;
+    dir24_swap_spare(d->blk_spare, d->blk_free, d->blk_limbo);
+    d->blk_grace = d->blk_limbo;
+    d->blk_limbo = 0;
+
+    sr_rcu_defer(dir24_grace_done, d->grace);
+} /* -- dir24_reclaim -- */
+
+/* take a free index or block off spare, whose limbo follows the free ones */
+static uint16_t dir24_take_spare(uint16_t* spare, unsigned int* nfree,
+                                 unsigned int nlimbo)
+{
+    uint16_t k = spare[--(*nfree)];
+
+    spare[*nfree] = spare[*nfree + nlimbo];
+    return k;
+} /* -- dir24_take_spare -- */
+
+/* drop k from the hash, closing the gap so later probes still work */
+static void dir24_nh_unhash(struct sr_dir24* d, uint16_t k)
+{
+    unsigned int i = dir24_nh_hash(d->nh[k]);
+    unsigned int j = 0, h = 0;
+
+    while(d->nh_hash[i] != k)
+    { i = (i + 1) & (DIR24_HASH_SZ - 1); }
+
+    for(j = (i + 1) & (DIR24_HASH_SZ - 1); d->nh_hash[j];
+        j = (j + 1) & (DIR24_HASH_SZ - 1))
+    {
+        /* -- the entry at j may move up to i unless it hashed in (i, j] -- */
+        h = dir24_nh_hash(d->nh[d->nh_hash[j]]);
+        if((i < j) ? (h <= i || h > j) : (h <= i && h > j))
+        {
+            d->nh_hash[i] = d->nh_hash[j];
+            i = j;
+        }
+    }
+    d->nh_hash[i] = 0;
+} /* -- dir24_nh_unhash -- */
+
+/*---------------------------------------------------------------------
+ * Method: dir24_settle(..)
+ * Scope:  Local
+ *
+ * End of an update: retire the next hop indices it left without entries.
+ *
+ *---------------------------------------------------------------------*/
+
+static void dir24_settle(struct sr_dir24* d)
+{
+    unsigned int i = 0;
+    uint16_t k = 0;
+
+    for(i = 0; i < d->nh_ncheck; i++)
+    {
+        k = d->nh_check[i];
+        d->nh_ref[k] &= ~DIR24_CHECKED;
+        if(d->nh_ref[k] == 0)
+        {
+            dir24_nh_unhash(d, k);
+            d->nh_spare[d->nh_grace + d->nh_free + d->nh_limbo++] = k;
+        }
+    }
+    d->nh_ncheck = 0;
+} /* -- dir24_settle -- */
+
+/* make rt's copy next hop index k, which is unused */
+static int dir24_nh_put(struct dir24_builder* b, uint16_t k,
+                        const struct sr_rt* rt, unsigned int slot)
+{
+    struct sr_dir24* d = b->d;
+    struct sr_rt** grown = 0;
+    struct sr_rt* copy = 0;
+
+    copy = (struct sr_rt*)malloc(sizeof(struct sr_rt));
+    if(!copy)
+    {
+        b->failed = 1;
+        return -1;
+    }
+    memcpy(copy, rt, sizeof(struct sr_rt));
+    copy->next = 0;
+    copy->prev = 0;
+
+    while(k >= d->cap_nh)
+    {
+        grown = (struct sr_rt**)calloc(2 * d->cap_nh, sizeof(struct sr_rt*));
+        if(!grown)
+        {
+            free(copy);
+            b->failed = 1;
+            return -1;
+        }
+        memcpy(grown, d->nh, d->cap_nh * sizeof(struct sr_rt*));
+        sr_rcu_defer_free(d->nh);
+        DIR24_PUBLISH(d->nh, grown);
+        d->cap_nh *= 2;
+    }
+
+    DIR24_PUBLISH(d->nh[k], copy);
+    d->nh_hash[slot] = k;
+    d->nh_ref[k] = 0;
+    dir24_check(d, k);
+    return 0;
+} /* -- dir24_nh_put -- */
+
+static uint16_t dir24_nh_index(struct dir24_builder* b, struct sr_rt* rt)
+{
+    struct sr_dir24* d = b->d;
+    unsigned int i = dir24_nh_hash(rt);
+    uint16_t k = 0;
+
+    while(d->nh_hash[i])
+    {
+        if(dir24_nh_equal(d->nh[d->nh_hash[i]], rt))
+        { return d->nh_hash[i]; }
+        i = (i + 1) & (DIR24_HASH_SZ - 1);
+    }
+
+    if(d->nh_free == 0)
+    { dir24_reclaim(d, d->nnh > SR_DIR24_MAX_NH); }
+
+    if(d->nh_free > 0)
+    {
+        k = dir24_take_spare(d->nh_spare + d->nh_grace, &(d->nh_free),
+                             d->nh_limbo);
+    }
+    else if(d->nnh > SR_DIR24_MAX_NH)
+    {
+        fprintf(stderr, "DIR-24-8: more than %d distinct next hops\n",
+                SR_DIR24_MAX_NH);
+        b->failed = 1;
+        return 0;
+    }
+    else
+    { k = (uint16_t)d->nnh; }
+
+    /* -- on failure the table is given up, k does not matter -- */
+    if(dir24_nh_put(b, k, rt, i) != 0)
+    { return 0; }
+    if(k == d->nnh)
+    { d->nnh++; }
+    return k;
+} /* -- dir24_nh_index -- */
+
+static uint16_t dir24_new_block(struct dir24_builder* b, uint16_t fill)
+{
+    struct sr_dir24* d = b->d;
+    uint16_t* grown = 0;
+    uint16_t* blk = 0;
+    unsigned int cap = 0;
+    uint16_t k = 0;
+    int i = 0;
+
+    if(d->blk_free == 0)
+    { dir24_reclaim(d, d->nblocks == SR_DIR24_MAX_BLK); }
+
+    if(d->blk_free > 0)
+    {
+        k = dir24_take_spare(d->blk_spare + d->blk_grace, &(d->blk_free),
+                             d->blk_limbo);
+    }
+    else if(d->nblocks == SR_DIR24_MAX_BLK)
+    {
+        fprintf(stderr, "DIR-24-8: more than %d second level blocks\n",
+                SR_DIR24_MAX_BLK);
+        b->failed = 1;
+        return 0;
+    }
+    else
+    {
+        if(d->nblocks == d->cap_blocks)
+        {
+            cap = d->cap_blocks ? 2 * d->cap_blocks : 64;
+            grown = (uint16_t*)malloc((cap * 256 + SR_DIR24_PAD) *
+                                      sizeof(uint16_t));
+            if(!grown)
+            {
+                b->failed = 1;
+                return 0;
+            }
+            memset(grown + d->nblocks * 256, 0,
+                   ((cap - d->nblocks) * 256 + SR_DIR24_PAD) *
+                   sizeof(uint16_t));
+            if(d->tbllong)
+            {
+                memcpy(grown, d->tbllong,
+                       d->nblocks * 256 * sizeof(uint16_t));
+                if(dir24_owned(d, d->tbllong))
+                { sr_rcu_defer_free(d->tbllong); }
+            }
+            DIR24_PUBLISH(d->tbllong, grown);
+            d->cap_blocks = cap;
+        }
+        k = (uint16_t)d->nblocks++;
+    }
+
+    /* -- nothing can reach a reused block, it is not in tbl24 yet -- */
+    blk = d->tbllong + (uint32_t)k * 256;
+    for(i = 0; i < 256; i++)
+    { blk[i] = fill; }
+    dir24_ref(d, fill, 256);
+
+    return k;
+} /* -- dir24_new_block -- */
+
+/* the /24 of block k is covered whole again */
+static void dir24_free_block(struct sr_dir24* d, uint16_t k)
+{
+    const uint16_t* blk = d->tbllong + (uint32_t)k * 256;
+    int i = 0;
+
+    for(i = 0; i < 256; i++)
+    { dir24_unref(d, blk[i], 1); }
+    d->blk_spare[d->blk_grace + d->blk_free + d->blk_limbo++] = k;
+} /* -- dir24_free_block -- */
+
+/*---------------------------------------------------------------------
+ * Method: dir24_fill(..)
+ * Scope:  Local
+ *
+ * Point every address in [lo, hi) at next hop nh.  Whole /24s go in the
+ * first level; a /24 that is only partly covered gets a second level
+ * block if it does not have one yet.  A whole /24 that had a block no
+ * longer needs it and the block is retired.
+ *
+ *---------------------------------------------------------------------*/
+
+static void dir24_fill(struct dir24_builder* b, uint64_t lo, uint64_t hi,
+                       uint16_t nh)
+{
+    struct sr_dir24* d = b->d;
+    uint64_t end = 0;
+    uint32_t i = 0, j = 0;
+    uint16_t e = 0, blk = 0;
+
+    while(lo < hi && !b->failed)
+    {
+        i = (uint32_t)(lo >> 8);
+
+        if((lo & 0xff) == 0 && hi - lo >= 256)
+        {
+            /* -- only touch entries that change, pages stay untouched -- */
+            e = d->tbl24[i];
+            if(e != nh)
+            {
+                DIR24_SET(d->tbl24[i], nh);
+                dir24_ref(d, nh, 1);
+                if(e & SR_DIR24_EXT)
+                { dir24_free_block(d, e & ~SR_DIR24_EXT); }
+                else
+                { dir24_unref(d, e, 1); }
+            }
+            lo += 256;
+            continue;
+        }
+
+        e = d->tbl24[i];
+        if(e & SR_DIR24_EXT)
+        { blk = e & ~SR_DIR24_EXT; }
+        else
+        {
+            blk = dir24_new_block(b, e);
+            if(b->failed)
+            { return; }
+            DIR24_PUBLISH(d->tbl24[i], SR_DIR24_EXT | blk);
+            dir24_unref(d, e, 1);
+        }
+
+        end = ((lo >> 8) + 1) << 8;
+        if(end > hi)
+        { end = hi; }
+        for(j = (uint32_t)(lo & 0xff); lo < end; lo++, j++)
+        {
+            e = d->tbllong[((uint32_t)blk << 8) | j];
+            if(e != nh)
+            {
+                DIR24_SET(d->tbllong[((uint32_t)blk << 8) | j], nh);
+                dir24_ref(d, nh, 1);
+                dir24_unref(d, e, 1);
+            }
+        }
+    }
+} /* -- dir24_fill -- */
+
+/*---------------------------------------------------------------------
+ * Method: dir24_paint(..)
+ * Scope:  Local
+ *
+ * Paint the range [lo, hi) given the trie nodes below it (in address
+ * order) and the next hop covering it from above.  Gaps between the
+ * nodes get nh; each node is painted recursively with its own route, if
+ * any, as the new cover.  Every address is written exactly once with its
+ * final next hop, so a concurrent lookup never sees a temporary value.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint64_t dir24_node_end(const struct sr_fib_node* node)
+{
+    return (uint64_t)node->prefix + ((uint64_t)1 << (32 - node->len));
+} /* -- dir24_node_end -- */
+
+static void dir24_paint(struct dir24_builder* b,
+        const struct sr_fib_node* const* nodes, int n,
+        uint64_t lo, uint64_t hi, uint16_t nh)
+{
+    const struct sr_fib_node* node = 0;
+    uint16_t own = 0;
+    int k = 0;
+
+    for(k = 0; k < n && !b->failed; k++)
+    {
+        if(!(node = nodes[k]))
+        { continue; }
+
+        own = nh;
+        if(node->rt)
+        { own = dir24_nh_index(b, node->rt); }
+
+        dir24_fill(b, lo, node->prefix, nh);
+        dir24_paint(b, (const struct sr_fib_node* const*)node->child, 2,
+                    node->prefix, dir24_node_end(node), own);
+        lo = dir24_node_end(node);
+    }
+
+    dir24_fill(b, lo, hi, nh);
+} /* -- dir24_paint -- */
+
+/* next hop and block bookkeeping, d->cap_nh set */
+static int dir24_alloc(struct sr_dir24* d)
+{
+    d->nh = (struct sr_rt**)calloc(d->cap_nh, sizeof(struct sr_rt*));
+    d->nnh = 1;
+    d->nh_hash = (uint16_t*)calloc(DIR24_HASH_SZ, sizeof(uint16_t));
+    d->nh_ref = (uint32_t*)calloc(SR_DIR24_MAX_NH + 1, sizeof(uint32_t));
+    d->nh_spare = (uint16_t*)malloc((SR_DIR24_MAX_NH + 1) * sizeof(uint16_t));
+    d->nh_check = (uint16_t*)malloc((SR_DIR24_MAX_NH + 1) * sizeof(uint16_t));
+    d->blk_spare = (uint16_t*)malloc(SR_DIR24_MAX_BLK * sizeof(uint16_t));
+
+    return (d->nh && d->nh_hash && d->nh_ref && d->nh_spare && d->nh_check &&
+            d->blk_spare) ? 0 : -1;
+} /* -- dir24_alloc -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dir24_build(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_dir24* sr_dir24_build(const struct sr_fib* fib)
+{
+    struct dir24_builder b;
+    struct sr_dir24* d = 0;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+
+    d = (struct sr_dir24*)calloc(1, sizeof(struct sr_dir24));
+    if(!d)
+    { return 0; }
+
+    /* zeroed: every address starts out with next hop 0, no route */
+    d->tbl24 = (uint16_t*)calloc(SR_DIR24_TBL24_SZ + SR_DIR24_PAD,
+                                 sizeof(uint16_t));
+    d->cap_nh = 64;
+
+    memset(&b, 0, sizeof(b));
+    b.d = d;
+
+    if(!d->tbl24 || dir24_alloc(d) != 0)
+    { b.failed = 1; }
+
+    dir24_paint(&b, (const struct sr_fib_node* const*)&(fib->root), 1,
+                0, (uint64_t)1 << 32, 0);
+    if(!b.failed)
+    { dir24_settle(d); }
+
+    if(b.failed)
+    {
+        sr_dir24_destroy(d);
+        return 0;
+    }
+
+    return d;
+} /* -- sr_dir24_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dir24_update(..)
+ * Scope:  Global
+ *
+ * Repaint the range of prefix/len after the route for it was added,
+ * withdrawn or replaced in fib.  Only that range is touched: it gets the
+ * covering route from above and the trie nodes inside it repainted on
+ * top.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_dir24_update(struct sr_dir24* d, const struct sr_fib* fib,
+                    uint32_t prefix, uint8_t len)
+{
+    struct dir24_builder b;
+    const struct sr_fib_node* top = 0;
+    struct sr_rt* cover = 0;
+    uint16_t nh = 0;
+    uint64_t lo = 0;
+
+    /* -- REQUIRES -- */
+    assert(d);
+    assert(fib);
+    assert(len <= 32);
+
+    memset(&b, 0, sizeof(b));
+    b.d = d;
+
+    prefix &= sr_fib_len_mask(len);
+    top = sr_fib_cover(fib, prefix, len, &cover);
+    if(cover)
+    { nh = dir24_nh_index(&b, cover); }
+
+    lo = prefix;
+    dir24_paint(&b, &top, 1, lo, lo + ((uint64_t)1 << (32 - len)), nh);
+    if(b.failed)
+    { return -1; }
+
+    /* -- a cover nothing is painted with leaves an unused index too -- */
+    dir24_settle(d);
+    return 0;
+} /* -- sr_dir24_update -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_dir24_attach(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_dir24* sr_dir24_attach(void* map, size_t map_len,
+        uint16_t* tbl24, uint16_t* tbllong, unsigned int nblocks,
+        const struct sr_rt* nh, unsigned int nnh)
+{
+    struct dir24_builder b;
+    struct sr_dir24* d = 0;
+    uint8_t* in_use = 0;
+    unsigned int i = 0, j = 0, slot = 0;
+    uint16_t e = 0;
+
+    /* -- REQUIRES -- */
+    assert(map);
+    assert(tbl24);
+    assert(tbllong);
+
+    if(nnh == 0 || nnh > SR_DIR24_MAX_NH + 1 || nblocks > SR_DIR24_MAX_BLK)
+    { return 0; }
+
+    d = (struct sr_dir24*)calloc(1, sizeof(struct sr_dir24));
+    if(!d)
+    { return 0; }
+
+    d->tbl24 = tbl24;
+    d->tbllong = tbllong;
+    d->nblocks = nblocks;
+    d->cap_blocks = nblocks;
+    d->cap_nh = 64;
+    while(d->cap_nh < nnh)
+    { d->cap_nh *= 2; }
+
+    memset(&b, 0, sizeof(b));
+    b.d = d;
+    in_use = (uint8_t*)calloc(nblocks + 1, 1);
+    if(dir24_alloc(d) != 0 || !in_use)
+    { b.failed = 1; }
+    d->nnh = nnh;
+
+    /* -- distinct next hops go in at the index they had when written; a
+          slot written empty was free then -- */
+    for(i = 1; i < nnh && !b.failed; i++)
+    {
+        if(nh[i].interface[0] == 0)
+        {
+            d->nh_spare[d->nh_free++] = (uint16_t)i;
+            continue;
+        }
+        for(slot = dir24_nh_hash(&(nh[i])); d->nh_hash[slot];
+            slot = (slot + 1) & (DIR24_HASH_SZ - 1))
+        {
+            if(dir24_nh_equal(d->nh[d->nh_hash[slot]], &(nh[i])))
+            { b.failed = 1; }
+        }
+        if(!b.failed)
+        { dir24_nh_put(&b, (uint16_t)i, &(nh[i]), slot); }
+    }
+
+    /* -- count what holds each index; blocks no /24 names are spare -- */
+    for(i = 0; i < SR_DIR24_TBL24_SZ && !b.failed; i++)
+    {
+        e = tbl24[i];
+        if(e & SR_DIR24_EXT)
+        {
+            if((unsigned int)(e & ~SR_DIR24_EXT) >= nblocks)
+            { b.failed = 1; }
+            else
+            { in_use[e & ~SR_DIR24_EXT] = 1; }
+        }
+        else if(e >= nnh || (e && !d->nh[e]))
+        { b.failed = 1; }
+        else
+        { dir24_ref(d, e, 1); }
+    }
+    for(i = 0; i < nblocks && !b.failed; i++)
+    {
+        if(!in_use[i])
+        {
+            d->blk_spare[d->blk_free++] = (uint16_t)i;
+            continue;
+        }
+        for(j = 0; j < 256 && !b.failed; j++)
+        {
+            e = tbllong[i * 256 + j];
+            if(e >= nnh || (e && !d->nh[e]))
+            { b.failed = 1; }
+            else
+            { dir24_ref(d, e, 1); }
+        }
+    }
+    free(in_use);
+
+    if(b.failed)
+    {
+        d->tbl24 = 0;
+        d->tbllong = 0;
+        sr_dir24_destroy(d);
+        return 0;
+    }
+    dir24_settle(d);
+
+    d->map = map;
+    d->map_len = map_len;
+    return d;
+} /* -- sr_dir24_attach -- */
+
+void sr_dir24_destroy(struct sr_dir24* d)
+{
+    unsigned int i = 0;
+
+    if(!d)
+    { return; }
+
+    /* -- a callback still to come frees the state itself -- */
+    if(d->grace &&
+       __atomic_exchange_n(d->grace, DIR24_GRACE_ORPHAN, __ATOMIC_ACQ_REL) ==
+       DIR24_GRACE_DONE)
+    { free(d->grace); }
+
+    for(i = 1; d->nh && i < d->nnh; i++)
+    { free(d->nh[i]); }
+    if(dir24_owned(d, d->tbl24))
+    { free(d->tbl24); }
+    if(dir24_owned(d, d->tbllong))
+    { free(d->tbllong); }
+    if(d->map)
+    { munmap(d->map, d->map_len); }
+    free(d->nh);
+    free(d->nh_hash);
+    free(d->nh_ref);
+    free(d->nh_spare);
+    free(d->nh_check);
+    free(d->blk_spare);
+    free(d);
+} /* -- sr_dir24_destroy -- */
+
+size_t sr_dir24_footprint(const struct sr_dir24* d)
+{
+    if(!d)
+    { return 0; }
+
+    return sizeof(*d) +
+        (SR_DIR24_TBL24_SZ + SR_DIR24_PAD) * sizeof(uint16_t) +
+        ((size_t)d->cap_blocks * 256 + SR_DIR24_PAD) * sizeof(uint16_t) +
+        (size_t)d->cap_nh * sizeof(struct sr_rt*) +
+        (size_t)(d->nnh - d->nh_free) * sizeof(struct sr_rt) +
+        DIR24_HASH_SZ * sizeof(uint16_t) +
+        (SR_DIR24_MAX_NH + 1) * (sizeof(uint32_t) + 2 * sizeof(uint16_t)) +
+        SR_DIR24_MAX_BLK * sizeof(uint16_t);
+} /* -- sr_dir24_footprint -- */
+
+/*---------------------------------------------------------------------
+ * Burst lookup
+ *
+ * The scalar version is the reference.  The AVX2 version handles eight
+ * addresses per iteration: byte swap to host order, gather the first
+ * level entries, then gather the second level only for the lanes that
+ * point into an overflow block.
+ *
+ *---------------------------------------------------------------------*/
+
+static void dir24_lookup_burst_scalar(const struct sr_dir24* d,
+        const uint32_t* ip, uint16_t* nh, unsigned int n)
+{
+    unsigned int i = 0;
+
+    for(i = 0; i < n; i++)
+    { nh[i] = sr_dir24_lookup_nh(d, ip[i]); }
+} /* -- dir24_lookup_burst_scalar -- */
+
+#ifdef DIR24_HAVE_AVX2
+__attribute__((target("avx2")))
+static void dir24_lookup_burst_avx2(const struct sr_dir24* d,
+        const uint32_t* ip, uint16_t* nh, unsigned int n)
+{
+    const __m256i bswap = _mm256_setr_epi8(
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12,
+            3, 2, 1, 0, 7, 6, 5, 4, 11, 10, 9, 8, 15, 14, 13, 12);
+    const __m256i lo16 = _mm256_set1_epi32(0xffff);
+    const __m256i ext  = _mm256_set1_epi32(SR_DIR24_EXT);
+    const __m256i lo8  = _mm256_set1_epi32(0xff);
+    const uint16_t* tbllong = 0;
+    __m256i key, e, is_ext, idx;
+    uint32_t out[8];
+    unsigned int i = 0, j = 0;
+
+    for(i = 0; i + 8 <= n; i += 8)
+    {
+        key = _mm256_shuffle_epi8(
+                _mm256_loadu_si256((const __m256i*)(ip + i)), bswap);
+
+        e = _mm256_i32gather_epi32((const int*)d->tbl24,
+                _mm256_srli_epi32(key, 8), 2);
+        e = _mm256_and_si256(e, lo16);
+
+        is_ext = _mm256_cmpeq_epi32(_mm256_and_si256(e, ext), ext);
+        if(!_mm256_testz_si256(is_ext, is_ext))
+        {
+            /* -- block array must be read after the entries naming it -- */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            tbllong = __atomic_load_n(&(d->tbllong), __ATOMIC_ACQUIRE);
+            idx = _mm256_or_si256(
+                    _mm256_slli_epi32(_mm256_andnot_si256(ext, e), 8),
+                    _mm256_and_si256(key, lo8));
+            e = _mm256_mask_i32gather_epi32(e, (const int*)tbllong,
+                    idx, is_ext, 2);
+            e = _mm256_and_si256(e, lo16);
+        }
+
+        _mm256_storeu_si256((__m256i*)out, e);
+        for(j = 0; j < 8; j++)
+        { nh[i + j] = (uint16_t)out[j]; }
+    }
+
+    dir24_lookup_burst_scalar(d, ip + i, nh + i, n - i);
+} /* -- dir24_lookup_burst_avx2 -- */
+#endif /* DIR24_HAVE_AVX2 */
+
+typedef void (*dir24_burst_fn)(const struct sr_dir24*, const uint32_t*,
+                               uint16_t*, unsigned int);
+
+static dir24_burst_fn dir24_select_burst(void)
+{
+#ifdef DIR24_HAVE_AVX2
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx2"))
+    { return dir24_lookup_burst_avx2; }
+#endif
+    return dir24_lookup_burst_scalar;
+} /* -- dir24_select_burst -- */
+
+void sr_dir24_lookup_burst(const struct sr_dir24* d, const uint32_t* ip,
+                           uint16_t* nh, unsigned int n)
+{
+    static dir24_burst_fn burst = 0;
+
+    /* -- REQUIRES -- */
+    assert(d);
+
+    if(!burst)
+    { burst = dir24_select_burst(); }
+    burst(d, ip, nh, n);
+} /* -- sr_dir24_lookup_burst -- */
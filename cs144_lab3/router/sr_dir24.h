@@ -0,0 +1,137 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_dir24.h
+ *
+ * Description:
+ *
+ * DIR-24-8 lookup table.  A 2^24 entry first level array is indexed by the
+ * top 24 bits of the destination; prefixes longer than /24 spill into 256
+ * entry second level blocks.  Each entry is a 16 bit next hop index, or,
+ * with SR_DIR24_EXT set, the number of the second level block to look in.
+ * Most lookups are a single memory access.
+ *
+ * The table is compiled from the trie in struct sr_fib and then kept in
+ * step with it by sr_dir24_update, which only repaints the address range
+ * of the prefix that changed.  Lookups may run concurrently with an update
+ * inside RCU read sections.  Both levels carry one spare entry at the end
+ * so a 32 bit gather of the last 16 bit entry stays inside the allocation.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_DIR24_H
+#define SR_DIR24_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <stddef.h>
+#include <arpa/inet.h>
+
+struct sr_rt;
+struct sr_fib;
+
+#define SR_DIR24_TBL24_SZ (1U << 24)
+#define SR_DIR24_PAD     2        /* spare entries at the end of each level */
+#define SR_DIR24_EXT     0x8000
+#define SR_DIR24_MAX_NH  0x7fff   /* next hop 0 means no route */
+#define SR_DIR24_MAX_BLK 0x8000
+
+struct sr_dir24
+{
+    uint16_t* tbl24;        /* 1 << 24 entries */
+    uint16_t* tbllong;      /* nblocks * 256 entries */
+    unsigned int nblocks;
+    unsigned int cap_blocks;
+    struct sr_rt** nh;      /* next hop index -> private copy of a route,
+                               only gw, interface and mp are meaningful;
+                               0 for an index that is free */
+    unsigned int nnh;       /* entries used so far in nh, including slot 0 */
+    unsigned int cap_nh;
+    uint16_t* nh_hash;      /* (gw, interface, mp) -> index in nh, 0 = empty */
+    uint32_t* nh_ref;       /* entries holding each next hop index */
+    uint16_t* nh_check;     /* indices that may have lost their last entry */
+    unsigned int nh_ncheck;
+    uint16_t* nh_spare;     /* unused indices: nh_grace waiting out a */
+    unsigned int nh_grace;  /* grace period, nh_free ready for reuse, */
+    unsigned int nh_free;   /* then nh_limbo a lookup may still hold */
+    unsigned int nh_limbo;
+    uint16_t* blk_spare;    /* the same for second level blocks */
+    unsigned int blk_grace;
+    unsigned int blk_free;
+    unsigned int blk_limbo;
+    int* grace;             /* state of the grace period, 0 if none */
+    void* map;              /* image tbl24/tbllong live in, see attach */
+    size_t map_len;
+};
+
+/* Compile a table from the trie.  Returns 0 if it does not fit the 15 bit
+   next hop / block indices or memory runs out. */
+struct sr_dir24* sr_dir24_build(const struct sr_fib* fib);
+void sr_dir24_destroy(struct sr_dir24* d);
+
+/* Use tables that already exist in a mapped FIB image instead of building
+   them.  tbl24 and tbllong (nblocks blocks, both with the spare entries)
+   must lie inside map, which the table takes over and unmaps on destroy;
+   the mapping has to be writable (MAP_PRIVATE is fine) for later updates.
+   nh[1..nnh-1] give gateway and interface of each next hop index, an
+   empty interface marking a free one.  Returns 0 on failure, leaving map
+   alone. */
+struct sr_dir24* sr_dir24_attach(void* map, size_t map_len,
+        uint16_t* tbl24, uint16_t* tbllong, unsigned int nblocks,
+        const struct sr_rt* nh, unsigned int nnh);
+
+/* Bring the range covered by prefix/len (host byte order) back in line
+   with fib after the route for it changed.  Writers must be serialized
+   and outside any RCU read section: next hop indices and blocks the
+   change leaves unused are handed to sr_rcu_defer and reused once the
+   grace period has run its course.  Returns -1 if the table ran out of
+   next hop or block indices; it is then inconsistent and has to be
+   rebuilt or dropped. */
+int sr_dir24_update(struct sr_dir24* d, const struct sr_fib* fib,
+                    uint32_t prefix, uint8_t len);
+
+/* Resolve n destinations (network byte order) to next hop indices in one
+   go.  Uses AVX2 gathers when the CPU has them, so the first and second
+   level loads for eight addresses are in flight together; otherwise falls
+   back to a plain loop.  The choice is made once at runtime. */
+void sr_dir24_lookup_burst(const struct sr_dir24* d, const uint32_t* ip,
+                           uint16_t* nh, unsigned int n);
+
+/* Bytes held by the table, for reporting. */
+size_t sr_dir24_footprint(const struct sr_dir24* d);
+
+/* Longest prefix match, ip in network byte order.  Returns the next hop
+   index, 0 on miss. */
+static __inline__ uint16_t sr_dir24_lookup_nh(const struct sr_dir24* d,
+                                              uint32_t ip)
+{
+    uint32_t key = ntohl(ip);
+    uint16_t e = __atomic_load_n(&(d->tbl24[key >> 8]), __ATOMIC_ACQUIRE);
+
+    if(e & SR_DIR24_EXT)
+    {
+        e = __atomic_load_n(&(d->tbllong), __ATOMIC_ACQUIRE)
+                [((uint32_t)(e & ~SR_DIR24_EXT) << 8) | (key & 0xff)];
+    }
+    return e;
+}
+
+/* Route for a next hop index from sr_dir24_lookup_nh or the burst lookup. */
+static __inline__ struct sr_rt* sr_dir24_nh(const struct sr_dir24* d,
+                                            uint16_t nh)
+{
+    return __atomic_load_n(&(__atomic_load_n(&(d->nh), __ATOMIC_ACQUIRE)[nh]),
+                           __ATOMIC_ACQUIRE);
+}
+
+static __inline__ struct sr_rt* sr_dir24_lookup(const struct sr_dir24* d,
+                                                uint32_t ip)
+{
+    return sr_dir24_nh(d, sr_dir24_lookup_nh(d, ip));
+}
+
+#endif /* -- SR_DIR24_H -- */
@@ -0,0 +1,179 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_evloop.c
+ *
+ * Description:
+ *
+ * Single threaded event loop.  See sr_evloop.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+
+#include "sr_evloop.h"
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_timer.h"
+#include "sr_io.h"
+
+#define SR_EVLOOP_EVENTS 8
+
+/* fire the timerfd at at, ms on the sr_timer_now_ms clock */
+static void sr_evloop_arm(int tfd, uint64_t at)
+{
+    struct itimerspec its;
+
+    memset(&its, 0, sizeof(its));
+    if(at != SR_TIMER_NEVER)
+    {
+        /* -- all zero would disarm it -- */
+        its.it_value.tv_sec  = at / 1000;
+        its.it_value.tv_nsec = (long)(at % 1000) * 1000000 + 1;
+    }
+    if(timerfd_settime(tfd, TFD_TIMER_ABSTIME, &its, 0) != 0)
+    { perror("timerfd_settime"); }
+} /* -- sr_evloop_arm -- */
+
+static int sr_evloop_watch(int efd, int fd)
+{
+    struct epoll_event ev;
+
+    memset(&ev, 0, sizeof(ev));
+    ev.events = EPOLLIN;
+    ev.data.fd = fd;
+    return epoll_ctl(efd, EPOLL_CTL_ADD, fd, &ev);
+} /* -- sr_evloop_watch -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_evloop_run(..)
+ * Scope: Global
+ *
+ * After each round of events the timerfd is moved if the next ARP timer
+ * changed, which packets do when they arm a sooner one.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_evloop_run(struct sr_instance* sr)
+{
+    struct epoll_event ev[SR_EVLOOP_EVENTS];
+    struct signalfd_siginfo si;
+    sigset_t sigs;
+    uint64_t armed = SR_TIMER_NEVER;
+    uint64_t ticks = 0;
+    uint64_t rounds = 0;
+    uint64_t timer_runs = 0;
+    int efd = -1;
+    int tfd = -1;
+    int sfd = -1;
+    int ret = 1;
+    int n = 0;
+    int i = 0;
+    unsigned int p = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(sr->evloop);
+
+    /* -- signals only come in through the signalfd -- */
+    sigemptyset(&sigs);
+    sigaddset(&sigs, SIGHUP);
+    sigaddset(&sigs, SIGINT);
+    sigaddset(&sigs, SIGTERM);
+    pthread_sigmask(SIG_BLOCK, &sigs, 0);
+
+    if((efd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+       (tfd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+       (sfd = signalfd(-1, &sigs, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+       (!sr->io && sr_evloop_watch(efd, sr->sockfd) != 0) ||
+       sr_evloop_watch(efd, tfd) != 0 ||
+       sr_evloop_watch(efd, sfd) != 0)
+    {
+        perror("sr_evloop_run");
+        ret = -1;
+    }
+    /* -- or, with local interfaces, each of their ports -- */
+    for(p = 0; ret == 1 && sr->io && p < sr->io->nports; p++)
+    {
+        if(sr_evloop_watch(efd, sr->io->port[p].fd) != 0)
+        {
+            perror("sr_evloop_run");
+            ret = -1;
+        }
+    }
+
+    /* -- whatever came in with the session, and timers already due -- */
+    if(ret == 1)
+    {
+        if(!sr->io)
+        { ret = sr_read_from_server_ready(sr, 0); }
+        sr_arpcache_run_timers(sr);
+        timer_runs++;
+    }
+
+    while(ret == 1 && !sr_stopping)
+    {
+        if(sr->cache.wake_at != armed)
+        {
+            armed = sr->cache.wake_at;
+            sr_evloop_arm(tfd, armed);
+        }
+
+        if((n = epoll_wait(efd, ev, SR_EVLOOP_EVENTS, -1)) < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("epoll_wait");
+            ret = -1;
+            break;
+        }
+        rounds++;
+
+        for(i = 0; i < n && ret == 1; i++)
+        {
+            if(!sr->io && ev[i].data.fd == sr->sockfd)
+            { ret = sr_read_from_server_ready(sr, 1); }
+            else if(ev[i].data.fd == tfd)
+            {
+                if(read(tfd, &ticks, sizeof(ticks)) == sizeof(ticks))
+                {
+                    sr_arpcache_run_timers(sr);
+                    timer_runs++;
+                    armed = 0; /* -- spent, set it again -- */
+                }
+            }
+            else if(ev[i].data.fd == sfd)
+            {
+                while(read(sfd, &si, sizeof(si)) == sizeof(si))
+                {
+                    if(si.ssi_signo == SIGHUP)
+                    { sr_rt_reload(sr); }
+                    else
+                    { sr_stopping = 1; }
+                }
+            }
+            else if(sr->io)
+            { ret = sr_io_ready(sr, ev[i].data.fd); }
+        }
+    }
+
+    fprintf(stderr, "Event loop: %llu rounds, %llu timer runs\n",
+            (unsigned long long)rounds, (unsigned long long)timer_runs);
+
+    if(sfd >= 0)
+    { close(sfd); }
+    if(tfd >= 0)
+    { close(tfd); }
+    if(efd >= 0)
+    { close(efd); }
+
+    return ret < 0 ? -1 : 0;
+} /* -- sr_evloop_run -- */
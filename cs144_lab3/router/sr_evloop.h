@@ -0,0 +1,26 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_evloop.h
+ *
+ * Description:
+ *
+ * Single threaded event loop, the alternative to the main loop plus the
+ * ARP cache and routing table reload threads.  One epoll set watches the
+ * VNS socket or the ports of an I/O driver (sr_io.h), a timerfd kept at
+ * the ARP timer wheel's next expiry and a signalfd for SIGHUP (reload the
+ * routing table), SIGINT and SIGTERM (stop).  Packets, timers and
+ * reloads then never run at the same time, so the locks they share are
+ * never contended.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_EVLOOP_H
+#define SR_EVLOOP_H
+
+struct sr_instance;
+
+/* Run until the server closes the session or we are told to stop; the
+   instance must have been set up with evloop on.  Returns 0, or -1 on
+   error. */
+int sr_evloop_run(struct sr_instance* sr);
+
+#endif /* SR_EVLOOP_H */
@@ -0,0 +1,576 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.c
+ *
+ * Description:
+ *
+ * Path-compressed binary trie used for longest prefix match.  Every node
+ * stores the full prefix it represents, so a lookup only has to compare the
+ * key against each node on its way down and branch on the first bit past
+ * the node's length.  See sr_fib.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_fib.h"
+#include "sr_rcu.h"
+
+/* bit i of key, counting from the most significant bit */
+#define FIB_BIT(key, i) (((key) >> (31 - (i))) & 1)
+
+/* Readers walk the trie without locks, so every pointer that makes a node
+   or route reachable is published with a release store after the thing it
+   points at is fully set up, and read back with an acquire load. */
+#define FIB_PUBLISH(p, v) __atomic_store_n(&(p), (v), __ATOMIC_RELEASE)
+#define FIB_READ(p)       __atomic_load_n(&(p), __ATOMIC_ACQUIRE)
+
+uint32_t sr_fib_len_mask(uint8_t len)
+{
+    return len ? (0xffffffffU << (32 - len)) : 0;
+} /* -- sr_fib_len_mask -- */
+
+uint8_t sr_fib_mask_len(uint32_t mask_nbo)
+{
+    uint32_t mask = ntohl(mask_nbo);
+    uint8_t len = 0;
+
+    while(len < 32 && (mask & (0x80000000U >> len)))
+    { len++; }
+
+    return len;
+} /* -- sr_fib_mask_len -- */
+
+/* number of leading bits a and b have in common */
+static uint8_t sr_fib_common_len(uint32_t a, uint32_t b)
+{
+    uint32_t diff = a ^ b;
+
+    if(diff == 0)
+    { return 32; }
+    return (uint8_t)__builtin_clz(diff);
+} /* -- sr_fib_common_len -- */
+
+static struct sr_fib_node* sr_fib_new_node(struct sr_fib* fib,
+        uint32_t prefix, uint8_t len, struct sr_rt* rt)
+{
+    struct sr_fib_node* node = 0;
+
+    node = (struct sr_fib_node*)calloc(1, sizeof(struct sr_fib_node));
+    if(!node)
+    { return 0; }
+
+    node->prefix = prefix & sr_fib_len_mask(len);
+    node->len    = len;
+    node->rt     = rt;
+    fib->nnodes++;
+    if(rt)
+    { fib->nroutes++; }
+
+    return node;
+} /* -- sr_fib_new_node -- */
+
+static void sr_fib_free_node(struct sr_fib* fib, struct sr_fib_node* node)
+{
+    fib->nnodes--;
+    free(node);
+} /* -- sr_fib_free_node -- */
+
+/* for nodes that were reachable by readers */
+static void sr_fib_retire_node(struct sr_fib* fib, struct sr_fib_node* node)
+{
+    fib->nnodes--;
+    sr_rcu_defer_free(node);
+} /* -- sr_fib_retire_node -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_init(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_init(struct sr_fib* fib)
+{
+    /* -- REQUIRES -- */
+    assert(fib);
+
+    fib->root    = 0;
+    fib->nroutes = 0;
+    fib->nnodes  = 0;
+} /* -- sr_fib_init -- */
+
+static void sr_fib_destroy_subtree(struct sr_fib_node* node)
+{
+    if(!node)
+    { return; }
+    sr_fib_destroy_subtree(node->child[0]);
+    sr_fib_destroy_subtree(node->child[1]);
+    free(node);
+} /* -- sr_fib_destroy_subtree -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_destroy(..)
+ * Scope:  Global
+ *
+ * Frees every node.  The routes themselves are left alone.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_fib_destroy(struct sr_fib* fib)
+{
+    /* -- REQUIRES -- */
+    assert(fib);
+
+    sr_fib_destroy_subtree(fib->root);
+    sr_fib_init(fib);
+} /* -- sr_fib_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_sort(..)
+ * Scope:  Global
+ *
+ * LSD radix sort on the 40 bit key, 8 bits a pass.  Stable, so routes
+ * for the same prefix stay in the order they were given.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fib_sort(struct sr_fib_entry* e, unsigned int n)
+{
+    struct sr_fib_entry* tmp = 0;
+    struct sr_fib_entry* src = e;
+    struct sr_fib_entry* dst = 0;
+    struct sr_fib_entry* swap = 0;
+    unsigned int count[256];
+    unsigned int i = 0, sum = 0, c = 0;
+    int shift = 0;
+
+    if(n < 2)
+    { return 0; }
+
+    tmp = (struct sr_fib_entry*)malloc(n * sizeof(struct sr_fib_entry));
+    if(!tmp)
+    { return -1; }
+    dst = tmp;
+
+    for(shift = 0; shift < 40; shift += 8)
+    {
+        memset(count, 0, sizeof(count));
+        for(i = 0; i < n; i++)
+        { count[(src[i].key >> shift) & 0xff]++; }
+
+        /* -- skip passes where every key has the same digit -- */
+        if(count[(src[0].key >> shift) & 0xff] == n)
+        { continue; }
+
+        for(i = 0, sum = 0; i < 256; i++)
+        {
+            c = count[i];
+            count[i] = sum;
+            sum += c;
+        }
+        for(i = 0; i < n; i++)
+        { dst[count[(src[i].key >> shift) & 0xff]++] = src[i]; }
+
+        swap = src;
+        src = dst;
+        dst = swap;
+    }
+
+    if(src != e)
+    { memcpy(e, src, n * sizeof(struct sr_fib_entry)); }
+    free(tmp);
+
+    return 0;
+} /* -- sr_fib_sort -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_build_range(..)
+ * Scope:  Local
+ *
+ * Subtree for the sorted entries [lo, hi).  If the first entry covers
+ * all the others it becomes the root and the rest split on the bit after
+ * it; otherwise the root is an internal node at the first bit where the
+ * first and last prefixes differ.  Returns 0 with *out = 0 for an empty
+ * range, -1 on allocation failure.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_fib_build_range(struct sr_fib* fib, const struct sr_fib_entry* e,
+        unsigned int lo, unsigned int hi, struct sr_fib_node** out)
+{
+    struct sr_fib_node* node = 0;
+    uint32_t first = 0, last = 0;
+    uint8_t len = 0, common = 0;
+    unsigned int mid = 0, a = 0, b = 0;
+
+    *out = 0;
+    if(lo == hi)
+    { return 0; }
+
+    first = (uint32_t)(e[lo].key >> 8);
+    last  = (uint32_t)(e[hi - 1].key >> 8);
+    len   = (uint8_t)(e[lo].key & 0xff);
+    common = sr_fib_common_len(first, last);
+
+    if(len <= common)
+    {
+        node = sr_fib_new_node(fib, first, len, e[lo].rt);
+        lo++;
+    }
+    else
+    {
+        len = common;
+        node = sr_fib_new_node(fib, first, len, 0);
+    }
+    if(!node)
+    { return -1; }
+    *out = node;
+
+    if(lo == hi)
+    { return 0; }
+
+    /* -- first entry with bit len set -- */
+    a = lo;
+    b = hi;
+    while(a < b)
+    {
+        mid = a + (b - a) / 2;
+        if(FIB_BIT((uint32_t)(e[mid].key >> 8), len))
+        { b = mid; }
+        else
+        { a = mid + 1; }
+    }
+
+    if(sr_fib_build_range(fib, e, lo, a, &(node->child[0])) != 0 ||
+       sr_fib_build_range(fib, e, a, hi, &(node->child[1])) != 0)
+    { return -1; }
+
+    return 0;
+} /* -- sr_fib_build_range -- */
+
+int sr_fib_build(struct sr_fib* fib, const struct sr_fib_entry* e,
+                 unsigned int n)
+{
+    struct sr_fib_node* root = 0;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(fib->root == 0);
+
+    if(sr_fib_build_range(fib, e, 0, n, &root) != 0)
+    {
+        sr_fib_destroy_subtree(root);
+        sr_fib_init(fib);
+        return -1;
+    }
+
+    FIB_PUBLISH(fib->root, root);
+    return 0;
+} /* -- sr_fib_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_insert(..)
+ * Scope:  Global
+ *
+ * Walk down while the node's prefix covers the new one.  Where the key
+ * diverges from a node (or ends inside it) the node is split, either by
+ * hanging it below the new route or below a fresh internal node that has
+ * the old node and the new route as its two children.
+ *
+ * An existing route for the same prefix is left alone; sr_fib_replace
+ * swaps it.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fib_insert(struct sr_fib* fib, uint32_t prefix, uint8_t len,
+                  struct sr_rt* rt)
+{
+    struct sr_fib_node** link = 0;
+    struct sr_fib_node*  node = 0;
+    struct sr_fib_node*  fresh = 0;
+    struct sr_fib_node*  split = 0;
+    uint8_t common = 0;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(rt);
+    assert(len <= 32);
+
+    prefix &= sr_fib_len_mask(len);
+    link = &fib->root;
+
+    while((node = *link) != 0)
+    {
+        common = sr_fib_common_len(node->prefix, prefix);
+        if(common > node->len)
+        { common = node->len; }
+        if(common > len)
+        { common = len; }
+
+        if(common < node->len)
+        {
+            /* -- key leaves this node's path, split above it -- */
+            fresh = sr_fib_new_node(fib, prefix, len, rt);
+            if(!fresh)
+            { return -1; }
+
+            if(common == len)
+            {
+                fresh->child[FIB_BIT(node->prefix, len)] = node;
+                FIB_PUBLISH(*link, fresh);
+                return 0;
+            }
+
+            split = sr_fib_new_node(fib, prefix, common, 0);
+            if(!split)
+            {
+                sr_fib_free_node(fib, fresh);
+                fib->nroutes--;
+                return -1;
+            }
+            split->child[FIB_BIT(node->prefix, common)] = node;
+            split->child[FIB_BIT(prefix, common)]       = fresh;
+            FIB_PUBLISH(*link, split);
+            return 0;
+        }
+
+        if(node->len == len)
+        {
+            if(node->rt == 0)
+            {
+                FIB_PUBLISH(node->rt, rt);
+                fib->nroutes++;
+                return 0;
+            }
+            return 1;
+        }
+
+        link = &node->child[FIB_BIT(prefix, node->len)];
+    } /* -- while -- */
+
+    fresh = sr_fib_new_node(fib, prefix, len, rt);
+    if(!fresh)
+    { return -1; }
+    FIB_PUBLISH(*link, fresh);
+
+    return 0;
+} /* -- sr_fib_insert -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_find_node(..)
+ * Scope:  Local
+ *
+ * Node for exactly prefix/len, whether or not it carries a route.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_fib_node* sr_fib_find_node(const struct sr_fib* fib,
+        uint32_t prefix, uint8_t len)
+{
+    struct sr_fib_node* node = fib->root;
+
+    prefix &= sr_fib_len_mask(len);
+
+    while(node)
+    {
+        if(node->len > len ||
+           sr_fib_common_len(node->prefix, prefix) < node->len)
+        { return 0; }
+        if(node->len == len)
+        { return node; }
+        node = node->child[FIB_BIT(prefix, node->len)];
+    }
+
+    return 0;
+} /* -- sr_fib_find_node -- */
+
+struct sr_rt* sr_fib_find(const struct sr_fib* fib, uint32_t prefix,
+                          uint8_t len)
+{
+    struct sr_fib_node* node = 0;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(len <= 32);
+
+    node = sr_fib_find_node(fib, prefix, len);
+    return node ? node->rt : 0;
+} /* -- sr_fib_find -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_replace(..)
+ * Scope:  Global
+ *
+ * Swap the route for exactly prefix/len in one store, so a concurrent
+ * lookup sees either the old or the new route and never a miss.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_replace(struct sr_fib* fib, uint32_t prefix,
+                             uint8_t len, struct sr_rt* rt)
+{
+    struct sr_fib_node* node = 0;
+    struct sr_rt* old = 0;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(rt);
+    assert(len <= 32);
+
+    node = sr_fib_find_node(fib, prefix, len);
+    if(!node || !node->rt)
+    { return 0; }
+
+    old = node->rt;
+    FIB_PUBLISH(node->rt, rt);
+    return old;
+} /* -- sr_fib_replace -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_cover(..)
+ * Scope:  Global
+ *
+ * Everything the trie knows about the address range prefix/len: the
+ * topmost node lying inside the range (all other nodes in the range hang
+ * below it) and, in *cover, the most specific route strictly shorter
+ * than len that contains the range.
+ *
+ *---------------------------------------------------------------------*/
+
+const struct sr_fib_node* sr_fib_cover(const struct sr_fib* fib,
+        uint32_t prefix, uint8_t len, struct sr_rt** cover)
+{
+    const struct sr_fib_node* node = 0;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(cover);
+    assert(len <= 32);
+
+    prefix &= sr_fib_len_mask(len);
+    *cover = 0;
+
+    node = fib->root;
+    while(node)
+    {
+        if(node->len >= len)
+        {
+            if(((node->prefix ^ prefix) & sr_fib_len_mask(len)) != 0)
+            { return 0; }
+            return node;
+        }
+        if(sr_fib_common_len(node->prefix, prefix) < node->len)
+        { return 0; }
+        if(node->rt)
+        { *cover = node->rt; }
+        node = node->child[FIB_BIT(prefix, node->len)];
+    }
+
+    return 0;
+} /* -- sr_fib_cover -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_delete(..)
+ * Scope:  Global
+ *
+ * Clears the route from its node and then removes any node that no
+ * longer earns its place: a routeless node with no children is unlinked,
+ * one with a single child is replaced by that child.  At most the node
+ * and its parent need fixing up.  Unlinked nodes are freed after an RCU
+ * grace period since lookups may still be standing on them.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_delete(struct sr_fib* fib, uint32_t prefix, uint8_t len)
+{
+    struct sr_fib_node** link = 0;
+    struct sr_fib_node** parent_link = 0;
+    struct sr_fib_node*  node = 0;
+    struct sr_fib_node*  parent = 0;
+    struct sr_rt* rt = 0;
+
+    /* -- REQUIRES -- */
+    assert(fib);
+    assert(len <= 32);
+
+    prefix &= sr_fib_len_mask(len);
+    link = &fib->root;
+
+    while((node = *link) != 0)
+    {
+        if(node->len > len ||
+           sr_fib_common_len(node->prefix, prefix) < node->len)
+        { return 0; }
+        if(node->len == len)
+        { break; }
+        parent_link = link;
+        link = &node->child[FIB_BIT(prefix, node->len)];
+    }
+
+    if(!node || !node->rt)
+    { return 0; }
+
+    rt = node->rt;
+    FIB_PUBLISH(node->rt, 0);
+    fib->nroutes--;
+
+    if(node->child[0] && node->child[1])
+    { return rt; }
+
+    FIB_PUBLISH(*link, node->child[0] ? node->child[0] : node->child[1]);
+    sr_fib_retire_node(fib, node);
+
+    /* -- the parent may now be a pass-through internal node -- */
+    if(parent_link)
+    {
+        parent = *parent_link;
+        if(parent->rt == 0 && (!parent->child[0] || !parent->child[1]))
+        {
+            FIB_PUBLISH(*parent_link, parent->child[0] ? parent->child[0]
+                                                       : parent->child[1]);
+            sr_fib_retire_node(fib, parent);
+        }
+    }
+
+    return rt;
+} /* -- sr_fib_delete -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fib_lookup(..)
+ * Scope:  Global
+ *
+ * Longest prefix match for ip (network byte order).  Remembers the last
+ * route seen on the way down and stops at the first node whose prefix
+ * does not cover the key.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip)
+{
+    const struct sr_fib_node* node = 0;
+    struct sr_rt* best = 0;
+    struct sr_rt* rt = 0;
+    uint32_t key = ntohl(ip);
+
+    /* -- REQUIRES -- */
+    assert(fib);
+
+    node = FIB_READ(fib->root);
+    while(node)
+    {
+        if(((key ^ node->prefix) & sr_fib_len_mask(node->len)) != 0)
+        { break; }
+        if((rt = FIB_READ(node->rt)) != 0)
+        { best = rt; }
+        if(node->len == 32)
+        { break; }
+        node = FIB_READ(node->child[FIB_BIT(key, node->len)]);
+    }
+
+    return best;
+} /* -- sr_fib_lookup -- */
@@ -0,0 +1,114 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fib.h
+ *
+ * Description:
+ *
+ * Forwarding information base built from the routing table.  Routes are
+ * kept in a path-compressed binary (Patricia) trie keyed on the masked
+ * destination in host byte order, so a longest prefix match costs at most
+ * one node visit per prefix bit instead of a walk over every route.
+ *
+ * The trie does not own the routes it points at; they remain on the
+ * route list of the sr_rt_table it belongs to.
+ *
+ * Updates must be serialized by the caller but may run concurrently with
+ * sr_fib_lookup from other threads inside RCU read sections.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FIB_H
+#define SR_FIB_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+struct sr_rt;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib_node
+ *
+ * Node in the trie.  Internal nodes created by a split carry no route.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib_node
+{
+    uint32_t prefix;              /* host byte order, bits past len are 0 */
+    uint8_t  len;                 /* prefix length, 0..32 */
+    struct sr_rt* rt;             /* route for exactly prefix/len, or 0 */
+    struct sr_fib_node* child[2]; /* indexed by bit len of the key */
+};
+
+struct sr_fib
+{
+    struct sr_fib_node* root;
+    unsigned int nroutes;         /* nodes carrying a route */
+    unsigned int nnodes;          /* all nodes, including internal ones */
+};
+
+/* ----------------------------------------------------------------------------
+ * struct sr_fib_entry
+ *
+ * One route for bulk construction.  key is (prefix << 8) | len with the
+ * prefix in host byte order and masked to len, so sorting by key puts
+ * routes in trie preorder.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_fib_entry
+{
+    uint64_t key;
+    struct sr_rt* rt;
+};
+
+#define SR_FIB_KEY(prefix, len) (((uint64_t)(prefix) << 8) | (len))
+
+void sr_fib_init(struct sr_fib* fib);
+void sr_fib_destroy(struct sr_fib* fib);
+
+/* Stable sort by key. */
+int sr_fib_sort(struct sr_fib_entry* e, unsigned int n);
+
+/* Build the trie of an empty fib from n entries sorted by sr_fib_sort with
+   no two sharing a key, in O(n).  Returns 0, or -1 on allocation failure
+   (the fib is then left empty). */
+int sr_fib_build(struct sr_fib* fib, const struct sr_fib_entry* e,
+                 unsigned int n);
+
+/* Inserts the route under prefix/len (both host byte order).  Returns 0 if
+   the route was added, 1 if there already is a route for the prefix (it is
+   kept), -1 on allocation failure. */
+int sr_fib_insert(struct sr_fib* fib, uint32_t prefix, uint8_t len,
+                  struct sr_rt* rt);
+
+/* Removes the route for exactly prefix/len.  Returns the route that was
+   removed or 0 if there was none. */
+struct sr_rt* sr_fib_delete(struct sr_fib* fib, uint32_t prefix, uint8_t len);
+
+/* Route for exactly prefix/len, or 0. */
+struct sr_rt* sr_fib_find(const struct sr_fib* fib, uint32_t prefix,
+                          uint8_t len);
+
+/* Puts rt in place of the route for exactly prefix/len and returns the old
+   one, or returns 0 and changes nothing if there is none. */
+struct sr_rt* sr_fib_replace(struct sr_fib* fib, uint32_t prefix,
+                             uint8_t len, struct sr_rt* rt);
+
+/* Topmost node inside the range prefix/len and the route covering the
+   whole range from above; used to repaint a range after an update. */
+const struct sr_fib_node* sr_fib_cover(const struct sr_fib* fib,
+        uint32_t prefix, uint8_t len, struct sr_rt** cover);
+
+/* Longest prefix match.  ip is in network byte order.  Returns 0 on miss. */
+struct sr_rt* sr_fib_lookup(const struct sr_fib* fib, uint32_t ip);
+
+/* Helpers for converting a route's dotted mask to a prefix length. */
+uint8_t  sr_fib_mask_len(uint32_t mask_nbo);
+uint32_t sr_fib_len_mask(uint8_t len);
+
+#endif /* -- SR_FIB_H -- */
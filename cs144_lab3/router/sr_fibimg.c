@@ -0,0 +1,550 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fibimg.c
+ *
+ * Description:
+ *
+ * Writing and mapping precompiled FIB images.  See sr_fibimg.h.
+ *
+ * Layout, all in host byte order, every section starting on a page:
+ *
+ *     struct sr_fibimg_hdr
+ *     struct sr_fibimg_route   routes[nroutes]     rtable file order
+ *     uint32_t                 order[nroutes]      trie preorder
+ *     struct sr_fibimg_nh      nh[nnh]             entry 0 unused
+ *     uint16_t                 tbl24[1 << 24 + pad]
+ *     uint16_t                 tbllong[nblocks * 256 + pad]
+ *
+ * The checksum is a 64 bit FNV-1a over 32 bit words of the whole file,
+ * taken with the checksum field zero.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_fibimg.h"
+#include "sr_rt.h"
+#include "sr_fib.h"
+#include "sr_dir24.h"
+
+#define FIBIMG_MAGIC      "SRFIBIMG"
+#define FIBIMG_BYTE_ORDER 0x01020304
+#define FIBIMG_ALIGN      4096
+#define FIBIMG_MAX_ROUTES (1U << 24)   /* index has to fit the sort key */
+
+struct sr_fibimg_hdr
+{
+    char     magic[8];
+    uint32_t byte_order;
+    uint32_t version;
+    uint64_t total_len;
+    uint64_t checksum;
+    uint64_t src_size;          /* rtable file this was compiled from */
+    int64_t  src_mtime;
+    int64_t  src_mtime_ns;
+    uint32_t nroutes;
+    uint32_t nnh;
+    uint32_t nblocks;
+    uint32_t unused;
+    uint64_t off_routes;
+    uint64_t off_order;
+    uint64_t off_nh;
+    uint64_t off_tbl24;
+    uint64_t off_tbllong;
+};
+
+struct sr_fibimg_route
+{
+    uint32_t dest;              /* network byte order, as in struct sr_rt */
+    uint32_t gw;
+    uint32_t mask;
+    char     interface[sr_IFACE_NAMELEN];
+};
+
+struct sr_fibimg_nh
+{
+    uint32_t gw;
+    char     interface[sr_IFACE_NAMELEN];
+};
+
+static uint64_t fibimg_align(uint64_t off)
+{
+    return (off + FIBIMG_ALIGN - 1) & ~(uint64_t)(FIBIMG_ALIGN - 1);
+} /* -- fibimg_align -- */
+
+/* len must be a multiple of 4 */
+static uint64_t fibimg_sum(uint64_t h, const void* buf, uint64_t len)
+{
+    const unsigned char* p = (const unsigned char*)buf;
+    uint32_t w = 0;
+    uint64_t i = 0;
+
+    for(i = 0; i < len; i += 4)
+    {
+        memcpy(&w, p + i, 4);
+        h = (h ^ w) * 1099511628211ULL;
+    }
+    return h;
+} /* -- fibimg_sum -- */
+
+#define FIBIMG_SUM_INIT 14695981039346656037ULL
+
+/*---------------------------------------------------------------------
+ * Writing
+ *---------------------------------------------------------------------*/
+
+struct fibimg_out
+{
+    FILE* fp;
+    uint64_t sum;
+    uint64_t off;
+    int err;
+};
+
+static void fibimg_put(struct fibimg_out* o, const void* buf, uint64_t len)
+{
+    if(o->err || len == 0)
+    { return; }
+
+    if(fwrite(buf, 1, len, o->fp) != len)
+    { o->err = 1; }
+    o->sum = fibimg_sum(o->sum, buf, len);
+    o->off += len;
+} /* -- fibimg_put -- */
+
+static void fibimg_pad(struct fibimg_out* o, uint64_t to)
+{
+    static const char zero[FIBIMG_ALIGN];
+
+    while(o->off < to && !o->err)
+    {
+        fibimg_put(o, zero, (to - o->off < FIBIMG_ALIGN) ?
+                   to - o->off : FIBIMG_ALIGN);
+    }
+} /* -- fibimg_pad -- */
+
+static int fibimg_cmp_u64(const void* a, const void* b)
+{
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+
+    return (x > y) - (x < y);
+} /* -- fibimg_cmp_u64 -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fibimg_write(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fibimg_write(const struct sr_rt_table* tbl, const char* path,
+                    const char* src)
+{
+    struct sr_fibimg_hdr hdr;
+    struct sr_fibimg_route rec;
+    struct sr_fibimg_nh nh_rec;
+    struct fibimg_out o;
+    struct stat st;
+    const struct sr_dir24* d = 0;
+    const struct sr_rt* rt_walker = 0;
+    uint64_t* keys = 0;
+    uint32_t idx = 0;
+    uint32_t prefix = 0;
+    uint8_t len = 0;
+    char tmp[512];
+    unsigned int i = 0;
+
+    /* -- REQUIRES -- */
+    assert(tbl);
+    assert(path);
+    assert(src);
+
+    d = tbl->dir24;
+    if(!d)
+    { return -1; }
+
+    if(stat(src, &st) != 0)
+    {
+        perror("stat");
+        return -1;
+    }
+
+    memset(&hdr, 0, sizeof(hdr));
+    memcpy(hdr.magic, FIBIMG_MAGIC, sizeof(hdr.magic));
+    hdr.byte_order   = FIBIMG_BYTE_ORDER;
+    hdr.version      = SR_FIBIMG_VERSION;
+    hdr.src_size     = (uint64_t)st.st_size;
+    hdr.src_mtime    = (int64_t)st.st_mtim.tv_sec;
+    hdr.src_mtime_ns = (int64_t)st.st_mtim.tv_nsec;
+    hdr.nnh          = d->nnh;
+    hdr.nblocks      = d->nblocks;
+
+    for(rt_walker = tbl->routes; rt_walker; rt_walker = rt_walker->next)
+    {
+        if(rt_walker->mp)
+        {
+            fprintf(stderr, "FIB image: multipath routes are not supported\n");
+            return -1;
+        }
+        hdr.nroutes++;
+    }
+    if(hdr.nroutes >= FIBIMG_MAX_ROUTES)
+    {
+        fprintf(stderr, "FIB image: too many routes\n");
+        return -1;
+    }
+
+    hdr.off_routes  = fibimg_align(sizeof(hdr));
+    hdr.off_order   = fibimg_align(hdr.off_routes +
+                        (uint64_t)hdr.nroutes * sizeof(struct sr_fibimg_route));
+    hdr.off_nh      = fibimg_align(hdr.off_order +
+                        (uint64_t)hdr.nroutes * sizeof(uint32_t));
+    hdr.off_tbl24   = fibimg_align(hdr.off_nh +
+                        (uint64_t)hdr.nnh * sizeof(struct sr_fibimg_nh));
+    hdr.off_tbllong = fibimg_align(hdr.off_tbl24 +
+                        (SR_DIR24_TBL24_SZ + SR_DIR24_PAD) * sizeof(uint16_t));
+    hdr.total_len   = fibimg_align(hdr.off_tbllong +
+                        ((uint64_t)hdr.nblocks * 256 + SR_DIR24_PAD) *
+                        sizeof(uint16_t));
+
+    /* -- trie preorder is the order of (prefix, len), ties impossible -- */
+    keys = (uint64_t*)malloc((hdr.nroutes + 1) * sizeof(uint64_t));
+    if(!keys)
+    { return -1; }
+    for(rt_walker = tbl->routes, idx = 0; rt_walker;
+        rt_walker = rt_walker->next, idx++)
+    {
+        len = sr_fib_mask_len(rt_walker->mask.s_addr);
+        prefix = ntohl(rt_walker->dest.s_addr) & sr_fib_len_mask(len);
+        keys[idx] = (SR_FIB_KEY(prefix, len) << 24) | idx;
+    }
+    qsort(keys, hdr.nroutes, sizeof(uint64_t), fibimg_cmp_u64);
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+    memset(&o, 0, sizeof(o));
+    o.fp = fopen(tmp, "wb");
+    if(!o.fp)
+    {
+        perror("fopen");
+        free(keys);
+        return -1;
+    }
+    o.sum = FIBIMG_SUM_INIT;
+
+    fibimg_put(&o, &hdr, sizeof(hdr));
+
+    fibimg_pad(&o, hdr.off_routes);
+    for(rt_walker = tbl->routes; rt_walker; rt_walker = rt_walker->next)
+    {
+        memset(&rec, 0, sizeof(rec));
+        rec.dest = rt_walker->dest.s_addr;
+        rec.gw   = rt_walker->gw.s_addr;
+        rec.mask = rt_walker->mask.s_addr;
+        strncpy(rec.interface, rt_walker->interface, sr_IFACE_NAMELEN - 1);
+        fibimg_put(&o, &rec, sizeof(rec));
+    }
+
+    fibimg_pad(&o, hdr.off_order);
+    for(i = 0; i < hdr.nroutes; i++)
+    {
+        idx = (uint32_t)(keys[i] & (FIBIMG_MAX_ROUTES - 1));
+        fibimg_put(&o, &idx, sizeof(idx));
+    }
+    free(keys);
+
+    fibimg_pad(&o, hdr.off_nh);
+    memset(&nh_rec, 0, sizeof(nh_rec));
+    fibimg_put(&o, &nh_rec, sizeof(nh_rec));
+    for(i = 1; i < d->nnh; i++)
+    {
+        /* -- a free index is written empty -- */
+        memset(&nh_rec, 0, sizeof(nh_rec));
+        if(d->nh[i])
+        {
+            nh_rec.gw = d->nh[i]->gw.s_addr;
+            strncpy(nh_rec.interface, d->nh[i]->interface,
+                    sr_IFACE_NAMELEN - 1);
+        }
+        fibimg_put(&o, &nh_rec, sizeof(nh_rec));
+    }
+
+    fibimg_pad(&o, hdr.off_tbl24);
+    fibimg_put(&o, d->tbl24,
+               (SR_DIR24_TBL24_SZ + SR_DIR24_PAD) * sizeof(uint16_t));
+
+    fibimg_pad(&o, hdr.off_tbllong);
+    fibimg_put(&o, d->tbllong,
+               ((uint64_t)d->nblocks * 256 + SR_DIR24_PAD) * sizeof(uint16_t));
+    fibimg_pad(&o, hdr.total_len);
+
+    /* -- the header was summed with checksum 0, now fill it in -- */
+    hdr.checksum = o.sum;
+    if(!o.err && (fseek(o.fp, 0, SEEK_SET) != 0 ||
+                  fwrite(&hdr, sizeof(hdr), 1, o.fp) != 1))
+    { o.err = 1; }
+    if(fclose(o.fp) != 0)
+    { o.err = 1; }
+
+    if(o.err || rename(tmp, path) != 0)
+    {
+        perror("FIB image");
+        unlink(tmp);
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_fibimg_write -- */
+
+/*---------------------------------------------------------------------
+ * Loading
+ *---------------------------------------------------------------------*/
+
+/* does [off, off + len) fit in an image of size total and start aligned */
+static int fibimg_section_ok(const struct sr_fibimg_hdr* hdr, uint64_t off,
+                             uint64_t len)
+{
+    return (off % FIBIMG_ALIGN) == 0 && off >= sizeof(*hdr) &&
+        off <= hdr->total_len && len <= hdr->total_len - off;
+} /* -- fibimg_section_ok -- */
+
+static const char* fibimg_check(const struct sr_fibimg_hdr* hdr,
+                                const char* base, uint64_t size,
+                                const char* src)
+{
+    struct sr_fibimg_hdr copy;
+    struct stat st;
+    uint64_t sum = 0;
+
+    if(size < sizeof(*hdr) ||
+       memcmp(hdr->magic, FIBIMG_MAGIC, sizeof(hdr->magic)) != 0 ||
+       hdr->byte_order != FIBIMG_BYTE_ORDER)
+    { return "not a FIB image"; }
+    if(hdr->version != SR_FIBIMG_VERSION)
+    { return "wrong version"; }
+    if(hdr->total_len != size)
+    { return "truncated"; }
+
+    if(stat(src, &st) != 0 || (uint64_t)st.st_size != hdr->src_size ||
+       (int64_t)st.st_mtim.tv_sec != hdr->src_mtime ||
+       (int64_t)st.st_mtim.tv_nsec != hdr->src_mtime_ns)
+    { return "older than the routing table file"; }
+
+    if(hdr->nroutes >= FIBIMG_MAX_ROUTES || hdr->nnh == 0 ||
+       hdr->nnh > SR_DIR24_MAX_NH + 1 || hdr->nblocks > SR_DIR24_MAX_BLK ||
+       !fibimg_section_ok(hdr, hdr->off_routes,
+            (uint64_t)hdr->nroutes * sizeof(struct sr_fibimg_route)) ||
+       !fibimg_section_ok(hdr, hdr->off_order,
+            (uint64_t)hdr->nroutes * sizeof(uint32_t)) ||
+       !fibimg_section_ok(hdr, hdr->off_nh,
+            (uint64_t)hdr->nnh * sizeof(struct sr_fibimg_nh)) ||
+       !fibimg_section_ok(hdr, hdr->off_tbl24,
+            (SR_DIR24_TBL24_SZ + SR_DIR24_PAD) * sizeof(uint16_t)) ||
+       !fibimg_section_ok(hdr, hdr->off_tbllong,
+            ((uint64_t)hdr->nblocks * 256 + SR_DIR24_PAD) * sizeof(uint16_t)))
+    { return "bad layout"; }
+
+    memcpy(&copy, hdr, sizeof(copy));
+    copy.checksum = 0;
+    sum = fibimg_sum(FIBIMG_SUM_INIT, &copy, sizeof(copy));
+    sum = fibimg_sum(sum, base + sizeof(copy), size - sizeof(copy));
+    if(sum != hdr->checksum)
+    { return "bad checksum"; }
+
+    return 0;
+} /* -- fibimg_check -- */
+
+/*---------------------------------------------------------------------
+ * Method: fibimg_attach(..)
+ * Scope:  Local
+ *
+ * Rebuild the trie over the routes in rts (already filled from the
+ * records) in the image's preorder and attach the DIR-24-8 arrays.
+ * Returns 0, 1 if the image contents do not hang together, -1 if out
+ * of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+static int fibimg_attach(struct sr_rt_table* tbl, char* base, uint64_t size,
+                         struct sr_rt** rts)
+{
+    const struct sr_fibimg_hdr* hdr = (const struct sr_fibimg_hdr*)base;
+    const struct sr_fibimg_nh* nh_rec = 0;
+    const uint32_t* order = 0;
+    struct sr_fib_entry* e = 0;
+    struct sr_rt* nh = 0;
+    struct sr_dir24* d = 0;
+    uint32_t prefix = 0;
+    uint8_t len = 0;
+    unsigned int i = 0, n = hdr->nroutes;
+    int ret = 0;
+
+    order  = (const uint32_t*)(base + hdr->off_order);
+    nh_rec = (const struct sr_fibimg_nh*)(base + hdr->off_nh);
+
+    e  = (struct sr_fib_entry*)malloc((n + 1) * sizeof(struct sr_fib_entry));
+    nh = (struct sr_rt*)calloc(hdr->nnh, sizeof(struct sr_rt));
+    if(!e || !nh)
+    { ret = -1; }
+
+    /* -- sr_fib_build wants strictly increasing keys -- */
+    for(i = 0; i < n && ret == 0; i++)
+    {
+        if(order[i] >= n)
+        {
+            ret = 1;
+            break;
+        }
+        len = sr_fib_mask_len(rts[order[i]]->mask.s_addr);
+        prefix = ntohl(rts[order[i]]->dest.s_addr) & sr_fib_len_mask(len);
+        e[i].key = SR_FIB_KEY(prefix, len);
+        e[i].rt  = rts[order[i]];
+        if(i > 0 && e[i].key <= e[i - 1].key)
+        { ret = 1; }
+    }
+
+    for(i = 1; i < hdr->nnh && ret == 0; i++)
+    {
+        nh[i].gw.s_addr = nh_rec[i].gw;
+        memcpy(nh[i].interface, nh_rec[i].interface, sr_IFACE_NAMELEN);
+        nh[i].interface[sr_IFACE_NAMELEN - 1] = 0;
+    }
+
+    if(ret == 0 && sr_fib_build(&(tbl->fib), e, n) != 0)
+    { ret = -1; }
+
+    if(ret == 0)
+    {
+        d = sr_dir24_attach(base, size,
+                            (uint16_t*)(base + hdr->off_tbl24),
+                            (uint16_t*)(base + hdr->off_tbllong),
+                            hdr->nblocks, nh, hdr->nnh);
+        if(!d)
+        {
+            sr_fib_destroy(&(tbl->fib));
+            ret = 1;
+        }
+    }
+
+    if(ret == 0)
+    {
+        for(i = 0; i < n; i++)
+        {
+            rts[i]->prev = tbl->tail;
+            if(tbl->tail)
+            { tbl->tail->next = rts[i]; }
+            else
+            { tbl->routes = rts[i]; }
+            tbl->tail = rts[i];
+        }
+        tbl->dir24 = d;
+        tbl->gen++;
+    }
+
+    free(e);
+    free(nh);
+
+    return ret;
+} /* -- fibimg_attach -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_fibimg_load(..)
+ * Scope:  Global
+ *
+ * Map the image privately so its pages stay shared with every other
+ * mapping until this router changes a route, check it, rebuild the route
+ * list and trie from the records and attach the DIR-24-8 arrays in place.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_fibimg_load(struct sr_rt_table* tbl, const char* path,
+                   const char* src)
+{
+    const struct sr_fibimg_hdr* hdr = 0;
+    const struct sr_fibimg_route* rec = 0;
+    struct sr_rt** rts = 0;
+    const char* why = 0;
+    struct stat st;
+    char* base = 0;
+    unsigned int i = 0, n = 0;
+    int fd = -1;
+    int ret = 0;
+
+    /* -- REQUIRES -- */
+    assert(tbl);
+    assert(tbl->routes == 0);
+    assert(path);
+    assert(src);
+
+    fd = open(path, O_RDONLY);
+    if(fd < 0)
+    { return 1; }
+    if(fstat(fd, &st) != 0 || st.st_size < (off_t)sizeof(*hdr))
+    {
+        close(fd);
+        return 1;
+    }
+
+    base = (char*)mmap(0, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                       fd, 0);
+    close(fd);
+    if(base == MAP_FAILED)
+    {
+        perror("mmap");
+        return 1;
+    }
+
+    hdr = (const struct sr_fibimg_hdr*)base;
+    why = fibimg_check(hdr, base, (uint64_t)st.st_size, src);
+    if(why)
+    {
+        fprintf(stderr, "FIB image %s: %s\n", path, why);
+        munmap(base, st.st_size);
+        return 1;
+    }
+
+    n   = hdr->nroutes;
+    rec = (const struct sr_fibimg_route*)(base + hdr->off_routes);
+
+    rts = (struct sr_rt**)calloc(n + 1, sizeof(struct sr_rt*));
+    if(!rts)
+    { ret = -1; }
+
+    for(i = 0; i < n && ret == 0; i++)
+    {
+        rts[i] = (struct sr_rt*)calloc(1, sizeof(struct sr_rt));
+        if(!rts[i])
+        {
+            ret = -1;
+            break;
+        }
+        rts[i]->dest.s_addr = rec[i].dest;
+        rts[i]->gw.s_addr   = rec[i].gw;
+        rts[i]->mask.s_addr = rec[i].mask;
+        memcpy(rts[i]->interface, rec[i].interface, sr_IFACE_NAMELEN);
+        rts[i]->interface[sr_IFACE_NAMELEN - 1] = 0;
+    }
+
+    if(ret == 0)
+    { ret = fibimg_attach(tbl, base, (uint64_t)st.st_size, rts); }
+
+    if(ret != 0)
+    {
+        if(ret > 0)
+        { fprintf(stderr, "FIB image %s: bad contents\n", path); }
+        for(i = 0; rts && i < n; i++)
+        { free(rts[i]); }
+        munmap(base, st.st_size);
+    }
+    free(rts);
+
+    return ret;
+} /* -- sr_fibimg_load -- */
@@ -0,0 +1,40 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_fibimg.h
+ *
+ * Description:
+ *
+ * Precompiled FIB images.  An image holds everything needed to forward
+ * with a DIR-24-8 table: the first and second level arrays laid out
+ * exactly as in memory, the next hop table and the routes themselves (in
+ * file order, plus their trie preorder so the trie can be rebuilt without
+ * sorting).  At startup the image is mapped instead of parsing the rtable
+ * file and painting the table; the big arrays are used in place, so
+ * several routers on one host share the same page cache pages until one
+ * of them changes a route.
+ *
+ * An image is tied to the rtable file it was compiled from by that file's
+ * size and modification time, and carries a version and a checksum; if
+ * anything does not match the caller falls back to the text file.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_FIBIMG_H
+#define SR_FIBIMG_H
+
+#define SR_FIBIMG_VERSION 2
+
+struct sr_rt_table;
+
+/* Write tbl, which must have a DIR-24-8 table and no multipath routes, to
+   path.  src is the rtable file tbl was loaded from.  The image is written to a temporary file and
+   renamed into place.  Returns 0 or -1. */
+int sr_fibimg_write(const struct sr_rt_table* tbl, const char* path,
+                    const char* src);
+
+/* Fill the empty table tbl from the image at path.  Returns 0 on success,
+   1 if the image is missing, stale with respect to src or damaged, -1 if
+   memory ran out. */
+int sr_fibimg_load(struct sr_rt_table* tbl, const char* path,
+                   const char* src);
+
+#endif /* -- SR_FIBIMG_H -- */
@@ -0,0 +1,198 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmp.c
+ *
+ * Description:
+ *
+ * ICMP messages the router sends on its own.  See sr_icmp.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_icmp.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_router.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_output(..)
+ * Scope:  Local
+ *
+ * Route frame, an ICMP message whose IP header has everything but the
+ * source address and checksum, back towards ip_dst and send it.  src is
+ * the source address to put in, 0 for the address of the interface the
+ * message leaves by.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_icmp_output(struct sr_instance* sr, uint8_t* frame,
+                          unsigned int len, uint32_t src)
+{
+    struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)frame;
+    struct sr_ip_hdr* ip_hdr =
+        (struct sr_ip_hdr*)(frame + sizeof(struct sr_ethernet_hdr));
+    struct sr_arpentry arp_entry;
+    struct sr_arpreq* req = 0;
+    struct sr_if* iface = 0;
+    uint32_t next_hop = 0;
+    int arp_slot = 0;
+    char iface_name[sr_IFACE_NAMELEN];
+
+    if(!sr_next_hop_ip_and_iface(sr, ip_hdr->ip_dst, &next_hop, iface_name) ||
+       (iface = sr_get_interface(sr, iface_name)) == 0)
+    { return -1; }
+
+    ip_hdr->ip_src = src ? src : iface->ip;
+    ip_hdr->ip_sum = 0;
+    ip_hdr->ip_sum = cksum(ip_hdr, ip_hdr->ip_hl * 4);
+
+    memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ethertype_ip);
+
+    arp_slot = sr_arpcache_lookup_into(&(sr->cache), next_hop, iface->index,
+                                       &arp_entry);
+    if(arp_slot)
+    {
+        sr_arpcache_touch(&(sr->cache), arp_slot - 1);
+        memcpy(e_hdr->ether_dhost, arp_entry.mac, ETHER_ADDR_LEN);
+        return sr_send_packet_if(sr, frame, len, iface);
+    }
+
+    /* -- nothing waits on a neighbour held down as failed -- */
+    if(sr_arpcache_failed(&(sr->cache), next_hop) != SR_ARPNEG_NONE)
+    { return -1; }
+
+    req = sr_arpcache_queuereq(&(sr->cache), next_hop, frame, len,
+                               iface->name);
+    if(!req)
+    { return -1; }
+    sr_handle_arpreq(sr, req);
+
+    return 0;
+} /* -- sr_icmp_output -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_send_error(..)
+ * Scope:  Global
+ *
+ * The type 3 and type 11 messages share a layout: 4 unused bytes (the
+ * next hop MTU for a fragmentation needed, which we never send), then
+ * the quote.  A port unreachable comes from the address the packet was
+ * sent to, any other error from the interface it leaves by.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_icmp_send_error(struct sr_instance* sr, const uint8_t* packet,
+                       unsigned int len, uint8_t type, uint8_t code)
+{
+    uint8_t frame[sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr) +
+                  sizeof(struct sr_icmp_t3_hdr)];
+    const struct sr_ip_hdr* orig =
+        (const struct sr_ip_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+    struct sr_ip_hdr* ip_hdr =
+        (struct sr_ip_hdr*)(frame + sizeof(struct sr_ethernet_hdr));
+    struct sr_icmp_t3_hdr* icmp_hdr =
+        (struct sr_icmp_t3_hdr*)(frame + sizeof(struct sr_ethernet_hdr) +
+                                 sizeof(struct sr_ip_hdr));
+    const struct sr_icmp_hdr* orig_icmp = 0;
+    unsigned int ip_len = 0;
+    unsigned int hl = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(packet);
+
+    if(len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr))
+    { return -1; }
+    ip_len = len - sizeof(struct sr_ethernet_hdr);
+    hl = orig->ip_hl * 4;
+
+    /* -- an error about an error could go back and forth for ever -- */
+    if(orig->ip_p == ip_protocol_icmp &&
+       ip_len >= hl + sizeof(struct sr_icmp_hdr))
+    {
+        orig_icmp = (const struct sr_icmp_hdr*)((const uint8_t*)orig + hl);
+        if(orig_icmp->icmp_type == icmp_type_unreach ||
+           orig_icmp->icmp_type == icmp_type_time_exceeded)
+        { return -1; }
+    }
+
+    memset(frame, 0, sizeof(frame));
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = sizeof(struct sr_ip_hdr) / 4;
+    ip_hdr->ip_len = htons(sizeof(struct sr_ip_hdr) +
+                           sizeof(struct sr_icmp_t3_hdr));
+    ip_hdr->ip_ttl = SR_ICMP_TTL;
+    ip_hdr->ip_p = ip_protocol_icmp;
+    ip_hdr->ip_dst = orig->ip_src;
+
+    icmp_hdr->icmp_type = type;
+    icmp_hdr->icmp_code = code;
+    memcpy(icmp_hdr->data, orig,
+           ip_len < ICMP_DATA_SIZE ? ip_len : ICMP_DATA_SIZE);
+    icmp_hdr->icmp_sum = cksum(icmp_hdr, sizeof(struct sr_icmp_t3_hdr));
+
+    return sr_icmp_output(sr, frame, sizeof(frame),
+                          (type == icmp_type_unreach &&
+                           code == icmp_code_port_unreach) ? orig->ip_dst : 0);
+} /* -- sr_icmp_send_error -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_icmp_send_echo_reply(..)
+ * Scope:  Global
+ *
+ * The reply is the request turned around in place: the data, identifier
+ * and sequence number go back as they came.  A request whose ICMP
+ * checksum does not add up is dropped.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_icmp_send_echo_reply(struct sr_instance* sr, uint8_t* packet,
+                            unsigned int len)
+{
+    struct sr_ip_hdr* ip_hdr =
+        (struct sr_ip_hdr*)(packet + sizeof(struct sr_ethernet_hdr));
+    struct sr_icmp_hdr* icmp_hdr = 0;
+    unsigned int ip_len = 0;
+    unsigned int hl = 0;
+    uint32_t src = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(packet);
+
+    if(len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_ip_hdr))
+    { return -1; }
+    ip_len = ntohs(ip_hdr->ip_len);
+    hl = ip_hdr->ip_hl * 4;
+    if(hl < sizeof(struct sr_ip_hdr) ||
+       ip_len > len - sizeof(struct sr_ethernet_hdr) ||
+       ip_len < hl + sizeof(struct sr_icmp_hdr))
+    { return -1; }
+
+    icmp_hdr = (struct sr_icmp_hdr*)((uint8_t*)ip_hdr + hl);
+    if(icmp_hdr->icmp_type != icmp_type_echo_request ||
+       cksum(icmp_hdr, ip_len - hl) != 0xffff)
+    { return -1; }
+
+    src = ip_hdr->ip_dst;
+    ip_hdr->ip_dst = ip_hdr->ip_src;
+    ip_hdr->ip_ttl = SR_ICMP_TTL;
+
+    icmp_hdr->icmp_type = icmp_type_echo_reply;
+    icmp_hdr->icmp_code = 0;
+    icmp_hdr->icmp_sum = 0;
+    icmp_hdr->icmp_sum = cksum(icmp_hdr, ip_len - hl);
+
+    return sr_icmp_output(sr, packet, sizeof(struct sr_ethernet_hdr) + ip_len,
+                          src);
+} /* -- sr_icmp_send_echo_reply -- */
@@ -0,0 +1,59 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_icmp.h
+ *
+ * Description:
+ *
+ * ICMP messages the router sends on its own: echo replies, and the errors
+ * of RFC 792 for packets it cannot deliver.  A message goes back to the
+ * sender through the routing table and the ARP cache like any packet we
+ * forward; if the next hop towards the sender is not resolved yet, the
+ * message waits on an ARP request.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_ICMP_H
+#define SR_ICMP_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+
+#define SR_ICMP_TTL 64
+
+struct sr_instance;
+
+enum sr_icmp_type {
+    icmp_type_echo_reply = 0,
+    icmp_type_unreach = 3,
+    icmp_type_echo_request = 8,
+    icmp_type_time_exceeded = 11,
+};
+
+enum sr_icmp_unreach_code {
+    icmp_code_net_unreach = 0,
+    icmp_code_host_unreach = 1,
+    icmp_code_port_unreach = 3,
+};
+
+/* Send an error of type and code back to the source of packet, a whole
+   Ethernet frame of len bytes, quoting its IP header and the first bytes
+   of its data.  Nothing is sent about a frame too short to hold an IP
+   header or about another ICMP error.  The caller must be inside an RCU
+   read section and must not hold the ARP cache lock.  Returns 0 if the
+   message went out or is waiting on ARP. */
+int sr_icmp_send_error(struct sr_instance* sr, const uint8_t* packet,
+                       unsigned int len, uint8_t type, uint8_t code);
+
+/* Turn the echo request in packet, a whole Ethernet frame of len bytes
+   addressed to us, into the reply and send it back.  Same conditions and
+   return as sr_icmp_send_error. */
+int sr_icmp_send_echo_reply(struct sr_instance* sr, uint8_t* packet,
+                            unsigned int len);
+
+#endif /* -- SR_ICMP_H -- */
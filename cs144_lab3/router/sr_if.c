@@ -25,30 +25,64 @@
 #include "sr_if.h"
 #include "sr_router.h"
 
+static unsigned int sr_if_name_hash(const char* name)
+{
+    unsigned int h = 2166136261U;
+    int i = 0;
+
+    for(i = 0; i < sr_IFACE_NAMELEN && name[i]; i++)
+    { h = (h ^ (unsigned char)name[i]) * 16777619U; }
+    return h & (SR_IF_HASH_SZ - 1);
+} /* -- sr_if_name_hash -- */
+
+/* give the interface just appended to the list an index */
+static void sr_if_index(struct sr_instance* sr, struct sr_if* iface)
+{
+    unsigned int i = 0;
+
+    iface->speed = 0;
+    iface->arp_tx_at = 0;      /* -- full bucket on first use -- */
+    iface->arp_tokens = 0;
+    if(sr->nifs == SR_MAX_IFACES)
+    {
+        fprintf(stderr, "Error: more than %d interfaces\n", SR_MAX_IFACES);
+        exit(1);
+    }
+
+    iface->index = (uint16_t)sr->nifs;
+    sr->if_index[sr->nifs++] = iface;
+
+    i = sr_if_name_hash(iface->name);
+    while(sr->if_hash[i])
+    { i = (i + 1) & (SR_IF_HASH_SZ - 1); }
+    sr->if_hash[i] = (uint8_t)(iface->index + 1);
+} /* -- sr_if_index -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_get_interface
  * Scope: Global
  *
  * Given an interface name return the interface record or 0 if it doesn't
- * exist.
+ * exist.  Names are hashed when interfaces are added, so this is usually
+ * a single comparison.
  *
  *---------------------------------------------------------------------*/
 
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name)
 {
     struct sr_if* if_walker = 0;
+    unsigned int i = 0;
 
     /* -- REQUIRES -- */
     assert(name);
     assert(sr);
 
-    if_walker = sr->if_list;
-
-    while(if_walker)
+    for(i = sr_if_name_hash(name); sr->if_hash[i];
+        i = (i + 1) & (SR_IF_HASH_SZ - 1))
     {
-       if(!strncmp(if_walker->name,name,sr_IFACE_NAMELEN))
+        if_walker = sr->if_index[sr->if_hash[i] - 1];
+        if(!strncmp(if_walker->name,name,sr_IFACE_NAMELEN))
         { return if_walker; }
-        if_walker = if_walker->next;
     }
 
     return 0;
@@ -77,6 +111,7 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
         assert(sr->if_list);
         sr->if_list->next = 0;
         strncpy(sr->if_list->name,name,sr_IFACE_NAMELEN);
+        sr_if_index(sr, sr->if_list);
         return;
     }
 
@@ -90,6 +125,7 @@ void sr_add_interface(struct sr_instance* sr, const char* name)
     if_walker = if_walker->next;
     strncpy(if_walker->name,name,sr_IFACE_NAMELEN);
     if_walker->next = 0;
+    sr_if_index(sr, if_walker);
 } /* -- sr_add_interface -- */ 
 
 /*--------------------------------------------------------------------- 
@@ -140,6 +176,72 @@ void sr_set_ether_ip(struct sr_instance* sr, uint32_t ip_nbo)
 
 } /* -- sr_set_ether_ip -- */
 
+/*--------------------------------------------------------------------- 
+ * Method: sr_set_ether_speed(..)
+ * Scope: Global
+ *
+ * set the link speed of the LAST interface in the interface list
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_set_ether_speed(struct sr_instance* sr, uint32_t speed)
+{
+    struct sr_if* if_walker = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr->if_list);
+    
+    if_walker = sr->if_list;
+    while(if_walker->next)
+    {if_walker = if_walker->next; }
+
+    if_walker->speed = speed;
+
+} /* -- sr_set_ether_speed -- */
+
+/*--------------------------------------------------------------------- 
+ * Method: sr_if_arp_templates(..)
+ * Scope: Global
+ *
+ * Fill in the interface's ARP request and reply frames once its
+ * addresses are known.  Everything but the target is the same for every
+ * request or reply we send out of it, so a sender copies the template
+ * and patches the target in (the destination MAC too, for a reply).
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_if_arp_templates(struct sr_if* iface)
+{
+    struct sr_ethernet_hdr* e_hdr = 0;
+    struct sr_arp_hdr* a_hdr = 0;
+
+    /* -- REQUIRES -- */
+    assert(iface);
+
+    e_hdr = (struct sr_ethernet_hdr*)iface->arp_request;
+    a_hdr = (struct sr_arp_hdr*)(iface->arp_request +
+                                 sizeof(struct sr_ethernet_hdr));
+    memset(e_hdr->ether_dhost, 0xff, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ethertype_arp);
+    a_hdr->ar_hrd = htons(arp_hrd_ethernet);
+    a_hdr->ar_pro = htons(ethertype_ip);
+    a_hdr->ar_hln = ETHER_ADDR_LEN;
+    a_hdr->ar_pln = 4;
+    a_hdr->ar_op  = htons(arp_op_request);
+    memcpy(a_hdr->ar_sha, iface->addr, ETHER_ADDR_LEN);
+    a_hdr->ar_sip = iface->ip;
+    memset(a_hdr->ar_tha, 0, ETHER_ADDR_LEN);
+    a_hdr->ar_tip = 0;
+
+    memcpy(iface->arp_reply, iface->arp_request, SR_ARP_FRAME_LEN);
+    e_hdr = (struct sr_ethernet_hdr*)iface->arp_reply;
+    a_hdr = (struct sr_arp_hdr*)(iface->arp_reply +
+                                 sizeof(struct sr_ethernet_hdr));
+    memset(e_hdr->ether_dhost, 0, ETHER_ADDR_LEN);
+    a_hdr->ar_op  = htons(arp_op_reply);
+} /* -- sr_if_arp_templates -- */
+
 /*--------------------------------------------------------------------- 
  * Method: sr_print_if_list(..)
  * Scope: Global
@@ -194,17 +296,27 @@ void sr_print_if(struct sr_if* iface)
 } /* -- sr_print_if -- */
 
 
-// check whether the destination of the ip packet is in the list
-int sr_ip_des_inlist(struct sr_instance *sr, uint32_t ip_dst) {
-    struct sr_if *interface = sr->if_list;
-    if (!interface) {
-        return 0;
-    }
-    while (interface != 0) {
-        if (ip_dst == interface) {
-            return 1;
-        }
-        interface = interface->next;
+/*---------------------------------------------------------------------
+ * Method: sr_ip_des_inlist(..)
+ * Scope: Global
+ *
+ * Whether ip_dst (network byte order) is the address of one of our
+ * interfaces, i.e. whether a packet for it is for the router itself.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_ip_des_inlist(struct sr_instance* sr, uint32_t ip_dst)
+{
+    struct sr_if* if_walker = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    for(if_walker = sr->if_list; if_walker; if_walker = if_walker->next)
+    {
+        if(if_walker->ip == ip_dst)
+        { return 1; }
     }
+
     return 0;
-}
\ No newline at end of file
+} /* -- sr_ip_des_inlist -- */
@@ -28,6 +28,10 @@
 
 struct sr_instance;
 
+/* an Ethernet frame carrying an ARP packet, all there is to one */
+#define SR_ARP_FRAME_LEN \
+    (sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr))
+
 /* ----------------------------------------------------------------------------
  * struct sr_if
  *
@@ -41,13 +45,24 @@ struct sr_if
   unsigned char addr[ETHER_ADDR_LEN];
   uint32_t ip;
   uint32_t speed;
+  uint16_t index;               /* dense, see sr_if_by_index */
+  uint64_t arp_tx_at;           /* ARP request token bucket, last refill, */
+  uint64_t arp_tokens;          /* and thousandths of a request in it */
+  uint8_t arp_request[SR_ARP_FRAME_LEN]; /* broadcast request, no target */
+  uint8_t arp_reply[SR_ARP_FRAME_LEN];   /* reply, no target */
   struct sr_if* next;
 };
 
+/* Interface with the given index; no name comparisons. */
+#define sr_if_by_index(sr, i) ((sr)->if_index[(i)])
+
 struct sr_if* sr_get_interface(struct sr_instance* sr, const char* name);
 void sr_add_interface(struct sr_instance*, const char*);
 void sr_set_ether_addr(struct sr_instance*, const unsigned char*);
 void sr_set_ether_ip(struct sr_instance*, uint32_t ip_nbo);
+void sr_set_ether_speed(struct sr_instance*, uint32_t speed);
+void sr_if_arp_templates(struct sr_if*);
+int sr_ip_des_inlist(struct sr_instance*, uint32_t ip_nbo);
 void sr_print_if_list(struct sr_instance*);
 void sr_print_if(struct sr_if*);
 
@@ -0,0 +1,377 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io.c
+ *
+ * Description:
+ *
+ * Packet I/O drivers, the parts that are the same for every driver: the
+ * interface file, polling the ports, corking.  See sr_io.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_io.h"
+#include "sr_if.h"
+#include "sr_router.h"
+
+static const struct sr_io_ops* sr_io_drivers[] =
+{ &sr_io_tap_ops, &sr_io_packet_ops, 0 };
+
+/* link speed the kernel reports for dev, in Mb/s, 0 if it does not */
+static uint32_t sr_io_dev_speed(const char* dev)
+{
+    char path[64];
+    FILE* fp = 0;
+    int speed = 0;
+
+    snprintf(path, sizeof(path), "/sys/class/net/%s/speed", dev);
+    if((fp = fopen(path, "r")) == 0)
+    { return 0; }
+    if(fscanf(fp, "%d", &speed) != 1 || speed < 0)
+    { speed = 0; }
+    fclose(fp);
+    return (uint32_t)speed;
+} /* -- sr_io_dev_speed -- */
+
+/* open the port for the interface just added to the router */
+static int sr_io_open_port(struct sr_instance* sr, struct sr_io* io,
+                           const char* dev, const unsigned char* mac)
+{
+    struct sr_io_port* port = &(io->port[io->nports]);
+    struct sr_if* iface = sr_if_by_index(sr, sr->nifs - 1);
+    unsigned char addr[ETHER_ADDR_LEN];
+
+    memset(port, 0, sizeof(*port));
+    port->ops = io->ops;
+    port->sr = sr;
+    port->iface = iface;
+    port->fd = -1;
+    strncpy(port->dev, dev, SR_IO_DEVLEN - 1);
+    pthread_mutex_init(&(port->tx_lock), 0);
+
+    if(mac)
+    { memcpy(addr, mac, ETHER_ADDR_LEN); }
+    else
+    { memset(addr, 0, ETHER_ADDR_LEN); }
+    if(io->ops->open(port, addr) != 0)
+    {
+        io->ops->close(port);
+        fprintf(stderr, "Error opening %s on %s with the %s driver\n",
+                iface->name, dev, io->ops->name);
+        return -1;
+    }
+    sr_set_ether_addr(sr, addr);
+    sr_set_ether_speed(sr, sr_io_dev_speed(dev));
+
+    io->nports++;
+    return 0;
+} /* -- sr_io_open_port -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_io_create(..)
+ * Scope: Global
+ *
+ * The interface file has a line per interface,
+ *
+ *   name  device  ip  [mac]
+ *
+ * name as the routing table uses it, the Linux interface the driver opens
+ * for it and the router's address on it.  Without a mac the driver picks
+ * one: the device's own for packet, one next to it for tap, where the
+ * device's is the kernel's.  # starts a comment.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_io* sr_io_create(struct sr_instance* sr, const char* driver,
+                           const char* path)
+{
+    struct sr_io* io = 0;
+    FILE* fp = 0;
+    char line[256];
+    char name[sr_IFACE_NAMELEN];
+    char dev[SR_IO_DEVLEN];
+    char ip_str[32];
+    char mac_str[32];
+    unsigned int m[ETHER_ADDR_LEN];
+    unsigned char mac[ETHER_ADDR_LEN];
+    struct in_addr ip;
+    int lineno = 0;
+    int n = 0;
+    int i = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(driver);
+    assert(path);
+
+    if((io = (struct sr_io*)calloc(1, sizeof(struct sr_io))) == 0)
+    { return 0; }
+    for(i = 0; sr_io_drivers[i]; i++)
+    {
+        if(strcmp(sr_io_drivers[i]->name, driver) == 0)
+        { io->ops = sr_io_drivers[i]; }
+    }
+    if(!io->ops)
+    {
+        fprintf(stderr, "Error: no I/O driver %s\n", driver);
+        free(io);
+        return 0;
+    }
+
+    if((fp = fopen(path, "r")) == 0)
+    {
+        perror(path);
+        free(io);
+        return 0;
+    }
+
+    while(fgets(line, sizeof(line), fp))
+    {
+        lineno++;
+        if(strchr(line, '#'))
+        { *strchr(line, '#') = 0; }
+        if(sscanf(line, "%31s", ip_str) != 1)
+        { continue; }
+
+        n = sscanf(line, "%31s %15s %31s %31s", name, dev, ip_str, mac_str);
+        if(n < 3 || inet_aton(ip_str, &ip) == 0 ||
+           (n == 4 && sscanf(mac_str, "%x:%x:%x:%x:%x:%x", &m[0], &m[1],
+                             &m[2], &m[3], &m[4], &m[5]) != 6))
+        {
+            fprintf(stderr, "%s:%d: expected \"name device ip [mac]\"\n",
+                    path, lineno);
+            break;
+        }
+        if(sr_get_interface(sr, name))
+        {
+            fprintf(stderr, "%s:%d: %s twice\n", path, lineno, name);
+            break;
+        }
+        for(i = 0; i < ETHER_ADDR_LEN; i++)
+        { mac[i] = (unsigned char)m[i]; }
+
+        sr_add_interface(sr, name);
+        sr_set_ether_ip(sr, ip.s_addr);
+        if(sr_io_open_port(sr, io, dev, n == 4 ? mac : 0) != 0)
+        { break; }
+    } /* -- while -- */
+
+    if(ferror(fp) || !feof(fp) || io->nports == 0)
+    {
+        if(io->nports == 0 && feof(fp))
+        { fprintf(stderr, "%s: no interfaces\n", path); }
+        fclose(fp);
+        sr_io_close(io);
+        free(io);
+        return 0;
+    }
+    fclose(fp);
+
+    printf("Opened %u interfaces with the %s driver\n",
+           io->nports, io->ops->name);
+    return io;
+} /* -- sr_io_create -- */
+
+/* handle what port has come in, corked so replies go out together */
+static int sr_io_port_input(struct sr_instance* sr, struct sr_io_port* port)
+{
+    int n = 0;
+
+    sr_tx_cork(sr);
+    n = port->ops->recv(port);
+    sr_tx_uncork(sr);
+
+    if(n < 0)
+    {
+        fprintf(stderr, "Error receiving on %s\n", port->dev);
+        return -1;
+    }
+    return 1;
+} /* -- sr_io_port_input -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_io_poll(..)
+ * Scope: Global
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_io_poll(struct sr_instance* sr, int timeout_ms)
+{
+    struct sr_io* io = sr->io;
+    struct pollfd pfd[SR_MAX_IFACES];
+    unsigned int i = 0;
+    int n = 0;
+
+    /* REQUIRES */
+    assert(io);
+
+    for(i = 0; i < io->nports; i++)
+    {
+        pfd[i].fd = io->port[i].fd;
+        pfd[i].events = POLLIN;
+        pfd[i].revents = 0;
+    }
+
+    if((n = poll(pfd, io->nports, timeout_ms)) < 0)
+    {
+        if(errno == EINTR)
+        { return 1; }
+        perror("poll");
+        return -1;
+    }
+
+    for(i = 0; i < io->nports && n > 0; i++)
+    {
+        if(pfd[i].revents == 0)
+        { continue; }
+        n--;
+        if(pfd[i].revents & (POLLERR | POLLNVAL))
+        {
+            fprintf(stderr, "Error: %s went away\n", io->port[i].dev);
+            return -1;
+        }
+        if(sr_io_port_input(sr, &(io->port[i])) < 0)
+        { return -1; }
+    }
+    return 1;
+} /* -- sr_io_poll -- */
+
+int sr_io_ready(struct sr_instance* sr, int fd)
+{
+    struct sr_io* io = sr->io;
+    unsigned int i = 0;
+
+    for(i = 0; i < io->nports; i++)
+    {
+        if(io->port[i].fd == fd)
+        { return sr_io_port_input(sr, &(io->port[i])); }
+    }
+    return 1;
+} /* -- sr_io_ready -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_io_send(..)
+ * Scope: Global
+ *
+ * Queue the frame on iface's port and, unless someone holds a cork, push
+ * it out.  The cork count is read after queueing: whoever drops the last
+ * cork flushes after taking the port lock, so it sees this frame.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_io_send(struct sr_io* io, struct sr_if* iface, const uint8_t* buf,
+               unsigned int len)
+{
+    struct sr_io_port* port = 0;
+    int ret = 0;
+
+    /* REQUIRES */
+    assert(io);
+    assert(iface);
+
+    if(iface->index >= io->nports)
+    { return -1; }
+    port = &(io->port[iface->index]);
+
+    pthread_mutex_lock(&(port->tx_lock));
+    if(port->fd < 0)
+    { ret = -1; } /* -- closed, we are shutting down -- */
+    else if((ret = port->ops->send(port, buf, len)) == 0)
+    {
+        port->tx_frames++;
+        port->tx_queued++;
+    }
+    else
+    { port->tx_drops++; }
+    if(port->tx_queued > 0 &&
+       __atomic_load_n(&(io->corked), __ATOMIC_SEQ_CST) == 0)
+    {
+        port->ops->flush(port);
+        port->tx_queued = 0;
+        port->tx_flushes++;
+    }
+    pthread_mutex_unlock(&(port->tx_lock));
+
+    return ret;
+} /* -- sr_io_send -- */
+
+void sr_io_cork(struct sr_io* io)
+{
+    __atomic_add_fetch(&(io->corked), 1, __ATOMIC_SEQ_CST);
+} /* -- sr_io_cork -- */
+
+void sr_io_uncork(struct sr_io* io)
+{
+    struct sr_io_port* port = 0;
+    unsigned int i = 0;
+
+    if(__atomic_sub_fetch(&(io->corked), 1, __ATOMIC_SEQ_CST) != 0)
+    { return; }
+
+    for(i = 0; i < io->nports; i++)
+    {
+        port = &(io->port[i]);
+        pthread_mutex_lock(&(port->tx_lock));
+        if(port->tx_queued > 0 && port->fd >= 0)
+        {
+            port->ops->flush(port);
+            port->tx_queued = 0;
+            port->tx_flushes++;
+        }
+        pthread_mutex_unlock(&(port->tx_lock));
+    }
+} /* -- sr_io_uncork -- */
+
+void sr_io_input(struct sr_io_port* port, uint8_t* buf, unsigned int len)
+{
+    port->rx_frames++;
+    sr_receive_packet(port->sr, buf, len, port->iface);
+} /* -- sr_io_input -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_io_close(..)
+ * Scope: Global
+ *
+ * Other threads may still be sending, so io stays; they find the ports
+ * closed and drop what they send.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_io_close(struct sr_io* io)
+{
+    struct sr_io_port* port = 0;
+    unsigned int i = 0;
+
+    if(!io)
+    { return; }
+
+    for(i = 0; i < io->nports; i++)
+    {
+        port = &(io->port[i]);
+        pthread_mutex_lock(&(port->tx_lock));
+        if(port->tx_queued > 0)
+        {
+            port->ops->flush(port);
+            port->tx_flushes++;
+        }
+        fprintf(stderr, "%s on %s: %llu in, %llu out in %llu flushes, "
+                "%llu dropped\n", port->iface->name, port->dev,
+                (unsigned long long)port->rx_frames,
+                (unsigned long long)port->tx_frames,
+                (unsigned long long)port->tx_flushes,
+                (unsigned long long)port->tx_drops);
+        port->ops->close(port);
+        port->fd = -1;
+        pthread_mutex_unlock(&(port->tx_lock));
+    }
+} /* -- sr_io_close -- */
@@ -0,0 +1,112 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io.h
+ *
+ * Description:
+ *
+ * Packet I/O drivers: the router attached straight to Linux interfaces
+ * instead of to the VNS server.  The interfaces come from a local file
+ * (see sr_io_create) and each is opened as a port of one driver:
+ *
+ *   tap     a TAP device, a frame per read or write
+ *   packet  an AF_PACKET socket on an existing interface (a veth end, say)
+ *           with TPACKET_V3 receive and transmit rings mapped in
+ *
+ * Received frames go to sr_receive_packet, sr_send_packet_if comes here
+ * for sending.  Any thread may send; one thread receives.  A frame sent
+ * while the router is corked (sr_tx_cork) only waits in the port until
+ * the last cork goes, so a burst goes out with one kick of the ring.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_IO_H
+#define SR_IO_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <pthread.h>
+
+#include "sr_router.h"
+
+#define SR_IO_DEVLEN 16
+
+struct sr_io_port;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_io_ops
+ *
+ * What a driver does.  open fills in the port's fd, which is polled for
+ * input.  mac comes in as the address configured for the port, all zero
+ * if none was, and the driver sets it to the address the router uses.
+ * send and flush are called with the port's tx_lock held.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_io_ops
+{
+    const char* name;
+    int  (*open)(struct sr_io_port* port, unsigned char* mac);
+    int  (*recv)(struct sr_io_port* port);   /* frames handed in, or -1 */
+    int  (*send)(struct sr_io_port* port, const uint8_t* buf,
+                 unsigned int len);           /* queue one frame */
+    int  (*flush)(struct sr_io_port* port);  /* push out what is queued */
+    void (*close)(struct sr_io_port* port);
+};
+
+struct sr_io_port
+{
+    const struct sr_io_ops* ops;
+    struct sr_instance* sr;
+    struct sr_if* iface;
+    char dev[SR_IO_DEVLEN];      /* the Linux interface */
+    int fd;
+    void* priv;                  /* the driver's */
+    pthread_mutex_t tx_lock;
+    unsigned int tx_queued;      /* frames queued, not pushed out yet */
+    uint64_t rx_frames;
+    uint64_t tx_frames;
+    uint64_t tx_flushes;
+    uint64_t tx_drops;
+};
+
+struct sr_io
+{
+    const struct sr_io_ops* ops;
+    struct sr_io_port port[SR_MAX_IFACES];  /* by interface index */
+    unsigned int nports;
+    unsigned int corked;         /* corks held, over all threads */
+};
+
+/* -- the drivers, sr_io_tap.c and sr_io_packet.c -- */
+extern const struct sr_io_ops sr_io_tap_ops;
+extern const struct sr_io_ops sr_io_packet_ops;
+
+/* Open every interface in path with the named driver, adding them to the
+   router.  Returns 0, having said why, on failure. */
+struct sr_io* sr_io_create(struct sr_instance* sr, const char* driver,
+                           const char* path);
+
+/* Wait up to timeout_ms (-1 for ever) for input and handle all of it.
+   Returns 1, or -1 on error; a signal just makes it return early. */
+int sr_io_poll(struct sr_instance* sr, int timeout_ms);
+
+/* The port whose fd is fd has input: handle it.  Returns 1 or -1. */
+int sr_io_ready(struct sr_instance* sr, int fd);
+
+int sr_io_send(struct sr_io* io, struct sr_if* iface, const uint8_t* buf,
+               unsigned int len);
+void sr_io_cork(struct sr_io* io);
+void sr_io_uncork(struct sr_io* io);
+
+/* For drivers: one frame in from port. */
+void sr_io_input(struct sr_io_port* port, uint8_t* buf, unsigned int len);
+
+/* Close all ports and print their stats. */
+void sr_io_close(struct sr_io* io);
+
+#endif /* SR_IO_H */
@@ -0,0 +1,316 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io_packet.c
+ *
+ * Description:
+ *
+ * AF_PACKET packet I/O driver.  The port is a packet socket bound to an
+ * existing interface, a veth end say, with a TPACKET_V3 receive ring and
+ * transmit ring mapped in, so neither way copies through a system call.
+ *
+ * The kernel fills receive blocks with frames and hands a block over when
+ * it is full or SR_IO_PKT_RETIRE_MS after its first frame; we handle the
+ * frames where they are and give the block back.  Sends are copied into
+ * transmit slots and go out, all queued slots at once, when the port is
+ * flushed.  By default we use the interface's own address; with another
+ * one configured the interface is put in promiscuous mode.  See sr_io.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sr_io.h"
+
+#ifdef _LINUX_
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <arpa/inet.h>
+#include <linux/if_packet.h>
+#include <linux/if_ether.h>
+
+#define SR_IO_PKT_BLOCK_SZ  (64 * 1024)
+#define SR_IO_PKT_RX_BLOCKS 32       /* 2 MB to receive into */
+#define SR_IO_PKT_FRAME_SZ  2048     /* a transmit slot, one frame */
+#define SR_IO_PKT_TX_FRAMES 512      /* 1 MB to send from */
+#define SR_IO_PKT_RETIRE_MS 1
+
+/* a slot's header: a received frame's sockaddr_ll follows it, a frame to
+   send goes right after it */
+#define SR_IO_PKT_HDR_LEN TPACKET_ALIGN(sizeof(struct tpacket3_hdr))
+
+struct sr_io_packet
+{
+    uint8_t* map;                /* receive ring, then transmit ring */
+    size_t map_sz;
+    uint8_t* rx;
+    unsigned int rx_block;       /* next block we get */
+    uint8_t* tx;
+    unsigned int tx_head;        /* next slot we fill */
+};
+
+static int sr_io_packet_ring(int fd, int opt, unsigned int blocks,
+                             unsigned int frame_sz, unsigned int retire_ms)
+{
+    struct tpacket_req3 req;
+
+    memset(&req, 0, sizeof(req));
+    req.tp_block_size = SR_IO_PKT_BLOCK_SZ;
+    req.tp_block_nr = blocks;
+    req.tp_frame_size = frame_sz;
+    req.tp_frame_nr = blocks * (SR_IO_PKT_BLOCK_SZ / frame_sz);
+    req.tp_retire_blk_tov = retire_ms;
+    return setsockopt(fd, SOL_PACKET, opt, &req, sizeof(req));
+} /* -- sr_io_packet_ring -- */
+
+static int sr_io_packet_open(struct sr_io_port* port, unsigned char* mac)
+{
+    static const unsigned char none[ETHER_ADDR_LEN];
+    struct sr_io_packet* pk = 0;
+    struct sockaddr_ll sll;
+    struct packet_mreq mr;
+    struct ifreq ifr;
+    unsigned int ifindex = 0;
+    unsigned int tx_blocks = 0;
+    int version = TPACKET_V3;
+    int one = 1;
+
+    if((ifindex = if_nametoindex(port->dev)) == 0)
+    {
+        perror(port->dev);
+        return -1;
+    }
+    if((pk = (struct sr_io_packet*)calloc(1, sizeof(*pk))) == 0)
+    { return -1; }
+    port->priv = pk;
+
+    /* -- no protocol: nothing comes in before the rings are there -- */
+    if((port->fd = socket(AF_PACKET, SOCK_RAW | SOCK_CLOEXEC, 0)) < 0)
+    {
+        perror("socket(AF_PACKET)");
+        return -1;
+    }
+
+    tx_blocks = SR_IO_PKT_TX_FRAMES * SR_IO_PKT_FRAME_SZ / SR_IO_PKT_BLOCK_SZ;
+    if(setsockopt(port->fd, SOL_PACKET, PACKET_VERSION,
+                  &version, sizeof(version)) != 0 ||
+       sr_io_packet_ring(port->fd, PACKET_RX_RING, SR_IO_PKT_RX_BLOCKS,
+                         SR_IO_PKT_FRAME_SZ, SR_IO_PKT_RETIRE_MS) != 0 ||
+       sr_io_packet_ring(port->fd, PACKET_TX_RING, tx_blocks,
+                         SR_IO_PKT_FRAME_SZ, 0) != 0)
+    {
+        perror("TPACKET_V3 rings");
+        return -1;
+    }
+#ifdef PACKET_IGNORE_OUTGOING
+    /* -- what we send is not looped back to us -- */
+    setsockopt(port->fd, SOL_PACKET, PACKET_IGNORE_OUTGOING, &one, sizeof(one));
+#endif /* PACKET_IGNORE_OUTGOING */
+
+    pk->map_sz = (size_t)(SR_IO_PKT_RX_BLOCKS + tx_blocks) * SR_IO_PKT_BLOCK_SZ;
+    pk->map = (uint8_t*)mmap(0, pk->map_sz, PROT_READ | PROT_WRITE,
+                             MAP_SHARED, port->fd, 0);
+    if(pk->map == MAP_FAILED)
+    {
+        perror("mmap(TPACKET_V3 rings)");
+        pk->map = 0;
+        return -1;
+    }
+    pk->rx = pk->map;
+    pk->tx = pk->map + (size_t)SR_IO_PKT_RX_BLOCKS * SR_IO_PKT_BLOCK_SZ;
+
+    memset(&sll, 0, sizeof(sll));
+    sll.sll_family = AF_PACKET;
+    sll.sll_protocol = htons(ETH_P_ALL);
+    sll.sll_ifindex = (int)ifindex;
+    if(bind(port->fd, (struct sockaddr*)&sll, sizeof(sll)) != 0)
+    {
+        perror(port->dev);
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    strncpy(ifr.ifr_name, port->dev, IFNAMSIZ - 1);
+    if(ioctl(port->fd, SIOCGIFHWADDR, &ifr) != 0)
+    {
+        perror(port->dev);
+        return -1;
+    }
+    if(memcmp(mac, none, ETHER_ADDR_LEN) == 0)
+    { memcpy(mac, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN); }
+    else if(memcmp(mac, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN) != 0)
+    {
+        /* -- frames to our address would not get past the device -- */
+        memset(&mr, 0, sizeof(mr));
+        mr.mr_ifindex = (int)ifindex;
+        mr.mr_type = PACKET_MR_PROMISC;
+        if(setsockopt(port->fd, SOL_PACKET, PACKET_ADD_MEMBERSHIP,
+                      &mr, sizeof(mr)) != 0)
+        {
+            perror("PACKET_MR_PROMISC");
+            return -1;
+        }
+    }
+    return 0;
+} /* -- sr_io_packet_open -- */
+
+/* hand in every frame of every block the kernel has given us */
+static int sr_io_packet_recv(struct sr_io_port* port)
+{
+    struct sr_io_packet* pk = (struct sr_io_packet*)port->priv;
+    struct tpacket_block_desc* bd = 0;
+    struct tpacket3_hdr* hdr = 0;
+    struct sockaddr_ll* sll = 0;
+    unsigned int blocks = 0;
+    unsigned int i = 0;
+    int frames = 0;
+
+    for(blocks = 0; blocks < SR_IO_PKT_RX_BLOCKS; blocks++)
+    {
+        bd = (struct tpacket_block_desc*)
+             (pk->rx + (size_t)pk->rx_block * SR_IO_PKT_BLOCK_SZ);
+        if(!(__atomic_load_n(&(bd->hdr.bh1.block_status), __ATOMIC_ACQUIRE) &
+             TP_STATUS_USER))
+        { break; }
+
+        hdr = (struct tpacket3_hdr*)
+              ((uint8_t*)bd + bd->hdr.bh1.offset_to_first_pkt);
+        for(i = 0; i < bd->hdr.bh1.num_pkts; i++)
+        {
+            sll = (struct sockaddr_ll*)((uint8_t*)hdr + SR_IO_PKT_HDR_LEN);
+            /* -- truncated frames are no use to anyone -- */
+            if(sll->sll_pkttype != PACKET_OUTGOING &&
+               hdr->tp_snaplen == hdr->tp_len &&
+               hdr->tp_snaplen >= sizeof(struct sr_ethernet_hdr))
+            {
+                sr_io_input(port, (uint8_t*)hdr + hdr->tp_mac, hdr->tp_snaplen);
+                frames++;
+            }
+            hdr = (struct tpacket3_hdr*)((uint8_t*)hdr + hdr->tp_next_offset);
+        }
+
+        __atomic_store_n(&(bd->hdr.bh1.block_status), TP_STATUS_KERNEL,
+                         __ATOMIC_RELEASE);
+        pk->rx_block = (pk->rx_block + 1) % SR_IO_PKT_RX_BLOCKS;
+    }
+    return frames;
+} /* -- sr_io_packet_recv -- */
+
+static int sr_io_packet_kick(struct sr_io_port* port, int flags)
+{
+    if(sendto(port->fd, 0, 0, flags, 0, 0) < 0 &&
+       errno != EAGAIN && errno != ENOBUFS && errno != EINTR)
+    {
+        perror("sendto(AF_PACKET)");
+        return -1;
+    }
+    return 0;
+} /* -- sr_io_packet_kick -- */
+
+static int sr_io_packet_busy(struct tpacket3_hdr* hdr)
+{
+    return (__atomic_load_n(&(hdr->tp_status), __ATOMIC_ACQUIRE) &
+            (TP_STATUS_SEND_REQUEST | TP_STATUS_SENDING)) != 0;
+} /* -- sr_io_packet_busy -- */
+
+static int sr_io_packet_send(struct sr_io_port* port, const uint8_t* buf,
+                             unsigned int len)
+{
+    struct sr_io_packet* pk = (struct sr_io_packet*)port->priv;
+    struct tpacket3_hdr* hdr = 0;
+
+    if(len > SR_IO_PKT_FRAME_SZ - SR_IO_PKT_HDR_LEN)
+    { return -1; }
+
+    hdr = (struct tpacket3_hdr*)
+          (pk->tx + (size_t)pk->tx_head * SR_IO_PKT_FRAME_SZ);
+    if(sr_io_packet_busy(hdr))
+    {
+        /* -- ring full: send what is queued and wait for it -- */
+        sr_io_packet_kick(port, 0);
+        if(sr_io_packet_busy(hdr))
+        { return -1; }
+    }
+
+    memcpy((uint8_t*)hdr + SR_IO_PKT_HDR_LEN, buf, len);
+    hdr->tp_len = len;
+    hdr->tp_snaplen = len;
+    hdr->tp_next_offset = 0;
+    __atomic_store_n(&(hdr->tp_status), TP_STATUS_SEND_REQUEST,
+                     __ATOMIC_RELEASE);
+    pk->tx_head = (pk->tx_head + 1) % SR_IO_PKT_TX_FRAMES;
+    return 0;
+} /* -- sr_io_packet_send -- */
+
+static int sr_io_packet_flush(struct sr_io_port* port)
+{
+    return sr_io_packet_kick(port, MSG_DONTWAIT);
+} /* -- sr_io_packet_flush -- */
+
+static void sr_io_packet_close(struct sr_io_port* port)
+{
+    struct sr_io_packet* pk = (struct sr_io_packet*)port->priv;
+
+    if(pk && pk->map)
+    {
+        /* -- let the slots still queued go before the ring does -- */
+        sr_io_packet_kick(port, 0);
+        munmap(pk->map, pk->map_sz);
+    }
+    if(port->fd >= 0)
+    { close(port->fd); }
+    free(pk);
+    port->priv = 0;
+} /* -- sr_io_packet_close -- */
+
+#else /* _LINUX_ */
+
+static int sr_io_packet_open(struct sr_io_port* port, unsigned char* mac)
+{
+    (void)port;
+    (void)mac;
+    fprintf(stderr, "packet: Linux only\n");
+    return -1;
+} /* -- sr_io_packet_open -- */
+
+static int sr_io_packet_recv(struct sr_io_port* port)
+{
+    (void)port;
+    return -1;
+}
+
+static int sr_io_packet_send(struct sr_io_port* port, const uint8_t* buf,
+                             unsigned int len)
+{
+    (void)port;
+    (void)buf;
+    (void)len;
+    return -1;
+}
+
+static int sr_io_packet_flush(struct sr_io_port* port)
+{
+    (void)port;
+    return -1;
+}
+
+static void sr_io_packet_close(struct sr_io_port* port)
+{ (void)port; }
+
+#endif /* _LINUX_ */
+
+const struct sr_io_ops sr_io_packet_ops =
+{
+    "packet",
+    sr_io_packet_open,
+    sr_io_packet_recv,
+    sr_io_packet_send,
+    sr_io_packet_flush,
+    sr_io_packet_close
+};
@@ -0,0 +1,167 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_io_tap.c
+ *
+ * Description:
+ *
+ * TAP packet I/O driver.  The port is a TAP device, made if it does not
+ * exist, whose other side is the kernel: frames we write it receives, and
+ * what it sends out of the device we read.  That end keeps the device's
+ * address, so unless told otherwise we use one differing from it in the
+ * last bit.  See sr_io.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sr_io.h"
+
+#ifdef _LINUX_
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <net/if.h>
+#include <linux/if_tun.h>
+
+#define SR_IO_TAP_BUF_SZ (16 * 1024)
+#define SR_IO_TAP_BURST  64       /* reads per call, so no port starves */
+
+static int sr_io_tap_open(struct sr_io_port* port, unsigned char* mac)
+{
+    static const unsigned char none[ETHER_ADDR_LEN];
+    struct ifreq ifr;
+
+    if((port->fd = open("/dev/net/tun", O_RDWR | O_NONBLOCK | O_CLOEXEC)) < 0)
+    {
+        perror("open(/dev/net/tun)");
+        return -1;
+    }
+
+    memset(&ifr, 0, sizeof(ifr));
+    ifr.ifr_flags = IFF_TAP | IFF_NO_PI;
+    strncpy(ifr.ifr_name, port->dev, IFNAMSIZ - 1);
+    if(ioctl(port->fd, TUNSETIFF, &ifr) != 0 ||
+       (memcmp(mac, none, ETHER_ADDR_LEN) == 0 &&
+        ioctl(port->fd, SIOCGIFHWADDR, &ifr) != 0))
+    {
+        perror(port->dev);
+        close(port->fd);
+        port->fd = -1;
+        return -1;
+    }
+    if(memcmp(mac, none, ETHER_ADDR_LEN) == 0)
+    {
+        memcpy(mac, ifr.ifr_hwaddr.sa_data, ETHER_ADDR_LEN);
+        mac[ETHER_ADDR_LEN - 1] ^= 1;
+    }
+
+    if((port->priv = malloc(SR_IO_TAP_BUF_SZ)) == 0)
+    {
+        close(port->fd);
+        port->fd = -1;
+        return -1;
+    }
+    return 0;
+} /* -- sr_io_tap_open -- */
+
+static int sr_io_tap_recv(struct sr_io_port* port)
+{
+    uint8_t* buf = (uint8_t*)port->priv;
+    ssize_t n = 0;
+    int frames = 0;
+
+    while(frames < SR_IO_TAP_BURST)
+    {
+        if((n = read(port->fd, buf, SR_IO_TAP_BUF_SZ)) < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            if(errno == EAGAIN || errno == EWOULDBLOCK)
+            { break; }
+            perror("read(tap)");
+            return -1;
+        }
+        if(n < (ssize_t)sizeof(struct sr_ethernet_hdr))
+        { continue; }
+        sr_io_input(port, buf, (unsigned int)n);
+        frames++;
+    }
+    return frames;
+} /* -- sr_io_tap_recv -- */
+
+static int sr_io_tap_send(struct sr_io_port* port, const uint8_t* buf,
+                          unsigned int len)
+{
+    ssize_t n = 0;
+
+    /* -- a frame a write, there is nothing to queue in -- */
+    do
+    { n = write(port->fd, buf, len); }
+    while(n < 0 && errno == EINTR);
+
+    return n == (ssize_t)len ? 0 : -1;
+} /* -- sr_io_tap_send -- */
+
+static int sr_io_tap_flush(struct sr_io_port* port)
+{
+    (void)port;
+    return 0;
+} /* -- sr_io_tap_flush -- */
+
+static void sr_io_tap_close(struct sr_io_port* port)
+{
+    if(port->fd >= 0)
+    { close(port->fd); }
+    free(port->priv);
+    port->priv = 0;
+} /* -- sr_io_tap_close -- */
+
+#else /* _LINUX_ */
+
+static int sr_io_tap_open(struct sr_io_port* port, unsigned char* mac)
+{
+    (void)port;
+    (void)mac;
+    fprintf(stderr, "tap: Linux only\n");
+    return -1;
+} /* -- sr_io_tap_open -- */
+
+static int sr_io_tap_recv(struct sr_io_port* port)
+{
+    (void)port;
+    return -1;
+}
+
+static int sr_io_tap_send(struct sr_io_port* port, const uint8_t* buf,
+                          unsigned int len)
+{
+    (void)port;
+    (void)buf;
+    (void)len;
+    return -1;
+}
+
+static int sr_io_tap_flush(struct sr_io_port* port)
+{
+    (void)port;
+    return -1;
+}
+
+static void sr_io_tap_close(struct sr_io_port* port)
+{ (void)port; }
+
+#endif /* _LINUX_ */
+
+const struct sr_io_ops sr_io_tap_ops =
+{
+    "tap",
+    sr_io_tap_open,
+    sr_io_tap_recv,
+    sr_io_tap_send,
+    sr_io_tap_flush,
+    sr_io_tap_close
+};
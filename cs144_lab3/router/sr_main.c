@@ -22,6 +22,7 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
 #include <pwd.h>
 #include <sys/types.h>
 
@@ -32,6 +33,13 @@
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_rt.h"
+#include "sr_dir24.h"
+#include "sr_rcache.h"
+#include "sr_rcu.h"
+#include "sr_adj.h"
+#include "sr_uring.h"
+#include "sr_evloop.h"
+#include "sr_io.h"
 
 extern char* optarg;
 
@@ -44,12 +52,16 @@ extern char* optarg;
 #define DEFAULT_SERVER "localhost"
 #define DEFAULT_RTABLE "rtable"
 #define DEFAULT_TOPO 0
+#define DEFAULT_IO_DRIVER "packet"
 
 static void usage(char* );
 static void sr_init_instance(struct sr_instance* );
 static void sr_destroy_instance(struct sr_instance* );
 static void sr_set_user(struct sr_instance* );
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable);
+static void sr_stop(int sig);
+
+volatile sig_atomic_t sr_stopping = 0;
 
 /*-----------------------------------------------------------------------------
  *---------------------------------------------------------------------------*/
@@ -65,11 +77,31 @@ int main(int argc, char **argv)
     unsigned int port = DEFAULT_PORT;
     unsigned int topo = DEFAULT_TOPO;
     char *logfile = 0;
+    char *fib_image = 0;
+    int fib_mode = SR_FIB_TRIE;
+    unsigned int arp_size = 0;
+    unsigned int arp_retry_ms = 0;
+    unsigned int arp_timeout_ms = 0;
+    unsigned int arp_queue_pkts = 0;
+    unsigned int arp_queue_bytes = 0;
+    int arp_drop_policy = SR_ARPREQ_DROP_TAIL;
+    unsigned int arp_hold_ms = 0;
+    unsigned int arp_max_reqs = 0;
+    unsigned int arp_tx_rate = 0;
+    unsigned int tx_batch_us = 0;
+    int use_uring = 0;
+    int evloop = 0;
+    char *ifaces = 0;
+    char *io_driver = DEFAULT_IO_DRIVER;
+    char *arp_static = 0;
+    char *arp_snapshot = 0;
     struct sr_instance sr;
+    struct sigaction sa;
+    sigset_t stop_sigs;
 
     printf("Using %s\n", VERSION_INFO);
 
-    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:")) != EOF)
+    while ((c = getopt(argc, argv, "hs:v:p:u:t:r:l:T:F:B:A:R:E:Q:M:D:H:S:P:O:L:W:Uei:d:")) != EOF)
     {
         switch (c)
         {
@@ -101,11 +133,108 @@ int main(int argc, char **argv)
             case 'T':
                 template = optarg;
                 break;
+            case 'F':
+                if(strcmp(optarg, "trie") == 0)
+                { fib_mode = SR_FIB_TRIE; }
+                else if(strcmp(optarg, "dir24") == 0)
+                { fib_mode = SR_FIB_DIR24; }
+                else
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'B':
+                fib_image = optarg;
+                break;
+            case 'A':
+                arp_size = atoi((char *) optarg);
+                break;
+            case 'R':
+                arp_retry_ms = atoi((char *) optarg);
+                break;
+            case 'E':
+                arp_timeout_ms = atoi((char *) optarg);
+                break;
+            case 'Q':
+                arp_queue_pkts = atoi((char *) optarg);
+                break;
+            case 'M':
+                arp_queue_bytes = atoi((char *) optarg);
+                break;
+            case 'D':
+                if(strcmp(optarg, "tail") == 0)
+                { arp_drop_policy = SR_ARPREQ_DROP_TAIL; }
+                else if(strcmp(optarg, "oldest") == 0)
+                { arp_drop_policy = SR_ARPREQ_DROP_OLDEST; }
+                else
+                {
+                    usage(argv[0]);
+                    exit(1);
+                }
+                break;
+            case 'H':
+                arp_hold_ms = atoi((char *) optarg);
+                break;
+            case 'S':
+                arp_static = optarg;
+                break;
+            case 'O':
+                arp_max_reqs = atoi((char *) optarg);
+                break;
+            case 'L':
+                arp_tx_rate = atoi((char *) optarg);
+                break;
+            case 'P':
+                arp_snapshot = optarg;
+                break;
+            case 'W':
+                tx_batch_us = atoi((char *) optarg);
+                break;
+            case 'U':
+                use_uring = 1;
+                break;
+            case 'e':
+                evloop = 1;
+                break;
+            case 'i':
+                ifaces = optarg;
+                break;
+            case 'd':
+                io_driver = optarg;
+                break;
         } /* switch */
     } /* -- while -- */
 
+    if(ifaces && template)
+    {
+        fprintf(stderr, "-T needs the VNS server, it does not go with -i\n");
+        exit(1);
+    }
+
     /* -- zero out sr instance -- */
     sr_init_instance(&sr);
+    sr.fib_mode = fib_mode;
+    sr.arp_size = arp_size;
+    sr.arp_retry_ms = arp_retry_ms;
+    sr.arp_timeout_ms = arp_timeout_ms;
+    sr.arp_queue_pkts = arp_queue_pkts;
+    sr.arp_queue_bytes = arp_queue_bytes;
+    sr.arp_drop_policy = arp_drop_policy;
+    sr.arp_hold_ms = arp_hold_ms;
+    sr.arp_max_reqs = arp_max_reqs;
+    sr.arp_tx_rate = arp_tx_rate;
+    sr.evloop = evloop;
+    if(arp_static)
+    { strncpy(sr.arp_static, arp_static, sizeof(sr.arp_static) - 1); }
+    if(arp_snapshot)
+    { strncpy(sr.arp_snapshot, arp_snapshot, sizeof(sr.arp_snapshot) - 1); }
+    if(fib_image)
+    {
+        /* -- the image holds a DIR-24-8 table -- */
+        strncpy(sr.rt_image, fib_image, sizeof(sr.rt_image) - 1);
+        sr.fib_mode = SR_FIB_DIR24;
+    }
 
     /* -- set up routing table from file -- */
     if(template == NULL) {
@@ -135,32 +264,94 @@ int main(int argc, char **argv)
         }
     }
 
-    Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
-    if(template)
-        Debug("Requesting topology template %s\n", template);
-    else
-        Debug("Requesting topology %d\n", topo);
-
-    /* connect to server and negotiate session */
-    if(sr_connect_to_server(&sr,port,server) == -1)
+    if(ifaces)
     {
-        return 1;
+        /* -- our own interfaces, frames go straight onto them -- */
+        if(tx_batch_us)
+        { fprintf(stderr, "-W only batches sends to the server, ignored\n"); }
+        if((sr.io = sr_io_create(&sr, io_driver, ifaces)) == 0)
+        { exit(1); }
     }
+    else
+    {
+        Debug("Client %s connecting to Server %s:%d\n", sr.user, server, port);
+        if(template)
+            Debug("Requesting topology template %s\n", template);
+        else
+            Debug("Requesting topology %d\n", topo);
 
-    if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
-        Debug("Connected to new instantiation of topology template %s\n", template);
-        sr_load_rt_wrap(&sr, "rtable.vrhost");
+        if(tx_batch_us && sr_tx_batch_init(&sr, tx_batch_us) != 0)
+        {
+            fprintf(stderr,"Error setting up send batching\n");
+            exit(1);
+        }
+
+        /* connect to server and negotiate session */
+        if(sr_connect_to_server(&sr,port,server) == -1)
+        {
+            return 1;
+        }
+
+        if(template != NULL && strcmp(rtable, "rtable.vrhost") == 0) { /* we've recv'd the rtable now, so read it in */
+            Debug("Connected to new instantiation of topology template %s\n", template);
+            sr_load_rt_wrap(&sr, "rtable.vrhost");
+        }
+        else {
+          /* Read from specified routing table */
+          sr_load_rt_wrap(&sr, rtable);
+        }
     }
-    else {
-      /* Read from specified routing table */
-      sr_load_rt_wrap(&sr, rtable);
+
+    /* -- the session is up, from here on the socket and log can go
+       through io_uring -- */
+    if(use_uring && ifaces)
+    { fprintf(stderr, "-U is for the server connection, ignored with -i\n"); }
+    else if(use_uring && evloop)
+    { fprintf(stderr, "-U does not go with -e, using blocking I/O\n"); }
+    else if(use_uring)
+    {
+        if(sr.logfile)
+        { fflush(sr.logfile); }
+        sr.uring = sr_uring_create(sr.sockfd,
+                                   sr.logfile ? fileno(sr.logfile) : -1);
+        if(!sr.uring)
+        { fprintf(stderr, "io_uring not available, using blocking I/O\n"); }
     }
 
+    /* -- SIGINT and SIGTERM stop the main loop so that we shut down
+       cleanly; they are blocked while sr_init starts its threads so that
+       only this one, waiting on the server, takes them -- */
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sr_stop;
+    sigemptyset(&(sa.sa_mask));
+    sigaction(SIGINT, &sa, 0);
+    sigaction(SIGTERM, &sa, 0);
+    sigemptyset(&stop_sigs);
+    sigaddset(&stop_sigs, SIGINT);
+    sigaddset(&stop_sigs, SIGTERM);
+    if(sr.evloop)
+    { sigaddset(&stop_sigs, SIGHUP); } /* -- stays blocked, see sr_evloop.c -- */
+    pthread_sigmask(SIG_BLOCK, &stop_sigs, 0);
+
     /* call router init (for arp subsystem etc.) */
     sr_init(&sr);
 
+    /* -- our own interfaces are known already; the server's come later,
+       with VNSHWINFO -- */
+    if(sr.io && sr_interfaces_up(&sr) != 0)
+    { exit(1); }
+
     /* -- whizbang main loop ;-) */
-    while( sr_read_from_server(&sr) == 1);
+    if(sr.evloop)
+    { sr_evloop_run(&sr); }
+    else
+    {
+        pthread_sigmask(SIG_UNBLOCK, &stop_sigs, 0);
+        if(sr.io)
+        { while( !sr_stopping && sr_io_poll(&sr, -1) == 1); }
+        else
+        { while( !sr_stopping && sr_read_from_server(&sr) == 1); }
+    }
 
     sr_destroy_instance(&sr);
 
@@ -178,7 +369,16 @@ static void usage(char* argv0)
     printf("Format: %s [-h] [-v host] [-s server] [-p port] \n",argv0);
     printf("           [-T template_name] [-u username] \n");
     printf("           [-t topo id] [-r routing table] \n");
-    printf("           [-l log file] \n");
+    printf("           [-l log file] [-F trie|dir24] [-B fib image] \n");
+    printf("           [-A arp cache entries] [-R arp retry ms] \n");
+    printf("           [-E arp entry timeout ms] [-Q arp queue packets] \n");
+    printf("           [-M arp queue bytes] [-D tail|oldest] \n");
+    printf("           [-H arp failure hold-down ms] [-S static arp file] \n");
+    printf("           [-P arp snapshot file] [-O arp requests outstanding] \n");
+    printf("           [-L arp requests/s per interface] \n");
+    printf("           [-W batch sends, holding each at most usec] \n");
+    printf("           [-U use io_uring] [-e one thread, event loop] \n");
+    printf("           [-i interface file, no server] [-d tap|packet] \n");
     printf("   defaults server=%s port=%d host=%s  \n",
             DEFAULT_SERVER, DEFAULT_PORT, DEFAULT_HOST );
 } /* -- usage -- */
@@ -208,6 +408,19 @@ void sr_set_user(struct sr_instance* sr)
 
 } /* -- sr_set_user -- */
 
+/*-----------------------------------------------------------------------------
+ * Method: sr_stop(..)
+ * Scope: local
+ *
+ * SIGINT/SIGTERM handler, ends the main loop.
+ *---------------------------------------------------------------------------*/
+
+static void sr_stop(int sig)
+{
+    (void)sig;
+    sr_stopping = 1;
+} /* -- sr_stop -- */
+
 /*-----------------------------------------------------------------------------
  * Method: sr_destroy_instance(..)
  * Scope: Local
@@ -217,14 +430,41 @@ void sr_set_user(struct sr_instance* sr)
 
 static void sr_destroy_instance(struct sr_instance* sr)
 {
+    int n = 0;
+
     /* REQUIRES */
     assert(sr);
 
+    sr_tx_batch_close(sr);
+    sr_uring_close(sr->uring);
+    sr_io_close(sr->io);
+
     if(sr->logfile)
     {
         sr_dump_close(sr->logfile);
     }
 
+    sr_rcache_print_stats(sr->rcache);
+    sr_rcache_destroy(sr->rcache);
+    sr_rt_print_path_stats(sr);
+    if(sr->arp_snapshot[0])
+    {
+        n = sr_arpcache_save(sr, sr->arp_snapshot);
+        if(n < 0)
+        { fprintf(stderr, "Error saving ARP cache to %s\n", sr->arp_snapshot); }
+        else
+        { fprintf(stderr, "Saved %d ARP entries to %s\n", n, sr->arp_snapshot); }
+    }
+    sr_arpcache_print_stats(&(sr->cache));
+    sr_rt_table_free(sr->rt);
+    sr->rt = 0;
+    sr_adj_destroy(sr->adj);
+    sr->adj = 0;
+    free(sr->rx_buf);
+    sr->rx_buf = 0;
+    free(sr->rt_burst);
+    sr->rt_burst = 0;
+
     /*
     fprintf(stderr,"sr_destroy_instance leaking memory\n");
     */
@@ -243,11 +483,39 @@ static void sr_init_instance(struct sr_instance* sr)
     assert(sr);
 
     sr->sockfd = -1;
+    sr->rx_buf = 0;
+    sr->rx_head = 0;
+    sr->rx_tail = 0;
+    sr->rt_burst = 0;
+    sr->tx = 0;
+    sr->uring = 0;
+    sr->evloop = 0;
+    sr->io = 0;
     sr->user[0] = 0;
     sr->host[0] = 0;
     sr->topo_id = 0;
     sr->if_list = 0;
-    sr->routing_table = 0;
+    sr->nifs = 0;
+    memset(sr->if_hash, 0, sizeof(sr->if_hash));
+    sr->adj = sr_adj_create();
+    assert(sr->adj);
+    sr->rt = sr_rt_table_create(1);
+    pthread_mutex_init(&(sr->rt_lock), 0);
+    sr->rt_file[0] = 0;
+    sr->rt_image[0] = 0;
+    sr->fib_mode = SR_FIB_TRIE;
+    sr->arp_size = 0;
+    sr->arp_retry_ms = 0;
+    sr->arp_timeout_ms = 0;
+    sr->arp_queue_pkts = 0;
+    sr->arp_queue_bytes = 0;
+    sr->arp_drop_policy = SR_ARPREQ_DROP_TAIL;
+    sr->arp_hold_ms = 0;
+    sr->arp_max_reqs = 0;
+    sr->arp_tx_rate = 0;
+    sr->arp_static[0] = 0;
+    sr->arp_snapshot[0] = 0;
+    sr->rcache = 0;
     sr->logfile = 0;
 } /* -- sr_init_instance -- */
 
@@ -267,20 +535,44 @@ static void sr_init_instance(struct sr_instance* sr)
  *---------------------------------------------------------------------------*/
 
 int sr_verify_routing_table(struct sr_instance* sr)
+{
+    int ret = 0;
+
+    /* -- REQUIRES --*/
+    assert(sr);
+
+    sr_rcu_read_lock();
+    ret = sr_verify_route_list(sr, sr_rt_current(sr)->routes);
+    sr_rcu_read_unlock();
+
+    return ret;
+} /* -- sr_verify_routing_table -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_verify_route_list()
+ * Scope: Global
+ *
+ * Same check for a route list that need not be published yet, e.g. a
+ * table being reloaded.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_verify_route_list(struct sr_instance* sr, struct sr_rt* routes)
 {
     struct sr_rt* rt_walker = 0;
     struct sr_if* if_walker = 0;
+    unsigned int i = 0;
     int ret = 0;
 
     /* -- REQUIRES --*/
     assert(sr);
 
-    if( (sr->if_list == 0) || (sr->routing_table == 0))
+    if( (sr->if_list == 0) || (routes == 0))
     {
         return 999; /* doh! */
     }
 
-    rt_walker = sr->routing_table;
+    rt_walker = routes;
 
     while(rt_walker)
     {
@@ -296,13 +588,22 @@ int sr_verify_routing_table(struct sr_instance* sr)
         if(if_walker == 0)
         { ret++; } /* -- interface not found! -- */
 
+        /* -- and those of any further equal-cost paths -- */
+        for(i = 1; rt_walker->mp && i < rt_walker->mp->npaths; i++)
+        {
+            if(sr_get_interface(sr, rt_walker->mp->path[i].interface) == 0)
+            { ret++; }
+        }
+
         rt_walker = rt_walker->next;
     } /* -- while -- */
 
     return ret;
-} /* -- sr_verify_routing_table -- */
+} /* -- sr_verify_route_list -- */
 
 static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
+    struct sr_rt_table* tbl = 0;
+
     if(sr_load_rt(sr, rtable) != 0) {
         fprintf(stderr,"Error setting up routing table from file %s\n",
                 rtable);
@@ -314,4 +615,20 @@ static void sr_load_rt_wrap(struct sr_instance* sr, char* rtable) {
     printf("---------------------------------------------\n");
     sr_print_routing_table(sr);
     printf("---------------------------------------------\n");
+
+    /* no other thread can publish yet, so no read section needed */
+    tbl = sr_rt_current(sr);
+    if(tbl->dir24)
+    {
+        printf("FIB: DIR-24-8, %lu KB (%u next hops, %u /24 overflow blocks)\n",
+                (unsigned long)(sr_dir24_footprint(tbl->dir24) / 1024),
+                tbl->dir24->nnh - 1, tbl->dir24->nblocks);
+    }
+    else
+    {
+        printf("FIB: trie, %lu KB (%u routes, %u nodes)\n",
+                (unsigned long)(tbl->fib.nnodes *
+                                sizeof(struct sr_fib_node) / 1024),
+                tbl->fib.nroutes, tbl->fib.nnodes);
+    }
 }
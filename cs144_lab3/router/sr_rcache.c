@@ -0,0 +1,107 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcache.c
+ *
+ * Description:
+ *
+ * Destination route cache.  See sr_rcache.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_rcache.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+
+static __inline__ unsigned int sr_rcache_slot(uint32_t ip)
+{
+    return (ip * 2654435761U) >> (32 - SR_RCACHE_BITS);
+} /* -- sr_rcache_slot -- */
+
+struct sr_rcache* sr_rcache_create(void)
+{
+    void* mem = 0;
+
+    if(posix_memalign(&mem, 64, sizeof(struct sr_rcache)) != 0)
+    { return 0; }
+    memset(mem, 0, sizeof(struct sr_rcache));
+
+    return (struct sr_rcache*)mem;
+} /* -- sr_rcache_create -- */
+
+void sr_rcache_destroy(struct sr_rcache* rc)
+{
+    free(rc);
+} /* -- sr_rcache_destroy -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcache_lookup(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rcache_entry* sr_rcache_lookup(struct sr_rcache* rc, uint32_t ip,
+                                         uint32_t rt_gen, uint32_t arp_gen)
+{
+    struct sr_rcache_entry* e = 0;
+
+    if(!rc)
+    { return 0; }
+
+    e = &(rc->entries[sr_rcache_slot(ip)]);
+    if(e->ip == ip && e->rt_gen == rt_gen && e->arp_gen == arp_gen)
+    {
+        rc->hits++;
+        return e;
+    }
+
+    rc->misses++;
+    return 0;
+} /* -- sr_rcache_lookup -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcache_fill(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcache_fill(struct sr_rcache* rc, uint32_t ip,
+                    uint32_t rt_gen, uint32_t arp_gen, uint32_t arp_slot,
+                    struct sr_if* iface, const unsigned char* dst_mac)
+{
+    struct sr_rcache_entry* e = 0;
+    struct sr_ethernet_hdr* e_hdr = 0;
+
+    if(!rc)
+    { return; }
+
+    /* -- REQUIRES -- */
+    assert(iface);
+    assert(dst_mac);
+
+    e = &(rc->entries[sr_rcache_slot(ip)]);
+    e->ip      = ip;
+    e->rt_gen  = rt_gen;
+    e->arp_gen = arp_gen;
+    e->arp_slot = arp_slot;
+    e->iface   = iface;
+
+    e_hdr = (struct sr_ethernet_hdr*)e->eth;
+    memcpy(e_hdr->ether_dhost, dst_mac, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ethertype_ip);
+} /* -- sr_rcache_fill -- */
+
+void sr_rcache_print_stats(struct sr_rcache* rc)
+{
+    if(!rc)
+    { return; }
+
+    printf("Route cache: %lu hits, %lu misses\n", rc->hits, rc->misses);
+} /* -- sr_rcache_print_stats -- */
@@ -0,0 +1,70 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcache.h
+ *
+ * Description:
+ *
+ * Destination route cache sitting in front of the FIB and ARP cache.  It
+ * is a small direct-mapped table keyed by destination IP; each entry holds
+ * the egress interface and the complete Ethernet header to put on packets
+ * for that destination, so a hit forwards with one probe and a 14 byte
+ * copy.
+ *
+ * Entries are stamped with the routing table and ARP cache generations
+ * current when they were filled and are ignored once either moves on, so
+ * nothing has to walk the cache when routes or neighbours change.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RCACHE_H
+#define SR_RCACHE_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include "sr_protocol.h"
+
+#define SR_RCACHE_BITS 8
+#define SR_RCACHE_SZ   (1 << SR_RCACHE_BITS)
+
+struct sr_if;
+
+struct sr_rcache_entry
+{
+    uint32_t ip;               /* destination, network byte order */
+    uint32_t rt_gen;           /* 0 means the slot was never filled */
+    uint32_t arp_gen;
+    uint32_t arp_slot;         /* ARP cache slot of the next hop */
+    struct sr_if* iface;       /* egress interface */
+    uint8_t  eth[sizeof(struct sr_ethernet_hdr)]; /* prebuilt header */
+} __attribute__ ((aligned (64)));
+
+struct sr_rcache
+{
+    struct sr_rcache_entry entries[SR_RCACHE_SZ];
+    unsigned long hits;
+    unsigned long misses;
+};
+
+struct sr_rcache* sr_rcache_create(void);
+void sr_rcache_destroy(struct sr_rcache* rc);
+
+/* Returns the entry for ip if it was filled under the given generations,
+   otherwise 0.  Counts the hit or miss. */
+struct sr_rcache_entry* sr_rcache_lookup(struct sr_rcache* rc, uint32_t ip,
+                                         uint32_t rt_gen, uint32_t arp_gen);
+
+/* Remember how to reach ip.  The generations must be the ones read before
+   the route and ARP lookups the entry is built from; arp_slot is where the
+   next hop's ARP entry was, so hits can keep it marked in use. */
+void sr_rcache_fill(struct sr_rcache* rc, uint32_t ip,
+                    uint32_t rt_gen, uint32_t arp_gen, uint32_t arp_slot,
+                    struct sr_if* iface, const unsigned char* dst_mac);
+
+void sr_rcache_print_stats(struct sr_rcache* rc);
+
+#endif /* -- SR_RCACHE_H -- */
@@ -0,0 +1,185 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.c
+ *
+ * Description:
+ *
+ * Epoch based RCU.  Each reader thread owns a cache line holding the
+ * global epoch it saw when it entered its outermost read section, or 0
+ * while it is outside one.  synchronize() advances the epoch and waits
+ * until no slot holds an epoch older than the new one: any reader still
+ * inside a section at that point entered after the writer's pointer store
+ * and so cannot see the old version.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "sr_rcu.h"
+
+struct sr_rcu_slot
+{
+    unsigned long epoch;   /* 0 when quiescent */
+    int in_use;
+    char pad[64 - sizeof(unsigned long) - sizeof(int)];
+};
+
+static struct sr_rcu_slot sr_rcu_slots[SR_RCU_MAX_READERS]
+    __attribute__ ((aligned (64)));
+static unsigned long sr_rcu_epoch = 1;
+
+struct sr_rcu_cb
+{
+    void (*fn)(void*);
+    void* arg;
+};
+
+/* callbacks waiting for a grace period */
+static struct sr_rcu_cb sr_rcu_pending[SR_RCU_DEFER_BATCH];
+static int sr_rcu_npending = 0;
+static pthread_mutex_t sr_rcu_defer_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static __thread struct sr_rcu_slot* sr_rcu_self = 0;
+static __thread int sr_rcu_depth = 0;
+
+static struct sr_rcu_slot* sr_rcu_register(void)
+{
+    int i = 0;
+
+    for(i = 0; i < SR_RCU_MAX_READERS; i++)
+    {
+        if(__atomic_exchange_n(&(sr_rcu_slots[i].in_use), 1,
+                               __ATOMIC_ACQ_REL) == 0)
+        { return &(sr_rcu_slots[i]); }
+    }
+
+    fprintf(stderr, "Error: more than %d RCU reader threads\n",
+            SR_RCU_MAX_READERS);
+    abort();
+    return 0;
+} /* -- sr_rcu_register -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_read_lock(..)
+ * Scope:  Global
+ *
+ * The full fence orders the slot store before any load of the shared
+ * pointer, pairing with the one in sr_rcu_synchronize.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcu_read_lock(void)
+{
+    if(sr_rcu_depth++ > 0)
+    { return; }
+
+    if(!sr_rcu_self)
+    { sr_rcu_self = sr_rcu_register(); }
+
+    __atomic_store_n(&(sr_rcu_self->epoch),
+                     __atomic_load_n(&sr_rcu_epoch, __ATOMIC_RELAXED),
+                     __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+} /* -- sr_rcu_read_lock -- */
+
+void sr_rcu_read_unlock(void)
+{
+    assert(sr_rcu_depth > 0);
+
+    if(--sr_rcu_depth > 0)
+    { return; }
+
+    __atomic_store_n(&(sr_rcu_self->epoch), 0, __ATOMIC_RELEASE);
+} /* -- sr_rcu_read_unlock -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_synchronize(..)
+ * Scope:  Global
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcu_synchronize(void)
+{
+    unsigned long target = 0;
+    unsigned long seen = 0;
+    int i = 0;
+
+    assert(sr_rcu_depth == 0);
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    target = __atomic_add_fetch(&sr_rcu_epoch, 1, __ATOMIC_SEQ_CST);
+
+    for(i = 0; i < SR_RCU_MAX_READERS; i++)
+    {
+        while(1)
+        {
+            seen = __atomic_load_n(&(sr_rcu_slots[i].epoch), __ATOMIC_ACQUIRE);
+            if(seen == 0 || seen >= target)
+            { break; }
+            usleep(50);
+        }
+    }
+} /* -- sr_rcu_synchronize -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rcu_barrier(..)
+ * Scope:  Global
+ *
+ * One grace period, then every pending callback.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rcu_barrier(void)
+{
+    struct sr_rcu_cb run[SR_RCU_DEFER_BATCH];
+    int n = 0;
+    int i = 0;
+
+    pthread_mutex_lock(&sr_rcu_defer_lock);
+    n = sr_rcu_npending;
+    memcpy(run, sr_rcu_pending, n * sizeof(struct sr_rcu_cb));
+    sr_rcu_npending = 0;
+    pthread_mutex_unlock(&sr_rcu_defer_lock);
+
+    if(n == 0)
+    { return; }
+
+    sr_rcu_synchronize();
+    for(i = 0; i < n; i++)
+    { run[i].fn(run[i].arg); }
+} /* -- sr_rcu_barrier -- */
+
+void sr_rcu_defer(void (*fn)(void*), void* arg)
+{
+    int full = 0;
+
+    /* -- REQUIRES -- */
+    assert(fn);
+
+    while(1)
+    {
+        pthread_mutex_lock(&sr_rcu_defer_lock);
+        full = (sr_rcu_npending == SR_RCU_DEFER_BATCH);
+        if(!full)
+        {
+            sr_rcu_pending[sr_rcu_npending].fn  = fn;
+            sr_rcu_pending[sr_rcu_npending].arg = arg;
+            sr_rcu_npending++;
+        }
+        pthread_mutex_unlock(&sr_rcu_defer_lock);
+
+        if(!full)
+        { return; }
+        sr_rcu_barrier();
+    }
+} /* -- sr_rcu_defer -- */
+
+void sr_rcu_defer_free(void* p)
+{
+    if(p)
+    { sr_rcu_defer(free, p); }
+} /* -- sr_rcu_defer_free -- */
@@ -0,0 +1,39 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_rcu.h
+ *
+ * Description:
+ *
+ * Minimal epoch based read-copy-update.  Threads that look at shared
+ * read-mostly data (the routing table) bracket each use with
+ * sr_rcu_read_lock/unlock; these never block and only touch a per-thread
+ * slot.  A writer publishes a new version with an atomic pointer store,
+ * calls sr_rcu_synchronize to wait until every reader that could still be
+ * looking at the old version has left its read section, and only then
+ * frees it.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_RCU_H
+#define SR_RCU_H
+
+#define SR_RCU_MAX_READERS 16
+
+/* Read sections nest.  A thread is registered on its first read lock. */
+void sr_rcu_read_lock(void);
+void sr_rcu_read_unlock(void);
+
+/* Wait for all read sections that started before this call.  Must not be
+   called from inside a read section. */
+void sr_rcu_synchronize(void);
+
+/* Run fn(arg) once every reader that might still see arg is gone.
+   Callbacks are batched so that a stream of small updates does not pay
+   for a grace period each; sr_rcu_barrier runs whatever is pending.
+   Neither may be called from inside a read section. */
+#define SR_RCU_DEFER_BATCH 256
+
+void sr_rcu_defer(void (*fn)(void*), void* arg);
+void sr_rcu_defer_free(void* p);
+void sr_rcu_barrier(void);
+
+#endif /* -- SR_RCU_H -- */
@@ -12,6 +12,7 @@
 #include <netinet/in.h>
 #include <sys/time.h>
 #include <stdio.h>
+#include <signal.h>
 
 #include "sr_protocol.h"
 #include "sr_arpcache.h"
@@ -30,9 +31,27 @@
 #define INIT_TTL 255
 #define PACKET_DUMP_SIZE 1024
 
+/* interfaces are also kept in an array and a small hash by name */
+#define SR_MAX_IFACES 32
+#define SR_IF_HASH_SZ 64
+
+/* commands from the server are read this many bytes at a time at most */
+#define SR_RX_BUF_SZ (256 * 1024)
+
+/* lookup structure used on the forwarding path */
+#define SR_FIB_TRIE  0
+#define SR_FIB_DIR24 1
+
 /* forward declare */
 struct sr_if;
 struct sr_rt;
+struct sr_rt_table;
+struct sr_rt_burst;
+struct sr_rcache;
+struct sr_adj_table;
+struct sr_tx_batch;
+struct sr_uring;
+struct sr_io;
 
 /* ----------------------------------------------------------------------------
  * struct sr_instance
@@ -49,28 +68,73 @@ struct sr_instance
     char template[30]; /* template name if any */
     unsigned short topo_id;
     struct sockaddr_in sr_addr; /* address to server */
+    uint8_t* rx_buf;             /* commands read but not handled yet, */
+    unsigned int rx_head;        /* from rx_buf + rx_head */
+    unsigned int rx_tail;        /* to rx_buf + rx_tail */
+    struct sr_rt_burst* rt_burst; /* their routes, looked up ahead */
+    struct sr_tx_batch* tx;      /* batched sends, 0 when off */
+    struct sr_uring* uring;      /* io_uring engine, 0 for blocking I/O */
+    int evloop;                  /* one thread does it all, sr_evloop.c */
+    struct sr_io* io;            /* local interfaces, 0 when VNS has them */
     struct sr_if* if_list; /* list of interfaces */
-    struct sr_rt* routing_table; /* routing table */
+    struct sr_if* if_index[SR_MAX_IFACES]; /* the same, by index */
+    unsigned int nifs;
+    uint8_t if_hash[SR_IF_HASH_SZ]; /* name -> index + 1, 0 = empty */
+    struct sr_adj_table* adj;    /* next hop adjacencies */
+    struct sr_rt_table* rt;      /* routing table, RCU protected */
+    pthread_mutex_t rt_lock;     /* serializes routing table writers */
+    char rt_file[256];           /* file the routing table came from */
+    char rt_image[256];          /* precompiled FIB image, "" for none */
+    int fib_mode;                /* SR_FIB_TRIE or SR_FIB_DIR24 */
+    struct sr_rcache* rcache;    /* destination route cache */
     struct sr_arpcache cache;   /* ARP cache */
+    unsigned int arp_size;       /* ARP cache capacity, 0 for the default */
+    unsigned int arp_retry_ms;   /* ARP request interval, 0 for the default */
+    unsigned int arp_timeout_ms; /* ARP entry lifetime, 0 for the default */
+    unsigned int arp_queue_pkts; /* packets held per ARP request, 0 default */
+    unsigned int arp_queue_bytes; /* bytes held for ARP overall, 0 default */
+    int arp_drop_policy;         /* SR_ARPREQ_DROP_TAIL or _OLDEST */
+    unsigned int arp_hold_ms;    /* failed neighbour hold-down, 0 default */
+    unsigned int arp_max_reqs;   /* ARP requests outstanding, 0 default */
+    unsigned int arp_tx_rate;    /* ARP requests/s per interface, 0 default */
+    char arp_static[256];        /* static neighbour file, "" for none */
+    char arp_snapshot[256];      /* ARP cache kept across restarts, "" none */
     pthread_attr_t attr;
     FILE* logfile;
 };
 
 /* -- sr_main.c -- */
+extern volatile sig_atomic_t sr_stopping; /* SIGINT or SIGTERM arrived */
 int sr_verify_routing_table(struct sr_instance* sr);
+int sr_verify_route_list(struct sr_instance* sr, struct sr_rt* routes);
 
 /* -- sr_vns_comm.c -- */
 int sr_send_packet(struct sr_instance* , uint8_t* , unsigned int , const char*);
+int sr_send_packet_if(struct sr_instance* , uint8_t* , unsigned int ,
+                      struct sr_if* );
 int sr_connect_to_server(struct sr_instance* ,unsigned short , char* );
 int sr_read_from_server(struct sr_instance* );
+int sr_read_from_server_ready(struct sr_instance* , int );
+int sr_interfaces_up(struct sr_instance* );
+void sr_receive_packet(struct sr_instance* , uint8_t* , unsigned int ,
+                       struct sr_if* );
+int sr_tx_batch_init(struct sr_instance* , unsigned int );
+void sr_tx_batch_close(struct sr_instance* );
+void sr_tx_cork(struct sr_instance* );
+void sr_tx_uncork(struct sr_instance* );
 
 /* -- sr_router.c -- */
 void sr_init(struct sr_instance* );
 void sr_handlepacket(struct sr_instance* , uint8_t * , unsigned int , char* );
-void sr_new_icmp(struct sr_instance* sr, uint8_t type, uint8_t code, uint8_t* packet, unit8_t* new_packet, const char* iface);
-void sr_set_headers(struct sr_instance* sr, uint8_t* new_packet, uint8_t* packet, unsigned int len, const char* iface, uint8_t type, uint8_t code);
-void sr_new_icmp_reply(struct sr_instance* sr, uint8_t* new_packet, uint8_t* packet, const char* iface);
-void sr_handle_arpreq(struct sr_instance* sr, struct sr_arpreq* req);
+
+/* -- sr_arpcache.c -- */
+int sr_arpcache_learn(struct sr_instance* , struct sr_arp_hdr* , struct sr_if* );
+int sr_response_arp_req(struct sr_instance* , struct sr_arp_hdr* , char* );
+int sr_handle_arp_reply(struct sr_instance* , struct sr_arp_hdr* , char* );
+void sr_handle_arpreq(struct sr_instance* , struct sr_arpreq* );
+uint64_t sr_arpcache_run_timers(struct sr_instance* );
+int sr_arpcache_load(struct sr_instance* , const char* , int );
+int sr_arpcache_save(struct sr_instance* , const char* );
 
 /* -- sr_if.c -- */
 void sr_add_interface(struct sr_instance* , const char* );
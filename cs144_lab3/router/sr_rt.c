@@ -12,6 +12,12 @@
 #include <assert.h>
 #include <string.h>
 #include <unistd.h>
+#include <signal.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 
 #include <sys/socket.h>
@@ -21,115 +27,1177 @@
 
 #include "sr_rt.h"
 #include "sr_router.h"
+#include "sr_dir24.h"
+#include "sr_rcu.h"
+#include "sr_fibimg.h"
+#include "sr_adj.h"
+
+/* posted from the SIGHUP handler, waited on by the reload thread */
+static sem_t sr_rt_reload_sem;
+
+static uint8_t sr_rt_prefix(struct in_addr dest, struct in_addr mask,
+                            uint32_t* prefix);
+static struct sr_rt* sr_rt_burst_take(struct sr_rt_burst* b,
+                                      const struct sr_rt_table* tbl,
+                                      uint32_t ip_dst, int* found);
+static int sr_rt_path_add(struct sr_rt* rt, struct in_addr gw,
+                          const char* if_name, int live);
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_create(..)
+ *
+ * Empty routing table.  It is private to the caller until handed to
+ * sr_rt_publish.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt_table* sr_rt_table_create(uint32_t gen)
+{
+    struct sr_rt_table* tbl = 0;
+
+    tbl = (struct sr_rt_table*)calloc(1, sizeof(struct sr_rt_table));
+    assert(tbl);
+    sr_fib_init(&(tbl->fib));
+    tbl->gen = gen;
+
+    return tbl;
+} /* -- sr_rt_table_create -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_free(..)
+ *
+ * Only call this on a table no reader can reach any more, i.e. one that
+ * was never published or has been unpublished and synchronized.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_table_free(struct sr_rt_table* tbl)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_rt* next = 0;
+
+    if(!tbl)
+    { return; }
+
+    for(rt_walker = tbl->routes; rt_walker; rt_walker = next)
+    {
+        next = rt_walker->next;
+        free(rt_walker->mp);
+        free(rt_walker);
+    }
+    sr_dir24_destroy(tbl->dir24);
+    sr_fib_destroy(&(tbl->fib));
+    free(tbl);
+} /* -- sr_rt_table_free -- */
+
+/*---------------------------------------------------------------------
+ * rtable file scanner
+ *
+ * One route per line, either
+ *
+ *     dest gateway mask interface
+ *     dest/len gateway interface
+ *
+ * with addresses as plain dotted quads.  The scanner works directly on
+ * the mmapped file, which need not end in a newline or a NUL.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt_scan
+{
+    const char* p;
+    const char* end;
+    unsigned int line;
+};
+
+static int sr_rt_scan_space(int c)
+{
+    return c == ' ' || c == '\t' || c == '\r';
+} /* -- sr_rt_scan_space -- */
+
+/* advance to the next field on this line; 0 if the line has no more */
+static int sr_rt_scan_field(struct sr_rt_scan* sc)
+{
+    while(sc->p < sc->end && sr_rt_scan_space(*sc->p))
+    { sc->p++; }
+    return sc->p < sc->end && *sc->p != '\n';
+} /* -- sr_rt_scan_field -- */
+
+static int sr_rt_scan_ip(struct sr_rt_scan* sc, struct in_addr* addr)
+{
+    uint32_t ip = 0, octet = 0;
+    int i = 0, digits = 0;
+
+    for(i = 0; i < 4; i++)
+    {
+        if(i > 0)
+        {
+            if(sc->p == sc->end || *sc->p != '.')
+            { return -1; }
+            sc->p++;
+        }
+
+        octet = 0;
+        for(digits = 0; sc->p < sc->end && *sc->p >= '0' && *sc->p <= '9' &&
+                        digits < 3; digits++)
+        { octet = octet * 10 + (uint32_t)(*sc->p++ - '0'); }
+        if(digits == 0 || octet > 255)
+        { return -1; }
+
+        ip = (ip << 8) | octet;
+    }
+
+    addr->s_addr = htonl(ip);
+    return 0;
+} /* -- sr_rt_scan_ip -- */
+
+static int sr_rt_scan_len(struct sr_rt_scan* sc, struct in_addr* mask)
+{
+    unsigned int len = 0;
+    int digits = 0;
+
+    for(digits = 0; sc->p < sc->end && *sc->p >= '0' && *sc->p <= '9' &&
+                    digits < 2; digits++)
+    { len = len * 10 + (unsigned int)(*sc->p++ - '0'); }
+    if(digits == 0 || len > 32)
+    { return -1; }
+
+    mask->s_addr = htonl(sr_fib_len_mask((uint8_t)len));
+    return 0;
+} /* -- sr_rt_scan_len -- */
+
+static int sr_rt_scan_name(struct sr_rt_scan* sc, char* name)
+{
+    int n = 0;
+
+    while(sc->p < sc->end && *sc->p != '\n' && !sr_rt_scan_space(*sc->p))
+    {
+        if(n == sr_IFACE_NAMELEN - 1)
+        { return -1; }
+        name[n++] = *sc->p++;
+    }
+    name[n] = 0;
+
+    return n ? 0 : -1;
+} /* -- sr_rt_scan_name -- */
+
+/* the field just scanned must end here */
+static int sr_rt_scan_end(struct sr_rt_scan* sc)
+{
+    return (sc->p == sc->end || *sc->p == '\n' ||
+            sr_rt_scan_space(*sc->p)) ? 0 : -1;
+} /* -- sr_rt_scan_end -- */
+
+/* Parse one line.  Returns 1 for a route, 0 for a blank line, -1 on a
+   syntax error.  Leaves sc at the start of the next line. */
+static int sr_rt_scan_line(struct sr_rt_scan* sc, struct sr_rt* rt)
+{
+    int ret = 1;
+
+    sc->line++;
+
+    if(!sr_rt_scan_field(sc))
+    { ret = 0; }
+    else if(sr_rt_scan_ip(sc, &(rt->dest)) != 0)
+    { ret = -1; }
+    else if(sc->p < sc->end && *sc->p == '/')
+    {
+        sc->p++;
+        if(sr_rt_scan_len(sc, &(rt->mask)) != 0 || sr_rt_scan_end(sc) != 0 ||
+           !sr_rt_scan_field(sc) ||
+           sr_rt_scan_ip(sc, &(rt->gw)) != 0 || sr_rt_scan_end(sc) != 0 ||
+           !sr_rt_scan_field(sc) ||
+           sr_rt_scan_name(sc, rt->interface) != 0)
+        { ret = -1; }
+    }
+    else if(sr_rt_scan_end(sc) != 0 ||
+            !sr_rt_scan_field(sc) ||
+            sr_rt_scan_ip(sc, &(rt->gw)) != 0 || sr_rt_scan_end(sc) != 0 ||
+            !sr_rt_scan_field(sc) ||
+            sr_rt_scan_ip(sc, &(rt->mask)) != 0 || sr_rt_scan_end(sc) != 0 ||
+            !sr_rt_scan_field(sc) ||
+            sr_rt_scan_name(sc, rt->interface) != 0)
+    { ret = -1; }
+
+    /* -- anything after the interface name is ignored -- */
+    while(sc->p < sc->end && *sc->p++ != '\n')
+    { }
+
+    return ret;
+} /* -- sr_rt_scan_line -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_build(..)
+ * Scope: Local
+ *
+ * Index n freshly parsed routes (file order) in an empty table in one
+ * pass: sort them by prefix, settle duplicates, build the trie bottom-up
+ * from the sorted run and link the survivors onto the list in file
+ * order.  Duplicates are settled as sr_rt_table_add would: the first
+ * route for a prefix is kept and the others become further equal-cost
+ * paths of it.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_table_build(struct sr_rt_table* tbl, struct sr_rt** rts,
+                             unsigned int n)
+{
+    struct sr_fib_entry* e = 0;
+    struct sr_rt* rt = 0;
+    uint32_t prefix = 0;
+    uint8_t len = 0;
+    unsigned int i = 0, j = 0, k = 0;
+    int ret = 0;
+
+    e = (struct sr_fib_entry*)malloc((n ? n : 1) * sizeof(struct sr_fib_entry));
+    if(!e)
+    { return -1; }
+
+    for(i = 0; i < n; i++)
+    {
+        len = sr_rt_prefix(rts[i]->dest, rts[i]->mask, &prefix);
+        e[i].key = SR_FIB_KEY(prefix, len);
+        e[i].rt  = rts[i];
+    }
+
+    if(sr_fib_sort(e, n) != 0)
+    {
+        free(e);
+        return -1;
+    }
+
+    /* -- keep one route per key (the sort is stable, so the first in
+          the file), fold the rest into its paths and drop them -- */
+    for(i = 0, k = 0; i < n; i = j)
+    {
+        rt = e[i].rt;
+        for(j = i + 1; j < n && e[j].key == e[i].key; j++)
+        {
+            ret = sr_rt_path_add(rt, e[j].rt->gw, e[j].rt->interface, 0);
+            if(ret < 0)
+            {
+                free(e);
+                return -1;
+            }
+            if(ret == 1)
+            {
+                fprintf(stderr, "Warning: duplicate route for %s, ignored\n",
+                        inet_ntoa(rt->dest));
+            }
+            e[j].rt->next = e[j].rt; /* -- mark, see below -- */
+        }
+        e[k].key = e[i].key;
+        e[k].rt  = rt;
+        k++;
+    }
+
+    if(sr_fib_build(&(tbl->fib), e, k) != 0)
+    {
+        free(e);
+        return -1;
+    }
+    free(e);
+
+    for(i = 0; i < n; i++)
+    {
+        rt = rts[i];
+        if(rt->next == rt)
+        {
+            free(rt);
+            continue;
+        }
+
+        rt->next = 0;
+        rt->prev = tbl->tail;
+        if(tbl->tail)
+        { tbl->tail->next = rt; }
+        else
+        { tbl->routes = rt; }
+        tbl->tail = rt;
+    }
+    tbl->gen++;
+
+    return 0;
+} /* -- sr_rt_table_build -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_load(..)
+ *
+ * Read routes from a file into the empty table tbl.  The file is mapped
+ * rather than read line by line and the trie is built in bulk, which
+ * keeps startup with a full Internet table well under a second.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_table_load(struct sr_rt_table* tbl,const char* filename)
+{
+    struct sr_rt_scan sc;
+    struct stat st;
+    struct sr_rt** rts = 0;
+    struct sr_rt** grown = 0;
+    struct sr_rt* rt = 0;
+    unsigned int n = 0, cap = 0, i = 0;
+    void* map = 0;
+    int fd = -1;
+    int ret = 0;
+    int bad_line = 0;
+
+    /* -- REQUIRES -- */
+    assert(tbl);
+    assert(tbl->routes == 0);
+    assert(filename);
+
+    fd = open(filename, O_RDONLY);
+    if(fd < 0 || fstat(fd, &st) != 0)
+    {
+        perror("open");
+        if(fd >= 0)
+        { close(fd); }
+        return -1;
+    }
+
+    if(st.st_size > 0)
+    {
+        map = mmap(0, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if(map == MAP_FAILED)
+        {
+            perror("mmap");
+            close(fd);
+            return -1;
+        }
+        madvise(map, st.st_size, MADV_SEQUENTIAL);
+    }
+    close(fd);
+
+    memset(&sc, 0, sizeof(sc));
+    sc.p   = (const char*)map;
+    sc.end = sc.p + (map ? st.st_size : 0);
+
+    /* -- a line is at least 16 bytes, so this rarely needs to grow -- */
+    cap = (unsigned int)(st.st_size / 16) + 16;
+    rts = (struct sr_rt**)malloc(cap * sizeof(struct sr_rt*));
+    if(!rts)
+    { ret = -1; }
+
+    while(ret == 0 && sc.p < sc.end)
+    {
+        if(!rt && !(rt = (struct sr_rt*)calloc(1, sizeof(struct sr_rt))))
+        { ret = -1; break; }
+
+        ret = sr_rt_scan_line(&sc, rt);
+        if(ret < 0)
+        {
+            fprintf(stderr,
+                    "Error loading routing table, %s line %u is not a valid route\n",
+                    filename, sc.line);
+            bad_line = 1;
+            break;
+        }
+        if(ret == 0)
+        { continue; }
+        ret = 0;
+
+        if(n == cap)
+        {
+            grown = (struct sr_rt**)realloc(rts, 2 * cap * sizeof(struct sr_rt*));
+            if(!grown)
+            { ret = -1; break; }
+            rts = grown;
+            cap *= 2;
+        }
+        rts[n++] = rt;
+        rt = 0;
+    } /* -- while -- */
+
+    if(map)
+    { munmap(map, st.st_size); }
+    free(rt);
+
+    if(ret == 0)
+    { ret = sr_rt_table_build(tbl, rts, n); }
+
+    if(ret != 0)
+    {
+        if(!bad_line)
+        { fprintf(stderr, "Error: out of memory loading routing table\n"); }
+        for(i = 0; i < n; i++)
+        {
+            free(rts[i]->mp);
+            free(rts[i]);
+        }
+        free(rts);
+        return -1;
+    }
+
+    free(rts);
+
+    return 0; /* -- success -- */
+} /* -- sr_rt_table_load -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_compile(..)
+ *
+ * Build the lookup structure for fib_mode on top of the trie.  Returns
+ * the mode actually in use, which is SR_FIB_TRIE if DIR-24-8 failed.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_table_compile(struct sr_rt_table* tbl, int fib_mode)
+{
+    /* -- REQUIRES -- */
+    assert(tbl);
+
+    sr_dir24_destroy(tbl->dir24);
+    tbl->dir24 = 0;
+
+    if( fib_mode == SR_FIB_DIR24 )
+    {
+        tbl->dir24 = sr_dir24_build(&(tbl->fib));
+        if( tbl->dir24 == 0 )
+        {
+            fprintf(stderr,"Error building DIR-24-8 table, using trie\n");
+            return SR_FIB_TRIE;
+        }
+    }
+
+    return fib_mode;
+} /* -- sr_rt_table_compile -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_publish(..)
+ *
+ * Make tbl the table the forwarding path sees and free the one it
+ * replaces once no reader can still hold it.  Caller holds rt_lock.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_publish(struct sr_instance* sr, struct sr_rt_table* tbl)
+{
+    struct sr_rt_table* old = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(tbl);
+
+    old = __atomic_exchange_n(&(sr->rt), tbl, __ATOMIC_SEQ_CST);
+    if(old)
+    {
+        sr_rcu_synchronize();
+        sr_rt_table_free(old);
+    }
+} /* -- sr_rt_publish -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_save_image(..)
+ * Scope: Local
+ *
+ * Refresh the FIB image, if one is configured, from a table just loaded
+ * from the text file src.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_rt_save_image(struct sr_instance* sr,
+                             const struct sr_rt_table* tbl, const char* src)
+{
+    if(!sr->rt_image[0] || !tbl->dir24)
+    { return; }
+
+    if(sr_fibimg_write(tbl, sr->rt_image, src) != 0)
+    { fprintf(stderr, "Could not write FIB image %s\n", sr->rt_image); }
+    else
+    { printf("Wrote FIB image %s\n", sr->rt_image); }
+} /* -- sr_rt_save_image -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_load_rt(..)
+ *
+ * Build a complete table from filename off to the side and swap it in.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_load_rt(struct sr_instance* sr,const char* filename)
+{
+    struct sr_rt_table* tbl = 0;
+    struct sr_rt_table* cur = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(filename);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+
+    cur = sr_rt_current(sr);
+    tbl = sr_rt_table_create(cur ? cur->gen + 1 : 1);
+    if(sr->rt_image[0] && sr_fibimg_load(tbl, sr->rt_image, filename) == 0)
+    {
+        printf("Using FIB image %s\n", sr->rt_image);
+        sr->fib_mode = SR_FIB_DIR24;
+    }
+    else
+    {
+        if(sr_rt_table_load(tbl, filename) != 0)
+        {
+            pthread_mutex_unlock(&(sr->rt_lock));
+            sr_rt_table_free(tbl);
+            return -1;
+        }
+        sr->fib_mode = sr_rt_table_compile(tbl, sr->fib_mode);
+        sr_rt_save_image(sr, tbl, filename);
+    }
+    sr_rt_bind(sr, tbl);
+
+    if(filename != sr->rt_file)
+    {
+        strncpy(sr->rt_file, filename, sizeof(sr->rt_file) - 1);
+        sr->rt_file[sizeof(sr->rt_file) - 1] = 0;
+    }
+    sr_rt_publish(sr, tbl);
+
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    return 0; /* -- success -- */
+} /* -- sr_load_rt -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_reload_request(..)
+ *
+ * Async-signal-safe; installed as the SIGHUP handler.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_reload_request(int sig)
+{
+    (void)sig;
+    sem_post(&sr_rt_reload_sem);
+} /* -- sr_rt_reload_request -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_reload(..)
+ *
+ * Re-reads the routing table file.  The new table is checked against
+ * the interface list before it replaces the old one; a bad file leaves
+ * forwarding untouched.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_reload(struct sr_instance* sr)
+{
+    struct sr_rt_table* tbl = 0;
+    unsigned int nroutes = 0;
+    int mode = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+
+    tbl = sr_rt_table_create(sr_rt_current(sr)->gen + 1);
+    if(sr_rt_table_load(tbl, sr->rt_file) != 0 ||
+       (sr->if_list && sr_verify_route_list(sr, tbl->routes) != 0))
+    {
+        fprintf(stderr, "Routing table reload from %s failed, "
+                "keeping current table\n", sr->rt_file);
+        pthread_mutex_unlock(&(sr->rt_lock));
+        sr_rt_table_free(tbl);
+        return -1;
+    }
+    mode = sr_rt_table_compile(tbl, sr->fib_mode);
+    sr_rt_save_image(sr, tbl, sr->rt_file);
+    sr_rt_bind(sr, tbl);
+    nroutes = tbl->fib.nroutes;
+    sr_rt_publish(sr, tbl);
+
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    printf("Reloaded routing table from %s (%u routes, %s)\n",
+           sr->rt_file, nroutes,
+           mode == SR_FIB_DIR24 ? "DIR-24-8" : "trie");
+    return 0;
+} /* -- sr_rt_reload -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_reload_thread(..)
+ *
+ * Waits for reload requests and carries them out.
+ *
+ *---------------------------------------------------------------------*/
+
+void* sr_rt_reload_thread(void* sr_ptr)
+{
+    struct sr_instance* sr = (struct sr_instance*)sr_ptr;
+
+    while(1)
+    {
+        if(sem_wait(&sr_rt_reload_sem) != 0)
+        { continue; } /* -- EINTR -- */
+
+        sr_rt_reload(sr);
+    }
+
+    return 0;
+} /* -- sr_rt_reload_thread -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_reload_init(..)
+ *
+ * Start the reload thread and hook SIGHUP up to it.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_reload_init(struct sr_instance* sr)
+{
+    struct sigaction sa;
+    pthread_t thread;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    if(sem_init(&sr_rt_reload_sem, 0, 0) != 0)
+    {
+        perror("sem_init");
+        return -1;
+    }
+
+    if(pthread_create(&thread, &(sr->attr), sr_rt_reload_thread, sr) != 0)
+    {
+        perror("pthread_create");
+        return -1;
+    }
+
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = sr_rt_reload_request;
+    sigemptyset(&sa.sa_mask);
+    sa.sa_flags = SA_RESTART;
+    if(sigaction(SIGHUP, &sa, 0) != 0)
+    {
+        perror("sigaction");
+        return -1;
+    }
+
+    return 0;
+} /* -- sr_rt_reload_init -- */
+
+/*---------------------------------------------------------------------
+ * Route store
+ *
+ * A table keeps its routes on a doubly linked list in the order they were
+ * added (tail pointer, so appending is O(1)) and indexes them in the trie
+ * by prefix, so finding, adding and withdrawing a route costs one trie
+ * walk.  Each prefix has at most one route, which may have several
+ * equal-cost paths.  If a DIR-24-8 table has been compiled it is
+ * repainted for just the prefix that changed.
+ *
+ * The helpers below may run on a published table while the forwarding
+ * path reads it: everything a reader can reach is published with release
+ * stores and anything unlinked is freed after an RCU grace period.
+ * Writers hold rt_lock.
+ *
+ *---------------------------------------------------------------------*/
+
+static uint8_t sr_rt_prefix(struct in_addr dest, struct in_addr mask,
+                            uint32_t* prefix)
+{
+    uint8_t len = sr_fib_mask_len(mask.s_addr);
+
+    if(ntohl(mask.s_addr) != sr_fib_len_mask(len))
+    {
+        fprintf(stderr,
+                "Warning: non-contiguous mask %s, using /%d\n",
+                inet_ntoa(mask), len);
+    }
+
+    *prefix = ntohl(dest.s_addr) & sr_fib_len_mask(len);
+    return len;
+} /* -- sr_rt_prefix -- */
+
+static struct sr_rt* sr_rt_new(struct in_addr dest, struct in_addr gw,
+                               struct in_addr mask, const char* if_name)
+{
+    struct sr_rt* rt = 0;
+
+    rt = (struct sr_rt*)calloc(1, sizeof(struct sr_rt));
+    if(!rt)
+    { return 0; }
+
+    rt->dest = dest;
+    rt->gw   = gw;
+    rt->mask = mask;
+    strncpy(rt->interface,if_name,sr_IFACE_NAMELEN);
+
+    return rt;
+} /* -- sr_rt_new -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_path_add(..)
+ * Scope: Local
+ *
+ * Give rt another equal-cost path.  The path set is copied with the new
+ * path appended and the copy takes the old one's place; if live, rt may
+ * be visible to readers and the old set is freed after a grace period.
+ * Returns 0 if added, 1 if rt already has this path, 2 if it has no room
+ * for another, -1 if out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_path_add(struct sr_rt* rt, struct in_addr gw,
+                          const char* if_name, int live)
+{
+    struct sr_rt_mp* old = rt->mp;
+    struct sr_rt_mp* mp = 0;
+    struct sr_rt_path* path = 0;
+    unsigned int i = 0;
+
+    if(!old)
+    {
+        if(rt->gw.s_addr == gw.s_addr &&
+           strncmp(rt->interface, if_name, sr_IFACE_NAMELEN) == 0)
+        { return 1; }
+    }
+    else
+    {
+        for(i = 0; i < old->npaths; i++)
+        {
+            if(old->path[i].gw.s_addr == gw.s_addr &&
+               strncmp(old->path[i].interface, if_name,
+                       sr_IFACE_NAMELEN) == 0)
+            { return 1; }
+        }
+        if(old->npaths == SR_RT_MAX_PATHS)
+        {
+            fprintf(stderr, "Warning: more than %d paths for %s, ignored\n",
+                    SR_RT_MAX_PATHS, inet_ntoa(rt->dest));
+            return 2;
+        }
+    }
+
+    mp = (struct sr_rt_mp*)calloc(1, sizeof(struct sr_rt_mp));
+    if(!mp)
+    { return -1; }
+
+    if(old)
+    { memcpy(mp, old, sizeof(struct sr_rt_mp)); }
+    else
+    {
+        mp->path[0].gw = rt->gw;
+        strncpy(mp->path[0].interface, rt->interface, sr_IFACE_NAMELEN);
+        mp->path[0].nh_id  = rt->nh_id;
+        mp->path[0].weight = 1;
+        mp->npaths = 1;
+        mp->total  = 1;
+    }
+
+    path = &(mp->path[mp->npaths]);
+    path->gw = gw;
+    strncpy(path->interface, if_name, sr_IFACE_NAMELEN);
+    path->nh_id    = 0;
+    path->weight   = 1;
+    path->packets  = 0;
+    mp->total     += 1;
+    mp->npaths++;
+
+    if(live)
+    {
+        __atomic_store_n(&(rt->mp), mp, __ATOMIC_RELEASE);
+        sr_rcu_defer_free(old);
+    }
+    else
+    {
+        rt->mp = mp;
+        free(old);
+    }
+
+    return 0;
+} /* -- sr_rt_path_add -- */
+
+static void sr_rt_dir24_destroy(void* d)
+{
+    sr_dir24_destroy((struct sr_dir24*)d);
+} /* -- sr_rt_dir24_destroy -- */
+
+/* after the trie changed for prefix/len */
+static void sr_rt_changed(struct sr_rt_table* tbl, uint32_t prefix,
+                          uint8_t len)
+{
+    struct sr_dir24* d = tbl->dir24;
+
+    if(d && sr_dir24_update(d, &(tbl->fib), prefix, len) != 0)
+    {
+        fprintf(stderr, "DIR-24-8 table full, using trie\n");
+        __atomic_store_n(&(tbl->dir24), 0, __ATOMIC_RELEASE);
+        sr_rcu_defer(sr_rt_dir24_destroy, d);
+    }
+
+    __atomic_add_fetch(&(tbl->gen), 1, __ATOMIC_RELEASE);
+} /* -- sr_rt_changed -- */
 
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_rt_adj_id(..)
+ * Scope: Local
+ *
+ * Adjacency id kept in *slot for gateway gw out of the interface called
+ * name, looked up and stored if there is none yet.  0 if the interface
+ * does not exist (yet) or the adjacency table is full.  Writers only,
+ * under rt_lock; the forwarding path just loads the id.
  *
  *---------------------------------------------------------------------*/
 
-int sr_load_rt(struct sr_instance* sr,const char* filename)
+static uint16_t sr_rt_adj_id(struct sr_instance* sr, uint16_t* slot,
+                             struct in_addr gw, const char* name)
 {
-    FILE* fp;
-    char  line[BUFSIZ];
-    char  dest[32];
-    char  gw[32];
-    char  mask[32];
-    char  iface[32];
-    struct in_addr dest_addr;
-    struct in_addr gw_addr;
-    struct in_addr mask_addr;
-    int clear_routing_table = 0;
+    uint16_t id = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+    struct sr_if* iface = 0;
 
-    /* -- REQUIRES -- */
-    assert(filename);
-    if( access(filename,R_OK) != 0)
+    if(id == 0 && sr->adj && sr->if_list &&
+       (iface = sr_get_interface(sr, name)) != 0)
     {
-        perror("access");
-        return -1;
+        id = sr_adj_get(sr->adj, gw.s_addr, iface);
+        __atomic_store_n(slot, id, __ATOMIC_RELEASE);
     }
 
-    fp = fopen(filename,"r");
+    return id;
+} /* -- sr_rt_adj_id -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_bind_route(..)
+ * Scope: Local
+ *
+ * sr_rt_bind for the one route rt and its paths.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_rt_bind_route(struct sr_instance* sr, struct sr_rt* rt)
+{
+    struct sr_rt_mp* mp = rt->mp;
+    struct sr_if* iface = 0;
+    uint32_t total = 0, w = 0;
+    unsigned int i = 0;
+
+    sr_rt_adj_id(sr, &(rt->nh_id), rt->gw, rt->interface);
+    if(!mp)
+    { return; }
 
-    while( fgets(line,BUFSIZ,fp) != 0)
+    for(i = 0; i < mp->npaths; i++)
     {
-        sscanf(line,"%s %s %s %s",dest,gw,mask,iface);
-        if(inet_aton(dest,&dest_addr) == 0)
-        { 
-            fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    dest);
-            return -1; 
-        }
-        if(inet_aton(gw,&gw_addr) == 0)
-        { 
-            fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    gw);
-            return -1; 
-        }
-        if(inet_aton(mask,&mask_addr) == 0)
-        { 
-            fprintf(stderr,
-                    "Error loading routing table, cannot convert %s to valid IP\n",
-                    mask);
-            return -1; 
-        }
-        if( clear_routing_table == 0 ){
-            printf("Loading routing table from server, clear local routing table.\n");
-            sr->routing_table = 0;
-            clear_routing_table = 1;
+        sr_rt_adj_id(sr, &(mp->path[i].nh_id), mp->path[i].gw,
+                     mp->path[i].interface);
+
+        iface = sr->if_list ? sr_get_interface(sr, mp->path[i].interface) : 0;
+        w = (iface && iface->speed) ? iface->speed : 1;
+        if(w > SR_RT_MAX_WEIGHT)
+        { w = SR_RT_MAX_WEIGHT; }
+        __atomic_store_n(&(mp->path[i].weight), w, __ATOMIC_RELAXED);
+        total += w;
+    }
+    __atomic_store_n(&(mp->total), total, __ATOMIC_RELAXED);
+} /* -- sr_rt_bind_route -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_insert(..)
+ * Scope: Local
+ *
+ * Returns 0 if added, 1 if the prefix already has a route, -1 if out of
+ * memory.  If tbl is live in sr, the new route is bound before readers
+ * can find it; a table still being built passes 0 and is bound whole.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_table_insert(struct sr_instance* sr, struct sr_rt_table* tbl,
+        struct in_addr dest, struct in_addr gw, struct in_addr mask,
+        const char* if_name)
+{
+    struct sr_rt* rt = 0;
+    uint32_t prefix = 0;
+    uint8_t len = sr_rt_prefix(dest, mask, &prefix);
+    int ret = 0;
+
+    rt = sr_rt_new(dest, gw, mask, if_name);
+    if(!rt)
+    { return -1; }
+    if(sr)
+    { sr_rt_bind_route(sr, rt); }
+
+    ret = sr_fib_insert(&(tbl->fib), prefix, len, rt);
+    if(ret != 0)
+    {
+        free(rt);
+        return ret;
+    }
+
+    rt->prev = tbl->tail;
+    if(tbl->tail)
+    { __atomic_store_n(&(tbl->tail->next), rt, __ATOMIC_RELEASE); }
+    else
+    { __atomic_store_n(&(tbl->routes), rt, __ATOMIC_RELEASE); }
+    tbl->tail = rt;
+
+    sr_rt_changed(tbl, prefix, len);
+    return 0;
+} /* -- sr_rt_table_insert -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_remove(..)
+ * Scope: Local
+ *
+ * Returns 0 if the route for dest/mask was withdrawn, 1 if there was
+ * none.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_table_remove(struct sr_rt_table* tbl, struct in_addr dest,
+                              struct in_addr mask)
+{
+    struct sr_rt* rt = 0;
+    uint32_t prefix = 0;
+    uint8_t len = sr_rt_prefix(dest, mask, &prefix);
+
+    rt = sr_fib_delete(&(tbl->fib), prefix, len);
+    if(!rt)
+    { return 1; }
+
+    if(rt->prev)
+    { __atomic_store_n(&(rt->prev->next), rt->next, __ATOMIC_RELEASE); }
+    else
+    { __atomic_store_n(&(tbl->routes), rt->next, __ATOMIC_RELEASE); }
+    if(rt->next)
+    { rt->next->prev = rt->prev; }
+    else
+    { tbl->tail = rt->prev; }
+
+    sr_rt_changed(tbl, prefix, len);
+    sr_rcu_defer_free(rt->mp);
+    sr_rcu_defer_free(rt);
+    return 0;
+} /* -- sr_rt_table_remove -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_swap(..)
+ * Scope: Local
+ *
+ * Give the route for dest/mask a new gateway and interface, as its only
+ * path.  A fresh entry takes the old one's place so readers never see a
+ * half-written next hop, and it is bound, as for sr_rt_table_insert,
+ * before it goes in.  Returns 0 if replaced, 1 if there was no such
+ * route, -1 if out of memory.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_table_swap(struct sr_instance* sr, struct sr_rt_table* tbl,
+        struct in_addr dest, struct in_addr gw, struct in_addr mask,
+        const char* if_name)
+{
+    struct sr_rt* rt = 0;
+    struct sr_rt* old = 0;
+    uint32_t prefix = 0;
+    uint8_t len = sr_rt_prefix(dest, mask, &prefix);
+
+    rt = sr_rt_new(dest, gw, mask, if_name);
+    if(!rt)
+    { return -1; }
+    if(sr)
+    { sr_rt_bind_route(sr, rt); }
+
+    old = sr_fib_find(&(tbl->fib), prefix, len);
+    if(!old)
+    {
+        free(rt);
+        return 1;
+    }
+
+    rt->prev = old->prev;
+    rt->next = old->next;
+    sr_fib_replace(&(tbl->fib), prefix, len, rt);
+    if(old->prev)
+    { __atomic_store_n(&(old->prev->next), rt, __ATOMIC_RELEASE); }
+    else
+    { __atomic_store_n(&(tbl->routes), rt, __ATOMIC_RELEASE); }
+    if(old->next)
+    { old->next->prev = rt; }
+    else
+    { tbl->tail = rt; }
+
+    sr_rt_changed(tbl, prefix, len);
+    sr_rcu_defer_free(old->mp);
+    sr_rcu_defer_free(old);
+    return 0;
+} /* -- sr_rt_table_swap -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_multipath(..)
+ * Scope: Local
+ *
+ * Add gw/if_name as one more path of the existing route for dest/mask.
+ * Returns as sr_rt_path_add, or 1 if there is no such route.
+ *
+ *---------------------------------------------------------------------*/
+
+static int sr_rt_table_multipath(struct sr_rt_table* tbl, struct in_addr dest,
+        struct in_addr gw, struct in_addr mask, const char* if_name)
+{
+    struct sr_rt* rt = 0;
+    uint32_t prefix = 0;
+    uint8_t len = sr_rt_prefix(dest, mask, &prefix);
+    int ret = 0;
+
+    rt = sr_fib_find(&(tbl->fib), prefix, len);
+    if(!rt)
+    { return 1; }
+
+    ret = sr_rt_path_add(rt, gw, if_name, 1);
+    if(ret == 0)
+    { sr_rt_changed(tbl, prefix, len); }
+    return ret;
+} /* -- sr_rt_table_multipath -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_table_add(..)
+ *
+ * Add a route the way a routing table file is read: a prefix listed
+ * again with a different gateway or interface gains an equal-cost path,
+ * an exact repeat is ignored.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_table_add(struct sr_rt_table* tbl, struct in_addr dest,
+struct in_addr gw, struct in_addr mask,char* if_name)
+{
+    int ret = 0;
+
+    /* -- REQUIRES -- */
+    assert(if_name);
+    assert(tbl);
+
+    ret = sr_rt_table_insert(0, tbl, dest, gw, mask, if_name);
+    if(ret == 1)
+    {
+        ret = sr_rt_table_multipath(tbl, dest, gw, mask, if_name);
+        if(ret == 1)
+        {
+            fprintf(stderr, "Warning: duplicate route for %s, ignored\n",
+                    inet_ntoa(dest));
         }
-        sr_add_rt_entry(sr,dest_addr,gw_addr,mask_addr,iface);
-    } /* -- while -- */
+    }
 
-    return 0; /* -- success -- */
-} /* -- sr_load_rt -- */
+    if(ret < 0)
+    {
+        fprintf(stderr, "Error: out of memory adding route\n");
+        exit(1);
+    }
+} /* -- sr_rt_table_add -- */
 
 /*---------------------------------------------------------------------
- * Method:
+ * Method: sr_add_rt_entry(..)
+ *
+ * sr_rt_table_add on the live table.
  *
  *---------------------------------------------------------------------*/
 
 void sr_add_rt_entry(struct sr_instance* sr, struct in_addr dest,
 struct in_addr gw, struct in_addr mask,char* if_name)
+{
+    /* -- REQUIRES -- */
+    assert(if_name);
+    assert(sr);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    sr_rt_table_add(sr_rt_current(sr), dest, gw, mask, if_name);
+    sr_rt_bind(sr, sr_rt_current(sr));
+    pthread_mutex_unlock(&(sr->rt_lock));
+} /* -- sr_add_entry -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_bind(..)
+ *
+ * Tie the routes in tbl to the interface list: point every route, path
+ * and DIR-24-8 next hop at its adjacency, and weight every path of the
+ * multipath routes by the speed of its interface, so a faster uplink
+ * takes a proportionally larger share of the flows.  Paths over an
+ * interface that is unknown or reports no speed get weight 1.  Has to be
+ * run again when the interface list changes.  sr_rt_add and
+ * sr_rt_replace bind the routes they put in themselves.  Weights are
+ * written in place; a packet looked up meanwhile may be placed using a
+ * mix of old and new ones, which is harmless.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_bind(struct sr_instance* sr, struct sr_rt_table* tbl)
 {
     struct sr_rt* rt_walker = 0;
+    unsigned int i = 0;
 
     /* -- REQUIRES -- */
-    assert(if_name);
     assert(sr);
+    assert(tbl);
 
-    /* -- empty list special case -- */
-    if(sr->routing_table == 0)
-    {
-        sr->routing_table = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-        assert(sr->routing_table);
-        sr->routing_table->next = 0;
-        sr->routing_table->dest = dest;
-        sr->routing_table->gw   = gw;
-        sr->routing_table->mask = mask;
-        strncpy(sr->routing_table->interface,if_name,sr_IFACE_NAMELEN);
+    for(rt_walker = tbl->routes; rt_walker; rt_walker = rt_walker->next)
+    { sr_rt_bind_route(sr, rt_walker); }
 
-        return;
+    for(i = 1; tbl->dir24 && i < tbl->dir24->nnh; i++)
+    {
+        if((rt_walker = tbl->dir24->nh[i]) == 0)
+        { continue; } /* -- free index -- */
+        sr_rt_adj_id(sr, &(rt_walker->nh_id), rt_walker->gw,
+                     rt_walker->interface);
     }
+} /* -- sr_rt_bind -- */
 
-    /* -- find the end of the list -- */
-    rt_walker = sr->routing_table;
-    while(rt_walker->next){
-      rt_walker = rt_walker->next; 
-    }
+/*---------------------------------------------------------------------
+ * Method: sr_rt_add(..), sr_rt_del(..), sr_rt_replace(..)
+ *
+ * Incremental updates to the live table for route feeds.  Each costs one
+ * trie walk plus, in DIR-24-8 mode, a repaint of the prefix's own range.
+ *
+ *  sr_rt_add:     0 added, 1 prefix already has a route, -1 no memory
+ *  sr_rt_del:     0 withdrawn, 1 no route for the prefix
+ *  sr_rt_replace: 0 replaced, 1 no route for the prefix, -1 no memory
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_rt_add(struct sr_instance* sr, struct in_addr dest,
+              struct in_addr gw, struct in_addr mask, const char* if_name)
+{
+    int ret = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(if_name);
 
-    rt_walker->next = (struct sr_rt*)malloc(sizeof(struct sr_rt));
-    assert(rt_walker->next);
-    rt_walker = rt_walker->next;
+    pthread_mutex_lock(&(sr->rt_lock));
+    ret = sr_rt_table_insert(sr, sr_rt_current(sr), dest, gw, mask, if_name);
+    pthread_mutex_unlock(&(sr->rt_lock));
 
-    rt_walker->next = 0;
-    rt_walker->dest = dest;
-    rt_walker->gw   = gw;
-    rt_walker->mask = mask;
-    strncpy(rt_walker->interface,if_name,sr_IFACE_NAMELEN);
+    return ret;
+} /* -- sr_rt_add -- */
 
-} /* -- sr_add_entry -- */
+int sr_rt_del(struct sr_instance* sr, struct in_addr dest,
+              struct in_addr mask)
+{
+    int ret = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    ret = sr_rt_table_remove(sr_rt_current(sr), dest, mask);
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    return ret;
+} /* -- sr_rt_del -- */
+
+int sr_rt_replace(struct sr_instance* sr, struct in_addr dest,
+                  struct in_addr gw, struct in_addr mask, const char* if_name)
+{
+    int ret = 0;
+
+    /* -- REQUIRES -- */
+    assert(sr);
+    assert(if_name);
+
+    pthread_mutex_lock(&(sr->rt_lock));
+    ret = sr_rt_table_swap(sr, sr_rt_current(sr), dest, gw, mask, if_name);
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    return ret;
+} /* -- sr_rt_replace -- */
 
 /*---------------------------------------------------------------------
  * Method:
@@ -140,7 +1208,7 @@ void sr_print_routing_table(struct sr_instance* sr)
 {
     struct sr_rt* rt_walker = 0;
 
-    if(sr->routing_table == 0)
+    if(sr_rt_current(sr)->routes == 0)
     {
         printf(" *warning* Routing table empty \n");
         return;
@@ -148,7 +1216,7 @@ void sr_print_routing_table(struct sr_instance* sr)
 
     printf("Destination\tGateway\t\tMask\tIface\n");
 
-    rt_walker = sr->routing_table;
+    rt_walker = sr_rt_current(sr)->routes;
     
     sr_print_routing_entry(rt_walker);
     while(rt_walker->next)
@@ -166,6 +1234,8 @@ void sr_print_routing_table(struct sr_instance* sr)
 
 void sr_print_routing_entry(struct sr_rt* entry)
 {
+    unsigned int i = 0;
+
     /* -- REQUIRES --*/
     assert(entry);
     assert(entry->interface);
@@ -175,19 +1245,72 @@ void sr_print_routing_entry(struct sr_rt* entry)
     printf("%s\t",inet_ntoa(entry->mask));
     printf("%s\n",entry->interface);
 
+    /* -- further equal-cost paths, one per line -- */
+    for(i = 1; entry->mp && i < entry->mp->npaths; i++)
+    {
+        printf("\t\t%s\t\t",inet_ntoa(entry->mp->path[i].gw));
+        printf("%s\n",entry->mp->path[i].interface);
+    }
+
 } /* -- sr_print_routing_entry -- */
 
+/*---------------------------------------------------------------------
+ * Method: sr_rt_print_path_stats(..)
+ *
+ * How the packets for each multipath route were actually split.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_print_path_stats(struct sr_instance* sr)
+{
+    struct sr_rt* rt_walker = 0;
+    struct sr_rt_mp* mp = 0;
+    unsigned long sum = 0;
+    unsigned int i = 0;
+
+    sr_rcu_read_lock();
+    for(rt_walker = sr_rt_current(sr)->routes; rt_walker;
+        rt_walker = rt_walker->next)
+    {
+        mp = rt_walker->mp;
+        if(!mp)
+        { continue; }
+
+        sum = 0;
+        for(i = 0; i < mp->npaths; i++)
+        { sum += mp->path[i].packets; }
+
+        printf("Multipath %s/%d, %lu packets\n", inet_ntoa(rt_walker->dest),
+               sr_fib_mask_len(rt_walker->mask.s_addr), sum);
+        for(i = 0; i < mp->npaths; i++)
+        {
+            printf("    via %s %s weight %u: ",
+                   inet_ntoa(mp->path[i].gw), mp->path[i].interface,
+                   mp->path[i].weight);
+            printf("%lu packets (%lu%%)\n", mp->path[i].packets,
+                   sum ? mp->path[i].packets * 100 / sum : 0);
+        }
+    }
+    sr_rcu_read_unlock();
+} /* -- sr_rt_print_path_stats -- */
+
 
-/* find next hop ip and interface, return 1 if found */
-int sr_next_hop_ip_and_iface(struct sr_rt *rt, uint32_t ip_dst, uint32_t *next_hop_ip_p, char *iface_out)
+/*---------------------------------------------------------------------
+ * Method: sr_rt_lookup_linear(..)
+ *
+ * Reference longest prefix match by scanning the whole list.  The
+ * forwarding path uses the trie or DIR-24-8 table; test/test_fib checks
+ * them against this.
+ *
+ *---------------------------------------------------------------------*/
+
+struct sr_rt* sr_rt_lookup_linear(struct sr_rt* rt, uint32_t ip_dst)
 {
     struct sr_rt *first_entry = 0;
     struct sr_rt *find_entry = 0;
     uint32_t find_mask = 0;
     struct sr_rt *entry = rt;
 
-    int found = 0;
-
     while(entry){
         uint32_t mask_addr = entry->mask.s_addr;
         uint32_t dest_addr = entry->dest.s_addr;
@@ -197,18 +1320,291 @@ int sr_next_hop_ip_and_iface(struct sr_rt *rt, uint32_t ip_dst, uint32_t *next_h
         else {
             if (ntohl(mask_addr) > ntohl(find_mask) && (dest_addr&mask_addr) == (ip_dst&mask_addr)) {
                 find_entry = entry;
-                find_mask = mask;
+                find_mask = mask_addr;
             }
         }
-        entry = entry->next
+        entry = entry->next;
+    }
+    if (!find_entry)
+        find_entry = first_entry;
+    return find_entry;
+} /* -- sr_rt_lookup_linear -- */
+
+static __inline__ uint32_t sr_rt_mix(uint32_t h)
+{
+    h ^= h >> 16;
+    h *= 0x85ebca6bU;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35U;
+    h ^= h >> 16;
+    return h;
+} /* -- sr_rt_mix -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_flow_hash(..)
+ *
+ * Hash of the 5-tuple of the IP packet at ip_hdr, of which len bytes are
+ * present.  Ports are left out for fragments, since only the first one
+ * carries them, so that all pieces of a datagram take the same path.
+ *
+ *---------------------------------------------------------------------*/
+
+uint32_t sr_rt_flow_hash(const struct sr_ip_hdr* ip_hdr, unsigned int len)
+{
+    unsigned int hl = ip_hdr->ip_hl * 4;
+    uint32_t ports = 0;
+
+    if((ip_hdr->ip_p == ip_protocol_tcp || ip_hdr->ip_p == ip_protocol_udp) &&
+       (ntohs(ip_hdr->ip_off) & (IP_MF | IP_OFFMASK)) == 0 && len >= hl + 4)
+    { memcpy(&ports, (const uint8_t*)ip_hdr + hl, 4); }
+
+    return sr_rt_mix(ip_hdr->ip_src ^
+                     sr_rt_mix(ip_hdr->ip_dst ^ ((uint32_t)ip_hdr->ip_p << 24)) ^
+                     ports);
+} /* -- sr_rt_flow_hash -- */
+
+/* path i with probability weight / total; the top bits of flow pick */
+static struct sr_rt_path* sr_rt_pick_path(struct sr_rt_mp* mp, uint32_t flow)
+{
+    uint32_t total = __atomic_load_n(&(mp->total), __ATOMIC_RELAXED);
+    uint32_t x = (uint32_t)(((uint64_t)flow * total) >> 32);
+    uint32_t w = 0;
+    unsigned int i = 0;
+
+    for(i = 0; i + 1 < mp->npaths; i++)
+    {
+        w = __atomic_load_n(&(mp->path[i].weight), __ATOMIC_RELAXED);
+        if(x < w)
+        { break; }
+        x -= w;
+    }
+
+    return &(mp->path[i]);
+} /* -- sr_rt_pick_path -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_next_hop_adj(..)
+ *
+ * Adjacency a packet to ip_dst whose flow hashes to flow leaves through.
+ * Returns 0 if there is no usable route and otherwise, as for
+ * sr_next_hop_flow, 1 or 2 depending on whether the route is multipath.
+ * This is the forwarding path's lookup and it only reads: the writers
+ * bind every route to its adjacency, and no interface names are touched
+ * for a route they bound.  A next hop that got no adjacency, because the
+ * table is full or its interface was not up yet, is looked up by name
+ * and set up in *spare, unresolved, which is what *adj_out then points
+ * at.  Caller must be inside an RCU read section.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_next_hop_adj(struct sr_instance* sr, uint32_t ip_dst, uint32_t flow,
+                    struct sr_adj* spare, struct sr_adj** adj_out)
+{
+    struct sr_rt_table* tbl = sr_rt_current(sr);
+    struct sr_rt* find_entry = 0;
+    struct sr_rt_mp* mp = 0;
+    struct sr_rt_path* path = 0;
+    struct in_addr gw;
+    const char* name = 0;
+    struct sr_if* iface = 0;
+    uint16_t id = 0;
+    int ahead = 0;
+
+    /* -- the receive thread may have looked it up already -- */
+    find_entry = sr_rt_burst_take(sr->rt_burst, tbl, ip_dst, &ahead);
+    if(!ahead && tbl->dir24)
+    { find_entry = sr_dir24_lookup(tbl->dir24, ip_dst); }
+    else if(!ahead)
+    { find_entry = sr_fib_lookup(&(tbl->fib), ip_dst); }
+
+    if(!find_entry)
+    { return 0; }
+
+    mp = __atomic_load_n(&(find_entry->mp), __ATOMIC_ACQUIRE);
+    if(!mp)
+    {
+        gw = find_entry->gw;
+        name = find_entry->interface;
+        id = __atomic_load_n(&(find_entry->nh_id), __ATOMIC_ACQUIRE);
+    }
+    else
+    {
+        path = sr_rt_pick_path(mp, flow);
+        gw = path->gw;
+        name = path->interface;
+        id = __atomic_load_n(&(path->nh_id), __ATOMIC_ACQUIRE);
+    }
+
+    if(id != 0)
+    { *adj_out = sr_adj_at(sr->adj, id); }
+    else if(sr->if_list && (iface = sr_get_interface(sr, name)) != 0)
+    {
+        /* -- no adjacency for it: the slow way, by name -- */
+        sr_adj_init(spare, gw.s_addr, iface);
+        *adj_out = spare;
     }
-    if (find_entry || first_entry)
-        found = 1;
-    if (found) {
-        if (!find_entry)
-            find_entry = first_entry;
+    else
+    { return 0; }
+
+    if(path)
+    { __atomic_add_fetch(&(path->packets), 1, __ATOMIC_RELAXED); }
+    return mp ? 2 : 1;
+} /* -- sr_next_hop_adj -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_next_hop_flow(..)
+ *
+ * Next hop for a packet to ip_dst whose flow hashes to flow.  Returns 0
+ * if there is no route, 1 if the route has a single path and 2 if it is
+ * multipath, in which case the choice depends on the flow and must not
+ * be cached per destination.  The packet is counted against the path it
+ * takes.  Caller must be inside an RCU read section.
+ *
+ *---------------------------------------------------------------------*/
+
+int sr_next_hop_flow(struct sr_instance *sr, uint32_t ip_dst, uint32_t flow,
+                     uint32_t *next_hop_ip_p, char *iface_out)
+{
+    struct sr_rt_table *tbl = sr_rt_current(sr);
+    struct sr_rt *find_entry = 0;
+    struct sr_rt_mp *mp = 0;
+    struct sr_rt_path *path = 0;
+
+    if (tbl->dir24)
+        find_entry = sr_dir24_lookup(tbl->dir24, ip_dst);
+    else
+        find_entry = sr_fib_lookup(&(tbl->fib), ip_dst);
+
+    if (!find_entry)
+        return 0;
+
+    mp = __atomic_load_n(&(find_entry->mp), __ATOMIC_ACQUIRE);
+    if (!mp) {
         *next_hop_ip_p = find_entry->gw.s_addr;
-        strncpy(iface_out, match_entry->interface, sr_IFACE_NAMELEN);
+        strncpy(iface_out, find_entry->interface, sr_IFACE_NAMELEN);
+        return 1;
     }
-    return found;
+
+    path = sr_rt_pick_path(mp, flow);
+    __atomic_add_fetch(&(path->packets), 1, __ATOMIC_RELAXED);
+    *next_hop_ip_p = path->gw.s_addr;
+    strncpy(iface_out, path->interface, sr_IFACE_NAMELEN);
+    return 2;
+} /* -- sr_next_hop_flow -- */
+
+/* find next hop ip and interface, return 1 if found.  Multipath routes
+   are split by destination only.  Caller must be inside an RCU read
+   section. */
+int sr_next_hop_ip_and_iface(struct sr_instance *sr, uint32_t ip_dst, uint32_t *next_hop_ip_p, char *iface_out)
+{
+    return sr_next_hop_flow(sr, ip_dst, sr_rt_mix(ip_dst),
+                            next_hop_ip_p, iface_out) != 0;
 }
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_lookup_burst(..)
+ *
+ * Longest prefix match for n destinations at once.  out[i] is the
+ * matching route or 0.  With a DIR-24-8 table the lookups go through the
+ * vectorised burst path, otherwise through the trie one at a time.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_lookup_burst(struct sr_rt_table* tbl, const uint32_t* ip_dst,
+                        struct sr_rt** out, unsigned int n)
+{
+    uint16_t nh[SR_RT_BURST];
+    unsigned int i = 0, j = 0, chunk = 0;
+
+    /* -- REQUIRES -- */
+    assert(tbl);
+
+    if(!tbl->dir24)
+    {
+        for(i = 0; i < n; i++)
+        { out[i] = sr_fib_lookup(&(tbl->fib), ip_dst[i]); }
+        return;
+    }
+
+    for(i = 0; i < n; i += chunk)
+    {
+        chunk = (n - i < SR_RT_BURST) ? n - i : SR_RT_BURST;
+        sr_dir24_lookup_burst(tbl->dir24, ip_dst + i, nh, chunk);
+        for(j = 0; j < chunk; j++)
+        { out[i + j] = sr_dir24_nh(tbl->dir24, nh[j]); }
+    }
+} /* -- sr_rt_lookup_burst -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_burst_fill(..)
+ *
+ * Look up the routes to the n destinations of packets the receive
+ * thread is about to forward, in one burst, for sr_next_hop_adj to take
+ * in order.  n of 0 drops what is left of the last burst, which has to
+ * happen before the RCU read section it was filled in ends.  Receive
+ * thread only.
+ *
+ *---------------------------------------------------------------------*/
+
+void sr_rt_burst_fill(struct sr_instance* sr, const uint32_t* ip_dst,
+                      unsigned int n)
+{
+    struct sr_rt_burst* b = sr->rt_burst;
+    struct sr_rt_table* tbl = 0;
+
+    if(n == 0)
+    {
+        if(b)
+        { b->n = 0; }
+        return;
+    }
+    if(!b && (b = (struct sr_rt_burst*)calloc(1, sizeof(*b))) == 0)
+    { return; }
+    sr->rt_burst = b;
+
+    if(n > SR_RT_BURST)
+    { n = SR_RT_BURST; }
+
+    /* -- gen first: a change racing with the lookups moves it on -- */
+    tbl = sr_rt_current(sr);
+    b->tbl = tbl;
+    b->gen = __atomic_load_n(&(tbl->gen), __ATOMIC_ACQUIRE);
+    memcpy(b->ip, ip_dst, n * sizeof(uint32_t));
+    sr_rt_lookup_burst(tbl, b->ip, b->rt, n);
+    b->n = n;
+    b->next = 0;
+} /* -- sr_rt_burst_fill -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_rt_burst_take(..)
+ * Scope: Local
+ *
+ * The route looked up ahead for ip_dst, if the burst has one further on
+ * and tbl has not changed since.  Sets *found to whether it did; the
+ * route itself may be 0.
+ *
+ *---------------------------------------------------------------------*/
+
+static struct sr_rt* sr_rt_burst_take(struct sr_rt_burst* b,
+                                      const struct sr_rt_table* tbl,
+                                      uint32_t ip_dst, int* found)
+{
+    unsigned int i = 0;
+
+    *found = 0;
+    if(!b || b->next >= b->n || b->tbl != tbl ||
+       b->gen != __atomic_load_n(&(tbl->gen), __ATOMIC_ACQUIRE))
+    { return 0; }
+
+    /* -- packets not forwarded, to us or cached, leave gaps -- */
+    for(i = b->next; i < b->n; i++)
+    {
+        if(b->ip[i] == ip_dst)
+        {
+            b->next = i + 1;
+            *found = 1;
+            return b->rt[i];
+        }
+    }
+    return 0;
+} /* -- sr_rt_burst_take -- */
@@ -19,6 +19,40 @@
 #include <netinet/in.h>
 
 #include "sr_if.h"
+#include "sr_fib.h"
+
+struct sr_dir24;
+struct sr_adj;
+
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_mp
+ *
+ * Equal-cost next hops of a multipath route.  A packet takes path i with
+ * probability weight / total, chosen by a hash of its flow so that one
+ * flow always takes the same path.  path[0] is the route's own gw and
+ * interface.  Apart from weights and counters a published set is never
+ * written; adding a path replaces the whole set.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_RT_MAX_PATHS  16
+#define SR_RT_MAX_WEIGHT (1U << 20)
+
+struct sr_rt_path
+{
+    struct in_addr gw;
+    char   interface[sr_IFACE_NAMELEN];
+    uint16_t nh_id;              /* adjacency, 0 until bound */
+    uint32_t weight;             /* from the interface speed, at least 1 */
+    unsigned long packets;       /* sent this way, forwarding thread only */
+};
+
+struct sr_rt_mp
+{
+    unsigned int npaths;
+    uint32_t total;              /* sum of the weights */
+    struct sr_rt_path path[SR_RT_MAX_PATHS];
+};
 
 /* ----------------------------------------------------------------------------
  * struct sr_rt
@@ -34,14 +68,89 @@ struct sr_rt
     struct in_addr mask;
     char   interface[sr_IFACE_NAMELEN];
     struct sr_rt* next;
+    struct sr_rt* prev;
+    struct sr_rt_mp* mp;         /* 0 unless the prefix has several paths */
+    uint16_t nh_id;              /* adjacency, 0 until bound */
+};
+
+
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_table
+ *
+ * One complete version of the routing table: the route list plus the
+ * lookup structures built over it.  The forwarding path reaches it through
+ * sr_instance.rt inside an RCU read section; a new version is built off to
+ * the side and swapped in with sr_rt_publish.
+ *
+ * -------------------------------------------------------------------------- */
+
+struct sr_rt_table
+{
+    struct sr_rt* routes;        /* list, in the order routes were added */
+    struct sr_rt* tail;
+    struct sr_fib fib;           /* LPM index over routes */
+    struct sr_dir24* dir24;      /* compiled table if fib_mode is DIR24 */
+    uint32_t gen;                /* bumped whenever a route changes */
 };
 
+/* ----------------------------------------------------------------------------
+ * struct sr_rt_burst
+ *
+ * Routes of the packets the receive thread has read but not forwarded
+ * yet, looked up together with sr_rt_lookup_burst.  The forwarding path
+ * takes them in order and uses one only while table and gen are still
+ * current; like the routes, they are good for the RCU read section they
+ * were looked up in.
+ *
+ * -------------------------------------------------------------------------- */
+
+#define SR_RT_BURST 64
+
+struct sr_rt_burst
+{
+    const struct sr_rt_table* tbl;
+    uint32_t gen;                /* tbl->gen before the lookups */
+    unsigned int n;              /* routes looked up */
+    unsigned int next;           /* first not taken yet */
+    uint32_t ip[SR_RT_BURST];
+    struct sr_rt* rt[SR_RT_BURST];
+};
+
+/* Table the forwarding path should use right now. */
+#define sr_rt_current(sr) __atomic_load_n(&((sr)->rt), __ATOMIC_ACQUIRE)
+
+struct sr_rt_table* sr_rt_table_create(uint32_t gen);
+void sr_rt_table_free(struct sr_rt_table*);
+int sr_rt_table_load(struct sr_rt_table*, const char*);
+void sr_rt_table_add(struct sr_rt_table*, struct in_addr, struct in_addr,
+                     struct in_addr, char*);
+int sr_rt_table_compile(struct sr_rt_table*, int);
+void sr_rt_publish(struct sr_instance*, struct sr_rt_table*);
 
 int sr_load_rt(struct sr_instance*,const char*);
+int sr_rt_reload(struct sr_instance*);
+int sr_rt_reload_init(struct sr_instance*);
+void sr_rt_reload_request(int);
+int sr_next_hop_ip_and_iface(struct sr_instance*, uint32_t, uint32_t*, char*);
+int sr_next_hop_flow(struct sr_instance*, uint32_t, uint32_t, uint32_t*, char*);
+int sr_next_hop_adj(struct sr_instance*, uint32_t, uint32_t, struct sr_adj*,
+                    struct sr_adj**);
+uint32_t sr_rt_flow_hash(const struct sr_ip_hdr*, unsigned int);
+void sr_rt_bind(struct sr_instance*, struct sr_rt_table*);
+struct sr_rt* sr_rt_lookup_linear(struct sr_rt*, uint32_t);
+void sr_rt_lookup_burst(struct sr_rt_table*, const uint32_t*,
+                        struct sr_rt**, unsigned int);
+void sr_rt_burst_fill(struct sr_instance*, const uint32_t*, unsigned int);
 void sr_add_rt_entry(struct sr_instance*, struct in_addr,struct in_addr,
                   struct in_addr, char*);
+int sr_rt_add(struct sr_instance*, struct in_addr, struct in_addr,
+              struct in_addr, const char*);
+int sr_rt_del(struct sr_instance*, struct in_addr, struct in_addr);
+int sr_rt_replace(struct sr_instance*, struct in_addr, struct in_addr,
+                  struct in_addr, const char*);
 void sr_print_routing_table(struct sr_instance* sr);
 void sr_print_routing_entry(struct sr_rt* entry);
+void sr_rt_print_path_stats(struct sr_instance* sr);
 
 
 #endif  /* --  sr_RT_H -- */
@@ -0,0 +1,232 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.c
+ *
+ * Description:
+ *
+ * Hierarchical timer wheel.  See sr_timer.h.
+ *
+ * A timer in level l > 0 with delta = expires - now sits in slot
+ * (expires >> 6l) & 63, which is emptied into the levels below at the
+ * first tick T = (expires >> 6l) << 6l that is a multiple of 64^l; at that
+ * point it is less than 64^l ms away and lands at least one level lower.
+ * Level 0 holds timers less than 64 ms away in slot expires & 63, all of
+ * which are due when run reaches that slot.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "sr_timer.h"
+
+#define SR_TIMER_MASK (SR_TIMER_SLOTS - 1)
+
+uint64_t sr_timer_now_ms(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+} /* -- sr_timer_now_ms -- */
+
+void sr_timer_wheel_init(struct sr_timer_wheel* w, uint64_t now)
+{
+    /* -- REQUIRES -- */
+    assert(w);
+
+    memset(w, 0, sizeof(struct sr_timer_wheel));
+    w->now = now;
+} /* -- sr_timer_wheel_init -- */
+
+void sr_timer_init(struct sr_timer* t,
+                   void (*fn)(void* ctx, struct sr_timer* t), void* arg)
+{
+    /* -- REQUIRES -- */
+    assert(t);
+
+    memset(t, 0, sizeof(struct sr_timer));
+    t->fn  = fn;
+    t->arg = arg;
+} /* -- sr_timer_init -- */
+
+static void sr_timer_place(struct sr_timer_wheel* w, struct sr_timer* t)
+{
+    uint64_t e = t->expires;
+    uint64_t delta = 0;
+    unsigned int l = 0;
+    unsigned int i = 0;
+    struct sr_timer** head = 0;
+
+    if(e < w->now)
+    { e = w->now; }
+    delta = e - w->now;
+
+    for(l = 0; l < SR_TIMER_LEVELS - 1; l++)
+    {
+        if(delta < (1ULL << (SR_TIMER_SLOT_BITS * (l + 1))))
+        { break; }
+    }
+    /* -- beyond the top level: park it there, it cascades again -- */
+    if(delta >= (1ULL << (SR_TIMER_SLOT_BITS * SR_TIMER_LEVELS)))
+    { e = w->now + (1ULL << (SR_TIMER_SLOT_BITS * SR_TIMER_LEVELS)) - 1; }
+
+    i = (unsigned int)(e >> (SR_TIMER_SLOT_BITS * l)) & SR_TIMER_MASK;
+    head = &(w->slot[l][i]);
+
+    t->next = *head;
+    if(t->next)
+    { t->next->pprev = &(t->next); }
+    *head = t;
+    t->pprev = head;
+    t->slot = l * SR_TIMER_SLOTS + i;
+    w->bits[l] |= 1ULL << i;
+} /* -- sr_timer_place -- */
+
+static void sr_timer_unlink(struct sr_timer_wheel* w, struct sr_timer* t)
+{
+    unsigned int l = t->slot / SR_TIMER_SLOTS;
+    unsigned int i = t->slot % SR_TIMER_SLOTS;
+
+    *(t->pprev) = t->next;
+    if(t->next)
+    { t->next->pprev = t->pprev; }
+    t->next = 0;
+    t->pprev = 0;
+
+    if(!w->slot[l][i])
+    { w->bits[l] &= ~(1ULL << i); }
+} /* -- sr_timer_unlink -- */
+
+void sr_timer_add(struct sr_timer_wheel* w, struct sr_timer* t,
+                  uint64_t expires)
+{
+    /* -- REQUIRES -- */
+    assert(w);
+    assert(t);
+
+    if(t->pprev)
+    { sr_timer_unlink(w, t); }
+    t->expires = expires;
+    sr_timer_place(w, t);
+} /* -- sr_timer_add -- */
+
+void sr_timer_del(struct sr_timer_wheel* w, struct sr_timer* t)
+{
+    /* -- REQUIRES -- */
+    assert(w);
+    assert(t);
+
+    if(t->pprev)
+    { sr_timer_unlink(w, t); }
+} /* -- sr_timer_del -- */
+
+/*---------------------------------------------------------------------
+ * Method: sr_timer_cascade(..)
+ * Scope:  Local
+ *
+ * Re-place every timer of one slot relative to the current tick.  The
+ * list is taken off the slot first because a timer can land right back
+ * in it when it is a whole lap of that level away.
+ *
+ *---------------------------------------------------------------------*/
+
+static void sr_timer_cascade(struct sr_timer_wheel* w, unsigned int l,
+                             unsigned int i)
+{
+    struct sr_timer* t = w->slot[l][i];
+    struct sr_timer* next = 0;
+
+    w->slot[l][i] = 0;
+    w->bits[l] &= ~(1ULL << i);
+
+    for(; t; t = next)
+    {
+        next = t->next;
+        sr_timer_place(w, t);
+    }
+} /* -- sr_timer_cascade -- */
+
+void sr_timer_run(struct sr_timer_wheel* w, uint64_t now, void* ctx)
+{
+    struct sr_timer* t = 0;
+    uint64_t rest = 0;
+    uint64_t step = 0;
+    unsigned int i = 0;
+    unsigned int l = 0;
+
+    /* -- REQUIRES -- */
+    assert(w);
+
+    while(w->now <= now)
+    {
+        i = (unsigned int)w->now & SR_TIMER_MASK;
+
+        /* -- level 0 wrapped: bring the next slot of each level down -- */
+        if(i == 0)
+        {
+            for(l = 1; l < SR_TIMER_LEVELS; l++)
+            {
+                unsigned int j = (unsigned int)
+                    (w->now >> (SR_TIMER_SLOT_BITS * l)) & SR_TIMER_MASK;
+                if(w->bits[l] & (1ULL << j))
+                { sr_timer_cascade(w, l, j); }
+                if(j != 0)
+                { break; }
+            }
+        }
+
+        while((t = w->slot[0][i]) != 0)
+        {
+            sr_timer_unlink(w, t);
+            t->fn(ctx, t);
+        }
+
+        /* -- skip to the next busy slot, stopping where level 0 wraps -- */
+        rest = (w->bits[0] >> i) >> 1;
+        step = rest ? (uint64_t)__builtin_ctzll(rest) + 1 : SR_TIMER_SLOTS - i;
+        if(w->now + step > now + 1)
+        { step = now + 1 - w->now; }
+        w->now += step;
+    }
+} /* -- sr_timer_run -- */
+
+static __inline__ uint64_t sr_timer_rotr(uint64_t x, unsigned int r)
+{
+    return (x >> r) | (x << ((SR_TIMER_SLOTS - r) & SR_TIMER_MASK));
+}
+
+uint64_t sr_timer_next(const struct sr_timer_wheel* w)
+{
+    uint64_t best = SR_TIMER_NEVER;
+    uint64_t at = 0;
+    unsigned int l = 0;
+    unsigned int s = 0;
+    unsigned int cur = 0;
+
+    /* -- REQUIRES -- */
+    assert(w);
+
+    if(w->bits[0])
+    {
+        cur  = (unsigned int)w->now & SR_TIMER_MASK;
+        best = w->now + __builtin_ctzll(sr_timer_rotr(w->bits[0], cur));
+    }
+
+    /* -- higher levels: the first tick at or after now that is a multiple
+          of the level's granularity and cascades a busy slot -- */
+    for(l = 1; l < SR_TIMER_LEVELS; l++)
+    {
+        if(!w->bits[l])
+        { continue; }
+        s   = SR_TIMER_SLOT_BITS * l;
+        at  = (w->now + (1ULL << s) - 1) >> s;
+        cur = (unsigned int)at & SR_TIMER_MASK;
+        at  = (at + __builtin_ctzll(sr_timer_rotr(w->bits[l], cur))) << s;
+        if(at < best)
+        { best = at; }
+    }
+
+    return best;
+} /* -- sr_timer_next -- */
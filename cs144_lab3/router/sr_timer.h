@@ -0,0 +1,82 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_timer.h
+ *
+ * Description:
+ *
+ * Hierarchical timer wheel on a monotonic millisecond clock.  Four levels
+ * of 64 slots each cover 64 ms, 4 s, 4.5 min and 4.7 h at 1, 64, 4096 and
+ * 262144 ms granularity; a timer goes into the coarsest level that still
+ * tells its slot apart and is moved down a level each time the level
+ * below wraps, so it is in level 0, exact to the millisecond, when it
+ * fires.  Adding and deleting are O(1), and running the wheel costs the
+ * number of timers due plus the occupied slots passed, not the number of
+ * timers armed.  Timers further out than the top level are parked in it
+ * and cascade again until they are due.
+ *
+ * Timers are meant to be embedded in whatever owns them.  The wheel does
+ * no locking of its own; its user serializes add, del and run.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_TIMER_H
+#define SR_TIMER_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#define SR_TIMER_LEVELS    4
+#define SR_TIMER_SLOT_BITS 6
+#define SR_TIMER_SLOTS     (1 << SR_TIMER_SLOT_BITS)
+#define SR_TIMER_NEVER     ((uint64_t)-1)
+
+struct sr_timer
+{
+    uint64_t expires;            /* ms, sr_timer_now_ms clock */
+    struct sr_timer* next;
+    struct sr_timer** pprev;     /* 0 while not armed */
+    unsigned int slot;           /* level * SR_TIMER_SLOTS + index */
+    void (*fn)(void* ctx, struct sr_timer* t);
+    void* arg;                   /* for fn, the wheel does not use it */
+};
+
+struct sr_timer_wheel
+{
+    uint64_t now;                /* next tick run will look at */
+    uint64_t bits[SR_TIMER_LEVELS];  /* occupied slots of each level */
+    struct sr_timer* slot[SR_TIMER_LEVELS][SR_TIMER_SLOTS];
+};
+
+/* Milliseconds on CLOCK_MONOTONIC. */
+uint64_t sr_timer_now_ms(void);
+
+void sr_timer_wheel_init(struct sr_timer_wheel* w, uint64_t now);
+
+void sr_timer_init(struct sr_timer* t,
+                   void (*fn)(void* ctx, struct sr_timer* t), void* arg);
+
+/* Arm t to fire at expires, moving it if it is armed already.  A time
+   that has passed fires as soon as the wheel runs. */
+void sr_timer_add(struct sr_timer_wheel* w, struct sr_timer* t,
+                  uint64_t expires);
+void sr_timer_del(struct sr_timer_wheel* w, struct sr_timer* t);
+
+static __inline__ int sr_timer_pending(const struct sr_timer* t)
+{
+    return t->pprev != 0;
+}
+
+/* Fire every timer due at or before now, in order, passing ctx.  A timer
+   is disarmed before its function is called, which may add and delete
+   any timers, itself included. */
+void sr_timer_run(struct sr_timer_wheel* w, uint64_t now, void* ctx);
+
+/* Time of the next run that has anything to do: a timer firing or one
+   moving down a level.  SR_TIMER_NEVER if nothing is armed. */
+uint64_t sr_timer_next(const struct sr_timer_wheel* w);
+
+#endif /* -- SR_TIMER_H -- */
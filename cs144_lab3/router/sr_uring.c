@@ -0,0 +1,771 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.c
+ *
+ * Description:
+ *
+ * io_uring engine for the VNS socket and the packet log.  See sr_uring.h.
+ *
+ * The rings are used without a library.  Everything but the receiver's
+ * wait is done under one lock, by whichever thread comes along: queueing
+ * output and reaping completions, which may start the next chain.  The
+ * receiver sleeps in the kernel without the lock, so a thread that reaps
+ * a receive for it while it sleeps submits a no-op to wake it up.
+ *
+ * The kernel cancels what a thread submitted when the thread exits, so
+ * only the thread that created the engine, which lives as long as the
+ * router, submits reads and writes.  Other threads queue behind a chain
+ * in flight, and with none in flight write out what is queued themselves.
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <assert.h>
+#include <string.h>
+#include <errno.h>
+
+#include "sr_uring.h"
+
+#ifdef _LINUX_
+
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+
+#define SR_URING_ENTRIES   256           /* submission queue */
+#define SR_URING_RX_BUFS   64            /* receive buffers, a power of 2 */
+#define SR_URING_RX_BUF_SZ (16 * 1024)
+#define SR_URING_SLOTS     64            /* per output, a power of 2 */
+#define SR_URING_SLOT_SZ   (16 * 1024)
+#define SR_URING_BGID      0             /* our buffer group */
+
+/* -- what a completion is for, in the top half of its user_data -- */
+#define SR_URING_RECV      1
+#define SR_URING_SEND      2
+#define SR_URING_LOG       3
+#define SR_URING_WAKE      4
+
+/* an output: the socket or the log */
+struct sr_uring_out
+{
+    int fd;                      /* -1 if not used */
+    uint8_t op;                  /* IORING_OP_SEND or IORING_OP_WRITE */
+    uint64_t kind;               /* SR_URING_SEND or SR_URING_LOG */
+    uint64_t off;                /* file offset of the next write */
+    uint8_t* mem;                /* SR_URING_SLOTS slots */
+    unsigned int len[SR_URING_SLOTS];
+    unsigned int head;           /* first slot of the chain in flight */
+    unsigned int chain;          /* slots in that chain, */
+    unsigned int inflight;       /* not completed yet */
+    unsigned int queued;         /* slots filled after the chain */
+    int failed;
+    uint64_t chains;             /* chains submitted, */
+    uint64_t direct;             /* runs of slots written directly, */
+    uint64_t bytes;              /* with this much in them all */
+};
+
+/* a receive completion not handed out yet */
+struct sr_uring_rx
+{
+    int res;                     /* bytes, 0 end of stream or -errno */
+    uint16_t bid;
+    unsigned int off;            /* bytes of it already handed out */
+};
+
+struct sr_uring
+{
+    int fd;
+    pthread_t owner;             /* submits, see above */
+    pthread_mutex_t lock;
+
+    unsigned int* sq_head;
+    unsigned int* sq_tail;
+    unsigned int* sq_array;
+    unsigned int sq_mask;
+    unsigned int sq_entries;
+    unsigned int sq_next;        /* tail once the queued sqes are submitted */
+    unsigned int to_submit;
+    struct io_uring_sqe* sqes;
+    unsigned int* cq_head;
+    unsigned int* cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe* cqes;
+    void* ring_map;
+    size_t ring_map_sz;
+    size_t sqes_sz;
+
+    int sockfd;
+    struct io_uring_buf_ring* br;
+    uint8_t* rx_mem;
+    uint16_t br_tail;
+    int rx_armed;                /* a recv is in flight */
+    int rx_multishot;            /* 0 once the kernel refused one */
+    int rx_done;                 /* end of stream or error seen */
+    int rx_waiting;              /* the receiver sleeps in the kernel */
+    struct sr_uring_rx rx[SR_URING_RX_BUFS + 1];
+    unsigned int rx_head;
+    unsigned int rx_count;
+
+    struct sr_uring_out tx;
+    struct sr_uring_out log;
+
+    uint64_t enters;
+    uint64_t recvs;
+    uint64_t rx_bytes;
+};
+
+static int sr_uring_enter(struct sr_uring* u, unsigned int submit,
+                          unsigned int wait)
+{
+    __atomic_add_fetch(&(u->enters), 1, __ATOMIC_RELAXED);
+    return (int)syscall(__NR_io_uring_enter, u->fd, submit, wait,
+                        wait ? IORING_ENTER_GETEVENTS : 0, 0, 0);
+} /* -- sr_uring_enter -- */
+
+static int sr_uring_submit(struct sr_uring* u)
+{
+    int n = 0;
+
+    if(u->to_submit == 0)
+    { return 0; }
+
+    __atomic_store_n(u->sq_tail, u->sq_next, __ATOMIC_RELEASE);
+    while(u->to_submit > 0)
+    {
+        if((n = sr_uring_enter(u, u->to_submit, 0)) < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            perror("io_uring_enter");
+            return -1;
+        }
+        u->to_submit -= n;
+    }
+    return 0;
+} /* -- sr_uring_submit -- */
+
+/* next free sqe, zeroed; it goes in with the next sr_uring_submit */
+static struct io_uring_sqe* sr_uring_sqe(struct sr_uring* u, uint64_t kind,
+                                         unsigned int slot)
+{
+    struct io_uring_sqe* sqe = 0;
+    unsigned int i = 0;
+
+    if(u->sq_next - __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE) >=
+       u->sq_entries)
+    { sr_uring_submit(u); }
+
+    i = u->sq_next & u->sq_mask;
+    sqe = &(u->sqes[i]);
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->user_data = (kind << 32) | slot;
+    u->sq_array[i] = i;
+    u->sq_next++;
+    u->to_submit++;
+    return sqe;
+} /* -- sr_uring_sqe -- */
+
+static void sr_uring_arm(struct sr_uring* u)
+{
+    struct io_uring_sqe* sqe = sr_uring_sqe(u, SR_URING_RECV, 0);
+
+    sqe->opcode = IORING_OP_RECV;
+    sqe->fd = u->sockfd;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = SR_URING_BGID;
+    if(u->rx_multishot)
+    { sqe->ioprio = IORING_RECV_MULTISHOT; }
+    u->rx_armed = 1;
+} /* -- sr_uring_arm -- */
+
+/* give receive buffer bid back to the kernel */
+static void sr_uring_recycle(struct sr_uring* u, uint16_t bid)
+{
+    struct io_uring_buf* b =
+        &(u->br->bufs[u->br_tail & (SR_URING_RX_BUFS - 1)]);
+
+    b->addr = (uint64_t)(uintptr_t)(u->rx_mem + bid * SR_URING_RX_BUF_SZ);
+    b->len  = SR_URING_RX_BUF_SZ;
+    b->bid  = bid;
+    u->br_tail++;
+    __atomic_store_n(&(u->br->tail), u->br_tail, __ATOMIC_RELEASE);
+} /* -- sr_uring_recycle -- */
+
+/* write what is queued on o with one system call, not through the ring */
+static void sr_uring_flush_direct(struct sr_uring_out* o)
+{
+    struct iovec iov[SR_URING_SLOTS];
+    struct iovec* v = iov;
+    int cnt = (int)o->queued;
+    ssize_t n = 0;
+    unsigned int i = 0;
+    unsigned int slot = 0;
+
+    for(i = 0; i < o->queued; i++)
+    {
+        slot = (o->head + i) & (SR_URING_SLOTS - 1);
+        iov[i].iov_base = (void*)(o->mem + slot * SR_URING_SLOT_SZ);
+        iov[i].iov_len = o->len[slot];
+        o->bytes += o->len[slot];
+    }
+    o->head = (o->head + o->queued) & (SR_URING_SLOTS - 1);
+    o->queued = 0;
+    o->direct++;
+
+    while(cnt > 0 && !o->failed)
+    {
+        n = (o->op == IORING_OP_WRITE) ?
+            pwritev(o->fd, v, cnt, (off_t)o->off) : writev(o->fd, v, cnt);
+        if(n < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            o->failed = 1;
+            perror("io_uring direct write");
+            break;
+        }
+        if(o->op == IORING_OP_WRITE)
+        { o->off += n; }
+        while(cnt > 0 && (size_t)n >= v->iov_len)
+        {
+            n -= v->iov_len;
+            v++;
+            cnt--;
+        }
+        if(cnt > 0)
+        {
+            v->iov_base = (uint8_t*)v->iov_base + n;
+            v->iov_len -= n;
+        }
+    }
+} /* -- sr_uring_flush_direct -- */
+
+/* submit what is queued on o as one linked chain, unless one is in flight */
+static void sr_uring_flush(struct sr_uring* u, struct sr_uring_out* o)
+{
+    struct io_uring_sqe* sqe = 0;
+    unsigned int i = 0;
+    unsigned int slot = 0;
+
+    if(o->inflight > 0 || o->queued == 0)
+    { return; }
+    if(!pthread_equal(pthread_self(), u->owner))
+    {
+        sr_uring_flush_direct(o);
+        return;
+    }
+
+    o->chain = o->inflight = o->queued;
+    o->queued = 0;
+    o->chains++;
+    for(i = 0; i < o->chain; i++)
+    {
+        slot = (o->head + i) & (SR_URING_SLOTS - 1);
+        sqe = sr_uring_sqe(u, o->kind, slot);
+        sqe->opcode = o->op;
+        sqe->fd = o->fd;
+        sqe->addr = (uint64_t)(uintptr_t)(o->mem + slot * SR_URING_SLOT_SZ);
+        sqe->len = o->len[slot];
+        if(o->op == IORING_OP_WRITE)
+        {
+            sqe->off = o->off;
+            o->off += o->len[slot];
+        }
+        else
+        { sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL; }
+        if(i + 1 < o->chain)
+        { sqe->flags = IOSQE_IO_LINK; }
+        o->bytes += o->len[slot];
+    }
+} /* -- sr_uring_flush -- */
+
+static void sr_uring_written(struct sr_uring_out* o, struct io_uring_cqe* cqe)
+{
+    unsigned int slot = (unsigned int)cqe->user_data & (SR_URING_SLOTS - 1);
+
+    if(cqe->res != (int)o->len[slot] && !o->failed)
+    {
+        o->failed = 1;
+        fprintf(stderr, "io_uring %s failed: %s\n",
+                o->kind == SR_URING_SEND ? "send" : "log write",
+                cqe->res < 0 ? strerror(-cqe->res) : "short write");
+    }
+    if(--o->inflight == 0)
+    {
+        o->head = (o->head + o->chain) & (SR_URING_SLOTS - 1);
+        o->chain = 0;
+    }
+} /* -- sr_uring_written -- */
+
+static void sr_uring_received(struct sr_uring* u, struct io_uring_cqe* cqe)
+{
+    struct sr_uring_rx* e = 0;
+
+    if(!(cqe->flags & IORING_CQE_F_MORE))
+    { u->rx_armed = 0; }
+
+    /* -- out of buffers, rearmed once some come back -- */
+    if(cqe->res == -ENOBUFS)
+    { return; }
+    /* -- no multishot recv in this kernel, one at a time then -- */
+    if(cqe->res == -EINVAL && u->rx_multishot)
+    {
+        u->rx_multishot = 0;
+        return;
+    }
+
+    e = &(u->rx[(u->rx_head + u->rx_count) % (SR_URING_RX_BUFS + 1)]);
+    e->res = cqe->res;
+    e->bid = (uint16_t)(cqe->flags >> IORING_CQE_BUFFER_SHIFT);
+    e->off = 0;
+    u->rx_count++;
+    u->recvs++;
+    if(cqe->res <= 0)
+    { u->rx_done = 1; }
+} /* -- sr_uring_received -- */
+
+/* handle what has completed and start what waited for it; under the lock */
+static void sr_uring_reap(struct sr_uring* u)
+{
+    struct io_uring_cqe* cqe = 0;
+    unsigned int head = *(u->cq_head);
+    int got_rx = 0;
+
+    while(head != __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE))
+    {
+        cqe = &(u->cqes[head & u->cq_mask]);
+        switch(cqe->user_data >> 32)
+        {
+            case SR_URING_RECV:
+                sr_uring_received(u, cqe);
+                got_rx = 1;
+                break;
+            case SR_URING_SEND:
+                sr_uring_written(&(u->tx), cqe);
+                break;
+            case SR_URING_LOG:
+                sr_uring_written(&(u->log), cqe);
+                break;
+            default:
+                break;
+        }
+        head++;
+    }
+    __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+
+    if(got_rx && u->rx_waiting)
+    { sr_uring_sqe(u, SR_URING_WAKE, 0)->opcode = IORING_OP_NOP; }
+    sr_uring_flush(u, &(u->tx));
+    sr_uring_flush(u, &(u->log));
+    sr_uring_submit(u);
+} /* -- sr_uring_reap -- */
+
+static int sr_uring_write(struct sr_uring* u, struct sr_uring_out* o,
+                          const struct iovec* iov, int iovcnt)
+{
+    const uint8_t* p = 0;
+    size_t n = 0;
+    size_t c = 0;
+    unsigned int last = 0;
+    int ret = 0;
+    int i = 0;
+
+    pthread_mutex_lock(&(u->lock));
+    sr_uring_reap(u);
+
+    for(i = 0; i < iovcnt && ret == 0; i++)
+    {
+        p = (const uint8_t*)iov[i].iov_base;
+        n = iov[i].iov_len;
+        while(n > 0)
+        {
+            if(o->failed)
+            {
+                ret = -1;
+                break;
+            }
+
+            last = (o->head + o->chain + o->queued - 1) &
+                (SR_URING_SLOTS - 1);
+            if(o->queued == 0 || o->len[last] == SR_URING_SLOT_SZ)
+            {
+                /* -- next slot, waiting for a chain to finish if there
+                   are none left -- */
+                if(o->chain + o->queued == SR_URING_SLOTS)
+                {
+                    sr_uring_flush(u, o);
+                    sr_uring_submit(u);
+                    if(sr_uring_enter(u, 0, 1) < 0 && errno != EINTR)
+                    {
+                        perror("io_uring_enter");
+                        ret = -1;
+                        break;
+                    }
+                    sr_uring_reap(u);
+                    continue;
+                }
+                last = (o->head + o->chain + o->queued) &
+                    (SR_URING_SLOTS - 1);
+                o->len[last] = 0;
+                o->queued++;
+            }
+
+            c = SR_URING_SLOT_SZ - o->len[last];
+            if(c > n)
+            { c = n; }
+            memcpy(o->mem + last * SR_URING_SLOT_SZ + o->len[last], p, c);
+            o->len[last] += c;
+            p += c;
+            n -= c;
+        }
+    }
+
+    sr_uring_flush(u, o);
+    sr_uring_submit(u);
+    pthread_mutex_unlock(&(u->lock));
+
+    return ret;
+} /* -- sr_uring_write -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_recv(..)
+ * Scope: Global
+ *
+ * Hands out what completed receives brought, as much as fits in len,
+ * waiting for one if there are none.  A receive buffer goes back to the
+ * kernel once all of it was handed out.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_uring_recv(struct sr_uring* u, uint8_t* buf, unsigned int len)
+{
+    struct sr_uring_rx* e = 0;
+    unsigned int done = 0;
+    unsigned int c = 0;
+    int ret = 0;
+
+    /* -- REQUIRES -- */
+    assert(u);
+    assert(buf);
+
+    pthread_mutex_lock(&(u->lock));
+
+    for(;;)
+    {
+        sr_uring_reap(u);
+        if(u->rx_count > 0)
+        { break; }
+        if(!u->rx_armed)
+        {
+            sr_uring_arm(u);
+            sr_uring_submit(u);
+        }
+
+        u->rx_waiting = 1;
+        pthread_mutex_unlock(&(u->lock));
+        ret = sr_uring_enter(u, 0, 1);
+        pthread_mutex_lock(&(u->lock));
+        u->rx_waiting = 0;
+
+        if(ret < 0)
+        {
+            ret = errno;
+            pthread_mutex_unlock(&(u->lock));
+            errno = ret;
+            return -1;
+        }
+    }
+
+    while(u->rx_count > 0 && done < len)
+    {
+        e = &(u->rx[u->rx_head]);
+        if(e->res <= 0)
+        {
+            /* -- end of stream or error, left for the calls after -- */
+            if(done == 0)
+            {
+                ret = e->res;
+                pthread_mutex_unlock(&(u->lock));
+                if(ret == 0)
+                { return 0; }
+                errno = -ret;
+                return -1;
+            }
+            break;
+        }
+
+        c = e->res - e->off;
+        if(c > len - done)
+        { c = len - done; }
+        memcpy(buf + done, u->rx_mem + e->bid * SR_URING_RX_BUF_SZ + e->off, c);
+        done += c;
+        e->off += c;
+        if(e->off == (unsigned int)e->res)
+        {
+            sr_uring_recycle(u, e->bid);
+            u->rx_head = (u->rx_head + 1) % (SR_URING_RX_BUFS + 1);
+            u->rx_count--;
+        }
+    }
+    u->rx_bytes += done;
+
+    if(!u->rx_armed && !u->rx_done)
+    {
+        sr_uring_arm(u);
+        sr_uring_submit(u);
+    }
+
+    pthread_mutex_unlock(&(u->lock));
+
+    return (int)done;
+} /* -- sr_uring_recv -- */
+
+int sr_uring_send(struct sr_uring* u, const struct iovec* iov, int iovcnt)
+{
+    /* -- REQUIRES -- */
+    assert(u);
+
+    return sr_uring_write(u, &(u->tx), iov, iovcnt);
+} /* -- sr_uring_send -- */
+
+int sr_uring_log(struct sr_uring* u, const struct iovec* iov, int iovcnt)
+{
+    /* -- REQUIRES -- */
+    assert(u);
+
+    if(u->log.fd < 0)
+    { return -1; }
+    return sr_uring_write(u, &(u->log), iov, iovcnt);
+} /* -- sr_uring_log -- */
+
+static void sr_uring_free(struct sr_uring* u)
+{
+    if(u->ring_map)
+    { munmap(u->ring_map, u->ring_map_sz); }
+    if(u->sqes)
+    { munmap(u->sqes, u->sqes_sz); }
+    if(u->fd >= 0)
+    { close(u->fd); }
+    free(u->br);
+    free(u->rx_mem);
+    free(u->tx.mem);
+    free(u->log.mem);
+    free(u);
+} /* -- sr_uring_free -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_create(..)
+ * Scope: Global
+ *
+ * Needs Linux 5.19 for the buffer ring; multishot receive, 6.0, is used
+ * when there.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_uring* sr_uring_create(int sockfd, int logfd)
+{
+    struct sr_uring* u = 0;
+    struct io_uring_params p;
+    struct io_uring_buf_reg reg;
+    uint8_t* ring = 0;
+    void* mem = 0;
+    off_t off = 0;
+    unsigned int i = 0;
+
+    if((u = (struct sr_uring*)calloc(1, sizeof(struct sr_uring))) == 0)
+    { return 0; }
+    u->fd = -1;
+    u->sockfd = sockfd;
+    u->rx_multishot = 1;
+
+    memset(&p, 0, sizeof(p));
+    if((u->fd = (int)syscall(__NR_io_uring_setup, SR_URING_ENTRIES, &p)) < 0)
+    {
+        perror("io_uring_setup");
+        goto fail;
+    }
+    if(!(p.features & IORING_FEAT_SINGLE_MMAP))
+    {
+        fprintf(stderr, "io_uring: kernel too old\n");
+        goto fail;
+    }
+
+    /* -- the rings share one mapping, the entries have their own -- */
+    u->ring_map_sz = p.sq_off.array + p.sq_entries * sizeof(unsigned int);
+    if(u->ring_map_sz < p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe))
+    { u->ring_map_sz = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe); }
+    u->ring_map = mmap(0, u->ring_map_sz, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if(u->ring_map == MAP_FAILED)
+    {
+        u->ring_map = 0;
+        perror("io_uring mmap");
+        goto fail;
+    }
+    u->sqes_sz = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = (struct io_uring_sqe*)mmap(0, u->sqes_sz, PROT_READ | PROT_WRITE,
+                                         MAP_SHARED | MAP_POPULATE, u->fd,
+                                         IORING_OFF_SQES);
+    if(u->sqes == MAP_FAILED)
+    {
+        u->sqes = 0;
+        perror("io_uring mmap");
+        goto fail;
+    }
+
+    ring = (uint8_t*)u->ring_map;
+    u->sq_head    = (unsigned int*)(ring + p.sq_off.head);
+    u->sq_tail    = (unsigned int*)(ring + p.sq_off.tail);
+    u->sq_array   = (unsigned int*)(ring + p.sq_off.array);
+    u->sq_mask    = *(unsigned int*)(ring + p.sq_off.ring_mask);
+    u->sq_entries = p.sq_entries;
+    u->sq_next    = *(u->sq_tail);
+    u->cq_head    = (unsigned int*)(ring + p.cq_off.head);
+    u->cq_tail    = (unsigned int*)(ring + p.cq_off.tail);
+    u->cq_mask    = *(unsigned int*)(ring + p.cq_off.ring_mask);
+    u->cqes       = (struct io_uring_cqe*)(ring + p.cq_off.cqes);
+
+    /* -- receive buffers -- */
+    if(posix_memalign(&mem, 4096,
+                      SR_URING_RX_BUFS * sizeof(struct io_uring_buf)) != 0)
+    { goto fail; }
+    memset(mem, 0, SR_URING_RX_BUFS * sizeof(struct io_uring_buf));
+    u->br = (struct io_uring_buf_ring*)mem;
+    if((u->rx_mem = (uint8_t*)malloc(SR_URING_RX_BUFS * SR_URING_RX_BUF_SZ)) == 0)
+    { goto fail; }
+
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)u->br;
+    reg.ring_entries = SR_URING_RX_BUFS;
+    reg.bgid = SR_URING_BGID;
+    if(syscall(__NR_io_uring_register, u->fd, IORING_REGISTER_PBUF_RING,
+               &reg, 1) < 0)
+    {
+        perror("io_uring buffer ring");
+        goto fail;
+    }
+    for(i = 0; i < SR_URING_RX_BUFS; i++)
+    { sr_uring_recycle(u, (uint16_t)i); }
+
+    /* -- outputs -- */
+    u->tx.fd = sockfd;
+    u->tx.op = IORING_OP_SEND;
+    u->tx.kind = SR_URING_SEND;
+    if((u->tx.mem = (uint8_t*)malloc(SR_URING_SLOTS * SR_URING_SLOT_SZ)) == 0)
+    { goto fail; }
+
+    u->log.fd = -1;
+    u->log.op = IORING_OP_WRITE;
+    u->log.kind = SR_URING_LOG;
+    if(logfd >= 0)
+    {
+        if((off = lseek(logfd, 0, SEEK_CUR)) < 0)
+        {
+            perror("io_uring log");
+            goto fail;
+        }
+        if((u->log.mem = (uint8_t*)malloc(SR_URING_SLOTS * SR_URING_SLOT_SZ)) == 0)
+        { goto fail; }
+        u->log.fd = logfd;
+        u->log.off = (uint64_t)off;
+    }
+
+    u->owner = pthread_self();
+    pthread_mutex_init(&(u->lock), 0);
+    sr_uring_arm(u);
+    if(sr_uring_submit(u) != 0)
+    {
+        pthread_mutex_destroy(&(u->lock));
+        goto fail;
+    }
+
+    return u;
+
+fail:
+    sr_uring_free(u);
+    return 0;
+} /* -- sr_uring_create -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_uring_close(..)
+ * Scope: Global
+ *
+ * Other threads may still be sending, so the engine stays.  The log fd is
+ * left where the records end.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_uring_close(struct sr_uring* u)
+{
+    if(!u)
+    { return; }
+
+    pthread_mutex_lock(&(u->lock));
+
+    sr_uring_reap(u);
+    while(((u->tx.inflight || u->tx.queued) && !u->tx.failed) ||
+          ((u->log.inflight || u->log.queued) && !u->log.failed))
+    {
+        if(sr_uring_enter(u, 0, 1) < 0 && errno != EINTR)
+        { break; }
+        sr_uring_reap(u);
+    }
+    if(u->log.fd >= 0)
+    { lseek(u->log.fd, (off_t)u->log.off, SEEK_SET); }
+
+    fprintf(stderr, "io_uring: %llu receives (%llu bytes), "
+            "%llu system calls\n",
+            (unsigned long long)u->recvs, (unsigned long long)u->rx_bytes,
+            (unsigned long long)u->enters);
+    fprintf(stderr, "io_uring: sends %llu chains + %llu direct (%llu bytes), "
+            "log %llu chains + %llu direct (%llu bytes)\n",
+            (unsigned long long)u->tx.chains, (unsigned long long)u->tx.direct,
+            (unsigned long long)u->tx.bytes,
+            (unsigned long long)u->log.chains, (unsigned long long)u->log.direct,
+            (unsigned long long)u->log.bytes);
+
+    pthread_mutex_unlock(&(u->lock));
+} /* -- sr_uring_close -- */
+
+#else /* _LINUX_ */
+
+struct sr_uring* sr_uring_create(int sockfd, int logfd)
+{
+    (void)sockfd;
+    (void)logfd;
+    fprintf(stderr, "io_uring: Linux only\n");
+    return 0;
+} /* -- sr_uring_create -- */
+
+int sr_uring_recv(struct sr_uring* u, uint8_t* buf, unsigned int len)
+{
+    (void)u;
+    (void)buf;
+    (void)len;
+    errno = ENOSYS;
+    return -1;
+} /* -- sr_uring_recv -- */
+
+int sr_uring_send(struct sr_uring* u, const struct iovec* iov, int iovcnt)
+{
+    (void)u;
+    (void)iov;
+    (void)iovcnt;
+    return -1;
+}
+
+int sr_uring_log(struct sr_uring* u, const struct iovec* iov, int iovcnt)
+{
+    (void)u;
+    (void)iov;
+    (void)iovcnt;
+    return -1;
+}
+
+void sr_uring_close(struct sr_uring* u)
+{ (void)u; }
+
+#endif /* _LINUX_ */
@@ -0,0 +1,48 @@
+/*-----------------------------------------------------------------------------
+ * file:  sr_uring.h
+ *
+ * Description:
+ *
+ * io_uring engine for the VNS socket and the packet log, driven with raw
+ * system calls.  Receiving is one multishot recv into a ring of buffers
+ * registered with the kernel, so a busy connection needs no system call
+ * per read.  Sends and log records are copied into slots and submitted as
+ * linked chains, which keeps them in order without waiting for them;
+ * whatever is written while a chain is in flight is packed into the slots
+ * of the next one.  Log records are written at offsets we keep ourselves.
+ *
+ * Any thread may send or log.  Only one thread receives.
+ *
+ *---------------------------------------------------------------------------*/
+
+#ifndef SR_URING_H
+#define SR_URING_H
+
+#ifdef _LINUX_
+#include <stdint.h>
+#endif /* _LINUX_ */
+
+#ifdef _DARWIN_
+#include <inttypes.h>
+#endif /* _DARWIN_ */
+
+#include <sys/uio.h>
+
+struct sr_uring;
+
+/* Take over sockfd, and logfd if not -1, which is written on from where
+   it stands.  Returns 0, having said why, if the kernel cannot do it. */
+struct sr_uring* sr_uring_create(int sockfd, int logfd);
+
+/* Like recv: bytes read into buf, 0 at end of stream, or -1 with errno
+   set, EINTR if a signal came while waiting. */
+int sr_uring_recv(struct sr_uring* u, uint8_t* buf, unsigned int len);
+
+/* Queue iov for the socket or the log.  Returns -1 once a write failed. */
+int sr_uring_send(struct sr_uring* u, const struct iovec* iov, int iovcnt);
+int sr_uring_log(struct sr_uring* u, const struct iovec* iov, int iovcnt);
+
+/* Wait for everything queued to be written, and print stats. */
+void sr_uring_close(struct sr_uring* u);
+
+#endif /* SR_URING_H */
@@ -35,21 +35,39 @@
 #include <netinet/in.h>
 #include <arpa/inet.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <time.h>
 
 #include "sr_dumper.h"
 #include "sr_router.h"
 #include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_rcu.h"
 #include "sr_protocol.h"
+#include "sr_uring.h"
+#include "sr_io.h"
 
 #include "sha1.h"
 #include "vnscommand.h"
 
+/* batched sends are held in a buffer this big */
+#define SR_TX_BATCH_SZ (64 * 1024)
+
+/* the server's commands are never longer than this */
+#define SR_VNS_MAX_MSG 10000
+
 static void sr_log_packet(struct sr_instance* , uint8_t* , int );
 static int  sr_arp_req_not_for_us(struct sr_instance* sr,
                                   uint8_t * packet /* lent */,
                                   unsigned int len,
-                                  char* interface  /* lent */);
+                                  struct sr_if* iface  /* lent */);
 int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd);
+static int sr_handle_command(struct sr_instance* sr, uint8_t* buf, int len,
+                             int expected_cmd);
+static int sr_writev_all(int fd, struct iovec* iov, int iovcnt);
+static int sr_vns_writev(struct sr_instance* sr, struct iovec* iov, int iovcnt);
+static int sr_tx_batch_add(struct sr_instance* sr, c_packet_header* hdr,
+                           uint8_t* buf, unsigned int len);
 
 /*-----------------------------------------------------------------------------
  * Method: sr_session_closed_help(..)
@@ -201,6 +219,8 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
             case HWSPEED:
                 /* Debug("Speed: %d\n",
                         ntohl(*((unsigned int*)hwinfo->mHWInfo[i].value))); */
+                sr_set_ether_speed(sr,
+                        ntohl(*((uint32_t*)hwinfo->mHWInfo[i].value)));
                 break;
             case HWSUBNET:
                 /* Debug("Subnet: %s\n",inet_ntoa(
@@ -226,16 +246,69 @@ int sr_handle_hwinfo(struct sr_instance* sr, c_hwinfo* hwinfo)
         } /* -- switch -- */
     } /* -- for -- */
 
+    return num_entries;
+} /* -- sr_handle_hwinfo -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_interfaces_up(..)
+ * scope: global
+ *
+ * The interfaces and their addresses are all known, from the server or
+ * from sr_io_create: get the router ready to use them.  Neighbours known
+ * before any ARP, configured and left by the last run, are loaded here,
+ * as they name interfaces; sr_init has set up the ARP cache.  Returns 0,
+ * or -1 if the routing table names interfaces we do not have or the
+ * static neighbours cannot be read.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_interfaces_up(struct sr_instance* sr)
+{
+    struct sr_if* iface = 0;
+    int preloaded = 0;
+
+    /* REQUIRES */
+    assert(sr);
+
+    /* -- prebuild the ARP frames -- */
+    for(iface = sr->if_list; iface; iface = iface->next)
+    { sr_if_arp_templates(iface); }
+
     printf("Router interfaces:\n");
     sr_print_if_list(sr);
 
-    return num_entries;
-} /* -- sr_handle_hwinfo -- */
+    if(sr_verify_routing_table(sr) != 0)
+    {
+        fprintf(stderr,"Routing table not consistent with hardware\n");
+        return -1;
+    }
+    /* -- interface speeds are known now -- */
+    pthread_mutex_lock(&(sr->rt_lock));
+    sr_rt_bind(sr, sr_rt_current(sr));
+    pthread_mutex_unlock(&(sr->rt_lock));
+
+    if(sr->arp_static[0] && sr_arpcache_load(sr, sr->arp_static, 0) < 0)
+    {
+        fprintf(stderr,"Error reading static neighbours from %s\n",
+                sr->arp_static);
+        return -1;
+    }
+    if(sr->arp_snapshot[0] &&
+       (preloaded = sr_arpcache_load(sr, sr->arp_snapshot, 1)) > 0)
+    {
+        fprintf(stderr,"Loaded %d ARP entries from %s\n", preloaded,
+                sr->arp_snapshot);
+    }
+    printf(" <-- Ready to process packets --> \n");
+
+    return 0;
+} /* -- sr_interfaces_up -- */
 
 int sr_handle_rtable(struct sr_instance* sr, c_rtable* rtable) {
     char fn[7+IDSIZE+1];
     FILE* fp;
 
+    (void)sr;
     strcpy(fn, "rtable.");
     strcat(fn, rtable->mVirtualHostID);
     fp = fopen(fn, "w");
@@ -319,93 +392,323 @@ int sr_handle_auth_status(struct sr_instance* sr, c_auth_status* status) {
 }
 
 /*-----------------------------------------------------------------------------
- * Method: sr_read_from_server(..)
- * Scope: global
+ * Method: sr_rx_fill(..)
+ * Scope: Local
  *
- * Houses main while loop for communicating with the virtual router server.
+ * Read as much as the server has for us, up to what fits, into the
+ * receive buffer behind what is already there.  A partial message left
+ * over is first moved to the front, so messages are always contiguous
+ * and can be handled in place.
+ *
+ * RETURN VALUES:
+ *
+ *  bytes read, 0 if the server closed the connection or we were asked to
+ *  stop, -1 on error
  *
  *---------------------------------------------------------------------------*/
 
-int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+static int sr_rx_fill(struct sr_instance* sr)
 {
-    return sr_read_from_server_expect(sr, 0);
-}
+    int ret = 0;
 
-int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+    if(sr->rx_buf == 0)
+    {
+        if((sr->rx_buf = (uint8_t*)malloc(SR_RX_BUF_SZ)) == 0)
+        {
+            fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
+            return -1;
+        }
+        sr->rx_head = sr->rx_tail = 0;
+    }
+
+    if(sr->rx_head > 0)
+    {
+        memmove(sr->rx_buf, sr->rx_buf + sr->rx_head,
+                sr->rx_tail - sr->rx_head);
+        sr->rx_tail -= sr->rx_head;
+        sr->rx_head = 0;
+    }
+
+    do
+    { /* -- just in case SIGALRM breaks recv -- */
+        errno = 0; /* -- hacky glibc workaround -- */
+        if((ret = sr->uring ?
+                  sr_uring_recv(sr->uring, sr->rx_buf + sr->rx_tail,
+                                SR_RX_BUF_SZ - sr->rx_tail) :
+                  recv(sr->sockfd, sr->rx_buf + sr->rx_tail,
+                       SR_RX_BUF_SZ - sr->rx_tail, 0)) == -1)
+        {
+            if ( errno == EINTR )
+            {
+                /* -- asked to stop while waiting for a command -- */
+                if ( sr_stopping )
+                { return 0; }
+                continue;
+            }
+
+            perror("recv(..):sr_client.c::sr_read_from_server");
+            return -1;
+        }
+    } while ( errno == EINTR); /* be mindful of signals */
+
+    if(ret == 0)
+    { fprintf(stderr,"Connection to server closed\n"); }
+
+    sr->rx_tail += ret;
+    return ret;
+} /* -- sr_rx_fill -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_next(..)
+ * Scope: Local
+ *
+ * Take the next complete message off the receive buffer.  Returns it, in
+ * the buffer and valid until the next sr_rx_fill, with its length in
+ * *len; 0 if no complete message is buffered, with *len -1 if what is
+ * there cannot be a message.
+ *
+ *---------------------------------------------------------------------------*/
+
+static uint8_t* sr_rx_next(struct sr_instance* sr, int* len)
 {
-    int command, len;
-    unsigned char *buf = 0;
-    c_packet_ethernet_header* sr_pkt = 0;
-    int ret = 0, bytes_read = 0;
+    uint8_t* msg = 0;
+    uint32_t n = 0;
 
-    /* REQUIRES */
-    assert(sr);
+    *len = 0;
+    if(sr->rx_buf == 0 || sr->rx_tail - sr->rx_head < 4)
+    { return 0; }
+
+    msg = sr->rx_buf + sr->rx_head;
+    memcpy(&n, msg, 4);
+    n = ntohl(n);
+
+    if ( n > SR_VNS_MAX_MSG || n < 8 )
+    {
+        fprintf(stderr,"Error: command length to large %d\n",(int)n);
+        *len = -1;
+        return 0;
+    }
+    if(sr->rx_tail - sr->rx_head < n)
+    { return 0; }
 
-    /*---------------------------------------------------------------------------
-      Read a command from the server
-      -------------------------------------------------------------------------*/
+    sr->rx_head += n;
+    *len = (int)n;
+    return msg;
+} /* -- sr_rx_next -- */
 
-    bytes_read = 0;
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_get(..)
+ * Scope: Local
+ *
+ * Next command, reading from the server until one is complete.  Returns 1
+ * with *buf and *len set, 0 if the server closed the connection or we are
+ * stopping, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
 
-    /* attempt to read the size of the incoming packet */
-    while( bytes_read < 4)
+static int sr_rx_get(struct sr_instance* sr, uint8_t** buf, int* len)
+{
+    int ret = 0;
+
+    while((*buf = sr_rx_next(sr, len)) == 0)
     {
-        do
-        { /* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if((ret = recv(sr->sockfd,((uint8_t*)&len) + bytes_read,
-                            4 - bytes_read, 0)) == -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
+        if(*len < 0)
+        {
+            close(sr->sockfd);
+            return -1;
+        }
+        if((ret = sr_rx_fill(sr)) <= 0)
+        { return ret < 0 ? -1 : 0; }
+    }
+    return 1;
+} /* -- sr_rx_get -- */
 
-                perror("recv(..):sr_client.c::sr_read_from_server");
-                return -1;
-            }
-            bytes_read += ret;
-        } while ( errno == EINTR); /* be mindful of signals */
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_route_ahead(..)
+ * Scope: Local
+ *
+ * Look up together the routes of the IPv4 packets among the complete
+ * commands buffered from offset off on, as many as make a burst, for the
+ * forwarding path to take (sr_rt_burst_fill).  Returns the offset the
+ * burst reaches.  Caller is inside an RCU read section that lasts until
+ * those commands are handled.
+ *
+ *---------------------------------------------------------------------------*/
 
+static unsigned int sr_rx_route_ahead(struct sr_instance* sr, unsigned int off)
+{
+    uint32_t ip_dst[SR_RT_BURST];
+    sr_ethernet_hdr_t* e_hdr = 0;
+    sr_ip_hdr_t* ip_hdr = 0;
+    uint8_t* msg = 0;
+    uint32_t n = 0;
+    uint32_t cmd = 0;
+    unsigned int k = 0;
+
+    /* -- not handled yet, so the command is still in network order -- */
+    while(k < SR_RT_BURST && sr->rx_tail - off >= 8)
+    {
+        msg = sr->rx_buf + off;
+        memcpy(&n, msg, 4);
+        memcpy(&cmd, msg + 4, 4);
+        n = ntohl(n);
+        if(n < 8 || n > SR_VNS_MAX_MSG || sr->rx_tail - off < n)
+        { break; }
+
+        if(ntohl(cmd) == VNSPACKET &&
+           n >= sizeof(c_packet_header) + sizeof(sr_ethernet_hdr_t) +
+                sizeof(sr_ip_hdr_t))
+        {
+            e_hdr = (sr_ethernet_hdr_t*)(msg + sizeof(c_packet_header));
+            ip_hdr = (sr_ip_hdr_t*)(e_hdr + 1);
+            if(e_hdr->ether_type == htons(ethertype_ip))
+            { ip_dst[k++] = ip_hdr->ip_dst; }
+        }
+        off += n;
     }
 
-    len = ntohl(len);
+    sr_rt_burst_fill(sr, ip_dst, k);
+    return off;
+} /* -- sr_rx_route_ahead -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_rx_handle_all(..)
+ * Scope: Local
+ *
+ * Handle buf, the command just taken off the receive buffer, then every
+ * complete one after it, with the routes of each burst of packets looked
+ * up ahead.  Returns as sr_handle_command for the last one; *len is -1 if
+ * the buffer holds something that cannot be a command.
+ *
+ *---------------------------------------------------------------------------*/
 
-    if ( len > 10000 || len < 0 )
+static int sr_rx_handle_all(struct sr_instance* sr, uint8_t* buf, int* len)
+{
+    unsigned int ahead = 0;
+    int ret = 1;
+
+    sr_tx_cork(sr);
+    sr_rcu_read_lock();
+    for(; ret == 1 && buf; buf = sr_rx_next(sr, len))
     {
-        fprintf(stderr,"Error: command length to large %d\n",len);
-        close(sr->sockfd);
-        return -1;
+        if((unsigned int)(buf - sr->rx_buf) >= ahead)
+        { ahead = sr_rx_route_ahead(sr, (unsigned int)(buf - sr->rx_buf)); }
+        ret = sr_handle_command(sr, buf, *len, 0);
     }
+    sr_rt_burst_fill(sr, 0, 0);
+    sr_rcu_read_unlock();
+    sr_tx_uncork(sr);
 
-    if((buf = malloc(len)) == 0)
+    return ret;
+} /* -- sr_rx_handle_all -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server(..)
+ * Scope: global
+ *
+ * Houses main while loop for communicating with the virtual router server.
+ * Waits for a command, then handles every other complete command the same
+ * read brought in, so under load one recv serves many packets.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server(struct sr_instance* sr /* borrowed */)
+{
+    uint8_t* buf = 0;
+    int len = 0;
+    int ret = 0;
+
+    /* -- not corked while waiting, held packets would sit there -- */
+    if((ret = sr_rx_get(sr, &buf, &len)) <= 0)
+    { return ret; }
+
+    ret = sr_rx_handle_all(sr, buf, &len);
+
+    if(len < 0)
     {
-        fprintf(stderr,"Error: out of memory (sr_read_from_server)\n");
-        return -1;
+        close(sr->sockfd);
+        ret = -1;
     }
 
-    /* set first field of command since we've already read it */
-    *((int *)buf) = htonl(len);
+    return ret;
+} /* -- sr_read_from_server -- */
 
-    bytes_read = 0;
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_ready(..)
+ * Scope: global
+ *
+ * For the event loop: read once if the socket is readable, which does not
+ * block, then handle every complete command buffered.  Returns 1, 0 once
+ * the server closed the connection, -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
 
-    /* read the rest of the command */
-    while ( bytes_read < len - 4)
+int sr_read_from_server_ready(struct sr_instance* sr /* borrowed */, int readable)
+{
+    uint8_t* buf = 0;
+    int len = 0;
+    int ret = 1;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if(readable && (ret = sr_rx_fill(sr)) <= 0)
+    { return ret < 0 ? -1 : 0; }
+
+    ret = 1;
+    if((buf = sr_rx_next(sr, &len)) != 0)
+    { ret = sr_rx_handle_all(sr, buf, &len); }
+
+    if(len < 0)
     {
-        do
-        {/* -- just in case SIGALRM breaks recv -- */
-            errno = 0; /* -- hacky glibc workaround -- */
-            if ((ret = read(sr->sockfd, buf+4+bytes_read, len - 4 - bytes_read)) ==
-                    -1)
-            {
-                if ( errno == EINTR )
-                { continue; }
-                fprintf(stderr,"Error: failed reading command body %d\n",ret);
-                close(sr->sockfd);
-                return -1;
-            }
-            bytes_read += ret;
-        } while (errno == EINTR); /* be mindful of signals */
+        close(sr->sockfd);
+        ret = -1;
     }
 
+    return ret;
+} /* -- sr_read_from_server_ready -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_read_from_server_expect(..)
+ * Scope: global
+ *
+ * Read and handle one command, which must be expected_cmd if that is not
+ * 0.  Anything read along with it stays buffered for the next call.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expected_cmd)
+{
+    uint8_t* buf = 0;
+    int len = 0;
+    int ret = 0;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if((ret = sr_rx_get(sr, &buf, &len)) <= 0)
+    { return ret; }
+
+    return sr_handle_command(sr, buf, len, expected_cmd);
+} /* -- sr_read_from_server_expect -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_handle_command(..)
+ * Scope: Local
+ *
+ * Act on one command of len bytes read from the server; buf is changed in
+ * place.  Packets are handed to the router straight from it.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_handle_command(struct sr_instance* sr /* borrowed */,
+                             uint8_t* buf /* borrowed */, int len,
+                             int expected_cmd)
+{
+    int command;
+    struct sr_if* iface = 0;
+    int ret = 0;
+
     /* My entry for most unreadable line of code - guido */
     /* ... you win - mc                                  */
     command = *(((int *)buf)+1) = ntohl(*(((int *)buf)+1));
@@ -424,27 +727,15 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
         /* -------------        VNSPACKET     -------------------- */
 
         case VNSPACKET:
-            sr_pkt = (c_packet_ethernet_header *)buf;
-
-            /* -- check if it is an ARP to another router if so drop   -- */
-            if ( sr_arp_req_not_for_us(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base))) )
-            { break; }
-
-            /* -- log packet -- */
-            sr_log_packet(sr, buf + sizeof(c_packet_header),
-                    ntohl(sr_pkt->mLen) - sizeof(c_packet_header));
-
-            /* -- pass to router, student's code should take over here -- */
-            sr_handlepacket(sr,
-                    (buf+sizeof(c_packet_header)),
-                    len - sizeof(c_packet_ethernet_header) +
-                    sizeof(struct sr_ethernet_hdr),
-                    (char*)(buf + sizeof(c_base)));
+            iface = sr_get_interface(sr, (char*)(buf + sizeof(c_base)));
+            if ( iface == 0 ){
+                fprintf( stderr, "** Error, packet on interface %.16s, which does "
+                         "not exist\n", (char*)(buf + sizeof(c_base)));
+                break;
+            }
 
+            sr_receive_packet(sr, buf + sizeof(c_packet_header),
+                    len - sizeof(c_packet_header), iface);
             break;
 
             /* -------------        VNSCLOSE      -------------------- */
@@ -454,8 +745,6 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
             fprintf(stderr,"Reason: %s\n",((c_close*)buf)->mErrorMessage);
             sr_session_closed_help();
 
-            if(buf)
-            { free(buf); }
             return 0;
             break;
 
@@ -469,12 +758,8 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
         case VNSHWINFO:
             sr_handle_hwinfo(sr,(c_hwinfo*)buf);
-            if(sr_verify_routing_table(sr) != 0)
-            {
-                fprintf(stderr,"Routing table not consistent with hardware\n");
-                return -1;
-            }
-            printf(" <-- Ready to process packets --> \n");
+            if(sr_interfaces_up(sr) != 0)
+            { return -1; }
             break;
 
             /* ---------------- VNS_RTABLE ---------------- */
@@ -501,10 +786,45 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 
     }/* -- switch -- */
 
-    if(buf)
-    { free(buf); }
     return ret;
-}/* -- sr_read_from_server -- */
+}/* -- sr_handle_command -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_receive_packet(..)
+ * Scope: Global
+ *
+ * A frame of len bytes came in on iface, from the server or an I/O
+ * driver.  ARP requests for other hosts are only learnt from; the rest is
+ * logged and handed to the router.  buf may be changed in place.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_receive_packet(struct sr_instance* sr /* borrowed */,
+                       uint8_t* buf /* borrowed */,
+                       unsigned int len,
+                       struct sr_if* iface /* borrowed */)
+{
+    /* REQUIRES */
+    assert(sr);
+    assert(buf);
+    assert(iface);
+
+    /* -- check if it is an ARP to another router if so drop,
+       -- after merging what the sender says about itself       -- */
+    if ( sr_arp_req_not_for_us(sr, buf, len, iface) )
+    {
+        sr_arpcache_learn(sr,
+                (struct sr_arp_hdr*)(buf + sizeof(struct sr_ethernet_hdr)),
+                iface);
+        return;
+    }
+
+    /* -- log packet -- */
+    sr_log_packet(sr, buf, len);
+
+    /* -- pass to router, student's code should take over here -- */
+    sr_handlepacket(sr, buf, len, iface->name);
+} /* -- sr_receive_packet -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_ether_addrs_match_interface(..)
@@ -517,23 +837,16 @@ int sr_read_from_server_expect(struct sr_instance* sr /* borrowed */, int expect
 static int
 sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
                                 uint8_t* buf, /* borrowed */
-                                const char* name /* borrowed */ )
+                                const struct sr_if* iface /* borrowed */ )
 {
     struct sr_ethernet_hdr* ether_hdr = 0;
-    struct sr_if* iface = 0;
 
     /* -- REQUIRES -- */
     assert(sr);
     assert(buf);
-    assert(name);
+    assert(iface);
 
     ether_hdr = (struct sr_ethernet_hdr*)buf;
-    iface = sr_get_interface(sr, name);
-
-    if ( iface == 0 ){
-        fprintf( stderr, "** Error, interface %s, does not exist\n", name);
-        return 0;
-    }
 
     if ( memcmp( ether_hdr->ether_shost, iface->addr, ETHER_ADDR_LEN) != 0 ){
         fprintf( stderr, "** Error, source address does not match interface\n");
@@ -555,7 +868,7 @@ sr_ether_addrs_match_interface( struct sr_instance* sr, /* borrowed */
  * Scope: Global
  *
  * Send a packet (ethernet header included!) of length 'len' to the server
- * to be injected onto the wire.
+ * to be injected onto the wire, or onto it ourselves with an I/O driver.
  *
  *---------------------------------------------------------------------------*/
 
@@ -564,7 +877,37 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
                          unsigned int len,
                          const char* iface /* borrowed */)
 {
-    c_packet_header *sr_pkt;
+    struct sr_if* if_rec = 0;
+
+    /* REQUIRES */
+    assert(sr);
+    assert(iface);
+
+    if_rec = sr_get_interface(sr, iface);
+    if ( if_rec == 0 ){
+        fprintf( stderr, "** Error, interface %s, does not exist\n", iface);
+        return -1;
+    }
+
+    return sr_send_packet_if(sr, buf, len, if_rec);
+} /* -- sr_send_packet -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_send_packet_if(..)
+ * Scope: Global
+ *
+ * sr_send_packet for callers that already hold the interface record, e.g.
+ * from sr_if_by_index, so no name has to be looked up.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_send_packet_if(struct sr_instance* sr /* borrowed */,
+                      uint8_t* buf /* borrowed */ ,
+                      unsigned int len,
+                      struct sr_if* iface /* borrowed */)
+{
+    c_packet_header sr_pkt;
+    struct iovec iov[2];
     unsigned int total_len =  len + (sizeof(c_packet_header));
 
     /* REQUIRES */
@@ -578,35 +921,266 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
         return -1;
     }
 
-    /* Create packet */
-    sr_pkt = (c_packet_header *)malloc(len +
-            sizeof(c_packet_header));
-    assert(sr_pkt);
-    sr_pkt->mLen  = htonl(total_len);
-    sr_pkt->mType = htonl(VNSPACKET);
-    strncpy(sr_pkt->mInterfaceName,iface,16);
-    memcpy(((uint8_t*)sr_pkt) + sizeof(c_packet_header),
-            buf,len);
+    /* Create packet header, the frame goes out from where it is */
+    sr_pkt.mLen  = htonl(total_len);
+    sr_pkt.mType = htonl(VNSPACKET);
+    /* -- names are zero padded, see sr_add_interface -- */
+    memcpy(sr_pkt.mInterfaceName,iface->name,16);
 
     /* -- log packet -- */
     sr_log_packet(sr,buf,len);
 
     if ( ! sr_ether_addrs_match_interface( sr, buf, iface) ){
         fprintf( stderr, "*** Error: problem with ethernet header, check log\n");
-        free ( sr_pkt );
         return -1;
     }
 
-    if( write(sr->sockfd, sr_pkt, total_len) < total_len ){
+    if ( sr->io )
+    { return sr_io_send(sr->io, iface, buf, len); }
+
+    /* -- held back with others while corked -- */
+    if ( sr->tx )
+    { return sr_tx_batch_add(sr, &sr_pkt, buf, len); }
+
+    iov[0].iov_base = (void*)&sr_pkt;
+    iov[0].iov_len  = sizeof(c_packet_header);
+    iov[1].iov_base = (void*)buf;
+    iov[1].iov_len  = len;
+    if( sr_vns_writev(sr, iov, 2) != 0 ){
         fprintf(stderr, "Error writing packet\n");
-        free(sr_pkt);
         return -1;
     }
 
-    free(sr_pkt);
+    return 0;
+} /* -- sr_send_packet_if -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_writev_all(..)
+ * Scope: Local
+ *
+ * writev until all of iov is written, carrying on after signals and short
+ * writes.  iov is used up.  Returns 0, or -1 on error.
+ *
+ *---------------------------------------------------------------------------*/
+
+static int sr_writev_all(int fd, struct iovec* iov, int iovcnt)
+{
+    ssize_t n = 0;
 
+    while(iovcnt > 0)
+    {
+        if((n = writev(fd, iov, iovcnt)) < 0)
+        {
+            if(errno == EINTR)
+            { continue; }
+            return -1;
+        }
+        while(iovcnt > 0 && (size_t)n >= iov->iov_len)
+        {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if(iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t*)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
     return 0;
-} /* -- sr_send_packet -- */
+} /* -- sr_writev_all -- */
+
+/* write iov to the server, through io_uring if that is on */
+static int sr_vns_writev(struct sr_instance* sr, struct iovec* iov, int iovcnt)
+{
+    if(sr->uring)
+    { return sr_uring_send(sr->uring, iov, iovcnt); }
+    return sr_writev_all(sr->sockfd, iov, iovcnt);
+} /* -- sr_vns_writev -- */
+
+/*-----------------------------------------------------------------------------
+ * Batched sends
+ *
+ * With batching on (sr_tx_batch_init), a thread can cork the connection
+ * around work that sends several packets: a burst of commands from the
+ * server, the packets an ARP reply releases, a run of the ARP timers.
+ * Packets sent while corked are copied behind each other, headers and
+ * all, into one buffer that goes out in a single write when the last
+ * cork is removed, when it is full, or once its oldest packet has waited
+ * the deadline.  Sends while nobody holds a cork go out at once, after
+ * anything still held.  Without batching corks do nothing, unless an I/O
+ * driver is in use: then they hold frames in its ports, see sr_io.h.
+ *
+ *---------------------------------------------------------------------------*/
+
+struct sr_tx_batch
+{
+    pthread_mutex_t lock;
+    unsigned int corked;         /* corks held, over all threads */
+    unsigned int deadline_us;    /* longest a packet is held */
+    uint64_t first_us;           /* when the oldest held packet came */
+    unsigned int len;            /* bytes held */
+    unsigned int frames;         /* packets held */
+    uint64_t sent_frames;        /* packets written, */
+    uint64_t writes;             /* in this many writes */
+    uint8_t buf[SR_TX_BATCH_SZ];
+};
+
+static uint64_t sr_tx_now_us(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+} /* -- sr_tx_now_us -- */
+
+/* write out what is held; caller holds the lock */
+static int sr_tx_flush_locked(struct sr_instance* sr)
+{
+    struct sr_tx_batch* tx = sr->tx;
+    struct iovec iov;
+    int ret = 0;
+
+    if(tx->len == 0)
+    { return 0; }
+
+    iov.iov_base = (void*)tx->buf;
+    iov.iov_len  = tx->len;
+    if( sr_vns_writev(sr, &iov, 1) != 0 ){
+        fprintf(stderr, "Error writing packets\n");
+        ret = -1;
+    }
+    tx->sent_frames += tx->frames;
+    tx->writes++;
+    tx->len = 0;
+    tx->frames = 0;
+    return ret;
+} /* -- sr_tx_flush_locked -- */
+
+static int sr_tx_batch_add(struct sr_instance* sr, c_packet_header* hdr,
+                           uint8_t* buf, unsigned int len)
+{
+    struct sr_tx_batch* tx = sr->tx;
+    unsigned int total_len = len + sizeof(c_packet_header);
+    struct iovec iov[2];
+    uint64_t now = 0;
+    int ret = 0;
+
+    pthread_mutex_lock(&(tx->lock));
+
+    if(tx->len + total_len > SR_TX_BATCH_SZ || tx->corked == 0)
+    { ret = sr_tx_flush_locked(sr); }
+
+    if(tx->corked == 0 || total_len > SR_TX_BATCH_SZ)
+    {
+        /* -- not held: straight out, after what was -- */
+        iov[0].iov_base = (void*)hdr;
+        iov[0].iov_len  = sizeof(c_packet_header);
+        iov[1].iov_base = (void*)buf;
+        iov[1].iov_len  = len;
+        if( sr_vns_writev(sr, iov, 2) != 0 ){
+            fprintf(stderr, "Error writing packet\n");
+            ret = -1;
+        }
+        tx->sent_frames++;
+        tx->writes++;
+    }
+    else
+    {
+        now = sr_tx_now_us();
+        if(tx->len == 0)
+        { tx->first_us = now; }
+        memcpy(tx->buf + tx->len, hdr, sizeof(c_packet_header));
+        memcpy(tx->buf + tx->len + sizeof(c_packet_header), buf, len);
+        tx->len += total_len;
+        tx->frames++;
+        if(now - tx->first_us >= tx->deadline_us)
+        { ret = sr_tx_flush_locked(sr); }
+    }
+
+    pthread_mutex_unlock(&(tx->lock));
+    return ret;
+} /* -- sr_tx_batch_add -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_batch_init(..)
+ * Scope: Global
+ *
+ * Turn batching on, holding packets deadline_us at most.  Call before any
+ * threads are started.  Returns 0 on success.
+ *
+ *---------------------------------------------------------------------------*/
+
+int sr_tx_batch_init(struct sr_instance* sr, unsigned int deadline_us)
+{
+    struct sr_tx_batch* tx = 0;
+
+    /* REQUIRES */
+    assert(sr);
+
+    if((tx = (struct sr_tx_batch*)calloc(1, sizeof(struct sr_tx_batch))) == 0)
+    { return -1; }
+    pthread_mutex_init(&(tx->lock), 0);
+    tx->deadline_us = deadline_us;
+    sr->tx = tx;
+    return 0;
+} /* -- sr_tx_batch_init -- */
+
+/*-----------------------------------------------------------------------------
+ * Method: sr_tx_batch_close(..)
+ * Scope: Global
+ *
+ * Send what is held and print how well batching did.  Other threads may
+ * still be sending, so the batch stays, holding nothing from now on.
+ *
+ *---------------------------------------------------------------------------*/
+
+void sr_tx_batch_close(struct sr_instance* sr)
+{
+    struct sr_tx_batch* tx = sr->tx;
+
+    if(!tx)
+    { return; }
+
+    pthread_mutex_lock(&(tx->lock));
+    sr_tx_flush_locked(sr);
+    tx->deadline_us = 0;
+    fprintf(stderr, "VNS send: %llu packets in %llu writes\n",
+            (unsigned long long)tx->sent_frames,
+            (unsigned long long)tx->writes);
+    pthread_mutex_unlock(&(tx->lock));
+} /* -- sr_tx_batch_close -- */
+
+void sr_tx_cork(struct sr_instance* sr)
+{
+    if(sr->io)
+    {
+        sr_io_cork(sr->io);
+        return;
+    }
+    if(!sr->tx)
+    { return; }
+
+    pthread_mutex_lock(&(sr->tx->lock));
+    sr->tx->corked++;
+    pthread_mutex_unlock(&(sr->tx->lock));
+} /* -- sr_tx_cork -- */
+
+void sr_tx_uncork(struct sr_instance* sr)
+{
+    if(sr->io)
+    {
+        sr_io_uncork(sr->io);
+        return;
+    }
+    if(!sr->tx)
+    { return; }
+
+    pthread_mutex_lock(&(sr->tx->lock));
+    if(--sr->tx->corked == 0)
+    { sr_tx_flush_locked(sr); }
+    pthread_mutex_unlock(&(sr->tx->lock));
+} /* -- sr_tx_uncork -- */
 
 /*-----------------------------------------------------------------------------
  * Method: sr_log_packet()
@@ -617,6 +1191,8 @@ int sr_send_packet(struct sr_instance* sr /* borrowed */,
 void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 {
     struct pcap_pkthdr h;
+    struct pcap_sf_pkthdr sf;
+    struct iovec iov[2];
     int size;
 
     /* REQUIRES */
@@ -631,6 +1207,21 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
     h.caplen = size;
     h.len = (size < PACKET_DUMP_SIZE) ? size : PACKET_DUMP_SIZE;
 
+    if(sr->uring)
+    {
+        /* -- the record sr_dump would write -- */
+        sf.ts.tv_sec  = h.ts.tv_sec;
+        sf.ts.tv_usec = h.ts.tv_usec;
+        sf.caplen     = h.caplen;
+        sf.len        = h.len;
+        iov[0].iov_base = (void*)&sf;
+        iov[0].iov_len  = sizeof(sf);
+        iov[1].iov_base = (void*)buf;
+        iov[1].iov_len  = size;
+        sr_uring_log(sr->uring, iov, 2);
+        return;
+    }
+
     sr_dump(sr->logfile, &h, buf);
     fflush(sr->logfile);
 } /* -- sr_log_packet -- */
@@ -644,12 +1235,12 @@ void sr_log_packet(struct sr_instance* sr, uint8_t* buf, int len )
 int  sr_arp_req_not_for_us(struct sr_instance* sr,
                            uint8_t * packet /* lent */,
                            unsigned int len,
-                           char* interface  /* lent */)
+                           struct sr_if* iface  /* lent */)
 {
-    struct sr_if* iface = sr_get_interface(sr, interface);
     struct sr_ethernet_hdr* e_hdr = 0;
     struct sr_arp_hdr*       a_hdr = 0;
 
+    (void)sr;
     if (len < sizeof(struct sr_ethernet_hdr) + sizeof(struct sr_arp_hdr) )
     { return 0; }
 
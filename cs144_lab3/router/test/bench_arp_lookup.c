@@ -0,0 +1,229 @@
+/*-----------------------------------------------------------------------------
+ * file:  bench_arp_lookup.c
+ *
+ * Description:
+ *
+ * ARP cache lookups from several threads at once.  Reader threads look up
+ * a set of hot neighbours while a writer keeps refreshing them and pushes
+ * cold neighbours through the cache, so entries are rewritten, evicted
+ * and shifted back all the time.  Each thread count runs twice: with
+ * sr_arpcache_lookup_into, the lock free read under the cache's sequence
+ * count, and the way sr_arpcache_lookup used to read, taking the cache
+ * lock and handing back a malloc'd copy.  Every entry a reader gets must
+ * be the neighbour's own; a torn copy counts as wrong.
+ *
+ *   test/bench_arp_lookup [max threads [seconds]]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_arpcache.h"
+
+#define BENCH_HOT         64
+#define BENCH_MAX_READERS 16
+
+static struct sr_arpcache cache;
+static volatile int bench_stop = 0;
+static int bench_locked = 0;
+
+struct bench_reader
+{
+    pthread_t thread;
+    unsigned int seed;
+    unsigned long lookups;
+    unsigned long wrong;
+};
+
+/* -- sr_vns_comm.c, sr_rt.c, sr_router.c: the cache never sends here -- */
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   const char* iface)
+{
+    (void)sr;
+    (void)buf;
+    (void)len;
+    (void)iface;
+    return 0;
+}
+
+int sr_send_packet_if(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                      struct sr_if* iface)
+{
+    (void)sr;
+    (void)buf;
+    (void)len;
+    (void)iface;
+    return 0;
+}
+
+void sr_tx_cork(struct sr_instance* sr)
+{ (void)sr; }
+
+void sr_tx_uncork(struct sr_instance* sr)
+{ (void)sr; }
+
+int sr_next_hop_ip_and_iface(struct sr_instance* sr, uint32_t ip,
+                             uint32_t* next_hop, char* iface)
+{
+    (void)sr;
+    (void)ip;
+    (void)next_hop;
+    (void)iface;
+    return 0;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+} /* -- bench_now -- */
+
+/* hot neighbour i is 10.0.0.i on interface i % 4, its MAC ends in i */
+static void bench_learn(unsigned int i, unsigned char tag)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0 };
+
+    mac[4] = tag;
+    mac[5] = (unsigned char)i;
+    sr_arpcache_insert(&cache, mac, htonl(0x0a000000 | i), (uint16_t)(i % 4));
+} /* -- bench_learn -- */
+
+/* the old read path: under the cache lock, into a copy the caller frees */
+static struct sr_arpentry* bench_lookup_locked(uint32_t ip, uint16_t ifindex)
+{
+    struct sr_arpentry entry;
+    struct sr_arpentry* copy = 0;
+
+    pthread_mutex_lock(&(cache.lock));
+    if(sr_arpcache_lookup_into(&cache, ip, ifindex, &entry))
+    {
+        copy = (struct sr_arpentry*)malloc(sizeof(struct sr_arpentry));
+        memcpy(copy, &entry, sizeof(struct sr_arpentry));
+    }
+    pthread_mutex_unlock(&(cache.lock));
+    return copy;
+} /* -- bench_lookup_locked -- */
+
+static void* bench_reader(void* arg)
+{
+    struct bench_reader* r = (struct bench_reader*)arg;
+    struct sr_arpentry entry;
+    struct sr_arpentry* e = 0;
+    unsigned int i = 0;
+    uint32_t ip = 0;
+
+    while(!bench_stop)
+    {
+        i = (unsigned int)rand_r(&(r->seed)) % BENCH_HOT;
+        ip = htonl(0x0a000000 | i);
+        if(bench_locked)
+        { e = bench_lookup_locked(ip, (uint16_t)(i % 4)); }
+        else if(sr_arpcache_lookup_into(&cache, ip, (uint16_t)(i % 4), &entry))
+        { e = &entry; }
+        else
+        { e = 0; }
+
+        /* -- a hot neighbour may be evicted for a moment, never wrong -- */
+        if(e && (e->ip != ip || e->ifindex != i % 4 || e->mac[5] != i ||
+                 e->mac[0] != 2))
+        { r->wrong++; }
+        if(bench_locked)
+        { free(e); }
+        r->lookups++;
+    }
+    return 0;
+} /* -- bench_reader -- */
+
+static void* bench_writer(void* arg)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0 };
+    struct timespec ts = { 0, 100000 };
+    unsigned int n = 0;
+
+    (void)arg;
+    while(!bench_stop)
+    {
+        bench_learn(n % BENCH_HOT, (unsigned char)n);
+        mac[5] = (unsigned char)n;
+        sr_arpcache_insert(&cache, mac, htonl(0x0b000000 | (n & 0xffff)), 1);
+        n++;
+        nanosleep(&ts, 0);
+    }
+    return 0;
+} /* -- bench_writer -- */
+
+static void bench_run(int locked, int nreaders, double secs)
+{
+    struct bench_reader readers[BENCH_MAX_READERS];
+    struct timespec ts = { 0, 10000000 };
+    pthread_t writer;
+    unsigned long lookups = 0, wrong = 0;
+    double t0 = 0, t = 0;
+    int i = 0;
+
+    bench_locked = locked;
+    bench_stop = 0;
+    pthread_create(&writer, 0, bench_writer, 0);
+    t0 = bench_now();
+    for(i = 0; i < nreaders; i++)
+    {
+        memset(&readers[i], 0, sizeof(readers[i]));
+        readers[i].seed = (unsigned int)i + 1;
+        pthread_create(&(readers[i].thread), 0, bench_reader, &readers[i]);
+    }
+    while(bench_now() - t0 < secs)
+    { nanosleep(&ts, 0); }
+    bench_stop = 1;
+    for(i = 0; i < nreaders; i++)
+    {
+        pthread_join(readers[i].thread, 0);
+        lookups += readers[i].lookups;
+        wrong += readers[i].wrong;
+    }
+    t = bench_now() - t0;
+    pthread_join(writer, 0);
+
+    printf("  %-13s %2d readers %8.2f M lookups/s  %lu wrong\n",
+           locked ? "mutex+malloc" : "seqlock", nreaders, lookups / t / 1e6,
+           wrong);
+} /* -- bench_run -- */
+
+int main(int argc, char** argv)
+{
+    int max = argc > 1 ? atoi(argv[1]) : 8;
+    double secs = argc > 2 ? atof(argv[2]) : 0.5;
+    unsigned int i = 0;
+    int n = 0;
+
+    if(max < 1 || max > BENCH_MAX_READERS)
+    {
+        fprintf(stderr, "usage: %s [max threads [seconds]]\n", argv[0]);
+        return 1;
+    }
+
+    sr_arpcache_init(&cache, 1024, 0, 0);
+    for(i = 0; i < BENCH_HOT; i++)
+    { bench_learn(i, 0); }
+
+    printf("bench_arp_lookup, %d hot neighbours, 1024 entry cache\n",
+           BENCH_HOT);
+    for(n = 1; n <= max; n *= 2)
+    {
+        bench_run(0, n, secs);
+        bench_run(1, n, secs);
+    }
+
+    sr_arpcache_destroy(&cache);
+    return 0;
+} /* -- main -- */
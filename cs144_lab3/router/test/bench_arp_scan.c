@@ -0,0 +1,193 @@
+/*-----------------------------------------------------------------------------
+ * file:  bench_arp_scan.c
+ *
+ * Description:
+ *
+ * A scan across a connected /16 while traffic to known neighbours keeps
+ * flowing.  One thread does what the forwarding path does for each
+ * packet, as sr_handle_ip_packet would: packets to 16 resolved
+ * neighbours take the ARP cache hit, and in between every scan packet to
+ * an address with no mapping goes through queuereq and the real
+ * sr_handle_arpreq, with the cache's timers run on the way as the event
+ * loop runs them.  Runs with no scan, with the scan under the default
+ * limits on outstanding requests and ARP transmit rate, and with the
+ * scan and the limits lifted, and reports the cost of a lookup to a
+ * known neighbour, the ARP requests broadcast and what piled up.
+ *
+ *   test/bench_arp_scan [seconds]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+
+#define BENCH_KNOWN 16
+#define BENCH_BATCH 256
+
+static struct sr_instance sr;
+static unsigned long bench_bcast = 0;
+
+/* -- sr_vns_comm.c: count the broadcasts, send nothing -- */
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   const char* iface)
+{
+    (void)sr;
+    (void)iface;
+    if(len == SR_ARP_FRAME_LEN && buf[0] == 0xff)
+    { bench_bcast++; }
+    return 0;
+}
+
+int sr_send_packet_if(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                      struct sr_if* iface)
+{
+    return sr_send_packet(sr, buf, len, iface->name);
+}
+
+void sr_tx_cork(struct sr_instance* sr)
+{ (void)sr; }
+
+void sr_tx_uncork(struct sr_instance* sr)
+{ (void)sr; }
+
+/* -- sr_rt.c, sr_router.c: for the host unreachables after giving up -- */
+int sr_next_hop_ip_and_iface(struct sr_instance* sr, uint32_t ip,
+                             uint32_t* next_hop, char* iface)
+{
+    (void)sr;
+    *next_hop = ip;
+    strcpy(iface, "eth1");
+    return 1;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+} /* -- bench_now -- */
+
+static void bench_cache(int limits)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 1, 0 };
+    unsigned int i = 0;
+
+    sr_arpcache_init(&(sr.cache), 1024, 1000, 60000);
+    if(!limits)
+    { sr_arpcache_set_req_limits(&(sr.cache), 1U << 30, 1U << 30); }
+    for(i = 0; i < BENCH_KNOWN; i++)
+    {
+        mac[5] = (unsigned char)i;
+        sr_arpcache_add_static(&(sr.cache), mac, htonl(0x0a000100 | i), 0);
+    }
+    sr.if_list->arp_tx_at = 0;
+    bench_bcast = 0;
+} /* -- bench_cache -- */
+
+/* a packet to a /16 address nobody has answered for, as the router
+   handles it */
+static void bench_scan(uint32_t ip, uint8_t* packet, unsigned int len)
+{
+    struct sr_arpentry entry;
+    struct sr_arpreq* req = 0;
+
+    if(sr_arpcache_lookup_into(&(sr.cache), ip, 0, &entry) ||
+       sr_arpcache_failed(&(sr.cache), ip) != SR_ARPNEG_NONE)
+    { return; }
+    if((req = sr_arpcache_queuereq(&(sr.cache), ip, packet, len, "eth1")) != 0)
+    { sr_handle_arpreq(&sr, req); }
+} /* -- bench_scan -- */
+
+static void bench_run(const char* what, int scan, int limits, double secs)
+{
+    struct sr_arpentry entry;
+    uint8_t packet[98];
+    unsigned long lookups = 0, scanned = 0;
+    uint64_t peak = 0;
+    uint32_t n = 0;
+    double t0 = 0, t1 = 0, in_lookups = 0;
+    unsigned int i = 0;
+    int slot = 0;
+
+    bench_cache(limits);
+    memset(packet, 0, sizeof(packet));
+
+    t0 = bench_now();
+    while(bench_now() - t0 < secs)
+    {
+        /* -- a batch to the known neighbours, timed on its own -- */
+        t1 = bench_now();
+        for(i = 0; i < BENCH_BATCH; i++, lookups++)
+        {
+            slot = sr_arpcache_lookup_into(&(sr.cache),
+                       htonl(0x0a000100 | (i % BENCH_KNOWN)), 0, &entry);
+            if(!slot)
+            {
+                printf("  known neighbour missing\n");
+                exit(1);
+            }
+        }
+        in_lookups += bench_now() - t1;
+
+        /* -- then as many scan packets, round and round the /16 -- */
+        for(i = 0; scan && i < BENCH_BATCH; i++, scanned++)
+        {
+            bench_scan(htonl(0x0a010000 | (n++ & 0xffff)), packet,
+                       sizeof(packet));
+        }
+        if(sr.cache.qstats.requests > peak)
+        { peak = sr.cache.qstats.requests; }
+        sr_arpcache_run_timers(&sr);
+    }
+    t1 = bench_now() - t0;
+
+    printf("  %-17s %5.1f ns a known neighbour, %8.0f scan packets/s\n",
+           what, in_lookups / lookups * 1e9, scanned / t1);
+    if(scan)
+    {
+        printf("    %lu ARP requests sent, %llu outstanding (peak %llu), "
+               "%llu KB queued\n", bench_bcast,
+               (unsigned long long)sr.cache.qstats.requests,
+               (unsigned long long)peak,
+               (unsigned long long)(sr.cache.qstats.bytes >> 10));
+        printf("    %llu packets dropped at the cap, %llu requests held "
+               "back by the rate\n",
+               (unsigned long long)sr.cache.qstats.drop_cap,
+               (unsigned long long)sr.cache.qstats.tx_limited);
+    }
+
+    while(sr.cache.requests)
+    { sr_arpreq_destroy(&(sr.cache), sr.cache.requests); }
+    sr_arpcache_destroy(&(sr.cache));
+} /* -- bench_run -- */
+
+int main(int argc, char** argv)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0xaa, 0xbb, 0xcc, 0xdd, 0xee };
+    double secs = argc > 1 ? atof(argv[1]) : 2.0;
+
+    sr_add_interface(&sr, "eth1");
+    sr_set_ether_addr(&sr, mac);
+    sr_set_ether_ip(&sr, htonl(0x0a000001));
+    sr_if_arp_templates(sr.if_list);
+
+    printf("bench_arp_scan, %d known neighbours, a /16 scanned, %.1f s each\n",
+           BENCH_KNOWN, secs);
+    bench_run("no scan", 0, 1, secs);
+    bench_run("scan, limits on", 1, 1, secs);
+    bench_run("scan, limits off", 1, 0, secs);
+    return 0;
+} /* -- main -- */
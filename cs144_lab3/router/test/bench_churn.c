@@ -0,0 +1,232 @@
+/*-----------------------------------------------------------------------------
+ * file:  bench_churn.c
+ *
+ * Description:
+ *
+ * Route feed benchmark.  Loads a table of random routes, measures lookup
+ * throughput on it alone, then applies a stream of withdrawals, new
+ * routes and replacements through sr_rt_del/sr_rt_add/sr_rt_replace
+ * while reader threads keep looking routes up, and reports both rates.
+ * Every new or replaced route gets a gateway never used before, as a
+ * feed with moving next hops would, so the run goes through many more
+ * distinct next hops than DIR-24-8 has indices: the table only stays
+ * DIR-24-8 if it reuses the ones and the second level blocks the churn
+ * leaves unused.
+ *
+ *   test/bench_churn [routes [updates [readers]]]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_dir24.h"
+#include "sr_rcu.h"
+
+#define BENCH_MAX_READERS 8
+
+static struct sr_instance sr;
+static volatile int bench_stop = 0;
+static uint32_t bench_gw = 0;          /* gateways handed out so far */
+
+struct bench_route
+{
+    struct in_addr dest;
+    struct in_addr mask;
+};
+
+struct bench_reader
+{
+    pthread_t thread;
+    unsigned int seed;
+    unsigned long lookups;
+};
+
+/* -- sr_main.c -- */
+int sr_verify_route_list(struct sr_instance* sr, struct sr_rt* routes)
+{
+    (void)sr;
+    (void)routes;
+    return 0;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+} /* -- bench_now -- */
+
+/* a prefix under 10/8, /16 to /32 with a third longer than /24 */
+static void bench_prefix(struct bench_route* r)
+{
+    unsigned int len = 16 + (unsigned int)rand() % 17;
+    uint32_t ip = 0x0a000000 | ((uint32_t)rand() & 0x00ffffff);
+
+    r->mask.s_addr = htonl(sr_fib_len_mask((uint8_t)len));
+    r->dest.s_addr = htonl(ip) & r->mask.s_addr;
+} /* -- bench_prefix -- */
+
+static void bench_next_hop(struct in_addr* gw, char* iface)
+{
+    gw->s_addr = htonl(0x0b000000 | (bench_gw++ & 0x00ffffff));
+    sprintf(iface, "eth%u", bench_gw % 4);
+} /* -- bench_next_hop -- */
+
+static void* bench_reader(void* arg)
+{
+    struct bench_reader* r = (struct bench_reader*)arg;
+    char iface[sr_IFACE_NAMELEN];
+    uint32_t gw = 0, ip = 0;
+
+    while(!bench_stop)
+    {
+        ip = htonl(0x0a000000 | ((uint32_t)rand_r(&(r->seed)) & 0x00ffffff));
+        sr_rcu_read_lock();
+        sr_next_hop_ip_and_iface(&sr, ip, &gw, iface);
+        sr_rcu_read_unlock();
+        r->lookups++;
+    }
+    return 0;
+} /* -- bench_reader -- */
+
+static void bench_print_table(const char* when)
+{
+    const struct sr_rt_table* tbl = sr_rt_current(&sr);
+    const struct sr_dir24* d = tbl->dir24;
+
+    if(!d)
+    {
+        printf("  %-7s %7u routes, trie (DIR-24-8 gave up)\n", when,
+               tbl->fib.nroutes);
+        return;
+    }
+    printf("  %-7s %7u routes, DIR-24-8: %5u next hops in use of %5u, "
+           "%5u blocks in use of %5u, %4lu MB\n", when, tbl->fib.nroutes,
+           d->nnh - 1 - d->nh_grace - d->nh_free - d->nh_limbo, d->nnh - 1,
+           d->nblocks - d->blk_grace - d->blk_free - d->blk_limbo,
+           d->nblocks,
+           (unsigned long)(sr_dir24_footprint(d) >> 20));
+} /* -- bench_print_table -- */
+
+/* run the readers for secs, or until the updates are done if updates */
+static void bench_run(struct bench_route* routes, unsigned int nroutes,
+                      unsigned int updates, int nreaders, double secs)
+{
+    struct bench_reader readers[BENCH_MAX_READERS];
+    struct bench_route* r = 0;
+    struct in_addr gw;
+    char iface[sr_IFACE_NAMELEN];
+    unsigned long lookups = 0;
+    unsigned int i = 0;
+    double t0 = 0, t = 0;
+
+    bench_stop = 0;
+    for(i = 0; i < (unsigned int)nreaders; i++)
+    {
+        memset(&readers[i], 0, sizeof(readers[i]));
+        readers[i].seed = i + 1;
+        pthread_create(&(readers[i].thread), 0, bench_reader, &readers[i]);
+    }
+
+    t0 = bench_now();
+    if(updates)
+    {
+        /* -- replace a route, or withdraw it and announce a new prefix
+              in its place, which is two updates -- */
+        for(i = 0; i < updates; i++)
+        {
+            r = &routes[(unsigned int)rand() % nroutes];
+            bench_next_hop(&gw, iface);
+            if(i % 3 == 0)
+            { sr_rt_replace(&sr, r->dest, gw, r->mask, iface); }
+            else
+            {
+                sr_rt_del(&sr, r->dest, r->mask);
+                bench_prefix(r);
+                sr_rt_add(&sr, r->dest, gw, r->mask, iface);
+                i++;
+            }
+        }
+    }
+    else
+    {
+        while(bench_now() - t0 < secs)
+        { usleep(10000); }
+    }
+    t = bench_now() - t0;
+
+    bench_stop = 1;
+    for(i = 0; i < (unsigned int)nreaders; i++)
+    {
+        pthread_join(readers[i].thread, 0);
+        lookups += readers[i].lookups;
+    }
+
+    if(updates)
+    {
+        printf("  churn   %7u updates in %.2f s: %8.0f updates/s, "
+               "%6.2f M lookups/s over %d readers\n", updates, t,
+               updates / t, lookups / t / 1e6, nreaders);
+    }
+    else
+    {
+        printf("  steady  %6.2f M lookups/s over %d readers\n",
+               lookups / t / 1e6, nreaders);
+    }
+} /* -- bench_run -- */
+
+int main(int argc, char** argv)
+{
+    unsigned int nroutes = argc > 1 ? (unsigned int)atoi(argv[1]) : 20000;
+    unsigned int updates = argc > 2 ? (unsigned int)atoi(argv[2]) : 100000;
+    int nreaders = argc > 3 ? atoi(argv[3]) : 2;
+    struct bench_route* routes = 0;
+    struct sr_rt_table* tbl = 0;
+    struct in_addr gw;
+    char iface[sr_IFACE_NAMELEN];
+    unsigned int i = 0;
+
+    if(nroutes == 0 || nreaders < 1 || nreaders > BENCH_MAX_READERS)
+    {
+        fprintf(stderr, "usage: %s [routes [updates [readers]]]\n", argv[0]);
+        return 1;
+    }
+
+    srand(1);
+    pthread_mutex_init(&(sr.rt_lock), 0);
+    routes = (struct bench_route*)malloc(nroutes * sizeof(*routes));
+    tbl = sr_rt_table_create(1);
+    for(i = 0; i < nroutes; i++)
+    {
+        bench_prefix(&routes[i]);
+        bench_next_hop(&gw, iface);
+        sr_rt_table_add(tbl, routes[i].dest, gw, routes[i].mask, iface);
+    }
+    sr_rt_table_compile(tbl, SR_FIB_DIR24);
+    sr.rt = tbl;
+
+    printf("bench_churn, %u routes, next hops never reused\n", nroutes);
+    bench_print_table("loaded");
+    bench_run(routes, nroutes, 0, nreaders, 1.0);
+    bench_run(routes, nroutes, updates, nreaders, 0);
+    bench_print_table("after");
+    printf("  %u distinct next hops used in all\n", bench_gw);
+
+    sr_rcu_barrier();
+    sr.rt = 0;
+    sr_rt_table_free(tbl);
+    free(routes);
+    return 0;
+} /* -- main -- */
@@ -0,0 +1,368 @@
+/*-----------------------------------------------------------------------------
+ * file:  bench_evloop.c
+ *
+ * Description:
+ *
+ * Packet latency through the router with its ARP timers on their own
+ * thread, the way sr_init starts them, and with the event loop running
+ * them between packets.  A sender process streams VNSPACKET commands
+ * over a socketpair at a fixed rate, each frame stamped with the time it
+ * was written; a drain process takes whatever the router sends back.
+ * Per packet the router does what sr_handle_ip_packet does before
+ * forwarding: 15 of 16 packets go to resolved neighbours, the 16th to a
+ * new address, which is queued on ARP and broadcast for through the real
+ * sr_handle_arpreq, and retried from the timers after that.  The limits
+ * on outstanding requests are lifted so the timers have work to do.
+ * Reports the latency from the sender's stamp to the end of the packet's
+ * handling, and how many packets found the cache lock taken by the
+ * timer thread.  Each run is a process of its own.
+ *
+ *   test/bench_evloop [packets [packets/s]]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+#include <pthread.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+#include "sr_evloop.h"
+#include "vnscommand.h"
+
+#define BENCH_KNOWN   16
+#define BENCH_BURST   16
+#define BENCH_LEN     98
+#define BENCH_STAMP   50                /* -- in the frame, past the ICMP -- */
+#define BENCH_MAX_LAT 4000000
+
+static struct sr_instance sr;
+static uint32_t bench_lat[BENCH_MAX_LAT];
+static unsigned long bench_pkts = 0;
+static unsigned long bench_n = 0;
+static unsigned long bench_held = 0;
+
+/* -- sr_main.c -- */
+volatile sig_atomic_t sr_stopping = 0;
+
+int sr_verify_routing_table(struct sr_instance* sr)
+{
+    (void)sr;
+    return 0;
+}
+
+/* -- sr_rt.c: no table, every address is on eth1 -- */
+void sr_rt_bind(struct sr_instance* sr, struct sr_rt_table* tbl)
+{
+    (void)sr;
+    (void)tbl;
+}
+
+void sr_rt_burst_fill(struct sr_instance* sr, const uint32_t* ip,
+                      unsigned int n)
+{
+    (void)sr;
+    (void)ip;
+    (void)n;
+}
+
+int sr_rt_reload(struct sr_instance* sr)
+{
+    (void)sr;
+    return 0;
+}
+
+int sr_next_hop_ip_and_iface(struct sr_instance* sr, uint32_t ip,
+                             uint32_t* next_hop, char* iface)
+{
+    (void)sr;
+    *next_hop = ip;
+    strcpy(iface, "eth1");
+    return 1;
+}
+
+/* -- sr_io.c, sr_uring.c: only the VNS socket here -- */
+int sr_io_send(struct sr_io* io, struct sr_if* iface, const uint8_t* buf,
+               unsigned int len)
+{
+    (void)io;
+    (void)iface;
+    (void)buf;
+    (void)len;
+    return -1;
+}
+
+void sr_io_cork(struct sr_io* io)
+{ (void)io; }
+
+void sr_io_uncork(struct sr_io* io)
+{ (void)io; }
+
+int sr_io_ready(struct sr_instance* sr, int fd)
+{
+    (void)sr;
+    (void)fd;
+    return -1;
+}
+
+int sr_uring_recv(struct sr_uring* u, uint8_t* buf, unsigned int len)
+{
+    (void)u;
+    (void)buf;
+    (void)len;
+    return -1;
+}
+
+int sr_uring_send(struct sr_uring* u, const struct iovec* iov, int iovcnt)
+{
+    (void)u;
+    (void)iov;
+    (void)iovcnt;
+    return -1;
+}
+
+int sr_uring_log(struct sr_uring* u, const struct iovec* iov, int iovcnt)
+{
+    (void)u;
+    (void)iov;
+    (void)iovcnt;
+    return -1;
+}
+
+static uint64_t bench_now_ns(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+} /* -- bench_now_ns -- */
+
+void sr_handlepacket(struct sr_instance* sr, uint8_t* packet,
+                     unsigned int len, char* interface)
+{
+    struct sr_arpentry entry;
+    struct sr_arpreq* req = 0;
+    uint64_t stamp = 0;
+    uint32_t seq = 0, ip = 0;
+    int slot = 0;
+
+    (void)interface;
+    memcpy(&stamp, packet + BENCH_STAMP, sizeof(stamp));
+    memcpy(&seq, packet + BENCH_STAMP + sizeof(stamp), sizeof(seq));
+
+    /* -- would this packet have waited for the timer thread? -- */
+    if(pthread_mutex_trylock(&(sr->cache.lock)) == 0)
+    { pthread_mutex_unlock(&(sr->cache.lock)); }
+    else
+    { bench_held++; }
+
+    if(seq % BENCH_KNOWN)
+    {
+        ip = htonl(0x0a000100 | (seq % BENCH_KNOWN));
+        if((slot = sr_arpcache_lookup_into(&(sr->cache), ip, 0, &entry)) != 0)
+        { sr_arpcache_touch(&(sr->cache), slot - 1); }
+    }
+    else
+    {
+        ip = htonl(0x0a010000 | ((seq / BENCH_KNOWN) & 0xffff));
+        if(!sr_arpcache_lookup_into(&(sr->cache), ip, 0, &entry) &&
+           sr_arpcache_failed(&(sr->cache), ip) == SR_ARPNEG_NONE &&
+           (req = sr_arpcache_queuereq(&(sr->cache), ip, packet, len,
+                                       "eth1")) != 0)
+        { sr_handle_arpreq(sr, req); }
+    }
+
+    if(bench_pkts < BENCH_MAX_LAT)
+    { bench_lat[bench_pkts] = (uint32_t)(bench_now_ns() - stamp); }
+    if(++bench_pkts == bench_n)
+    { sr_stopping = 1; }
+}
+
+/* sender: n frames at rate a second, BENCH_BURST a write */
+static void bench_send(int fd, unsigned long n, unsigned long rate)
+{
+    static uint8_t burst[BENCH_BURST][sizeof(c_packet_header) + BENCH_LEN];
+    struct timespec ts;
+    c_packet_header* cmd = 0;
+    uint64_t start = bench_now_ns(), due = 0, now = 0;
+    unsigned long sent = 0;
+    uint32_t seq = 0;
+    unsigned int i = 0;
+
+    for(i = 0; i < BENCH_BURST; i++)
+    {
+        cmd = (c_packet_header*)burst[i];
+        memset(burst[i], 0, sizeof(burst[i]));
+        cmd->mLen = htonl(sizeof(burst[i]));
+        cmd->mType = htonl(VNSPACKET);
+        strcpy(cmd->mInterfaceName, "eth1");
+        burst[i][sizeof(c_packet_header) + 12] = 0x08;
+    }
+
+    while(sent < n)
+    {
+        due = start + (uint64_t)(sent * 1e9 / rate);
+        ts.tv_sec = (time_t)(due / 1000000000ULL);
+        ts.tv_nsec = (long)(due % 1000000000ULL);
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, 0);
+
+        now = bench_now_ns();
+        for(i = 0; i < BENCH_BURST; i++)
+        {
+            seq = (uint32_t)(sent + i);
+            memcpy(burst[i] + sizeof(c_packet_header) + BENCH_STAMP, &now,
+                   sizeof(now));
+            memcpy(burst[i] + sizeof(c_packet_header) + BENCH_STAMP +
+                   sizeof(now), &seq, sizeof(seq));
+        }
+        if(write(fd, burst, sizeof(burst)) < 0)
+        { _exit(1); }
+        sent += BENCH_BURST;
+    }
+    pause();
+    _exit(0);
+} /* -- bench_send -- */
+
+/* takes the ARP requests and unreachables the router sends */
+static void bench_drain(int fd)
+{
+    static uint8_t buf[65536];
+
+    while(read(fd, buf, sizeof(buf)) > 0)
+    { }
+    _exit(0);
+} /* -- bench_drain -- */
+
+static int bench_cmp(const void* a, const void* b)
+{
+    uint32_t x = *(const uint32_t*)a, y = *(const uint32_t*)b;
+
+    return x < y ? -1 : x > y;
+} /* -- bench_cmp -- */
+
+static void bench_cache(void)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 1, 0 };
+    unsigned int i = 0;
+
+    sr_arpcache_init(&(sr.cache), 65536, 0, 0);
+    sr_arpcache_set_req_limits(&(sr.cache), 1U << 20, 1U << 30);
+    for(i = 0; i < BENCH_KNOWN; i++)
+    {
+        mac[5] = (unsigned char)i;
+        sr_arpcache_add_static(&(sr.cache), mac, htonl(0x0a000100 | i), 0);
+    }
+} /* -- bench_cache -- */
+
+/* one run, in a process of its own: the timer thread never stops */
+static void bench_run(int evloop, unsigned long n, unsigned long rate)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0xaa, 0xbb, 0xcc, 0xdd, 0xee };
+    pthread_t timers;
+    pid_t sender = 0, drain = 0;
+    unsigned long k = 0;
+    int sv[2];
+
+    sr_add_interface(&sr, "eth1");
+    sr_set_ether_addr(&sr, mac);
+    sr_set_ether_ip(&sr, htonl(0x0a000001));
+    sr_if_arp_templates(sr.if_list);
+    bench_cache();
+    bench_n = n;
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        perror("socketpair");
+        exit(1);
+    }
+    if((sender = fork()) == 0)
+    {
+        close(sv[0]);
+        bench_send(sv[1], n, rate);
+    }
+    if((drain = fork()) == 0)
+    {
+        close(sv[0]);
+        bench_drain(sv[1]);
+    }
+    close(sv[1]);
+    sr.sockfd = sv[0];
+
+    sr.evloop = evloop;
+    if(evloop)
+    { sr_evloop_run(&sr); }
+    else
+    {
+        pthread_create(&timers, 0, sr_arpcache_timeout, &sr);
+        while(!sr_stopping && sr_read_from_server(&sr) == 1)
+        { }
+    }
+
+    /* -- the timer thread sends nothing more once it is locked out -- */
+    pthread_mutex_lock(&(sr.cache.lock));
+    kill(sender, SIGKILL);
+    kill(drain, SIGKILL);
+    waitpid(sender, 0, 0);
+    waitpid(drain, 0, 0);
+
+    k = bench_pkts < BENCH_MAX_LAT ? bench_pkts : BENCH_MAX_LAT;
+    if(k == 0)
+    {
+        printf("  no packets arrived\n");
+        exit(1);
+    }
+    qsort(bench_lat, k, sizeof(bench_lat[0]), bench_cmp);
+    printf("  %-12s %7lu/s  us p50 %6.1f  p99 %7.1f  p99.9 %7.1f  max %8.1f"
+           "  lock held %lu\n", evloop ? "event loop" : "timer thread", rate,
+           bench_lat[k / 2] / 1e3, bench_lat[k * 99 / 100] / 1e3,
+           bench_lat[k * 999 / 1000] / 1e3, bench_lat[k - 1] / 1e3,
+           bench_held);
+    if(bench_pkts != n)
+    { printf("  only %lu of %lu packets arrived\n", bench_pkts, n); }
+    fflush(stdout);
+    _exit(0);
+} /* -- bench_run -- */
+
+int main(int argc, char** argv)
+{
+    unsigned long n = argc > 1 ? strtoul(argv[1], 0, 10) : 400000;
+    unsigned long rate = argc > 2 ? strtoul(argv[2], 0, 10) : 0;
+    unsigned long rates[] = { 50000, 200000 };
+    unsigned int r = 0;
+    int evloop = 0, status = 0;
+    pid_t pid = 0;
+
+    if(rate)
+    {
+        rates[0] = rate;
+        rates[1] = 0;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    printf("bench_evloop, %lu packets, 1 in %d to a new neighbour\n", n,
+           BENCH_KNOWN);
+    fflush(stdout);
+    for(r = 0; r < sizeof(rates) / sizeof(rates[0]) && rates[r]; r++)
+    {
+        for(evloop = 0; evloop <= 1; evloop++)
+        {
+            if((pid = fork()) == 0)
+            { bench_run(evloop, n, rates[r]); }
+            waitpid(pid, &status, 0);
+            if(!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            { return 1; }
+        }
+    }
+    return 0;
+} /* -- main -- */
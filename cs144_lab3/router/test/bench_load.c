@@ -0,0 +1,153 @@
+/*-----------------------------------------------------------------------------
+ * file:  bench_load.c
+ *
+ * Description:
+ *
+ * Startup benchmark.  Writes a full-table sized rtable file, by default a
+ * million routes in both notations, and times sr_load_rt on it the way
+ * sr_main does at startup: with the trie, with DIR-24-8 compiled from it,
+ * and from a FIB image, first writing the image and then mapping it.
+ * Each load is into a fresh instance.
+ *
+ *   test/bench_load [routes]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_dir24.h"
+
+static char bench_file[] = "/tmp/bench_load.XXXXXX";
+static char bench_image[sizeof(bench_file) + 4];
+
+/* -- sr_main.c -- */
+int sr_verify_route_list(struct sr_instance* sr, struct sr_rt* routes)
+{
+    (void)sr;
+    (void)routes;
+    return 0;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+} /* -- bench_now -- */
+
+static void bench_quad(char* s, uint32_t a)
+{
+    sprintf(s, "%u.%u.%u.%u", a >> 24, (a >> 16) & 255, (a >> 8) & 255,
+            a & 255);
+} /* -- bench_quad -- */
+
+/* Mostly /24s, one in fifty longer prefixes inside them and one in a
+   hundred /16s, all distinct, every prefix with a single gateway so the
+   table can go into a FIB image; a thousand gateways, as many next hops
+   as a big router has peers.  Half the lines are CIDR, half dotted
+   masks. */
+static void bench_write(unsigned int n)
+{
+    char dest[16], gw[16], mask[16];
+    uint32_t prefix = 0, len = 0;
+    unsigned int i = 0, r = 0, n16 = 0;
+    FILE* fp = 0;
+    int fd = -1;
+
+    if((fd = mkstemp(bench_file)) < 0 || (fp = fdopen(fd, "w")) == 0)
+    {
+        perror(bench_file);
+        exit(1);
+    }
+    for(i = 0; i < n; i++)
+    {
+        r = (unsigned int)rand() % 100;
+        if(r == 0 && n16 < 0x10000)
+        {
+            len = 16;
+            prefix = ((n16++ * 40503U) & 0xffff) << 16;
+        }
+        else
+        {
+            /* -- odd multiplier: a distinct /24 for every i -- */
+            len = r <= 2 ? 25 + (unsigned int)rand() % 8 : 24;
+            prefix = ((i * 2654435761U) & 0xffffff) << 8;
+            prefix |= (uint32_t)rand() & 0xff & ~(0xffU >> (len - 24));
+        }
+
+        bench_quad(dest, prefix);
+        bench_quad(gw, 0x0b000000 | ((prefix >> 8) % 1000));
+        if(i & 1)
+        { fprintf(fp, "%s/%u %s eth%u\n", dest, len, gw, i % 4); }
+        else
+        {
+            bench_quad(mask, sr_fib_len_mask((uint8_t)len));
+            fprintf(fp, "%s %s %s eth%u\n", dest, gw, mask, i % 4);
+        }
+    }
+    fclose(fp);
+} /* -- bench_write -- */
+
+static void bench_load(const char* what, int mode, const char* image)
+{
+    struct sr_instance* sr = 0;
+    const struct sr_rt_table* tbl = 0;
+    double t0 = 0, t = 0;
+
+    sr = (struct sr_instance*)calloc(1, sizeof(struct sr_instance));
+    pthread_mutex_init(&(sr->rt_lock), 0);
+    sr->fib_mode = mode;
+    if(image)
+    { strcpy(sr->rt_image, image); }
+
+    t0 = bench_now();
+    if(sr_load_rt(sr, bench_file) != 0)
+    {
+        printf("  loading %s failed\n", bench_file);
+        exit(1);
+    }
+    t = bench_now() - t0;
+
+    tbl = sr_rt_current(sr);
+    printf("  %-28s %8u routes in %6.3f s  %5.2f M routes/s  %s\n", what,
+           tbl->fib.nroutes, t, tbl->fib.nroutes / t / 1e6,
+           tbl->dir24 ? "DIR-24-8" : "trie");
+
+    sr_rt_table_free(sr->rt);
+    pthread_mutex_destroy(&(sr->rt_lock));
+    free(sr);
+} /* -- bench_load -- */
+
+int main(int argc, char** argv)
+{
+    unsigned int n = argc > 1 ? (unsigned int)atoi(argv[1]) : 1000000;
+    double t0 = 0;
+
+    srand(1);
+    t0 = bench_now();
+    bench_write(n);
+    printf("bench_load, %u routes written in %.2f s\n", n, bench_now() - t0);
+    sprintf(bench_image, "%s.img", bench_file);
+
+    bench_load("trie", SR_FIB_TRIE, 0);
+    bench_load("DIR-24-8", SR_FIB_DIR24, 0);
+    unlink(bench_image);
+    bench_load("DIR-24-8, writing image", SR_FIB_DIR24, bench_image);
+    bench_load("DIR-24-8, from image", SR_FIB_DIR24, bench_image);
+
+    unlink(bench_image);
+    unlink(bench_file);
+    return 0;
+} /* -- main -- */
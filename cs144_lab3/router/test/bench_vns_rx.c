@@ -0,0 +1,264 @@
+/*-----------------------------------------------------------------------------
+ * file:  bench_vns_rx.c
+ *
+ * Description:
+ *
+ * Packets per second through the VNS receive path.  A child process
+ * streams VNSPACKET commands over a socketpair as fast as it can, and
+ * the router side takes them the way sr_main's loop does, with
+ * sr_read_from_server, whose bulk reader frames commands in place out of
+ * one receive buffer.  The same stream is then read the way the reader
+ * used to: the length with one recv, the rest into a malloc'd buffer
+ * with another.  sr_handlepacket is stubbed to check and count the
+ * frames; route lookups ahead of forwarding are not part of what is
+ * measured.
+ *
+ *   test/bench_vns_rx [packets]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <time.h>
+#include <signal.h>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_protocol.h"
+#include "vnscommand.h"
+
+static struct sr_instance sr;
+static unsigned long bench_pkts = 0;
+static unsigned int bench_len = 0;
+
+/* -- sr_main.c -- */
+volatile sig_atomic_t sr_stopping = 0;
+
+int sr_verify_routing_table(struct sr_instance* sr)
+{
+    (void)sr;
+    return 0;
+}
+
+/* -- sr_router.c -- */
+void sr_handlepacket(struct sr_instance* sr, uint8_t* packet,
+                     unsigned int len, char* interface)
+{
+    (void)sr;
+    if(len != bench_len || packet[12] != 0x08 || strcmp(interface, "eth1"))
+    {
+        printf("  bad packet\n");
+        exit(1);
+    }
+    bench_pkts++;
+}
+
+/* -- sr_arpcache.c, sr_rt.c: nothing to learn, no table to look in -- */
+int sr_arpcache_learn(struct sr_instance* sr, struct sr_arp_hdr* arp_hdr,
+                      struct sr_if* iface)
+{
+    (void)sr;
+    (void)arp_hdr;
+    (void)iface;
+    return 0;
+}
+
+int sr_arpcache_load(struct sr_instance* sr, const char* path, int stale)
+{
+    (void)sr;
+    (void)path;
+    (void)stale;
+    return 0;
+}
+
+void sr_rt_bind(struct sr_instance* sr, struct sr_rt_table* tbl)
+{
+    (void)sr;
+    (void)tbl;
+}
+
+void sr_rt_burst_fill(struct sr_instance* sr, const uint32_t* ip,
+                      unsigned int n)
+{
+    (void)sr;
+    (void)ip;
+    (void)n;
+}
+
+/* -- sr_io.c, sr_uring.c: the benchmark only receives -- */
+int sr_io_send(struct sr_io* io, struct sr_if* iface, const uint8_t* buf,
+               unsigned int len)
+{
+    (void)io;
+    (void)iface;
+    (void)buf;
+    (void)len;
+    return 0;
+}
+
+void sr_io_cork(struct sr_io* io)
+{ (void)io; }
+
+void sr_io_uncork(struct sr_io* io)
+{ (void)io; }
+
+int sr_uring_recv(struct sr_uring* u, uint8_t* buf, unsigned int len)
+{
+    (void)u;
+    (void)buf;
+    (void)len;
+    return -1;
+}
+
+int sr_uring_send(struct sr_uring* u, const struct iovec* iov, int iovcnt)
+{
+    (void)u;
+    (void)iov;
+    (void)iovcnt;
+    return -1;
+}
+
+int sr_uring_log(struct sr_uring* u, const struct iovec* iov, int iovcnt)
+{
+    (void)u;
+    (void)iov;
+    (void)iovcnt;
+    return -1;
+}
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec * 1e-9;
+} /* -- bench_now -- */
+
+/* child: n VNSPACKET commands carrying len byte IPv4 frames */
+static void bench_send(int fd, unsigned long n, unsigned int len)
+{
+    static uint8_t chunk[65536];
+    unsigned int size = sizeof(c_packet_header) + len;
+    unsigned int per = sizeof(chunk) / size, k = 0;
+    c_packet_header* cmd = 0;
+    unsigned long sent = 0;
+
+    for(k = 0; k < per; k++)
+    {
+        cmd = (c_packet_header*)(chunk + k * size);
+        memset(cmd, 0, size);
+        cmd->mLen = htonl(size);
+        cmd->mType = htonl(VNSPACKET);
+        strcpy(cmd->mInterfaceName, "eth1");
+        ((uint8_t*)cmd)[sizeof(c_packet_header) + 12] = 0x08;
+    }
+    while(sent < n)
+    {
+        k = n - sent < per ? (unsigned int)(n - sent) : per;
+        if(write(fd, chunk, k * size) < 0)
+        { _exit(1); }
+        sent += k;
+    }
+    _exit(0);
+} /* -- bench_send -- */
+
+/* the reader as it was: a recv for the length, a malloc'd body, a read */
+static int bench_read_old(struct sr_instance* sr)
+{
+    uint8_t* buf = 0;
+    uint32_t len = 0;
+    int ret = 0, got = 0;
+
+    while(got < 4)
+    {
+        if((ret = recv(sr->sockfd, (uint8_t*)&len + got, 4 - got, 0)) <= 0)
+        { return ret; }
+        got += ret;
+    }
+    len = ntohl(len);
+    if(len < sizeof(c_packet_header) || (buf = malloc(len)) == 0)
+    { return -1; }
+
+    *((uint32_t*)buf) = htonl(len);
+    for(got = 4; got < (int)len; got += ret)
+    {
+        if((ret = read(sr->sockfd, buf + got, len - got)) <= 0)
+        {
+            free(buf);
+            return -1;
+        }
+    }
+
+    if(ntohl(((c_base*)buf)->mType) == VNSPACKET)
+    {
+        sr_handlepacket(sr, buf + sizeof(c_packet_header),
+                        len - sizeof(c_packet_header),
+                        (char*)(buf + sizeof(c_base)));
+    }
+    free(buf);
+    return 1;
+} /* -- bench_read_old -- */
+
+static void bench_run(int old, unsigned long n, unsigned int len)
+{
+    int sv[2];
+    pid_t pid = 0;
+    double t = 0;
+
+    if(socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+    {
+        perror("socketpair");
+        exit(1);
+    }
+    if((pid = fork()) == 0)
+    {
+        close(sv[0]);
+        bench_send(sv[1], n, len);
+    }
+    close(sv[1]);
+
+    sr.sockfd = sv[0];
+    sr.rx_head = sr.rx_tail = 0;
+    bench_pkts = 0;
+    bench_len = len;
+    t = bench_now();
+    while(bench_pkts < n &&
+          (old ? bench_read_old(&sr) : sr_read_from_server(&sr)) == 1)
+    { }
+    t = bench_now() - t;
+
+    printf("  %-12s %4u byte frames: %7.2f M packets/s  %7.1f MB/s\n",
+           old ? "recv+malloc" : "bulk reader", len, bench_pkts / t / 1e6,
+           bench_pkts * (double)len / t / 1e6);
+    if(bench_pkts != n)
+    { printf("  only %lu of %lu packets arrived\n", bench_pkts, n); }
+
+    close(sv[0]);
+    waitpid(pid, 0, 0);
+} /* -- bench_run -- */
+
+int main(int argc, char** argv)
+{
+    static const unsigned int lens[] = { 64, 1500 };
+    unsigned long n = argc > 1 ? strtoul(argv[1], 0, 10) : 2000000;
+    unsigned int i = 0;
+
+    sr_add_interface(&sr, "eth1");
+    printf("bench_vns_rx, %lu packets over a socketpair\n", n);
+    for(i = 0; i < sizeof(lens) / sizeof(lens[0]); i++)
+    {
+        bench_run(0, n, lens[i]);
+        bench_run(1, n, lens[i]);
+    }
+
+    free(sr.rx_buf);
+    return 0;
+} /* -- main -- */
@@ -0,0 +1,264 @@
+/*-----------------------------------------------------------------------------
+ * file:  test_arpq.c
+ *
+ * Description:
+ *
+ * Packets waiting on ARP.  Fills the pending queue up to its per request
+ * and total byte limits under both drop policies and checks which
+ * packets are kept, that a packet which does not fit never starts a
+ * request, that the counters go back to 0 once every request is gone,
+ * and that sr_handle_arpreq copes with every request queuereq hands back,
+ * through the retries and the final give up.
+ *
+ *   test/test_arpq
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+
+#define TEST_LEN 1000
+
+static struct sr_instance sr;
+static int failures = 0;
+static unsigned int test_sent = 0;
+
+/* -- sr_vns_comm.c -- */
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   const char* iface)
+{
+    (void)sr;
+    (void)buf;
+    (void)len;
+    (void)iface;
+    test_sent++;
+    return 0;
+}
+
+int sr_send_packet_if(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                      struct sr_if* iface)
+{
+    (void)sr;
+    (void)buf;
+    (void)len;
+    (void)iface;
+    test_sent++;
+    return 0;
+}
+
+void sr_tx_cork(struct sr_instance* sr)
+{ (void)sr; }
+
+void sr_tx_uncork(struct sr_instance* sr)
+{ (void)sr; }
+
+/* -- sr_rt.c -- */
+int sr_next_hop_ip_and_iface(struct sr_instance* sr, uint32_t ip,
+                             uint32_t* next_hop, char* iface)
+{
+    (void)sr;
+    *next_hop = ip;
+    strcpy(iface, "eth0");
+    return 1;
+}
+
+static void test_expect(int ok, const char* what)
+{
+    printf("  %-58s %s\n", what, ok ? "ok" : "FAIL");
+    if(!ok)
+    { failures++; }
+} /* -- test_expect -- */
+
+/* a frame of len bytes from 172.16.0.1, numbered seq */
+static struct sr_arpreq* test_queue(uint32_t host, unsigned int seq,
+                                    unsigned int len)
+{
+    static uint8_t frame[4 * TEST_LEN];
+    struct sr_ip_hdr* ip_hdr =
+        (struct sr_ip_hdr*)(frame + sizeof(struct sr_ethernet_hdr));
+
+    memset(frame, 0, sizeof(frame));
+    ip_hdr->ip_src = htonl(0xac100001);
+    memcpy(frame + len - sizeof(seq), &seq, sizeof(seq));
+    return sr_arpcache_queuereq(&(sr.cache), htonl(0x0a000000 | host), frame,
+                                len, "eth0");
+} /* -- test_queue -- */
+
+/* seq of the packets waiting on req, in order, as first..last */
+static int test_seqs(const struct sr_arpreq* req, unsigned int first,
+                     unsigned int last)
+{
+    const struct sr_packet* pkt = 0;
+    unsigned int seq = 0, want = first;
+
+    for(pkt = req->packets; pkt; pkt = pkt->next, want++)
+    {
+        memcpy(&seq, pkt->buf + pkt->len - sizeof(seq), sizeof(seq));
+        if(seq != want)
+        { return 0; }
+    }
+    return want == last + 1 && req->npackets == last + 1 - first;
+} /* -- test_seqs -- */
+
+/* every pending request has packets, and bytes adds up */
+static int test_consistent(void)
+{
+    const struct sr_arpreq* req = 0;
+    const struct sr_packet* pkt = 0;
+    uint64_t bytes = 0, n = 0;
+
+    for(req = sr.cache.requests; req; req = req->next, n++)
+    {
+        if(!req->packets)
+        { return 0; }
+        for(pkt = req->packets; pkt; pkt = pkt->next)
+        { bytes += pkt->len; }
+    }
+    return bytes == sr.cache.qstats.bytes && n == sr.cache.qstats.requests;
+} /* -- test_consistent -- */
+
+/* destroy every request; the queue counters have to come back to 0 */
+static void test_clear(const char* name)
+{
+    char what[80];
+
+    while(sr.cache.requests)
+    { sr_arpreq_destroy(&(sr.cache), sr.cache.requests); }
+    sprintf(what, "%s: destroyed, counters back to 0", name);
+    test_expect(sr.cache.qstats.bytes == 0 && sr.cache.qstats.requests == 0,
+                what);
+    sr.cache.qstats.drop_req = 0;
+    sr.cache.qstats.drop_bytes = 0;
+} /* -- test_clear -- */
+
+static void test_byte_cap(int policy)
+{
+    struct sr_arpreq* req = 0;
+    unsigned int i = 0;
+    char what[80];
+    const char* name = policy == SR_ARPREQ_DROP_OLDEST ? "oldest" : "tail";
+
+    /* -- ten frames fill it; the eleventh does not fit anywhere -- */
+    sr_arpcache_set_queue_limits(&(sr.cache), 100, 10 * TEST_LEN, policy);
+    for(i = 0; i < 10; i++)
+    { req = test_queue(1, i, TEST_LEN); }
+
+    sprintf(what, "%s: a full queue starts no request", name);
+    test_expect(test_queue(2, 0, TEST_LEN) == 0 &&
+                sr.cache.qstats.requests == 1 &&
+                sr.cache.qstats.drop_bytes == 1 && test_consistent(), what);
+
+    sprintf(what, "%s: the request's own packets make room or not", name);
+    if(policy == SR_ARPREQ_DROP_OLDEST)
+    {
+        test_expect(test_queue(1, 10, TEST_LEN) == req &&
+                    test_seqs(req, 1, 10) && test_consistent(), what);
+    }
+    else
+    {
+        test_expect(test_queue(1, 10, TEST_LEN) == req &&
+                    test_seqs(req, 0, 9) && test_consistent(), what);
+    }
+
+    test_clear(name);
+
+    /* -- more than all of its own packets could make room for -- */
+    sprintf(what, "%s: a frame bigger than the request could free", name);
+    sr_arpcache_set_queue_limits(&(sr.cache), 100, 3 * TEST_LEN, policy);
+    req = test_queue(3, 0, 2 * TEST_LEN);
+    test_expect(test_queue(3, 1, 4 * TEST_LEN) == req &&
+                test_seqs(req, 0, 0) && test_consistent(), what);
+    test_clear(name);
+} /* -- test_byte_cap -- */
+
+static void test_req_cap(int policy)
+{
+    struct sr_arpreq* req = 0;
+    unsigned int i = 0;
+    char what[80];
+    const char* name = policy == SR_ARPREQ_DROP_OLDEST ? "oldest" : "tail";
+
+    sr_arpcache_set_queue_limits(&(sr.cache), 4, SR_ARPREQ_MAX_BYTES, policy);
+    for(i = 0; i < 6; i++)
+    { req = test_queue(1, i, TEST_LEN); }
+
+    sprintf(what, "%s: four packets a request", name);
+    test_expect(sr.cache.qstats.drop_req == 2 && test_consistent() &&
+                (policy == SR_ARPREQ_DROP_OLDEST ? test_seqs(req, 2, 5)
+                                                 : test_seqs(req, 0, 3)),
+                what);
+    test_clear(name);
+} /* -- test_req_cap -- */
+
+static void test_handle(void)
+{
+    struct sr_arpreq* req = 0;
+    unsigned int i = 0;
+
+    /* -- as sr_handle_ip_packet does, with the queue nearly full -- */
+    sr_arpcache_set_queue_limits(&(sr.cache), 100, 3 * TEST_LEN,
+                                 SR_ARPREQ_DROP_TAIL);
+    for(i = 1; i <= 4; i++)
+    {
+        if((req = test_queue(i, 0, TEST_LEN)) != 0)
+        { sr_handle_arpreq(&sr, req); }
+    }
+    test_expect(sr.cache.qstats.requests == 3 && test_sent == 3 &&
+                test_consistent(), "handle_arpreq: one ARP request each");
+
+    /* -- give up on one: its host unreachable does not fit -- */
+    req = sr.cache.requests;
+    req->times_sent = SR_ARPREQ_TRIES;
+    req->sent = 0;
+    sr_handle_arpreq(&sr, req);
+    test_expect(sr.cache.qstats.requests == 2 && test_consistent(),
+                "handle_arpreq: giving up leaves no empty request");
+    test_clear("handle_arpreq");
+} /* -- test_handle -- */
+
+int main(void)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 1 };
+
+    sr_add_interface(&sr, "eth0");
+    sr_set_ether_addr(&sr, mac);
+    sr_set_ether_ip(&sr, htonl(0x0a000001));
+    if(sr_arpcache_init(&(sr.cache), 0, 0, 0) != 0)
+    {
+        printf("sr_arpcache_init failed\n");
+        return 1;
+    }
+    printf("test_arpq\n");
+
+    test_byte_cap(SR_ARPREQ_DROP_TAIL);
+    test_byte_cap(SR_ARPREQ_DROP_OLDEST);
+    test_req_cap(SR_ARPREQ_DROP_TAIL);
+    test_req_cap(SR_ARPREQ_DROP_OLDEST);
+    test_handle();
+
+    /* -- default limits: 4 MiB of frames, then no new neighbours -- */
+    sr_arpcache_set_queue_limits(&(sr.cache), SR_ARPREQ_MAX_PKTS,
+                                 SR_ARPREQ_MAX_BYTES, SR_ARPREQ_DROP_OLDEST);
+    sr_arpcache_set_req_limits(&(sr.cache), 8192, 0);
+    while(test_queue(sr.cache.qstats.requests + 1, 0, 4 * TEST_LEN) != 0)
+    { }
+    test_expect(sr.cache.qstats.bytes + 4 * TEST_LEN > SR_ARPREQ_MAX_BYTES &&
+                sr.cache.qstats.drop_bytes == 1 && test_consistent(),
+                "4 MiB of frames, then no new neighbours");
+    test_clear("4 MiB");
+
+    sr_arpcache_destroy(&(sr.cache));
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+} /* -- main -- */
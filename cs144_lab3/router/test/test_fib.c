@@ -0,0 +1,327 @@
+/*-----------------------------------------------------------------------------
+ * file:  test_fib.c
+ *
+ * Description:
+ *
+ * Checks the lookup structures against the list scan they replace
+ * (sr_rt_lookup_linear) on random routing tables: the trie built route by
+ * route and in bulk from a file, the DIR-24-8 table compiled from it, the
+ * burst lookup, and all of them again after random withdrawals and
+ * replacements.  Every route's prefix, an address inside each prefix and
+ * random addresses are looked up.  The DIR-24-8 table's entry counts are
+ * recounted, and every next hop index and block it is not using has to
+ * be on its spare lists.
+ *
+ *   test/test_fib [seed]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_dir24.h"
+#include "sr_rcu.h"
+
+#define TEST_BURST 64
+
+static struct sr_instance sr;
+static int failures = 0;
+
+/* -- sr_main.c -- */
+int sr_verify_route_list(struct sr_instance* sr, struct sr_rt* routes)
+{
+    (void)sr;
+    (void)routes;
+    return 0;
+}
+
+static uint32_t test_rand32(void)
+{
+    return ((uint32_t)rand() << 16) ^ (uint32_t)rand();
+} /* -- test_rand32 -- */
+
+/* Longer prefixes cluster under a few first octets so that they nest
+   and overlap; lengths cover /0 to /32 with most between /8 and /24 and
+   enough past /24 to need second level DIR-24-8 blocks. */
+static void test_random_route(struct in_addr* dest, struct in_addr* gw,
+                              struct in_addr* mask, char* iface)
+{
+    static const uint32_t first[] = { 10, 172, 192, 0 };
+    uint32_t ip = test_rand32();
+    unsigned int len = 0;
+    unsigned int r = (unsigned int)rand() % 1000;
+
+    if(r < 3)
+    { len = 0; }
+    else if(r < 700)
+    { len = 8 + (unsigned int)rand() % 17; }
+    else
+    { len = 25 + (unsigned int)rand() % 8; }
+
+    if(len >= 12 && first[rand() % 4])
+    { ip = (first[rand() % 4] << 24) | (ip & 0x00ffffff); }
+    if(len > 16 && rand() % 2)
+    { ip &= 0xff0fffff; } /* -- crowd a few /16s -- */
+
+    mask->s_addr = htonl(sr_fib_len_mask((uint8_t)len));
+    dest->s_addr = htonl(ip) & mask->s_addr;
+    gw->s_addr = htonl(0x0a640000 | (uint32_t)(rand() % 1024));
+    sprintf(iface, "eth%d", rand() % 4);
+} /* -- test_random_route -- */
+
+/* the route a lookup structure returned stands for want */
+static int test_same(const struct sr_rt* got, const struct sr_rt* want)
+{
+    if(!got || !want)
+    { return got == want; }
+    return got->gw.s_addr == want->gw.s_addr && got->mp == want->mp &&
+           strncmp(got->interface, want->interface, sr_IFACE_NAMELEN) == 0;
+} /* -- test_same -- */
+
+static int test_one(struct sr_rt_table* tbl, uint32_t ip)
+{
+    struct sr_rt* want = sr_rt_lookup_linear(tbl->routes, ip);
+
+    /* -- the trie returns the very route, DIR-24-8 its own copy -- */
+    if(sr_fib_lookup(&(tbl->fib), ip) != want)
+    { return 1; }
+    if(tbl->dir24 && !test_same(sr_dir24_lookup(tbl->dir24, ip), want))
+    { return 1; }
+    return 0;
+} /* -- test_one -- */
+
+static int test_burst(struct sr_rt_table* tbl)
+{
+    struct sr_rt* rt_walker = tbl->routes;
+    uint32_t ip[TEST_BURST];
+    struct sr_rt* out[TEST_BURST];
+    unsigned int i = 0;
+    int bad = 0;
+
+    for(i = 0; i < TEST_BURST; i++)
+    {
+        ip[i] = test_rand32();
+        if(rt_walker && (i & 1))
+        {
+            ip[i] = rt_walker->dest.s_addr;
+            rt_walker = rt_walker->next;
+        }
+    }
+
+    /* -- an odd count leaves a tail for the scalar loop -- */
+    sr_rt_lookup_burst(tbl, ip, out, TEST_BURST - 3);
+    for(i = 0; i < TEST_BURST - 3; i++)
+    {
+        if(!test_same(out[i], sr_rt_lookup_linear(tbl->routes, ip[i])))
+        { bad++; }
+    }
+    return bad;
+} /* -- test_burst -- */
+
+/* DIR-24-8 bookkeeping against a recount; returns the number of errors */
+static int test_counts(const struct sr_dir24* d)
+{
+    static uint32_t ref[SR_DIR24_MAX_NH + 1];
+    unsigned int i = 0, j = 0, used = 0, blocks = 0;
+    uint16_t e = 0;
+    int bad = 0;
+
+    memset(ref, 0, sizeof(ref));
+    for(i = 0; i < SR_DIR24_TBL24_SZ; i++)
+    {
+        e = d->tbl24[i];
+        if(!(e & SR_DIR24_EXT))
+        {
+            ref[e]++;
+            continue;
+        }
+        blocks++;
+        for(j = 0; j < 256; j++)
+        { ref[d->tbllong[(uint32_t)(e & ~SR_DIR24_EXT) * 256 + j]]++; }
+    }
+
+    for(i = 1; i < d->nnh; i++)
+    {
+        if(ref[i] != d->nh_ref[i] || (ref[i] && !d->nh[i]))
+        { bad++; }
+        if(ref[i])
+        { used++; }
+    }
+    if(used + d->nh_grace + d->nh_free + d->nh_limbo != d->nnh - 1)
+    { bad++; }
+    if(blocks + d->blk_grace + d->blk_free + d->blk_limbo != d->nblocks)
+    { bad++; }
+    return bad;
+} /* -- test_counts -- */
+
+static void test_check(struct sr_rt_table* tbl, const char* what)
+{
+    struct sr_rt* rt_walker = 0;
+    uint32_t ip = 0;
+    int i = 0;
+    int bad = 0;
+    int n = 0;
+
+    for(rt_walker = tbl->routes; rt_walker; rt_walker = rt_walker->next)
+    {
+        ip = rt_walker->dest.s_addr & rt_walker->mask.s_addr;
+        bad += test_one(tbl, ip);
+        ip |= htonl(test_rand32()) & ~rt_walker->mask.s_addr;
+        bad += test_one(tbl, ip);
+        n += 2;
+    }
+    for(i = 0; i < 4096; i++, n++)
+    { bad += test_one(tbl, test_rand32()); }
+    for(i = 0; i < 16; i++)
+    { bad += test_burst(tbl); }
+    if(tbl->dir24)
+    { bad += test_counts(tbl->dir24); }
+
+    printf("  %-34s %6u routes %7d lookups: %s\n", what, tbl->fib.nroutes,
+           n, bad ? "FAIL" : "ok");
+    if(bad)
+    {
+        printf("  %d mismatches\n", bad);
+        failures++;
+    }
+} /* -- test_check -- */
+
+/* withdraw about a third of the routes, replace a sixth, add new ones */
+static void test_churn(struct sr_rt_table* tbl)
+{
+    struct in_addr dest, gw, mask;
+    struct sr_rt* rt_walker = 0;
+    struct sr_rt* next = 0;
+    char iface[sr_IFACE_NAMELEN];
+    unsigned int n = tbl->fib.nroutes;
+    unsigned int i = 0;
+
+    for(rt_walker = tbl->routes; rt_walker; rt_walker = next)
+    {
+        next = rt_walker->next;
+        dest = rt_walker->dest;
+        mask = rt_walker->mask;
+        switch(rand() % 6)
+        {
+            case 0:
+            case 1:
+                sr_rt_del(&sr, dest, mask);
+                break;
+            case 2:
+                test_random_route(&dest, &gw, &mask, iface);
+                sr_rt_replace(&sr, rt_walker->dest, gw, rt_walker->mask,
+                              iface);
+                break;
+        }
+    }
+    for(i = 0; i < n / 4; i++)
+    {
+        test_random_route(&dest, &gw, &mask, iface);
+        sr_rt_add(&sr, dest, gw, mask, iface);
+    }
+    sr_rcu_barrier();
+} /* -- test_churn -- */
+
+static struct sr_rt_table* test_table(unsigned int n, int mode)
+{
+    struct sr_rt_table* tbl = sr_rt_table_create(1);
+    struct in_addr dest, gw, mask;
+    char iface[sr_IFACE_NAMELEN];
+    unsigned int i = 0;
+
+    for(i = 0; i < n; i++)
+    {
+        test_random_route(&dest, &gw, &mask, iface);
+        sr_rt_table_add(tbl, dest, gw, mask, iface);
+    }
+    sr_rt_table_compile(tbl, mode);
+    return tbl;
+} /* -- test_table -- */
+
+/* the same kind of table, through the bulk loader */
+static struct sr_rt_table* test_table_file(unsigned int n, int mode)
+{
+    struct sr_rt_table* tbl = sr_rt_table_create(1);
+    struct in_addr dest, gw, mask;
+    char iface[sr_IFACE_NAMELEN];
+    char path[] = "/tmp/test_fib.XXXXXX";
+    unsigned int i = 0;
+    FILE* fp = 0;
+    int fd = -1;
+
+    if((fd = mkstemp(path)) < 0 || (fp = fdopen(fd, "w")) == 0)
+    {
+        perror(path);
+        exit(1);
+    }
+    for(i = 0; i < n; i++)
+    {
+        test_random_route(&dest, &gw, &mask, iface);
+        fprintf(fp, "%s", inet_ntoa(dest));
+        if(i & 1)
+        { fprintf(fp, "/%d", sr_fib_mask_len(mask.s_addr)); }
+        fprintf(fp, " %s", inet_ntoa(gw));
+        if(!(i & 1))
+        { fprintf(fp, " %s", inet_ntoa(mask)); }
+        fprintf(fp, " %s\n", iface);
+    }
+    fclose(fp);
+
+    if(sr_rt_table_load(tbl, path) != 0)
+    {
+        printf("  loading %s failed\n", path);
+        exit(1);
+    }
+    unlink(path);
+    sr_rt_table_compile(tbl, mode);
+    return tbl;
+} /* -- test_table_file -- */
+
+static void test_run(unsigned int n, int mode, int from_file)
+{
+    struct sr_rt_table* tbl = 0;
+    char what[64];
+
+    tbl = from_file ? test_table_file(n, mode) : test_table(n, mode);
+    sprintf(what, "%s, %s", from_file ? "bulk load" : "route by route",
+            mode == SR_FIB_DIR24 ? "DIR-24-8" : "trie");
+    test_check(tbl, what);
+
+    sr.rt = tbl;
+    test_churn(tbl);
+    strcat(what, ", churned");
+    test_check(tbl, what);
+
+    sr.rt = 0;
+    sr_rt_table_free(tbl);
+} /* -- test_run -- */
+
+int main(int argc, char** argv)
+{
+    static const unsigned int sizes[] = { 1, 20, 1000, 4000 };
+    unsigned int seed = argc > 1 ? (unsigned int)atoi(argv[1]) : 1;
+    unsigned int i = 0;
+
+    srand(seed);
+    pthread_mutex_init(&(sr.rt_lock), 0);
+    printf("test_fib, seed %u\n", seed);
+
+    for(i = 0; i < sizeof(sizes) / sizeof(sizes[0]); i++)
+    {
+        test_run(sizes[i], SR_FIB_TRIE, 0);
+        test_run(sizes[i], SR_FIB_DIR24, 0);
+        test_run(sizes[i], SR_FIB_DIR24, 1);
+    }
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+} /* -- main -- */
@@ -0,0 +1,282 @@
+/*-----------------------------------------------------------------------------
+ * file:  test_rcache.c
+ *
+ * Description:
+ *
+ * Forwards packets through sr_handlepacket and checks the route cache
+ * from the outside: the first packet to a destination misses and waits
+ * on ARP, the reply sends it on, the next one misses once more and fills
+ * the cache, and from then on packets hit.  A neighbour moving to a new
+ * MAC and a route change must each send the next packet down the miss
+ * path again, and every frame sent must carry the right header, a TTL
+ * one lower and a good checksum.  Runs for the trie and for DIR-24-8.
+ *
+ *   test/test_rcache
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_if.h"
+#include "sr_rt.h"
+#include "sr_adj.h"
+#include "sr_rcache.h"
+#include "sr_arpcache.h"
+#include "sr_protocol.h"
+#include "sr_utils.h"
+
+#define TEST_LEN 64
+#define TEST_TTL 64
+
+static struct sr_instance sr;
+static int failures = 0;
+
+/* -- the last frame sent and how many went out -- */
+static uint8_t test_frame[TEST_LEN];
+static unsigned int test_frame_len = 0;
+static char test_frame_if[sr_IFACE_NAMELEN];
+static unsigned int test_sent = 0;
+
+static const unsigned char test_host[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0x10 };
+static const unsigned char test_nbr[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0x20 };
+static const unsigned char test_moved[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0x21 };
+
+/* -- sr_main.c -- */
+int sr_verify_route_list(struct sr_instance* sr, struct sr_rt* routes)
+{
+    (void)sr;
+    (void)routes;
+    return 0;
+}
+
+/* -- sr_vns_comm.c -- */
+int sr_send_packet(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                   const char* iface)
+{
+    (void)sr;
+    test_frame_len = len < TEST_LEN ? len : TEST_LEN;
+    memcpy(test_frame, buf, test_frame_len);
+    strncpy(test_frame_if, iface, sr_IFACE_NAMELEN - 1);
+    test_sent++;
+    return 0;
+}
+
+int sr_send_packet_if(struct sr_instance* sr, uint8_t* buf, unsigned int len,
+                      struct sr_if* iface)
+{
+    return sr_send_packet(sr, buf, len, iface->name);
+}
+
+void sr_tx_cork(struct sr_instance* sr)
+{ (void)sr; }
+
+void sr_tx_uncork(struct sr_instance* sr)
+{ (void)sr; }
+
+static void test_expect(int ok, const char* what)
+{
+    printf("  %-58s %s\n", what, ok ? "ok" : "FAIL");
+    if(!ok)
+    { failures++; }
+} /* -- test_expect -- */
+
+/* a UDP packet from the host behind eth0 to dst, as it arrives */
+static void test_packet(uint8_t* buf, uint32_t dst)
+{
+    struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)buf;
+    struct sr_ip_hdr* ip_hdr =
+        (struct sr_ip_hdr*)(buf + sizeof(struct sr_ethernet_hdr));
+
+    memset(buf, 0, TEST_LEN);
+    memcpy(e_hdr->ether_dhost, sr_get_interface(&sr, "eth0")->addr,
+           ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_shost, test_host, ETHER_ADDR_LEN);
+    e_hdr->ether_type = htons(ethertype_ip);
+
+    ip_hdr->ip_v = 4;
+    ip_hdr->ip_hl = sizeof(struct sr_ip_hdr) / 4;
+    ip_hdr->ip_len = htons(TEST_LEN - sizeof(struct sr_ethernet_hdr));
+    ip_hdr->ip_ttl = TEST_TTL;
+    ip_hdr->ip_p = ip_protocol_udp;
+    ip_hdr->ip_src = htonl(0xc0a80002); /* -- 192.168.0.2 -- */
+    ip_hdr->ip_dst = dst;
+    ip_hdr->ip_sum = cksum(ip_hdr, sizeof(struct sr_ip_hdr));
+} /* -- test_packet -- */
+
+/* an ARP reply from ip at mac, as it arrives on eth1 */
+static void test_arp_reply(uint32_t ip, const unsigned char* mac)
+{
+    uint8_t buf[SR_ARP_FRAME_LEN];
+    struct sr_if* iface = sr_get_interface(&sr, "eth1");
+    struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)buf;
+    struct sr_arp_hdr* a_hdr =
+        (struct sr_arp_hdr*)(buf + sizeof(struct sr_ethernet_hdr));
+
+    memcpy(buf, iface->arp_reply, SR_ARP_FRAME_LEN);
+    memcpy(e_hdr->ether_dhost, iface->addr, ETHER_ADDR_LEN);
+    memcpy(e_hdr->ether_shost, mac, ETHER_ADDR_LEN);
+    memcpy(a_hdr->ar_sha, mac, ETHER_ADDR_LEN);
+    a_hdr->ar_sip = ip;
+    memcpy(a_hdr->ar_tha, iface->addr, ETHER_ADDR_LEN);
+    a_hdr->ar_tip = iface->ip;
+    sr_handlepacket(&sr, buf, sizeof(buf), "eth1");
+} /* -- test_arp_reply -- */
+
+/* the last frame sent is a packet from test_packet forwarded to mac */
+static int test_forwarded(const unsigned char* mac)
+{
+    struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)test_frame;
+    struct sr_ip_hdr* ip_hdr =
+        (struct sr_ip_hdr*)(test_frame + sizeof(struct sr_ethernet_hdr));
+
+    return test_frame_len == TEST_LEN && strcmp(test_frame_if, "eth1") == 0 &&
+           memcmp(e_hdr->ether_dhost, mac, ETHER_ADDR_LEN) == 0 &&
+           memcmp(e_hdr->ether_shost, sr_get_interface(&sr, "eth1")->addr,
+                  ETHER_ADDR_LEN) == 0 &&
+           e_hdr->ether_type == htons(ethertype_ip) &&
+           ip_hdr->ip_ttl == TEST_TTL - 1 &&
+           cksum(ip_hdr, sizeof(struct sr_ip_hdr)) == 0xffff;
+} /* -- test_forwarded -- */
+
+/* the last frame sent asks eth1's neighbours for ip */
+static int test_asked(uint32_t ip)
+{
+    struct sr_ethernet_hdr* e_hdr = (struct sr_ethernet_hdr*)test_frame;
+    struct sr_arp_hdr* a_hdr =
+        (struct sr_arp_hdr*)(test_frame + sizeof(struct sr_ethernet_hdr));
+
+    return test_frame_len == SR_ARP_FRAME_LEN &&
+           strcmp(test_frame_if, "eth1") == 0 &&
+           e_hdr->ether_type == htons(ethertype_arp) &&
+           a_hdr->ar_op == htons(arp_op_request) && a_hdr->ar_tip == ip;
+} /* -- test_asked -- */
+
+/* sends a packet to dst; returns the hits and misses it added */
+static void test_send(uint32_t dst, unsigned long* hits,
+                      unsigned long* misses)
+{
+    uint8_t buf[TEST_LEN];
+    unsigned long h = sr.rcache->hits;
+    unsigned long m = sr.rcache->misses;
+
+    test_packet(buf, dst);
+    sr_handlepacket(&sr, buf, sizeof(buf), "eth0");
+    *hits = sr.rcache->hits - h;
+    *misses = sr.rcache->misses - m;
+} /* -- test_send -- */
+
+static void test_run(int mode)
+{
+    struct sr_rt_table* tbl = sr_rt_table_create(1);
+    struct in_addr dest, gw, mask;
+    uint32_t dst = htonl(0x0a010203);  /* -- 10.1.2.3 -- */
+    uint32_t nbr = htonl(0xac100002);  /* -- 172.16.0.2 -- */
+    uint32_t nbr2 = htonl(0xac100003); /* -- 172.16.0.3 -- */
+    unsigned long hits = 0, misses = 0;
+    unsigned int sent = 0;
+    int i = 0, ok = 0;
+
+    printf("%s\n", mode == SR_FIB_DIR24 ? "DIR-24-8" : "trie");
+
+    /* -- 10.1/16 behind 172.16.0.2 on eth1, the host's /24 on eth0 -- */
+    dest.s_addr = htonl(0x0a010000);
+    gw.s_addr = nbr;
+    mask.s_addr = htonl(0xffff0000);
+    sr_rt_table_add(tbl, dest, gw, mask, "eth1");
+    dest.s_addr = htonl(0xc0a80000);
+    gw.s_addr = 0;
+    mask.s_addr = htonl(0xffffff00);
+    sr_rt_table_add(tbl, dest, gw, mask, "eth0");
+    sr_rt_table_compile(tbl, mode);
+    sr.rt = tbl;
+    sr.adj = sr_adj_create();
+    sr_rt_bind(&sr, tbl);
+    sr_arpcache_init(&(sr.cache), 0, 0, 0);
+    sr.rcache = sr_rcache_create();
+
+    sent = test_sent;
+    test_send(dst, &hits, &misses);
+    test_expect(misses == 1 && hits == 0 && test_sent == sent + 1 &&
+                test_asked(nbr), "unknown next hop: miss, ARP request");
+
+    sent = test_sent;
+    test_arp_reply(nbr, test_nbr);
+    test_expect(test_sent == sent + 1 && test_forwarded(test_nbr),
+                "the reply sends the waiting packet on");
+
+    sent = test_sent;
+    test_send(dst, &hits, &misses);
+    test_expect(misses == 1 && hits == 0 && test_sent == sent + 1 &&
+                test_forwarded(test_nbr), "resolved: miss, fill, forward");
+
+    for(i = 0, ok = 1; i < 8; i++)
+    {
+        sent = test_sent;
+        test_send(dst, &hits, &misses);
+        ok = ok && hits == 1 && misses == 0 && test_sent == sent + 1 &&
+             test_forwarded(test_nbr);
+    }
+    test_expect(ok, "then hits, with the prebuilt header");
+
+    /* -- the neighbour moves: the ARP generation moves on -- */
+    test_arp_reply(nbr, test_moved);
+    sent = test_sent;
+    test_send(dst, &hits, &misses);
+    test_expect(misses == 1 && hits == 0 && test_sent == sent + 1 &&
+                test_forwarded(test_moved), "neighbour moved: miss, new MAC");
+    sent = test_sent;
+    test_send(dst, &hits, &misses);
+    test_expect(hits == 1 && test_sent == sent + 1 &&
+                test_forwarded(test_moved), "and hits again on the new MAC");
+
+    /* -- a more specific route: the routing table generation moves on -- */
+    dest.s_addr = htonl(0x0a010200);
+    gw.s_addr = nbr2;
+    mask.s_addr = htonl(0xffffff00);
+    sr_rt_add(&sr, dest, gw, mask, "eth1");
+    sent = test_sent;
+    test_send(dst, &hits, &misses);
+    test_expect(misses == 1 && hits == 0 && test_sent == sent + 1 &&
+                test_asked(nbr2), "route changed: miss, ARP for the new hop");
+
+    sr_rcache_destroy(sr.rcache);
+    sr.rcache = 0;
+    sr_arpcache_destroy(&(sr.cache));
+    sr.rt = 0;
+    sr_rt_table_free(tbl);
+    sr_adj_destroy(sr.adj);
+    sr.adj = 0;
+} /* -- test_run -- */
+
+int main(void)
+{
+    unsigned char mac[ETHER_ADDR_LEN] = { 2, 0, 0, 0, 0, 0 };
+
+    pthread_mutex_init(&(sr.rt_lock), 0);
+    sr.evloop = 1;
+
+    sr_add_interface(&sr, "eth0");
+    sr_set_ether_addr(&sr, mac);
+    sr_set_ether_ip(&sr, htonl(0xc0a80001)); /* -- 192.168.0.1 -- */
+    sr_if_arp_templates(sr_get_interface(&sr, "eth0"));
+    mac[5] = 1;
+    sr_add_interface(&sr, "eth1");
+    sr_set_ether_addr(&sr, mac);
+    sr_set_ether_ip(&sr, htonl(0xac100001)); /* -- 172.16.0.1 -- */
+    sr_if_arp_templates(sr_get_interface(&sr, "eth1"));
+
+    printf("test_rcache\n");
+    test_run(SR_FIB_TRIE);
+    test_run(SR_FIB_DIR24);
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+} /* -- main -- */
@@ -0,0 +1,218 @@
+/*-----------------------------------------------------------------------------
+ * file:  test_reload.c
+ *
+ * Description:
+ *
+ * Reloads the routing table over and over, alternating between two
+ * files, while reader threads look routes up the way the forwarding path
+ * does.  The two tables route the same prefixes through different
+ * gateways and interfaces, and the second splits some prefixes further.
+ * A reader must always find a route, never one half from each table,
+ * and within one read section every lookup must come from the same
+ * table.  Runs for the trie and for DIR-24-8.
+ *
+ *   test/test_reload [reloads]
+ *
+ *---------------------------------------------------------------------------*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "sr_router.h"
+#include "sr_rt.h"
+#include "sr_rcu.h"
+
+#define TEST_ROUTES  4000
+#define TEST_READERS 3
+#define TEST_BURST   16
+
+static struct sr_instance sr;
+static char test_file[2][32];
+static volatile int test_stop = 0;
+
+struct test_reader
+{
+    pthread_t thread;
+    unsigned int seed;
+    unsigned long lookups;
+    unsigned long bad;
+};
+
+/* -- sr_main.c -- */
+int sr_verify_route_list(struct sr_instance* sr, struct sr_rt* routes)
+{
+    (void)sr;
+    (void)routes;
+    return 0;
+}
+
+/* Route i is 20.(i>>8).(i&255).0/24; table v sends it to 10.v.(i>>8).(i&255)
+   out of eth<v>.  Table 2 also splits every fourth prefix into /25s that
+   go the same way. */
+static void test_write(int v)
+{
+    unsigned int i = 0;
+    FILE* fp = 0;
+    int fd = -1;
+
+    strcpy(test_file[v - 1], "/tmp/test_reload.XXXXXX");
+    if((fd = mkstemp(test_file[v - 1])) < 0 || (fp = fdopen(fd, "w")) == 0)
+    {
+        perror(test_file[v - 1]);
+        exit(1);
+    }
+    for(i = 0; i < TEST_ROUTES; i++)
+    {
+        fprintf(fp, "20.%u.%u.0/24 10.%d.%u.%u eth%d\n",
+                i >> 8, i & 255, v, i >> 8, i & 255, v);
+        if(v == 2 && i % 4 == 0)
+        {
+            fprintf(fp, "20.%u.%u.0/25 10.%d.%u.%u eth%d\n",
+                    i >> 8, i & 255, v, i >> 8, i & 255, v);
+            fprintf(fp, "20.%u.%u.128/25 10.%d.%u.%u eth%d\n",
+                    i >> 8, i & 255, v, i >> 8, i & 255, v);
+        }
+    }
+    fclose(fp);
+} /* -- test_write -- */
+
+/* table the next hop came from, 0 if it is not route i's in either */
+static int test_version(unsigned int i, uint32_t gw, const char* iface)
+{
+    uint32_t h = ntohl(gw);
+    int v = (int)((h >> 16) & 0xff);
+
+    if((h >> 24) != 10 || (h & 0xffff) != i || (v != 1 && v != 2))
+    { return 0; }
+    if(iface[0] != 'e' || iface[3] != '0' + v || iface[4] != 0)
+    { return 0; }
+    return v;
+} /* -- test_version -- */
+
+static uint32_t test_addr(unsigned int i, unsigned int* seed)
+{
+    return htonl((20U << 24) | (i << 8) | ((unsigned int)rand_r(seed) & 255));
+} /* -- test_addr -- */
+
+static void* test_reader(void* arg)
+{
+    struct test_reader* r = (struct test_reader*)arg;
+    struct sr_rt_table* tbl = 0;
+    struct sr_rt* out[TEST_BURST];
+    uint32_t ip[TEST_BURST];
+    unsigned int idx[TEST_BURST];
+    char iface[sr_IFACE_NAMELEN];
+    uint32_t gw = 0;
+    unsigned int i = 0;
+    int v = 0, first = 0;
+
+    while(!test_stop)
+    {
+        /* -- one packet at a time, as sr_handle_ip_packet -- */
+        sr_rcu_read_lock();
+        i = (unsigned int)rand_r(&(r->seed)) % TEST_ROUTES;
+        memset(iface, 0, sizeof(iface));
+        if(!sr_next_hop_ip_and_iface(&sr, test_addr(i, &(r->seed)), &gw, iface)
+           || test_version(i, gw, iface) == 0)
+        { r->bad++; }
+        sr_rcu_read_unlock();
+
+        /* -- a burst against one table: it may not change underneath -- */
+        sr_rcu_read_lock();
+        tbl = sr_rt_current(&sr);
+        for(i = 0; i < TEST_BURST; i++)
+        {
+            idx[i] = (unsigned int)rand_r(&(r->seed)) % TEST_ROUTES;
+            ip[i] = test_addr(idx[i], &(r->seed));
+        }
+        sr_rt_lookup_burst(tbl, ip, out, TEST_BURST);
+        first = 0;
+        for(i = 0; i < TEST_BURST; i++)
+        {
+            v = out[i] ? test_version(idx[i], out[i]->gw.s_addr,
+                                      out[i]->interface) : 0;
+            if(v == 0 || (first && v != first))
+            { r->bad++; }
+            first = v;
+        }
+        sr_rcu_read_unlock();
+
+        r->lookups += 1 + TEST_BURST;
+    }
+
+    return 0;
+} /* -- test_reader -- */
+
+static int test_run(int mode, unsigned int reloads)
+{
+    struct test_reader readers[TEST_READERS];
+    unsigned long lookups = 0, bad = 0;
+    unsigned int i = 0, n = 0;
+    int failed = 0;
+
+    sr.fib_mode = mode;
+    if(sr_load_rt(&sr, test_file[0]) != 0)
+    {
+        printf("  loading %s failed\n", test_file[0]);
+        return 1;
+    }
+
+    test_stop = 0;
+    for(i = 0; i < TEST_READERS; i++)
+    {
+        memset(&readers[i], 0, sizeof(readers[i]));
+        readers[i].seed = i + 1;
+        pthread_create(&(readers[i].thread), 0, test_reader, &readers[i]);
+    }
+
+    /* -- both ways in: a fresh file, and SIGHUP's re-read of the last -- */
+    for(n = 0; n < reloads && !failed; n++)
+    {
+        if(n % 10 == 9)
+        { failed = sr_rt_reload(&sr) != 0; }
+        else
+        { failed = sr_load_rt(&sr, test_file[n & 1]) != 0; }
+    }
+
+    test_stop = 1;
+    for(i = 0; i < TEST_READERS; i++)
+    {
+        pthread_join(readers[i].thread, 0);
+        lookups += readers[i].lookups;
+        bad += readers[i].bad;
+    }
+
+    printf("  %-9s %4u reloads %9lu lookups %6lu bad: %s\n",
+           mode == SR_FIB_DIR24 ? "DIR-24-8" : "trie", n, lookups, bad,
+           (failed || bad || lookups == 0) ? "FAIL" : "ok");
+    return failed || bad || lookups == 0;
+} /* -- test_run -- */
+
+int main(int argc, char** argv)
+{
+    unsigned int reloads = argc > 1 ? (unsigned int)atoi(argv[1]) : 40;
+    int failures = 0;
+
+    pthread_mutex_init(&(sr.rt_lock), 0);
+    test_write(1);
+    test_write(2);
+    printf("test_reload, %d routes, %d readers\n", TEST_ROUTES, TEST_READERS);
+
+    failures += test_run(SR_FIB_TRIE, reloads);
+    failures += test_run(SR_FIB_DIR24, reloads);
+
+    unlink(test_file[0]);
+    unlink(test_file[1]);
+    sr_rt_table_free(sr.rt);
+    sr.rt = 0;
+
+    printf("%s\n", failures ? "FAILED" : "passed");
+    return failures ? 1 : 0;
+} /* -- main -- */